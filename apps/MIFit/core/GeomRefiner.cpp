@@ -229,8 +229,19 @@ unsigned long GeomRefiner::FindGeomErrors(Molecule *model, float error_threshold
         omega = CalcAtomTorsion(dict.RefiPhiPsis[i+2].getAtom1(), dict.RefiPhiPsis[i+2].getAtom2(), dict.RefiPhiPsis[i+2].atom3, dict.RefiPhiPsis[i+2].atom4);
         omegap = CalcAtomTorsion(dict.RefiPhiPsis[i+3].getAtom1(), dict.RefiPhiPsis[i+3].getAtom2(), dict.RefiPhiPsis[i+3].atom3, dict.RefiPhiPsis[i+3].atom4);
 
-        d = phipsi_energy(phi, psi);
-        if (d <= 3.0F && strcmp(dict.RefiPhiPsis[i].res->type().c_str(), "GLY") != 0)
+        bool badPhiPsi;
+        if (ramaTable)
+        {
+            const Residue *next = dict.RefiPhiPsis[i].res->next();
+            RamaTable::ResidueClass residueClass = RamaTable::Classify(dict.RefiPhiPsis[i].res->type(), next ? next->type() : std::string());
+            badPhiPsi = ramaTable->GetRegion(residueClass, phi, psi) == RamaTable::Outlier;
+        }
+        else
+        {
+            d = phipsi_energy(phi, psi);
+            badPhiPsi = d <= 3.0F && strcmp(dict.RefiPhiPsis[i].res->type().c_str(), "GLY") != 0;
+        }
+        if (badPhiPsi)
         {
             Annotation *ann = new Annotation;
             s = format("Bad phi-psi %s %0.1f, %0.1f", resid(dict.RefiPhiPsis[i].res).c_str(), phi, psi);
@@ -367,6 +378,7 @@ unsigned long GeomRefiner::FindGeomErrors(Molecule *model, float error_threshold
 void GeomRefiner::EditEntryCleanup(bool /*isok*/)
 {
     MIMoleculeBase *model = CurrentModel; // Just incase the model was rebuilt in the editor
+    journal.Discard();
     delete model;
     SaveToken--;
 
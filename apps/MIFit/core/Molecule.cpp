@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <climits>
+#include <map>
 #include <chemlib/chemlib.h>
 #include <chemlib/Residue.h>
 #include <map/maplib.h>
@@ -6,6 +8,8 @@
 #include <math/Quaternion.h>
 #include <math/Vector3.h>
 #include <opengl/QuatUtil.h>
+#include <util/SnapshotFile.h>
+#include <util/parallel.h>
 #include <utility>
 #include <vector>
 
@@ -32,7 +36,8 @@ Molecule::Molecule(int type)
       symmatoms_visible(false),
       m_pSecondaryStructure(NULL),
       secStruc_ribbon(false),
-      secStruc_schematic(false)
+      secStruc_schematic(false),
+      secStruc_stale(false)
 
 {
     ModelType = type;
@@ -46,6 +51,7 @@ Molecule::Molecule(int type)
     s_link = 0;                                               // the default startup settings
     srfdotsper = 0.5;
     srfboxsize = 3.0;
+    solventDotsper = -1.0f;
     symm_center[0] = 0;
     symm_center[1] = 0;
     symm_center[2] = 0;
@@ -58,7 +64,8 @@ Molecule::Molecule(Residue *reslist, std::string cmpd, FILE *fp, Bond *conns, in
       symmatoms_visible(false),
       m_pSecondaryStructure(NULL),
       secStruc_ribbon(false),
-      secStruc_schematic(false)
+      secStruc_schematic(false),
+      secStruc_stale(false)
 {
     ModelType = type;
     visible = dots_visible = labels_visible = annots_visible = 1;
@@ -80,6 +87,7 @@ Molecule::Molecule(Residue *reslist, std::string cmpd, FILE *fp, Bond *conns, in
     s_link = 0;                                               // the default startup settings
     srfdotsper = 0.5;
     srfboxsize = 3.0;
+    solventDotsper = -1.0f;
     symm_center[0] = 0;
     symm_center[1] = 0;
     symm_center[2] = 0;
@@ -1821,6 +1829,478 @@ void Molecule::Save(XMLArchive &ar)
     SetCoordsChanged(false);
 }
 
+namespace
+{
+    // Fixed size atom record of a model snapshot, read in place from the
+    // mapped file.
+    struct SnapshotAtom
+    {
+        float x, y, z;
+        float BValue;
+        float occ;
+        float U[6];
+        quint32 type;
+        qint32 symmop;
+        qint16 color;
+        qint16 atomicnumber;
+        char name[MAXATOMNAME];
+        char altloc;
+        quint8 radius_type;
+        quint8 hasU;
+        quint8 pad[3];
+    };
+
+    struct SnapshotBond
+    {
+        qint32 atom1;
+        qint32 atom2;
+        quint8 order;
+        qint8 type;
+        qint8 stereo;
+        quint8 pad;
+        float ideal_length;
+        float tolerance;
+    };
+
+    typedef std::map<const MIAtom*, int> SnapshotAtomIndex;
+
+    void WriteSnapshotResidues(SnapshotWriter &out, Residue *residues, SnapshotAtomIndex &index)
+    {
+        std::vector<SnapshotAtom> records;
+        quint32 nres = 0;
+        for (Residue *res = residues; res != NULL; res = res->next())
+        {
+            ++nres;
+        }
+        out.write(nres);
+        for (Residue *res = residues; res != NULL; res = res->next())
+        {
+            out.writeString(res->name());
+            out.writeString(res->type());
+            out.write((quint16)res->linkage_type());
+            out.write((quint16)res->chain_id());
+            out.write((quint16)res->flags());
+            out.write((quint16)res->confomer());
+            out.write((quint32)res->seqpos());
+            out.write(res->secstr());
+            out.write(res->name1());
+            out.write((quint32)res->atomCount());
+            for (int i = 0; i < res->atomCount(); ++i)
+            {
+                const MIAtom *a = res->atom(i);
+                SnapshotAtom r;
+                memset(&r, 0, sizeof(r));
+                r.x = a->x();
+                r.y = a->y();
+                r.z = a->z();
+                r.BValue = a->BValue();
+                r.occ = a->occ();
+                r.hasU = a->hasAnisotropicity();
+                for (size_t j = 0; r.hasU && j < 6; ++j)
+                {
+                    r.U[j] = a->U(j);
+                }
+                r.type = a->type();
+                r.symmop = a->symmop();
+                r.color = a->color();
+                r.atomicnumber = a->atomicnumber();
+                strncpy(r.name, a->name(), MAXATOMNAME);
+                r.altloc = a->altloc();
+                r.radius_type = a->radius_type();
+                index[a] = (int)index.size();
+                records.push_back(r);
+            }
+        }
+        out.writeArray(records);
+    }
+
+    void FreeSnapshotResidues(Residue *residues)
+    {
+        if (residues != NULL)
+        {
+            FreeResidueList(residues);
+        }
+    }
+
+    Residue *ReadSnapshotResidues(SnapshotSection &in, std::vector<MIAtom*> &atoms, std::vector<Residue*> &atomResidues, bool &ok)
+    {
+        Residue *first = NULL;
+        Residue *prev = NULL;
+        std::vector<quint32> counts;
+        quint32 nres = 0;
+        in.read(nres);
+        for (quint32 ires = 0; ires < nres && in.ok(); ++ires)
+        {
+            std::string name, type;
+            quint16 linkage_type = 0, chain_id = 0, flags = 0, confomer = 0;
+            quint32 seqpos = 0, natoms = 0;
+            char secstr = 'U', name1 = 'X';
+            in.readString(name);
+            in.readString(type);
+            in.read(linkage_type);
+            in.read(chain_id);
+            in.read(flags);
+            in.read(confomer);
+            in.read(seqpos);
+            in.read(secstr);
+            in.read(name1);
+            in.read(natoms);
+            if (!in.ok())
+            {
+                break;
+            }
+            Residue *res = new Residue();
+            res->setName(name);
+            res->setType(type);
+            res->set_linkage_type(linkage_type);
+            res->set_chain_id(chain_id);
+            res->setFlags(flags);
+            res->setConfomer(confomer);
+            res->setSeqpos(seqpos);
+            res->setSecstr(secstr);
+            res->setName1(name1);
+            counts.push_back(natoms);
+            if (prev == NULL)
+            {
+                first = res;
+                prev = res;
+            }
+            else
+            {
+                prev = prev->insertResidue(res);
+            }
+        }
+
+        size_t natoms = 0;
+        const SnapshotAtom *records = in.readArray<SnapshotAtom>(natoms);
+        size_t expected = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            expected += counts[i];
+        }
+        if (!in.ok() || counts.size() != nres || natoms != expected)
+        {
+            FreeSnapshotResidues(first);
+            ok = false;
+            return NULL;
+        }
+
+        size_t iatom = 0;
+        size_t ires = 0;
+        for (Residue *res = first; res != NULL; res = res->next(), ++ires)
+        {
+            res->reserveAtoms(counts[ires]);
+            for (quint32 i = 0; i < counts[ires]; ++i, ++iatom)
+            {
+                const SnapshotAtom &r = records[iatom];
+                char name[MAXATOMNAME+1];
+                memcpy(name, r.name, MAXATOMNAME);
+                name[MAXATOMNAME] = '\0';
+                MIAtom *a = new MIAtom;
+                a->setName(name);
+                a->setPosition(r.x, r.y, r.z);
+                a->setBValue(r.BValue);
+                a->setOcc(r.occ);
+                if (r.hasU)
+                {
+                    a->newAnisotropicity();
+                    for (size_t j = 0; j < 6; ++j)
+                    {
+                        a->U(j, r.U[j]);
+                    }
+                }
+                a->setType(r.type);
+                a->setSymmop(r.symmop);
+                a->setColor(r.color);
+                a->setAtomicnumber(r.atomicnumber);
+                a->setAltloc(r.altloc);
+                a->set_radius_type(r.radius_type);
+                a->setAtomnumber((int)atoms.size());
+                res->addAtom(a);
+                atoms.push_back(a);
+                atomResidues.push_back(res);
+            }
+        }
+        return first;
+    }
+
+    void WriteSnapshotBonds(SnapshotWriter &out, const std::vector<Bond> &bonds, const SnapshotAtomIndex &index)
+    {
+        std::vector<SnapshotBond> records;
+        records.reserve(bonds.size());
+        for (size_t i = 0; i < bonds.size(); ++i)
+        {
+            SnapshotAtomIndex::const_iterator a1 = index.find(bonds[i].getAtom1());
+            SnapshotAtomIndex::const_iterator a2 = index.find(bonds[i].getAtom2());
+            if (a1 == index.end() || a2 == index.end())
+            {
+                continue;
+            }
+            SnapshotBond r;
+            memset(&r, 0, sizeof(r));
+            r.atom1 = a1->second;
+            r.atom2 = a2->second;
+            r.order = bonds[i].getOrder();
+            r.type = bonds[i].type;
+            r.stereo = bonds[i].stereo;
+            r.ideal_length = bonds[i].ideal_length;
+            r.tolerance = bonds[i].tolerance;
+            records.push_back(r);
+        }
+        out.writeArray(records);
+    }
+
+    bool ReadSnapshotBonds(SnapshotSection &in, const std::vector<MIAtom*> &atoms, std::vector<Bond> &bonds)
+    {
+        size_t count = 0;
+        const SnapshotBond *records = in.readArray<SnapshotBond>(count);
+        bonds.clear();
+        bonds.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const SnapshotBond &r = records[i];
+            if (r.atom1 < 0 || r.atom2 < 0 || (size_t)r.atom1 >= atoms.size() || (size_t)r.atom2 >= atoms.size())
+            {
+                return false;
+            }
+            Bond bond(atoms[r.atom1], atoms[r.atom2], r.order, r.stereo);
+            bond.type = r.type;
+            bond.ideal_length = r.ideal_length;
+            bond.tolerance = r.tolerance;
+            bonds.push_back(bond);
+        }
+        return in.ok();
+    }
+}
+
+void Molecule::SaveSnapshot(SnapshotWriter &out)
+{
+    out.writeString(compound);
+    out.writeString(pathname);
+    out.writeString(author);
+    out.writeString(source);
+    out.write((qint32)visible);
+    out.write((qint32)dots_visible);
+    out.write((qint32)labels_visible);
+    out.write((qint32)annots_visible);
+    out.write((quint8)HVisible);
+    out.write((quint8)symmatoms_visible);
+    out.write((qint32)modelnumber);
+    out.write((qint32)ribbon_coloring);
+    out.write((qint32)s_link);
+    out.write((qint32)s_main);
+    out.write((qint32)s_nonprotein);
+    out.write((qint32)s_radiustype);
+    out.write((qint32)s_sides);
+    out.write((qint32)s_waters);
+    out.write(srfboxsize);
+    out.write(srfdotsper);
+    out.write(symm_radius);
+    out.write(symm_center);
+    out.write(link_here);
+    out.write(link_next);
+    out.write((quint8)(mapheader != NULL));
+    if (mapheader != NULL)
+    {
+        mapheader->WriteSnapshot(out);
+    }
+
+    SnapshotAtomIndex index;
+    WriteSnapshotResidues(out, residues, index);
+    WriteSnapshotResidues(out, SymmResidues, index);
+    WriteSnapshotBonds(out, bonds, index);
+    WriteSnapshotBonds(out, connects, index);
+    WriteSnapshotBonds(out, hbonds, index);
+
+    quint32 nlabels = 0;
+    for (AtomLabelList::iterator iter = atomLabels.begin(); iter != atomLabels.end(); ++iter)
+    {
+        if (index.find((*iter)->atom()) != index.end())
+        {
+            ++nlabels;
+        }
+    }
+    out.write(nlabels);
+    for (AtomLabelList::iterator iter = atomLabels.begin(); iter != atomLabels.end(); ++iter)
+    {
+        ATOMLABEL *label = *iter;
+        SnapshotAtomIndex::const_iterator atom = index.find(label->atom());
+        if (atom == index.end())
+        {
+            continue;
+        }
+        out.write((qint32)atom->second);
+        out.writeString(label->label());
+        out.write(label->red());
+        out.write(label->green());
+        out.write(label->blue());
+        out.write((quint8)label->isVisible());
+        out.write((qint32)label->xOffset());
+        out.write((qint32)label->yOffset());
+    }
+
+    out.write((quint32)annotations.size());
+    for (AnnotationList::iterator iter = annotations.begin(); iter != annotations.end(); ++iter)
+    {
+        Annotation *annotation = *iter;
+        out.write((quint32)annotation->m_type);
+        out.write((quint32)annotation->m_id);
+        out.write(annotation->m_x);
+        out.write(annotation->m_y);
+        out.write(annotation->m_z);
+        out.write(annotation->m_color.red);
+        out.write(annotation->m_color.green);
+        out.write(annotation->m_color.blue);
+        out.write((quint8)annotation->isHidden());
+        out.writeString(annotation->m_text);
+        out.writeString(annotation->m_author);
+        out.writeString(annotation->m_subject);
+    }
+
+    out.writeArray(dots);
+}
+
+bool Molecule::LoadSnapshot(SnapshotSection &in)
+{
+    qint32 ivalue[12];
+    quint8 hvisible = 1, symmvisible = 0, hasMapHeader = 0;
+    in.readString(compound);
+    in.readString(pathname);
+    in.readString(author);
+    in.readString(source);
+    for (int i = 0; i < 4; ++i)
+    {
+        in.read(ivalue[i]);
+    }
+    in.read(hvisible);
+    in.read(symmvisible);
+    for (int i = 4; i < 12; ++i)
+    {
+        in.read(ivalue[i]);
+    }
+    in.read(srfboxsize);
+    in.read(srfdotsper);
+    in.read(symm_radius);
+    in.read(symm_center);
+    in.read(link_here);
+    in.read(link_next);
+    link_here[MAXNAME-1] = '\0';
+    link_next[MAXNAME-1] = '\0';
+    in.read(hasMapHeader);
+    if (!in.ok())
+    {
+        return false;
+    }
+    visible = ivalue[0];
+    dots_visible = ivalue[1];
+    labels_visible = ivalue[2];
+    annots_visible = ivalue[3];
+    HVisible = hvisible != 0;
+    symmatoms_visible = symmvisible != 0;
+    modelnumber = ivalue[4];
+    ribbon_coloring = ivalue[5];
+    s_link = ivalue[6];
+    s_main = ivalue[7];
+    s_nonprotein = ivalue[8];
+    s_radiustype = ivalue[9];
+    s_sides = ivalue[10];
+    s_waters = ivalue[11];
+    if (hasMapHeader)
+    {
+        CMapHeader mh;
+        if (!mh.ReadSnapshot(in))
+        {
+            return false;
+        }
+        SetMapHeader(mh);
+    }
+
+    std::vector<MIAtom*> atoms;
+    std::vector<Residue*> atomResidues;
+    bool ok = true;
+    residues = ReadSnapshotResidues(in, atoms, atomResidues, ok);
+    if (ok)
+    {
+        SymmResidues = ReadSnapshotResidues(in, atoms, atomResidues, ok);
+    }
+    if (!ok
+        || !ReadSnapshotBonds(in, atoms, bonds)
+        || !ReadSnapshotBonds(in, atoms, connects)
+        || !ReadSnapshotBonds(in, atoms, hbonds))
+    {
+        return false;
+    }
+
+    quint32 nlabels = 0;
+    in.read(nlabels);
+    for (quint32 i = 0; i < nlabels && in.ok(); ++i)
+    {
+        qint32 atom = -1, xo = 0, yo = 0;
+        std::string text;
+        unsigned char red = 0, green = 0, blue = 0;
+        quint8 labelVisible = 1;
+        in.read(atom);
+        in.readString(text);
+        in.read(red);
+        in.read(green);
+        in.read(blue);
+        in.read(labelVisible);
+        in.read(xo);
+        in.read(yo);
+        if (!in.ok() || atom < 0 || (size_t)atom >= atoms.size())
+        {
+            return false;
+        }
+        ATOMLABEL *label = new ATOMLABEL(atomResidues[atom], atoms[atom]);
+        label->label(text.c_str());
+        label->visible(labelVisible != 0);
+        label->xOffset(xo);
+        label->yOffset(yo);
+        label->red(red);
+        label->green(green);
+        label->blue(blue);
+        addAtomLabel(label);
+    }
+
+    quint32 nannotations = 0;
+    in.read(nannotations);
+    for (quint32 i = 0; i < nannotations && in.ok(); ++i)
+    {
+        quint32 type = 0, id = 0;
+        quint8 hidden = 0;
+        Annotation *annotation = new Annotation();
+        in.read(type);
+        in.read(id);
+        in.read(annotation->m_x);
+        in.read(annotation->m_y);
+        in.read(annotation->m_z);
+        in.read(annotation->m_color.red);
+        in.read(annotation->m_color.green);
+        in.read(annotation->m_color.blue);
+        in.read(hidden);
+        in.readString(annotation->m_text);
+        in.readString(annotation->m_author);
+        in.readString(annotation->m_subject);
+        if (!in.ok())
+        {
+            delete annotation;
+            return false;
+        }
+        annotation->m_type = type;
+        annotation->m_id = id;
+        annotation->setHidden(hidden != 0);
+        addAnnotation(annotation);
+    }
+
+    in.readArray(dots);
+    if (!in.ok())
+    {
+        return false;
+    }
+    InitSeqPos();
+    return true;
+}
+
 void Molecule::Do()
 {
     short savec;
@@ -1858,22 +2338,93 @@ void Molecule::UnDo()
     undoable = false;
 }
 
+namespace
+{
+    // Largest radius used for any atom type, so that a cell list with
+    // cells twice this size finds every pair of overlapping atoms.
+    float MaxSurfaceRadius(const float *radius)
+    {
+        float maxRadius = 0.0f;
+        for (unsigned int i = 0; i < NTYPES; ++i)
+        {
+            maxRadius = std::max(maxRadius, radius[i]);
+        }
+        return maxRadius;
+    }
+
+    // Computes the dots of the flagged target atoms, each in the context of
+    // the neighbour atoms overlapping it. As in the serial routines at most
+    // 100 neighbours are used, taken in model order. Targets are
+    // independent, so MIParallelFor can spread them across threads once
+    // initspheres has built the spheres.
+    class SurfaceDotsBuilder
+    {
+        const std::vector<MIAtom*> &targets_;
+        const std::vector<char> &compute_;
+        const std::vector<MIAtom*> &neighbours_;
+        const SurfaceGrid &grid_;
+        const float *radius_;
+        float radiusOffset_;
+        std::vector<Molecule::SurfaceDots> &dots_;
+
+    public:
+        SurfaceDotsBuilder(const std::vector<MIAtom*> &targets, const std::vector<char> &compute,
+                           const std::vector<MIAtom*> &neighbours, const SurfaceGrid &grid,
+                           const float *radius, float radiusOffset,
+                           std::vector<Molecule::SurfaceDots> &dots)
+            : targets_(targets),
+              compute_(compute),
+              neighbours_(neighbours),
+              grid_(grid),
+              radius_(radius),
+              radiusOffset_(radiusOffset),
+              dots_(dots)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            std::vector<int> nearby;
+            std::vector<MIAtom*> b;
+            for (int i = begin; i < end; ++i)
+            {
+                if (!compute_[i])
+                {
+                    continue;
+                }
+                MIAtom *atom = targets_[i];
+                float r1 = atom->getRadius() + radiusOffset_;
+                grid_.candidates(atom->x(), atom->y(), atom->z(), nearby);
+                b.clear();
+                for (size_t n = 0; n < nearby.size() && b.size() < 100; ++n)
+                {
+                    MIAtom *other = neighbours_[nearby[n]];
+                    if (other != atom
+                        && AtomDist(*atom, *other) < (r1 + other->getRadius()+radiusOffset_))
+                    {
+                        b.push_back(other);
+                    }
+                }
+                dots_[i].clear();
+                atomsurfdots(atom, radius_, b.empty() ? NULL : &b[0], (long)b.size(), dots_[i]);
+            }
+        }
+    };
+
+    void AppendAtomCoords(const MIAtom *atom, std::vector<float> &xyz)
+    {
+        xyz.push_back(atom->x());
+        xyz.push_back(atom->y());
+        xyz.push_back(atom->z());
+    }
+}
+
 long Molecule::SolventSurface(ViewPoint*, float dotsper)
 {
-    int j, k;
-    MIAtom *b[100];
-    MIAtom *atom;
     extern int SurfResult;
     SurfResult = 1;
     srfdotsper = dotsper;
     extern float spacing;
-    float r1;
-    SURFDOT *adots;
-    long nadots = 0;
-    long maxadots = 0;
-    void *hdots = NULL;
-
-    std::vector<SURFDOT>().swap(dots); // was dots.clear();
     spacing = dotsper;
 
     float radius_offset = 1.4f;
@@ -1883,55 +2434,128 @@ long Molecule::SolventSurface(ViewPoint*, float dotsper)
         radius[i] = MIAtom::MIAtomRadiusForType(i)+radius_offset;
     }
     initspheres(radius);
+    float cutoff = 2.0f*MaxSurfaceRadius(radius);
 
-    for (ResidueListIterator res = residuesBegin(); res != residuesEnd() && SurfResult != 0; ++res)
+    std::vector<MIAtom*> atoms;
+    std::vector<float> xyz;
+    for (ResidueListIterator res = residuesBegin(); res != residuesEnd(); ++res)
     {
         if (!IsWater(res))
         {
-            for (k = 0; k < res->atomCount(); k++)
+            for (int k = 0; k < res->atomCount(); k++)
             {
-                int nb = 0;
-                atom = res->atom(k);
-                r1 = atom->getRadius() + radius_offset;
-                nb = 0;
-                for (ResidueListIterator res2 = residuesBegin(); res2 != residuesEnd(); ++res2)
+                atoms.push_back(res->atom(k));
+                AppendAtomCoords(res->atom(k), xyz);
+            }
+        }
+    }
+    SurfaceGrid grid;
+    grid.build(xyz, cutoff);
+
+    // Keep the dots of atoms that have not moved since the last surface,
+    // unless an atom that moved, appeared or went away was close enough to
+    // change which of their dots are buried.
+    std::vector<SurfaceDots> atomDots(atoms.size());
+    std::vector<char> compute(atoms.size(), 1);
+    if (solventDotsper == dotsper && !solventAtoms.empty())
+    {
+        std::map<MIAtom*, size_t> previous;
+        for (size_t j = 0; j < solventAtoms.size(); ++j)
+        {
+            previous[solventAtoms[j].atom] = j;
+        }
+        std::vector<char> kept(solventAtoms.size(), 0);
+        std::vector<float> moved;
+        for (size_t i = 0; i < atoms.size(); ++i)
+        {
+            MIAtom *atom = atoms[i];
+            std::map<MIAtom*, size_t>::iterator prev = previous.find(atom);
+            if (prev != previous.end())
+            {
+                const SolventSurfaceAtom &old = solventAtoms[prev->second];
+                if (old.x == atom->x() && old.y == atom->y() && old.z == atom->z()
+                    && old.type == MIAtom::MIGetAtomTypeFromName(atom->name()))
                 {
-                    if (!IsWater(res2))
-                    {
-                        for (j = 0; j < res2->atomCount(); j++)
-                        {
-                            if (res2->atom(j) != atom)
-                            {
-                                if (AtomDist(*atom, *res2->atom(j)) < (r1 + res2->atom(j)->getRadius()+radius_offset))
-                                {
-                                    if (nb < 100)
-                                    {
-                                        b[nb] = res2->atom(j);
-                                        nb++;
-                                    }
-                                }
-                            }
-                        }
-                    }
+                    kept[prev->second] = 1;
+                    compute[i] = 0;
+                    atomDots[i].swap(solventAtomDots[prev->second]);
+                    continue;
                 }
-                nadots = 0;
-                nadots = atomsurf(atom, 1.0F, b, nb, &adots, nadots, &maxadots, hdots, srfdotsper, radius_offset);
-                if (SurfResult == 0)
+            }
+            AppendAtomCoords(atom, moved);
+        }
+        for (size_t j = 0; j < solventAtoms.size(); ++j)
+        {
+            if (!kept[j])
+            {
+                moved.push_back(solventAtoms[j].x);
+                moved.push_back(solventAtoms[j].y);
+                moved.push_back(solventAtoms[j].z);
+            }
+        }
+
+        if (!moved.empty())
+        {
+            SurfaceGrid movedGrid;
+            movedGrid.build(moved, cutoff);
+            std::vector<int> nearby;
+            for (size_t i = 0; i < atoms.size(); ++i)
+            {
+                if (compute[i])
                 {
-                    break;
+                    continue;
                 }
-                for (int l = 0; l < nadots; l++)
+                MIAtom *atom = atoms[i];
+                movedGrid.candidates(atom->x(), atom->y(), atom->z(), nearby);
+                for (size_t n = 0; n < nearby.size(); ++n)
                 {
-                    dots.push_back(adots[l]);
+                    float dx = moved[3*nearby[n]] - atom->x();
+                    float dy = moved[3*nearby[n]+1] - atom->y();
+                    float dz = moved[3*nearby[n]+2] - atom->z();
+                    if (dx*dx + dy*dy + dz*dz <= cutoff*cutoff)
+                    {
+                        compute[i] = 1;
+                        break;
+                    }
                 }
             }
         }
     }
-    if (hdots != NULL)
+    std::vector<SurfaceDots>().swap(solventAtomDots);
+
+    SurfaceDotsBuilder builder(atoms, compute, atoms, grid, radius, radius_offset, atomDots);
+    MIParallelFor(0, (int)atoms.size(), builder, 32);
+
+    std::vector<SURFDOT>().swap(dots); // was dots.clear();
+    size_t ndots = 0;
+    for (size_t i = 0; i < atomDots.size(); ++i)
     {
-        free(hdots);
-        hdots = NULL;
+        ndots += atomDots[i].size();
+    }
+    dots.reserve(ndots);
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        // Kept dots may predate a colour change
+        short color = abs(atoms[i]->color());
+        for (size_t l = 0; l < atomDots[i].size(); ++l)
+        {
+            atomDots[i][l].color = color;
+        }
+        dots.insert(dots.end(), atomDots[i].begin(), atomDots[i].end());
     }
+
+    solventAtoms.resize(atoms.size());
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        solventAtoms[i].atom = atoms[i];
+        solventAtoms[i].x = atoms[i]->x();
+        solventAtoms[i].y = atoms[i]->y();
+        solventAtoms[i].z = atoms[i]->z();
+        solventAtoms[i].type = MIAtom::MIGetAtomTypeFromName(atoms[i]->name());
+    }
+    solventAtomDots.swap(atomDots);
+    solventDotsper = dotsper;
+
     surfaceChanged(this);
     return (dots.size());
 }
@@ -2121,49 +2745,127 @@ long Molecule::SurfaceCenter(ViewPoint *viewpoint, float dotsper, float boxsize,
     srfdotsper = dotsper;
     srfboxsize = boxsize;
     boxsize *= boxsize;
-    std::vector<SURFDOT>().swap(dots);
-    for (ResidueListIterator res = residuesBegin(); res != residuesEnd() && SurfResult != 0; ++res)
+    extern float spacing;
+    spacing = dotsper;
+
+    float radius[NTYPES];
+    for (unsigned int i = 0; i < NTYPES; ++i)
+    {
+        radius[i] = MIAtom::MIAtomRadiusForType(i);
+    }
+    initspheres(radius);
+
+    std::vector<MIAtom*> targets;
+    std::vector<MIAtom*> neighbours;
+    std::vector<float> xyz;
+    for (ResidueListIterator res = residuesBegin(); res != residuesEnd(); ++res)
     {
         for (int i = 0; i < res->atomCount(); ++i)
         {
-            float x = res->atom(i)->x() - cx;
-            float y = res->atom(i)->y() - cy;
-            float z = res->atom(i)->z() - cz;
+            MIAtom *atom = res->atom(i);
+            float x = atom->x() - cx;
+            float y = atom->y() - cy;
+            float z = atom->z() - cz;
             if (x*x + y*y + z*z < boxsize)
-                Surface(res->atom(i), ignore_hidden, false);
-
-            if (SurfResult == 0)
-                break;
+            {
+                targets.push_back(atom);
+            }
+            if (atom->color() >= 0 || !ignore_hidden)
+            {
+                neighbours.push_back(atom);
+                AppendAtomCoords(atom, xyz);
+            }
         }
     }
+    SurfaceGrid grid;
+    grid.build(xyz, 2.0f*MaxSurfaceRadius(radius));
+
+    std::vector<SurfaceDots> atomDots(targets.size());
+    std::vector<char> compute(targets.size(), 1);
+    SurfaceDotsBuilder builder(targets, compute, neighbours, grid, radius, 0.0f, atomDots);
+    MIParallelFor(0, (int)targets.size(), builder, 32);
+
+    std::vector<SURFDOT>().swap(dots);
+    for (size_t i = 0; i < atomDots.size(); ++i)
+    {
+        dots.insert(dots.end(), atomDots[i].begin(), atomDots[i].end());
+    }
     surfaceChanged(this);
     return (dots.size());
 }
 
 SecondaryStructure*Molecule::getSecondaryStructure()
 {
+    if (secStruc_stale)
+    {
+        UpdateSecondaryStructure();
+    }
     return m_pSecondaryStructure;
 }
 
+void Molecule::OnCoordsChanged()
+{
+    // Remade when next drawn, so that an edit moving many atoms, or one
+    // still under way, costs a single update
+    secStruc_stale = true;
+}
+
 void Molecule::MakeSecondaryStructure(bool bRibbon, bool bSchematic)
 {
 
     secStruc_ribbon = bRibbon;
     secStruc_schematic = bSchematic;
-    if (m_pSecondaryStructure)
+    if (!bRibbon && !bSchematic)
     {
-        delete m_pSecondaryStructure;
-        m_pSecondaryStructure = NULL;
+        if (m_pSecondaryStructure)
+        {
+            delete m_pSecondaryStructure;
+            m_pSecondaryStructure = NULL;
+        }
+        return;
     }
-    if (!bRibbon && !bSchematic)
+    if (m_pSecondaryStructure == NULL)
+    {
+        m_pSecondaryStructure = new SecondaryStructure();
+    }
+
+    std::string error;
+    if (!BuildSecondaryStructure(error))
+    {
+        std::string s;
+        s = format("Unable to create secondary structure:\n%s", error.c_str());
+        Logger::message(s);
+    }
+}
+
+void Molecule::UpdateSecondaryStructure()
+{
+    if (m_pSecondaryStructure == NULL)
     {
         return;
     }
-    m_pSecondaryStructure = new SecondaryStructure();
+    std::string error;
+    if (!BuildSecondaryStructure(error))
+    {
+        // Report a failure once, not on every move that repeats it
+        if (error != secStruc_error)
+        {
+            Logger::debug("Unable to update secondary structure: %s", error.c_str());
+        }
+    }
+    secStruc_error = error;
+}
+
+bool Molecule::BuildSecondaryStructure(std::string &error)
+{
+    bool built = true;
+    secStruc_stale = false;
 
+    // Spans whose control atoms have not moved are kept
+    m_pSecondaryStructure->BeginUpdate();
     try
     {
-        if (bRibbon)
+        if (secStruc_ribbon)
         {
             Residue *res = residues;
             while (res != NULL)
@@ -2188,7 +2890,7 @@ void Molecule::MakeSecondaryStructure(bool bRibbon, bool bSchematic)
             }
         }
 
-        if (bSchematic)
+        if (secStruc_schematic)
         {
             std::vector<std::pair<Residue*, Residue*> > pHelix;
             std::vector<std::pair<Residue*, Residue*> > pSheet;
@@ -2231,7 +2933,6 @@ void Molecule::MakeSecondaryStructure(bool bRibbon, bool bSchematic)
                     if (startSS != currentSS)
                     {
                         endRes = prevRes;
-                        Logger::debug("end %s %s %c %d", endRes->type().c_str(), endRes->name().c_str(), endRes->chain_id(), residueCount);
                         switch (startSS)
                         {
                         default:
@@ -2250,7 +2951,6 @@ void Molecule::MakeSecondaryStructure(bool bRibbon, bool bSchematic)
                         }
                         startSS = currentSS;
                         startRes = prevRes;
-                        Logger::debug("start %s %s %c", startRes->type().c_str(), startRes->name().c_str(), startRes->chain_id());
                         residueCount = 0;
                     }
                     prevRes = res;
@@ -2258,7 +2958,6 @@ void Molecule::MakeSecondaryStructure(bool bRibbon, bool bSchematic)
                     residueCount++;
                 }
                 endRes = prevRes;
-                Logger::debug("end %s %s %c %d", endRes->type().c_str(), endRes->name().c_str(), endRes->chain_id(), residueCount);
                 switch (startSS)
                 {
                 default:
@@ -2281,11 +2980,11 @@ void Molecule::MakeSecondaryStructure(bool bRibbon, bool bSchematic)
     }
     catch (std::string e)
     {
-        std::string s;
-        s = format("Unable to create secondary structure:\n%s", e.c_str());
-        Logger::message(s);
+        error = e;
+        built = false;
     }
-
+    m_pSecondaryStructure->EndUpdate();
+    return built;
 }
 
 void Molecule::DeleteSecondaryStructure()
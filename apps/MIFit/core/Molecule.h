@@ -24,6 +24,8 @@ class Molecule;
 class CMapHeaderBase;
 class SecondaryStructure;
 class CMapHeaderBase;
+class SnapshotWriter;
+class SnapshotSection;
 
 class MolPrefsHandler
 {
@@ -61,6 +63,22 @@ private:
     int annots_visible;
     float srfdotsper;
     float srfboxsize;
+
+    /**
+     * Atoms of the last solvent surface, with the positions and dots they
+     * had, so that SolventSurface only recomputes atoms near those moved.
+     */
+    struct SolventSurfaceAtom
+    {
+        chemlib::MIAtom *atom;
+        float x;
+        float y;
+        float z;
+        int type;
+    };
+    std::vector<SolventSurfaceAtom> solventAtoms;
+    std::vector<SurfaceDots> solventAtomDots;
+    float solventDotsper;
     std::vector<short> savecolors;
     bool undoable;
     CMapHeaderBase *mapheader;
@@ -74,6 +92,9 @@ private:
     SecondaryStructure *m_pSecondaryStructure;
     bool secStruc_ribbon;
     bool secStruc_schematic;
+    bool secStruc_stale;
+    std::string secStruc_error;
+    bool BuildSecondaryStructure(std::string &error);
 
     AnnotationList annotations;
     AtomLabelList atomLabels;
@@ -281,6 +302,16 @@ public:
     long Surface(chemlib::MIAtom*, bool ignore_hidden = true, bool send_signal = true);
     void Save(XMLArchive&);
     void Load(FILE *fp);
+    //@{
+    // Write the model to a binary session snapshot: everything Save(XMLArchive&)
+    // writes except the ribbon atoms, which are regenerated on demand.
+    //@}
+    void SaveSnapshot(SnapshotWriter &out);
+    //@{
+    // Restore a model written by SaveSnapshot into this empty molecule.
+    // Bonds are restored as saved, so Build() is not needed.
+    //@}
+    bool LoadSnapshot(SnapshotSection &in);
 
     void Translate(float, float, float, std::vector<chemlib::MIAtom*> *atoms); // need this b/c parent version is hidden by override below
     void Translate(float, float, float, std::vector<chemlib::MIAtom*> *atoms, SurfaceDots *dots);
@@ -290,6 +321,12 @@ public:
     int SaveSymmMolecule(chemlib::MIAtom *symatom, FILE *fp);
     int SeqMax();
     void MakeSecondaryStructure(bool bRibbon, bool bSchematic);
+    /**
+     * Brings the secondary structure shown, if any, up to date with the
+     * atoms, remaking only the segments whose CA, C or O atoms moved.
+     * getSecondaryStructure calls it once coordinates have changed.
+     */
+    void UpdateSecondaryStructure();
     void DeleteSecondaryStructure();
     SecondaryStructure *getSecondaryStructure();
     bool isSecondaryStructureRibbons();
@@ -318,6 +355,7 @@ protected:
     void doAtomBValueAndOccupancy(chemlib::MIAtom *atom, float bvalue, float occ);
 
     virtual void updateFixChainOptions(bool *breakByDiscontinuity, bool *breakByNonpeptide);
+    virtual void OnCoordsChanged();
 
 };
 
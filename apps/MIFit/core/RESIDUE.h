@@ -74,7 +74,7 @@ chemlib::Residue*SymmResidue(const chemlib::Residue *Model, CMapHeaderBase * mh,
 //@{
 // Function for the backbone builder.
 //@}
-chemlib::Residue *matchvec(const std::vector<chemlib::MIAtom*> &CA, const std::vector<chemlib::MIAtom*> &CB, std::string &pentdir, FILE*);
+chemlib::Residue *matchvec(const std::vector<chemlib::MIAtom*> &CA, const std::vector<chemlib::MIAtom*> &CB, std::string &pentdir);
 //@{
 // Function for the backbone builder.
 //@}
@@ -1,3 +1,5 @@
+#include <cstring>
+#include <map>
 #include <chemlib/chemlib.h>
 #include <util/utillib.h>
 
@@ -13,6 +15,12 @@ RibbonSegment::RibbonSegment()
     m_pRibbonSpanList = NULL;
     m_pRibbonSpanLast = NULL;
     m_pNext = NULL;
+    m_nResidues = 0;
+    m_dWidth = 0.0;
+    m_dThick = 0.0;
+    m_bSquare = false;
+    m_nPoints = 8;
+    m_nSteps = 10;
     for (int i = 0; i < 3; i++)
     {
         m_bRGB[i] = 255;
@@ -37,6 +45,10 @@ bool RibbonSegment::DeleteAllSpans()
     }
     m_pRibbonSpanList = NULL;
     m_pRibbonSpanLast = NULL;
+    for (size_t i = 0; i < m_controls.size(); i++)
+    {
+        m_controls[i].span = NULL;
+    }
     return true;
 }
 
@@ -47,7 +59,7 @@ bool RibbonSegment::RibbonProfile(double dWidth, double dThick, bool bSquare, in
     m_bSquare = bSquare;
     m_nPoints = nPoints;
     m_nSteps = nSteps;
-    return true;
+    return m_profile.Set(dWidth, dThick, bSquare, nPoints, nSteps);
 }
 
 bool RibbonSegment::SetColor(unsigned char bRed, unsigned char bGreen, unsigned char bBlue)
@@ -58,7 +70,7 @@ bool RibbonSegment::SetColor(unsigned char bRed, unsigned char bGreen, unsigned
     return true;
 }
 
-bool RibbonSegment::MakeRibbon(Residue *pFirstResidue, int nResidues)
+bool RibbonSegment::SetControlPoints(Residue *pFirstResidue, int nResidues)
 {
 
     //If there is already a ribbon, delete it.
@@ -66,6 +78,7 @@ bool RibbonSegment::MakeRibbon(Residue *pFirstResidue, int nResidues)
     {
         DeleteAllSpans();
     }
+    m_controls.clear();
 
     //Make sure there is a valid first residue
     if (!pFirstResidue || (( nResidues != 0) && (nResidues < 2)))
@@ -75,9 +88,10 @@ bool RibbonSegment::MakeRibbon(Residue *pFirstResidue, int nResidues)
 
     //Get the name
     m_csFirstResidueName = pFirstResidue->name();
+    m_csKey = format("%s %d", m_csFirstResidueName.c_str(), (int)pFirstResidue->chain_id());
     m_nResidues = 0;
 
-    //Now generate the spans.  We need four residues.
+    //Now collect the spans.  We need four residues.
     //Double up the first at the start of the segment and the last at the end
     Residue *pRes[4];
     pRes[0] = pFirstResidue;
@@ -98,11 +112,28 @@ bool RibbonSegment::MakeRibbon(Residue *pFirstResidue, int nResidues)
     {
         iResidues = nResidues;
     }
+    SpanControl control;
+    for (int j = 0; j < 4; j++)
+    {
+        control.flip[j] = false;
+    }
+    control.span = NULL;
     for (int i = 0; i < iResidues; i++)
     {
-        //Build the data arrays
-        double ptca[4][3], ptc[4][3], pto[4][3];
-        for (int j = 0; j < 4; j++)
+        //Build the data arrays; each span shares three residues with the last
+        if (!bFirst)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                for (int l = 0; l < 3; l++)
+                {
+                    control.ptca[k][l] = control.ptca[k+1][l];
+                    control.ptc[k][l] = control.ptc[k+1][l];
+                    control.pto[k][l] = control.pto[k+1][l];
+                }
+            }
+        }
+        for (int j = bFirst ? 0 : 3; j < 4; j++)
         {
             //CA
             MIAtom *pAtom = atom_from_name("CA", *pRes[j]);
@@ -110,9 +141,9 @@ bool RibbonSegment::MakeRibbon(Residue *pFirstResidue, int nResidues)
             {
                 throw format("no CA atom in residue %s %s %c", pRes[j]->type().c_str(), pRes[j]->name().c_str(), pRes[j]->chain_id());
             }
-            ptca[j][0] = pAtom->x();
-            ptca[j][1] = pAtom->y();
-            ptca[j][2] = pAtom->z();
+            control.ptca[j][0] = pAtom->x();
+            control.ptca[j][1] = pAtom->y();
+            control.ptca[j][2] = pAtom->z();
 
             //C
             pAtom = atom_from_name("C", *pRes[j]);
@@ -120,9 +151,9 @@ bool RibbonSegment::MakeRibbon(Residue *pFirstResidue, int nResidues)
             {
                 throw format("no C atom in residue %s %s %c", pRes[j]->type().c_str(), pRes[j]->name().c_str(), pRes[j]->chain_id());
             }
-            ptc[j][0] = pAtom->x();
-            ptc[j][1] = pAtom->y();
-            ptc[j][2] = pAtom->z();
+            control.ptc[j][0] = pAtom->x();
+            control.ptc[j][1] = pAtom->y();
+            control.ptc[j][2] = pAtom->z();
 
             //O
             pAtom = atom_from_name("O", *pRes[j]);
@@ -130,32 +161,15 @@ bool RibbonSegment::MakeRibbon(Residue *pFirstResidue, int nResidues)
             {
                 throw format("no O atom in residue %s %s %c", pRes[j]->type().c_str(), pRes[j]->name().c_str(), pRes[j]->chain_id());
             }
-            pto[j][0] = pAtom->x();
-            pto[j][1] = pAtom->y();
-            pto[j][2] = pAtom->z();
-        }
-        RibbonSpan *pSpan = new RibbonSpan();
-        if (m_nResidues == 0)
-        {
-            pSpan->SetProfile(m_dWidth, m_dThick, m_bSquare, m_nPoints, m_nSteps);
-        }
-        if (!pSpan->MakeSpan(ptca, ptc, pto, bFirst))
-        {
-            delete pSpan;
-            return false;
+            control.pto[j][0] = pAtom->x();
+            control.pto[j][1] = pAtom->y();
+            control.pto[j][2] = pAtom->z();
         }
-        bFirst = false;
 
-        //Now add this Segment to the list
-        if (m_pRibbonSpanLast == NULL)
-        {
-            m_pRibbonSpanList = pSpan;
-        }
-        else
-        {
-            m_pRibbonSpanLast->m_pNext = pSpan;
-        }
-        m_pRibbonSpanLast = pSpan;
+        //The flips carry on from span to span, so they are set here in order
+        RibbonSpan::UpdateFlips(control.ptc, control.pto, bFirst, control.flip);
+        bFirst = false;
+        m_controls.push_back(control);
 
         m_nResidues++;
 
@@ -187,3 +201,91 @@ bool RibbonSegment::MakeRibbon(Residue *pFirstResidue, int nResidues)
     return true;
 }
 
+bool RibbonSegment::SameProfile(const RibbonSegment &other) const
+{
+    return m_dWidth == other.m_dWidth && m_dThick == other.m_dThick && m_bSquare == other.m_bSquare
+           && m_nPoints == other.m_nPoints && m_nSteps == other.m_nSteps;
+}
+
+bool RibbonSegment::ControlOrder::operator()(const SpanControl *a, const SpanControl *b) const
+{
+    int c = memcmp(a->ptca, b->ptca, sizeof(a->ptca));
+    if (c == 0)
+    {
+        c = memcmp(a->ptc, b->ptc, sizeof(a->ptc));
+    }
+    if (c == 0)
+    {
+        c = memcmp(a->pto, b->pto, sizeof(a->pto));
+    }
+    if (c == 0)
+    {
+        c = memcmp(a->flip, b->flip, sizeof(a->flip));
+    }
+    return c < 0;
+}
+
+void RibbonSegment::AllocateSpans(RibbonSegment *pPrevious, std::vector<int> &toMake)
+{
+    DeleteAllSpans();
+    toMake.clear();
+
+    //The spans of the previous segment by what they were made from; they
+    //are matched by content so that spans moved along by an inserted or
+    //deleted residue are found too
+    typedef std::multimap<const SpanControl*, RibbonSpan*, ControlOrder> SpanMap;
+    SpanMap previous;
+    if (pPrevious != NULL)
+    {
+        for (size_t i = 0; i < pPrevious->m_controls.size(); i++)
+        {
+            if (pPrevious->m_controls[i].span != NULL)
+            {
+                previous.insert(std::make_pair(&pPrevious->m_controls[i], pPrevious->m_controls[i].span));
+                pPrevious->m_controls[i].span = NULL;
+            }
+        }
+        pPrevious->m_pRibbonSpanList = NULL;
+        pPrevious->m_pRibbonSpanLast = NULL;
+    }
+
+    for (size_t i = 0; i < m_controls.size(); i++)
+    {
+        RibbonSpan *pSpan;
+        SpanMap::iterator match = previous.find(&m_controls[i]);
+        if (match != previous.end())
+        {
+            pSpan = match->second;
+            previous.erase(match);
+        }
+        else
+        {
+            pSpan = new RibbonSpan();
+            toMake.push_back((int)i);
+        }
+        pSpan->m_pNext = NULL;
+
+        //Now add this span to the list
+        if (m_pRibbonSpanLast == NULL)
+        {
+            m_pRibbonSpanList = pSpan;
+        }
+        else
+        {
+            m_pRibbonSpanLast->m_pNext = pSpan;
+        }
+        m_pRibbonSpanLast = pSpan;
+        m_controls[i].span = pSpan;
+    }
+
+    for (SpanMap::iterator p = previous.begin(); p != previous.end(); ++p)
+    {
+        delete p->second;
+    }
+}
+
+void RibbonSegment::MakeSpan(int i)
+{
+    SpanControl &control = m_controls[i];
+    control.span->MakeSpan(control.ptca, control.ptc, control.pto, control.flip, m_profile);
+}
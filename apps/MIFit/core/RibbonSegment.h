@@ -2,11 +2,13 @@
 #define mifit_model_RibbonSegment_h
 
 #include <string>
+#include <vector>
+
+#include "RibbonSpan.h"
 
 namespace chemlib
 {class Residue;
 }
-class RibbonSpan;
 
 class RibbonSegment
 {
@@ -20,14 +22,61 @@ public:
     //Methods
     bool DeleteAllSpans(void);
     bool RibbonProfile(double dWidth, double dThick, bool bSquare, int nPoints, int nSteps);
-    bool MakeRibbon(chemlib::Residue *pFirstResidue, int nResidues);
     bool SetColor(unsigned char bRed, unsigned char bGreen, unsigned char bBlue);
 
+    /**
+     * Reads the CA, C and O positions controlling each span from the
+     * residues, replacing any spans. Throws a message if a residue lacks
+     * one of them.
+     */
+    bool SetControlPoints(chemlib::Residue *pFirstResidue, int nResidues);
+
+    /**
+     * True if other has the same cross section, so that spans made from the
+     * same control points are the same.
+     */
+    bool SameProfile(const RibbonSegment &other) const;
+
+    /**
+     * Creates a span for each set of control points. Spans of pPrevious,
+     * which must have the same profile, are taken over where their control
+     * points and flips match, and pPrevious is left without spans. Fills
+     * toMake with the spans still to be evaluated with MakeSpan; different
+     * spans may be made concurrently.
+     */
+    void AllocateSpans(RibbonSegment *pPrevious, std::vector<int> &toMake);
+    void MakeSpan(int i);
+
+    /**
+     * The first residue's name and chain, which identify the segment from
+     * one rebuild to the next.
+     */
+    const std::string &Key() const
+    {
+        return m_csKey;
+    }
+
 private:
 
+    struct SpanControl
+    {
+        double ptca[4][3];
+        double ptc[4][3];
+        double pto[4][3];
+        bool flip[4];
+        RibbonSpan *span;
+    };
+
+    // Orders controls by everything MakeSpan uses from them
+    struct ControlOrder
+    {
+        bool operator()(const SpanControl *a, const SpanControl *b) const;
+    };
+
     friend class GLRenderer;
 
     std::string m_csFirstResidueName;
+    std::string m_csKey;
     int m_nResidues;
     RibbonSpan *m_pRibbonSpanList;
     RibbonSpan *m_pRibbonSpanLast;
@@ -37,6 +86,8 @@ private:
     int m_nPoints; //Number of points in cross section
     int m_nSteps; //Numuber of parametric steps per span
     unsigned char m_bRGB[4];
+    RibbonSpanProfile m_profile;
+    std::vector<SpanControl> m_controls;
 
 };
 
@@ -44,7 +44,7 @@ static double cmat[4][4] = {{-b1,  b3, -b3, b1},
         {-1.0, 0.0, 0.0},
         {-c45, c45, 0.0}};
  */
-static double cdata[8][3] =    {{1.5, 0.5, 0.0},
+static const double default_cdata[8][3] =    {{1.5, 0.5, 0.0},
                                 {1.5, 0.5, 0.0},
                                 {1.5, -0.5, 0.0},
                                 {1.5, -0.5, 0.0},
@@ -52,7 +52,7 @@ static double cdata[8][3] =    {{1.5, 0.5, 0.0},
                                 {-1.5, -0.5, 0.0},
                                 {-1.5, 0.5, 0.0},
                                 {-1.5, 0.5, 0.0}};
-static double ndata[8][3] =    {{0.0, 1.0, 0.0},
+static const double default_ndata[8][3] =    {{0.0, 1.0, 0.0},
                                 {1.0, 0.0, 0.0},
                                 {1.0, 0.0, 0.0},
                                 {0.0, -1.0, 0.0},
@@ -74,8 +74,19 @@ static double arrowFlat_data[6][3] =   {{2.0, 0.5, 0.0},
                                         {0.0, -1.0, 0.0}};
  */
 
-static bool ribbon_flip[4] = {false, false, false, false}; // Control for ribbon flipping to avoid 180 twists
-
+RibbonSpanProfile::RibbonSpanProfile()
+    : npr(8),
+      nseg(10)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            cdata[i][j] = default_cdata[i][j];
+            ndata[i][j] = default_ndata[i][j];
+        }
+    }
+}
 
 
 RibbonSpan::RibbonSpan()
@@ -95,7 +106,58 @@ RibbonSpan::~RibbonSpan()
 //  pView->DrawPolySurf (npr, nseg, ribbon_pts, ribbon_norms);
 //}
 
-bool RibbonSpan::MakeSpan(double ptca[4][3], double ptc[4][3], double pto[4][3], bool bFirst)
+void RibbonSpan::UpdateFlips(double ptc[4][3], double pto[4][3], bool bFirst, bool flip[4])
+{
+    // Control for ribbon flipping to avoid 180 twists: the wide side of
+    // the ribbon follows C->O, reversed wherever that turns through more
+    // than 90 degrees from the point before
+    int i, j;
+    double b[3], bold[3];
+
+    if (bFirst)
+    {
+        flip[1] = false;
+    }
+
+    // Update the flips
+    for (i = 0; i < 3; i++)
+    {
+        flip[i] = flip[i+1];
+    }
+
+    for (i = 0; i < 4; i++)
+    {
+        for (j = 0; j < 3; j++)
+        {
+            b[j] = pto[i][j] - ptc[i][j];
+        }
+        ml_normalize(b);
+
+        // Update the flip direction for the last point or if this is the bFirst
+        if ((i == 3) || ((i > 0) && bFirst))
+        {
+            flip[i] = ml_dot(b, bold) < 0.0;
+        }
+
+        // Flip the direction if needed
+        if (flip[i])
+        {
+            for (j = 0; j < 3; j++)
+            {
+                b[j] = -b[j];
+            }
+        }
+
+        // Save this direction for latter testing
+        for (j = 0; j < 3; j++)
+        {
+            bold[j] = b[j];
+        }
+    }
+}
+
+bool RibbonSpan::MakeSpan(double ptca[4][3], double ptc[4][3], double pto[4][3],
+                          const bool flip[4], const RibbonSpanProfile &profile)
 {
     /* --------------------------------------------------------------------
        Function: Generate one segment of a ribbon from 4 control points.
@@ -107,9 +169,9 @@ bool RibbonSpan::MakeSpan(double ptca[4][3], double ptc[4][3], double pto[4][3],
        Input:    ptca -- The CA coordinates for four residues
         ptc -- The C coordinates for four residues
         pto -- the O coordinates for four residues.
-        bFirst -- This should be true iff this is the first
-          segment.  It is used to initialize direction
-          flipping.
+        flip -- Whether to reverse the direction of the
+          wide side at each point, from UpdateFlips.
+        profile -- The profile points and normals.
        Output:   ribbon_pts -- points returned.  They are returned in the
           order:
           profile pt1
@@ -127,18 +189,10 @@ bool RibbonSpan::MakeSpan(double ptca[4][3], double ptc[4][3], double pto[4][3],
     double mat[4][4], a[3], b[3], c[3], d[3], pnts[RibbonSpan_MP][4][4];
     double norms[RibbonSpan_MP][4][4], t[4];
     double spnts[RibbonSpan_MP][RibbonSpan_MS+1][4], snorms[RibbonSpan_MP][RibbonSpan_MS+1][4];
-    double x[4], tval, tinc, bold[3];
+    double x[4], tval, tinc, cdata[3], ndata[3];
 
-    if (bFirst)
-    {
-        ribbon_flip[1] = false;
-    }
-
-    // Update ribbon_flip
-    for (i = 0; i < 3; i++)
-    {
-        ribbon_flip[i] = ribbon_flip[i+1];
-    }
+    npr = profile.npr;
+    nseg = profile.nseg;
 
     // For each point construct a matrix and fill in the pnts and norms
     for (i = 0; i < 4; i++)
@@ -151,21 +205,8 @@ bool RibbonSpan::MakeSpan(double ptca[4][3], double ptc[4][3], double pto[4][3],
         ml_normalize(a);
         ml_normalize(b);
 
-        // Update the flip direction for the last point or if this is the bFirst
-        if ((i == 3) || ((i > 0) && bFirst))
-        {
-            if (ml_dot(b, bold) < 0.0)
-            {
-                ribbon_flip[i] = true;
-            }
-            else
-            {
-                ribbon_flip[i] = false;
-            }
-        }
-
         // Flip the direction if needed
-        if (ribbon_flip[i])
+        if (flip[i])
         {
             for (j = 0; j < 3; j++)
             {
@@ -173,12 +214,6 @@ bool RibbonSpan::MakeSpan(double ptca[4][3], double ptc[4][3], double pto[4][3],
             }
         }
 
-        // Save this direction for latter testing
-        for (j = 0; j < 3; j++)
-        {
-            bold[j] = b[j];
-        }
-
         // Find a thrird direction for a transform matrix
         ml_cross(a, b, c);
         ml_normalize(c);
@@ -202,8 +237,13 @@ bool RibbonSpan::MakeSpan(double ptca[4][3], double ptc[4][3], double pto[4][3],
 
         for (j = 0; j < npr; j++)
         {
-            ml_vec_mat44(cdata[j], 0.0, mat, d);
-            ml_vec_mat44(ndata[j], 0.0, mat, a);
+            for (k = 0; k < 3; k++)
+            {
+                cdata[k] = profile.cdata[j][k];
+                ndata[k] = profile.ndata[j][k];
+            }
+            ml_vec_mat44(cdata, 0.0, mat, d);
+            ml_vec_mat44(ndata, 0.0, mat, a);
             for (k = 0; k < 3; k++)
             {
                 pnts[j][i][k] = d[k] + ptca[i][k];
@@ -289,8 +329,8 @@ bool RibbonSpan::MakeSpan(double ptca[4][3], double ptc[4][3], double pto[4][3],
    } // End arrowFlat_new()
  */
 //////////////////////////////////////////////////////////////////////
-int RibbonSpan::SetProfile(double dx, double dy, int square, int profile_pts,
-                           int profile_segs)
+bool RibbonSpanProfile::Set(double dx, double dy, int square, int profile_pts,
+                            int profile_segs)
 {
     //////////////////////////////////////////////////////////////////////
     //Function: Generate the profile for a ribbon segment and set
@@ -304,7 +344,7 @@ int RibbonSpan::SetProfile(double dx, double dy, int square, int profile_pts,
     //      has an assoicated normal
     //    profile_segs -- Number of segments in a profile
     //Value:    FALSE if errors.
-    //Effect:   Global parameters set.
+    //Effect:   Profile set.
     //////////////////////////////////////////////////////////////////////
     // Begin ribbon_segment_new
     double inc, ang, ang_inc;
@@ -397,12 +437,6 @@ int RibbonSpan::SetProfile(double dx, double dy, int square, int profile_pts,
         arrowFlat_data[i][2] = (arrowFlat_data[i][2]/oldz)*dy*4;
     }
 
-    //Reset the flig
-    for (i = 0; i < 4; i++)
-    {
-        ribbon_flip[i] = false;
-    }
-
     return true;
 
 }
@@ -1,6 +1,27 @@
 #ifndef mifit_model_RibbonSpan_h
 #define mifit_model_RibbonSpan_h
 
+//Ribbon data
+#define RibbonSpan_MP 8
+#define RibbonSpan_MS 10
+
+/**
+ * Cross section of a ribbon: the profile points and their normals, swept
+ * through nseg steps along each span. Each segment keeps its own so that
+ * spans of several segments can be made at once.
+ */
+struct RibbonSpanProfile
+{
+    RibbonSpanProfile();
+
+    bool Set(double dx, double dy, int square, int profile_pts, int profile_segs);
+
+    int npr;  // Number for profile points
+    int nseg; // Number of segments
+    double cdata[RibbonSpan_MP][3];
+    double ndata[RibbonSpan_MP][3];
+};
+
 class RibbonSpan
 {
 public:
@@ -11,8 +32,19 @@ public:
     RibbonSpan *m_pNext;
 
     //Methods
-    bool MakeSpan(double ptca[4][3], double ptc[4][3], double pto[4][3], bool bFirst);
-    int SetProfile(double dx, double dy, int square, int profile_pts, int profile_segs);
+    /**
+     * Updates the direction flips of the four points of the next span of a
+     * ribbon from those of the span before it. The spans of a ribbon must be
+     * passed in order; flip starts all false and bFirst is true for the first.
+     */
+    static void UpdateFlips(double ptc[4][3], double pto[4][3], bool bFirst, bool flip[4]);
+
+    /**
+     * Evaluates the span. It depends on nothing but its arguments, so spans
+     * may be made concurrently once their flips are known.
+     */
+    bool MakeSpan(double ptca[4][3], double ptc[4][3], double pto[4][3],
+                  const bool flip[4], const RibbonSpanProfile &profile);
 
 private:
 
@@ -21,10 +53,6 @@ private:
     int npr;  // Number for profile points
     int nseg; // Number of segments
 
-    //Ribbon data
-#define RibbonSpan_MP 8
-#define RibbonSpan_MS 10
-
     double ribbon_pts[RibbonSpan_MP*RibbonSpan_MS][3];
     double ribbon_norms[RibbonSpan_MP*RibbonSpan_MS][3];
 
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <chemlib/chemlib.h>
 
 #include "Molecule.h"
@@ -161,6 +163,53 @@ atomsurf(MIAtom *a, float ra, MIAtom **b, long nb, SURFDOT **dots,
     return (ndots);
 }
 
+void atomsurfdots(const MIAtom *a, const float *radius, MIAtom *const *b, long nb,
+                  std::vector<SURFDOT> &dots)
+{
+    int itype = MIAtom::MIGetAtomTypeFromName(a->name());
+    std::vector<APOINT> &points = surfaceSpheres[itype].getPoints();
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        float x1 = a->x() + points[i].x;
+        float y1 = a->y() + points[i].y;
+        float z1 = a->z() + points[i].z;
+        bool obscured = false;
+        for (long j = 0; j < nb && !obscured; j++)
+        {
+            const MIAtom *a2 = b[j];
+            if (a2 == a)
+            {
+                continue;
+            }
+            float r2 = radius[MIAtom::MIGetAtomTypeFromName(a2->name())];
+            r2 = r2*r2;
+            float dx = a2->x() - x1;
+            float dist = dx*dx;
+            if (dist < r2)
+            {
+                float dy = a2->y() - y1;
+                dist += dy*dy;
+                if (dist < r2)
+                {
+                    float dz = a2->z() - z1;
+                    dist += dz*dz;
+                    obscured = dist < r2;
+                }
+            }
+        }
+        if (!obscured)
+        {
+            SURFDOT dot;
+            dot.x = x1;
+            dot.y = y1;
+            dot.z = z1;
+            dot.w = 1;
+            dot.color = abs(a->color());
+            dots.push_back(dot);
+        }
+    }
+}
+
 long
 atomsurfradius(MIAtom *a, float r, SURFDOT **dots,
                long ndots, long *maxdots, void* &hglb, float dotsper)
@@ -221,3 +270,117 @@ atomsurfradius(MIAtom *a, float r, SURFDOT **dots,
     return (ndots);
 }
 
+
+SurfaceGrid::SurfaceGrid()
+    : cellSize(1.0f)
+{
+    origin[0] = origin[1] = origin[2] = 0.0f;
+    dims[0] = dims[1] = dims[2] = 0;
+}
+
+int SurfaceGrid::cellIndex(int i, int j, int k) const
+{
+    return (k*dims[1] + j)*dims[0] + i;
+}
+
+void SurfaceGrid::build(const std::vector<float> &xyz, float size)
+{
+    int n = (int)(xyz.size()/3);
+    cellStart.clear();
+    cellPoints.clear();
+    dims[0] = dims[1] = dims[2] = 0;
+    if (n == 0)
+    {
+        return;
+    }
+
+    float hi[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        origin[d] = hi[d] = xyz[d];
+    }
+    for (int i = 1; i < n; ++i)
+    {
+        for (int d = 0; d < 3; ++d)
+        {
+            origin[d] = std::min(origin[d], xyz[3*i+d]);
+            hi[d] = std::max(hi[d], xyz[3*i+d]);
+        }
+    }
+
+    // A few stray atoms far from the rest would make the grid mostly empty
+    // cells; widen the cells until there are no more cells than points.
+    cellSize = std::max(size, 0.1f);
+    double ncells;
+    do
+    {
+        ncells = 1.0;
+        for (int d = 0; d < 3; ++d)
+        {
+            dims[d] = (int)floor((hi[d] - origin[d])/cellSize) + 1;
+            ncells *= dims[d];
+        }
+        if (ncells > 8.0*n + 64.0)
+        {
+            cellSize *= 2.0f;
+        }
+    } while (ncells > 8.0*n + 64.0);
+
+    // Counting sort by cell keeps the points of each cell in ascending order
+    std::vector<int> cell(n);
+    cellStart.assign((size_t)ncells + 1, 0);
+    for (int i = 0; i < n; ++i)
+    {
+        int c[3];
+        for (int d = 0; d < 3; ++d)
+        {
+            c[d] = std::min((int)((xyz[3*i+d] - origin[d])/cellSize), dims[d] - 1);
+        }
+        cell[i] = cellIndex(c[0], c[1], c[2]);
+        cellStart[cell[i] + 1]++;
+    }
+    for (size_t c = 1; c < cellStart.size(); ++c)
+    {
+        cellStart[c] += cellStart[c-1];
+    }
+    cellPoints.resize(n);
+    std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    for (int i = 0; i < n; ++i)
+    {
+        cellPoints[fill[cell[i]]++] = i;
+    }
+}
+
+void SurfaceGrid::candidates(float x, float y, float z, std::vector<int> &result) const
+{
+    result.clear();
+    if (cellPoints.empty())
+    {
+        return;
+    }
+    float p[3] = { x, y, z };
+    int lo[3], hi[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        int c = (int)floor((p[d] - origin[d])/cellSize);
+        lo[d] = std::max(c - 1, 0);
+        hi[d] = std::min(c + 1, dims[d] - 1);
+        if (lo[d] > hi[d])
+        {
+            return;
+        }
+    }
+    for (int k = lo[2]; k <= hi[2]; ++k)
+    {
+        for (int j = lo[1]; j <= hi[1]; ++j)
+        {
+            for (int i = lo[0]; i <= hi[0]; ++i)
+            {
+                int c = cellIndex(i, j, k);
+                result.insert(result.end(), cellPoints.begin() + cellStart[c],
+                              cellPoints.begin() + cellStart[c+1]);
+            }
+        }
+    }
+    std::sort(result.begin(), result.end());
+}
@@ -1,6 +1,7 @@
 #ifndef mifit_model_SURFDOT_h
 #define mifit_model_SURFDOT_h
 
+#include <vector>
 #include <chemlib/chemlib.h>
 
 #ifdef TESTING
@@ -28,6 +29,14 @@ public:
 long atomsurf(chemlib::MIAtom *a, float ra, chemlib::MIAtom **b, long nb,
               SURFDOT **dots, long ndots, long *maxdots, void*&, float dotsper, float radius_offset = 0.0f);
 //@{
+// Appends to dots the points of the sphere built by initspheres for atom a
+// that are not buried in the atoms b[]. radius[] must be the radii given to
+// initspheres. Unlike atomsurf this touches no globals, so once the spheres
+// are built several threads may call it at once.
+//@}
+void atomsurfdots(const chemlib::MIAtom *a, const float *radius, chemlib::MIAtom *const *b, long nb,
+                  std::vector<SURFDOT> &dots);
+//@{
 // Surface an atom at radius r.
 //@}
 long atomsurfradius(chemlib::MIAtom *a, float r, SURFDOT **dots,
@@ -41,4 +50,33 @@ int initspheres(float *radii);
 //@}
 void clearspheres();
 
+//@{
+// Cell list over a set of points, used to find the neighbours of an atom
+// without scanning the whole model. Every point within cellSize of a
+// position lies in one of the 27 cells around it.
+//@}
+class SurfaceGrid
+{
+    float cellSize;
+    float origin[3];
+    int dims[3];
+    std::vector<int> cellStart;
+    std::vector<int> cellPoints;
+
+    int cellIndex(int i, int j, int k) const;
+
+public:
+    SurfaceGrid();
+
+    //@{
+    // Buckets the points xyz[3*i], xyz[3*i+1], xyz[3*i+2].
+    //@}
+    void build(const std::vector<float> &xyz, float cellSize);
+
+    //@{
+    // Indices, in ascending order, of the points in the cells around (x, y, z).
+    //@}
+    void candidates(float x, float y, float z, std::vector<int> &result) const;
+};
+
 #endif // ifndef mifit_model_SURFDOT_h
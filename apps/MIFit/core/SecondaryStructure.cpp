@@ -1,4 +1,5 @@
 #include <chemlib/chemlib.h>
+#include <util/parallel.h>
 
 #include "SecondaryStructure.h"
 #include "RibbonSegment.h"
@@ -10,8 +11,33 @@
 
 using namespace chemlib;
 
+namespace
+{
+    // Makes the spans of the segments being rebuilt, each from its own
+    // control points, so MIParallelFor can spread them across threads.
+    class SpanBuilder
+    {
+        const std::vector<std::pair<RibbonSegment*, int> > &spans_;
+
+    public:
+        SpanBuilder(const std::vector<std::pair<RibbonSegment*, int> > &spans)
+            : spans_(spans)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                spans_[i].first->MakeSpan(spans_[i].second);
+            }
+        }
+    };
+}
+
 SecondaryStructure::SecondaryStructure()
 {
+    m_bUpdating = false;
     m_pRibbonSegmentList = NULL;
     m_pRibbonSegmentLast = NULL;
     m_pSheetList = NULL;
@@ -24,10 +50,117 @@ SecondaryStructure::SecondaryStructure()
 
 SecondaryStructure::~SecondaryStructure()
 {
+    if (m_bUpdating)
+    {
+        EndUpdate();
+    }
     DeleteAllRibbonSegments();
     DeleteAllSchematic();
 }
 
+void SecondaryStructure::TakeSegments(RibbonSegment *&pList, RibbonSegment *&pLast)
+{
+    RibbonSegment *pCurrRSeg = pList;
+    while (pCurrRSeg)
+    {
+        RibbonSegment *pNextRSeg = pCurrRSeg->m_pNext;
+        pCurrRSeg->m_pNext = NULL;
+        m_previous.insert(std::make_pair(pCurrRSeg->Key(), pCurrRSeg));
+        pCurrRSeg = pNextRSeg;
+    }
+    pList = NULL;
+    pLast = NULL;
+}
+
+void SecondaryStructure::BeginUpdate()
+{
+    if (m_bUpdating)
+    {
+        EndUpdate();
+    }
+    m_bUpdating = true;
+    TakeSegments(m_pRibbonSegmentList, m_pRibbonSegmentLast);
+    TakeSegments(m_pSheetList, m_pSheetLast);
+    TakeSegments(m_pTurnList, m_pTurnLast);
+    TakeSegments(m_pRandomList, m_pRandomLast);
+
+    // Helices are only a cylinder each, so they are simply made again
+    DeleteAllSchematic();
+}
+
+void SecondaryStructure::EndUpdate()
+{
+    std::multimap<std::string, RibbonSegment*>::iterator prev = m_previous.begin();
+    for (; prev != m_previous.end(); ++prev)
+    {
+        delete prev->second;
+    }
+    m_previous.clear();
+
+    SpanBuilder builder(m_pending);
+    MIParallelFor(0, (int)m_pending.size(), builder, 16);
+    m_pending.clear();
+    m_bUpdating = false;
+}
+
+bool SecondaryStructure::AddSegment(RibbonSegment *pNewRSeg, Residue *pFirstResidue, int nResidues,
+                                    RibbonSegment *&pList, RibbonSegment *&pLast)
+{
+    try
+    {
+        if (!pNewRSeg->SetControlPoints(pFirstResidue, nResidues))
+        {
+            delete pNewRSeg;
+            return false;
+        }
+    }
+    catch (...)
+    {
+        delete pNewRSeg;
+        throw;
+    }
+
+    // Take over the spans made before wherever nothing they depend on has
+    // changed, and make or queue the rest
+    RibbonSegment *pPrevious = NULL;
+    typedef std::multimap<std::string, RibbonSegment*>::iterator PreviousIterator;
+    std::pair<PreviousIterator, PreviousIterator> range = m_previous.equal_range(pNewRSeg->Key());
+    for (PreviousIterator prev = range.first; prev != range.second; ++prev)
+    {
+        if (prev->second->SameProfile(*pNewRSeg))
+        {
+            pPrevious = prev->second;
+            m_previous.erase(prev);
+            break;
+        }
+    }
+    std::vector<int> toMake;
+    pNewRSeg->AllocateSpans(pPrevious, toMake);
+    delete pPrevious;
+    for (size_t i = 0; i < toMake.size(); i++)
+    {
+        if (m_bUpdating)
+        {
+            m_pending.push_back(std::make_pair(pNewRSeg, toMake[i]));
+        }
+        else
+        {
+            pNewRSeg->MakeSpan(toMake[i]);
+        }
+    }
+
+    if (pLast == NULL)
+    {
+        pList = pNewRSeg;
+    }
+    else
+    {
+        pLast->m_pNext = pNewRSeg;
+    }
+    pLast = pNewRSeg;
+    return true;
+}
+
 #define CLAMP(x, low, high)  (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
 
 bool SecondaryStructure::AddRibbonSegment(Residue *pFirstResidue, int nResidues)
@@ -46,24 +179,7 @@ bool SecondaryStructure::AddRibbonSegment(Residue *pFirstResidue, int nResidues)
         (unsigned char)CLAMP(red, 0, 255),
         (unsigned char)CLAMP(green, 0, 255),
         (unsigned char)CLAMP(blue, 0, 255));
-    if (pNewRSeg->MakeRibbon(pFirstResidue, nResidues))
-    {
-        if (m_pRibbonSegmentLast == NULL)
-        {
-            m_pRibbonSegmentList = pNewRSeg;
-        }
-        else
-        {
-            m_pRibbonSegmentLast->m_pNext = pNewRSeg;
-        }
-        m_pRibbonSegmentLast = pNewRSeg;
-        return true;
-    }
-    else
-    {
-        delete pNewRSeg;
-        return false;
-    }
+    return AddSegment(pNewRSeg, pFirstResidue, nResidues, m_pRibbonSegmentList, m_pRibbonSegmentLast);
 }
 
 bool SecondaryStructure::AddSchematic(chemlib::MIMoleculeBase *mol,
@@ -118,23 +234,7 @@ bool SecondaryStructure::AddSchematic(chemlib::MIMoleculeBase *mol,
             (unsigned char)CLAMP(red, 0, 255),
             (unsigned char)CLAMP(green, 0, 255),
             (unsigned char)CLAMP(blue, 0, 255));
-        if (pNewRSeg->MakeRibbon(pSheet[i].first, nResidues))
-        {
-            if (m_pSheetLast == NULL)
-            {
-                m_pSheetList = pNewRSeg;
-            }
-            else
-            {
-                m_pSheetLast->m_pNext = pNewRSeg;
-            }
-            m_pSheetLast = pNewRSeg;
-        }
-        else
-        {
-            delete pNewRSeg;
-            //return false;
-        }
+        AddSegment(pNewRSeg, pSheet[i].first, nResidues, m_pSheetList, m_pSheetLast);
     }
 
     //Now do the turns
@@ -164,23 +264,7 @@ bool SecondaryStructure::AddSchematic(chemlib::MIMoleculeBase *mol,
             (unsigned char)CLAMP(green, 0, 255),
             (unsigned char)CLAMP(blue, 0, 255));
         pNewRSeg->SetColor(0, 0, 255);
-        if (pNewRSeg->MakeRibbon(pTurn[i].first, nResidues))
-        {
-            if (m_pTurnLast == NULL)
-            {
-                m_pTurnList = pNewRSeg;
-            }
-            else
-            {
-                m_pTurnLast->m_pNext = pNewRSeg;
-            }
-            m_pTurnLast = pNewRSeg;
-        }
-        else //Something wrong in MakeRibbon
-        {
-            //return false;
-            delete pNewRSeg;
-        }
+        AddSegment(pNewRSeg, pTurn[i].first, nResidues, m_pTurnList, m_pTurnLast);
     }
 
     //Now do the random coil
@@ -208,23 +292,7 @@ bool SecondaryStructure::AddSchematic(chemlib::MIMoleculeBase *mol,
             (unsigned char)CLAMP(red, 0, 255),
             (unsigned char)CLAMP(green, 0, 255),
             (unsigned char)CLAMP(blue, 0, 255));
-        if (pNewRSeg->MakeRibbon(pRandom[i].first, nResidues))
-        {
-            if (m_pRandomLast == NULL)
-            {
-                m_pRandomList = pNewRSeg;
-            }
-            else
-            {
-                m_pRandomLast->m_pNext = pNewRSeg;
-            }
-            m_pRandomLast = pNewRSeg;
-        }
-        else //Something wrong in MakeRibbon
-        {
-            //return false;
-            delete pNewRSeg;
-        }
+        AddSegment(pNewRSeg, pRandom[i].first, nResidues, m_pRandomList, m_pRandomLast);
     }
 
     return true;
@@ -252,6 +320,7 @@ bool SecondaryStructure::DeleteAllSchematic()
     {
         delete *pHelix;
     }
+    m_pHelixList.clear();
 
     RibbonSegment *pCurrRSeg = m_pSheetList;
     while (pCurrRSeg)
@@ -1,6 +1,8 @@
 #ifndef mifit_ui_SecondaryStructure_h
 #define mifit_ui_SecondaryStructure_h
 
+#include <map>
+#include <string>
 #include <vector>
 #include <utility>
 
@@ -27,10 +29,29 @@ public:
     bool DeleteAllRibbonSegments();
     bool DeleteAllSchematic();
 
+    /**
+     * Brackets adding the segments anew. A segment added in between takes
+     * over the spans of the one from before with the same first residue
+     * and profile wherever their control points are unchanged, so an edit
+     * to one loop of a chain remakes only the spans around it. EndUpdate
+     * makes the remaining spans, spread across threads, and drops the
+     * segments not added again.
+     */
+    void BeginUpdate();
+    void EndUpdate();
+
 private:
 
     friend class GLRenderer;
 
+    bool AddSegment(RibbonSegment *pNewRSeg, chemlib::Residue *pFirstResidue, int nResidues,
+                    RibbonSegment *&pList, RibbonSegment *&pLast);
+    void TakeSegments(RibbonSegment *&pList, RibbonSegment *&pLast);
+
+    bool m_bUpdating;
+    std::multimap<std::string, RibbonSegment*> m_previous;
+    std::vector<std::pair<RibbonSegment*, int> > m_pending;
+
     RibbonSegment *m_pRibbonSegmentList;
     RibbonSegment *m_pRibbonSegmentLast;
     std::vector<Helix*> m_pHelixList;
@@ -0,0 +1,582 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include <chemlib/chemlib.h>
+#include <map/maplib.h>
+#include <molopt/moloptlib.h>
+#include <util/parallel.h>
+
+#include "GeomRefiner.h"
+#include "Molecule.h"
+#include "ValidationReport.h"
+
+using namespace chemlib;
+
+namespace
+{
+    enum RestraintKind
+    {
+        BondRestraint,
+        AngleRestraint,
+        PlaneRestraint,
+        TorsionRestraint,
+        PhiPsiRestraint,
+        BumpRestraint
+    };
+
+    struct RestraintRef
+    {
+        RestraintKind kind;
+        int index;
+    };
+
+    typedef std::map<const MIAtom*, int> AtomResidueMap;
+
+    // Adds the restraint to each residue one of its atoms belongs to, so
+    // that every residue evaluates it and only writes to its own row.
+    void AddRestraint(std::vector<std::vector<RestraintRef> > &restraints, const AtomResidueMap &atomResidue,
+                      RestraintKind kind, int index, MIAtom *const *atoms, int natoms)
+    {
+        RestraintRef ref;
+        ref.kind = kind;
+        ref.index = index;
+        int last = -1;
+        for (int i = 0; i < natoms; ++i)
+        {
+            AtomResidueMap::const_iterator r = atomResidue.find(atoms[i]);
+            if (r == atomResidue.end() || r->second == last)
+            {
+                continue;
+            }
+            std::vector<RestraintRef> &list = restraints[r->second];
+            if (list.empty() || list.back().kind != kind || list.back().index != index)
+            {
+                list.push_back(ref);
+            }
+            last = r->second;
+        }
+    }
+
+    float TorsionDeviation(const TORSION &torsion)
+    {
+        float chi = (float)CalcAtomTorsion(torsion.getAtom1(), torsion.getAtom2(), torsion.atom3, torsion.atom4);
+        float dchi = 0.0f;
+        for (int j = 0; j < torsion.nideal; j++)
+        {
+            float d = torsion.ideal[j] - chi;
+            while (d < -180.0f)
+            {
+                d += 360.0f;
+            }
+            while (d > 180.0f)
+            {
+                d -= 360.0f;
+            }
+            if (j == 0 || fabs(d) < fabs(dchi))
+            {
+                dchi = d;
+            }
+        }
+        return (float)fabs(dchi);
+    }
+
+    bool HasDensity(const MIAtom *atom)
+    {
+        return atom->name()[0] != 'H' && atom->occ() > 0.00001f;
+    }
+
+    MIAtom *AtomByName(Residue *res, const char *name)
+    {
+        for (int i = 0; i < res->atomCount(); ++i)
+        {
+            if (!strcmp(res->atom(i)->name(), name))
+            {
+                return res->atom(i);
+            }
+        }
+        return NULL;
+    }
+
+    class ResidueValidator
+    {
+    public:
+        std::vector<ResidueValidation> &rows_;
+        std::vector<float> &correctedDensity_;
+        const std::vector<std::vector<RestraintRef> > &restraints_;
+        const std::vector<int> &previous_;
+        const std::vector<int> &next_;
+        const AtomResidueMap &atomResidue_;
+        MIMolDictionary &dict_;
+        EMapBase *map_;
+        const RamaTable *rama_;
+        float errorThreshold_;
+        float sigmaTorsion_;
+        float meanB_;
+        float resolutionB_;
+
+        ResidueValidator(std::vector<ResidueValidation> &rows, std::vector<float> &correctedDensity,
+                         const std::vector<std::vector<RestraintRef> > &restraints,
+                         const std::vector<int> &previous, const std::vector<int> &next,
+                         const AtomResidueMap &atomResidue, MIMolDictionary &dict,
+                         EMapBase *map, const RamaTable *rama, float errorThreshold, float meanB)
+            : rows_(rows),
+              correctedDensity_(correctedDensity),
+              restraints_(restraints),
+              previous_(previous),
+              next_(next),
+              atomResidue_(atomResidue),
+              dict_(dict),
+              map_(map),
+              rama_(rama),
+              errorThreshold_(errorThreshold),
+              sigmaTorsion_(dict.GetSigmaTorsion()),
+              meanB_(meanB),
+              resolutionB_(map ? map->ResolutionB() : 0.0f)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                geometry(i);
+                density(i);
+                ramachandran(i);
+            }
+        }
+
+    private:
+        void count(ResidueValidation &row, int &counter, float deviation)
+        {
+            if (deviation > row.worstDeviation)
+            {
+                row.worstDeviation = deviation;
+            }
+            if (deviation >= errorThreshold_)
+            {
+                counter++;
+            }
+        }
+
+        void geometry(int i)
+        {
+            ResidueValidation &row = rows_[i];
+            const std::vector<RestraintRef> &list = restraints_[i];
+            for (size_t k = 0; k < list.size(); ++k)
+            {
+                int n = list[k].index;
+                switch (list[k].kind)
+                {
+                case BondRestraint:
+                {
+                    const Bond &bond = dict_.RefiBonds[n];
+                    float d = (float)AtomDist(*bond.getAtom1(), *bond.getAtom2());
+                    count(row, row.badBonds, (float)fabs(bond.ideal_length - d)/bond.tolerance);
+                    break;
+                }
+                case AngleRestraint:
+                {
+                    const ANGLE &angle = dict_.RefiAngles[n];
+                    float d = (float)AtomDist(*angle.getAtom1(), *angle.atom3);
+                    count(row, row.badAngles, (float)fabs(angle.ideal_angle - d)/angle.tolerance);
+                    break;
+                }
+                case PlaneRestraint:
+                {
+                    // A plane spanning two residues is evaluated by both,
+                    // possibly at the same time, so fit a copy
+                    PLANE plane = dict_.RefiPlanes[n];
+                    lsqplane(plane);
+                    double dsum = 0.0;
+                    for (int j = 0; j < plane.natoms; j++)
+                    {
+                        MIAtom *a = plane.atoms[j];
+                        double d = a->x()*plane.vm[0] + a->y()*plane.vm[1] + a->z()*plane.vm[2] - plane.d;
+                        dsum += d*d;
+                    }
+                    float rms = (float)sqrt(dsum/(double)plane.natoms);
+                    count(row, row.badPlanes, rms/plane.tolerance);
+                    break;
+                }
+                case TorsionRestraint:
+                    count(row, row.badTorsions, TorsionDeviation(dict_.RefiTorsions[n])/sigmaTorsion_);
+                    break;
+                case PhiPsiRestraint:
+                    count(row, row.badTorsions, TorsionDeviation(dict_.RefiPhiPsis[n])/sigmaTorsion_);
+                    break;
+                case BumpRestraint:
+                {
+                    const Bond &bump = dict_.RefiBumps[n];
+                    MIAtom *atom1 = bump.getAtom1();
+                    MIAtom *atom2 = bump.getAtom2();
+                    if (atom1->altloc() != ' ' && atom2->altloc() != ' ')
+                    {
+                        break;
+                    }
+                    AtomResidueMap::const_iterator r1 = atomResidue_.find(atom1);
+                    AtomResidueMap::const_iterator r2 = atomResidue_.find(atom2);
+                    if ((atom1->altloc() != ' ' || atom2->altloc() != ' ')
+                        && r1 != atomResidue_.end() && r2 != atomResidue_.end() && r1->second == r2->second)
+                    {
+                        break;
+                    }
+                    float d = (float)AtomDist(*atom1, *atom2);
+                    count(row, row.bumps, (bump.ideal_length - d)/bump.tolerance);
+                    break;
+                }
+                }
+            }
+        }
+
+        void density(int i)
+        {
+            ResidueValidation &row = rows_[i];
+            Residue *res = row.residue;
+            MIAtomList atoms;
+            float rho = 0.0f;
+            float corrected = 0.0f;
+            for (int j = 0; j < res->atomCount(); ++j)
+            {
+                MIAtom *a = res->atom(j);
+                if (!HasDensity(a))
+                {
+                    continue;
+                }
+                atoms.push_back(a);
+                if (map_)
+                {
+                    float fx = a->x();
+                    float fy = a->y();
+                    float fz = a->z();
+                    map_->mapheader->CtoF(&fx, &fy, &fz);
+                    // The map is scaled to 50 per sigma; the peak height
+                    // of an atom falls as (B + Bresolution)^-3/2
+                    float atomRho = map_->avgrho(fx, fy, fz)/50.0f;
+                    rho += atomRho;
+                    corrected += atomRho*(float)pow((a->BValue() + resolutionB_)/(meanB_ + resolutionB_), 1.5);
+                }
+                row.meanB += a->BValue();
+            }
+            row.atoms = (int)atoms.size();
+            if (atoms.empty())
+            {
+                return;
+            }
+            row.meanB /= (float)atoms.size();
+            if (map_)
+            {
+                row.density = rho/(float)atoms.size();
+                correctedDensity_[i] = corrected/(float)atoms.size();
+                row.correlation = map_->LocalCorrelation(atoms, res);
+            }
+        }
+
+        void ramachandran(int i)
+        {
+            ResidueValidation &row = rows_[i];
+            if (previous_[i] < 0 || next_[i] < 0)
+            {
+                return;
+            }
+            Residue *res = row.residue;
+            MIAtom *Cprev = AtomByName(rows_[previous_[i]].residue, "C");
+            MIAtom *N = AtomByName(res, "N");
+            MIAtom *CA = AtomByName(res, "CA");
+            MIAtom *C = AtomByName(res, "C");
+            MIAtom *Nnext = AtomByName(rows_[next_[i]].residue, "N");
+            if (!Cprev || !N || !CA || !C || !Nnext)
+            {
+                return;
+            }
+            row.hasPhiPsi = true;
+            row.phi = (float)CalcAtomTorsion(Cprev, N, CA, C);
+            row.psi = (float)CalcAtomTorsion(N, CA, C, Nnext);
+            if (rama_ && rama_->IsLoaded())
+            {
+                RamaTable::ResidueClass residueClass = RamaTable::Classify(res->type(), rows_[next_[i]].type);
+                row.ramaRegion = RamaTable::RegionName(rama_->GetRegion(residueClass, row.phi, row.psi));
+            }
+        }
+    };
+
+    // Residues are peptide linked when they are in the same chain and the
+    // C-N distance is that of a bond
+    bool Linked(Residue *res, Residue *next)
+    {
+        if (res->chain_id() != next->chain_id())
+        {
+            return false;
+        }
+        MIAtom *C = AtomByName(res, "C");
+        MIAtom *N = AtomByName(next, "N");
+        return C && N && AtomDist(*C, *N) < 2.0;
+    }
+
+    std::string JSONString(const std::string &s)
+    {
+        std::string result = "\"";
+        for (size_t i = 0; i < s.size(); ++i)
+        {
+            if (s[i] == '"' || s[i] == '\\')
+            {
+                result += '\\';
+            }
+            result += s[i];
+        }
+        return result + "\"";
+    }
+}
+
+ValidationReport::ValidationReport()
+    : hasMap(false)
+{
+}
+
+bool ValidationReport::Build(Molecule *model, EMapBase *map, GeomRefiner *refiner, const RamaTable *rama,
+                             float errorThreshold)
+{
+    residues.clear();
+    hasMap = map != NULL && map->HasDensity();
+    if (!hasMap)
+    {
+        map = NULL;
+    }
+    if (!model || model->residuesBegin() == model->residuesEnd())
+    {
+        return false;
+    }
+    if (errorThreshold <= 0.0f)
+    {
+        errorThreshold = 6.0f;
+    }
+
+    AtomResidueMap atomResidue;
+    double sumB = 0.0;
+    int nB = 0;
+    for (ResidueListIterator ri = model->residuesBegin(); ri != model->residuesEnd(); ++ri)
+    {
+        Residue *res = ri;
+        ResidueValidation row;
+        row.residue = res;
+        row.chain = res->getChainId();
+        row.name = res->name();
+        row.type = res->type();
+        row.atoms = 0;
+        row.correlation = 0.0f;
+        row.density = 0.0f;
+        row.densityZ = 0.0f;
+        row.meanB = 0.0f;
+        row.badBonds = 0;
+        row.badAngles = 0;
+        row.badPlanes = 0;
+        row.badTorsions = 0;
+        row.bumps = 0;
+        row.worstDeviation = 0.0f;
+        row.hasPhiPsi = false;
+        row.phi = 0.0f;
+        row.psi = 0.0f;
+        for (int j = 0; j < res->atomCount(); ++j)
+        {
+            atomResidue[res->atom(j)] = (int)residues.size();
+            if (HasDensity(res->atom(j)))
+            {
+                sumB += res->atom(j)->BValue();
+                nB++;
+            }
+        }
+        residues.push_back(row);
+    }
+    int nres = (int)residues.size();
+    float meanB = nB > 0 ? (float)(sumB/nB) : 0.0f;
+
+    std::vector<int> previous(nres, -1);
+    std::vector<int> next(nres, -1);
+    for (int i = 0; i+1 < nres; ++i)
+    {
+        if (Linked(residues[i].residue, residues[i+1].residue))
+        {
+            next[i] = i+1;
+            previous[i+1] = i;
+        }
+    }
+
+    // Restraints come from the refiner set up over the whole model, as
+    // for FindGeomErrors
+    std::vector<std::vector<RestraintRef> > restraints(nres);
+    MIMolDictionary &dict = refiner->dict;
+    bool found_geom = false;
+    if (dict.EmptyDictCheck() && !refiner->IsRefining())
+    {
+        Logger::footer("Finding all geometry...");
+        found_geom = refiner->SetRefiRes(residues.front().residue, residues.back().residue, model) > 0;
+    }
+    for (size_t i = 0; i < dict.RefiBonds.size(); i++)
+    {
+        MIAtom *atoms[2] = { dict.RefiBonds[i].getAtom1(), dict.RefiBonds[i].getAtom2() };
+        AddRestraint(restraints, atomResidue, BondRestraint, (int)i, atoms, 2);
+    }
+    for (size_t i = 0; i < dict.RefiAngles.size(); i++)
+    {
+        MIAtom *atoms[3] = { dict.RefiAngles[i].getAtom1(), dict.RefiAngles[i].getAtom2(), dict.RefiAngles[i].atom3 };
+        AddRestraint(restraints, atomResidue, AngleRestraint, (int)i, atoms, 3);
+    }
+    for (size_t i = 0; i < dict.RefiPlanes.size(); i++)
+    {
+        if (dict.RefiPlanes[i].natoms > 0)
+        {
+            AddRestraint(restraints, atomResidue, PlaneRestraint, (int)i, dict.RefiPlanes[i].atoms, dict.RefiPlanes[i].natoms);
+        }
+    }
+    for (size_t i = 0; i < dict.RefiTorsions.size(); i++)
+    {
+        MIAtom *atoms[4] = { dict.RefiTorsions[i].getAtom1(), dict.RefiTorsions[i].getAtom2(), dict.RefiTorsions[i].atom3, dict.RefiTorsions[i].atom4 };
+        AddRestraint(restraints, atomResidue, TorsionRestraint, (int)i, atoms, 4);
+    }
+    // Phi-psi restraints come in fours: phi, psi, omega and omega prime.
+    // Phi and psi are classified from the Ramachandran tables instead.
+    for (size_t i = 0; i < dict.RefiPhiPsis.size(); i++)
+    {
+        if (i%4 >= 2)
+        {
+            MIAtom *atoms[4] = { dict.RefiPhiPsis[i].getAtom1(), dict.RefiPhiPsis[i].getAtom2(), dict.RefiPhiPsis[i].atom3, dict.RefiPhiPsis[i].atom4 };
+            AddRestraint(restraints, atomResidue, PhiPsiRestraint, (int)i, atoms, 4);
+        }
+    }
+    for (size_t i = 0; i < dict.RefiBumps.size(); i++)
+    {
+        MIAtom *atoms[2] = { dict.RefiBumps[i].getAtom1(), dict.RefiBumps[i].getAtom2() };
+        AddRestraint(restraints, atomResidue, BumpRestraint, (int)i, atoms, 2);
+    }
+
+    if (map)
+    {
+        map->PrepareDensityKernels();
+    }
+    std::vector<float> correctedDensity(nres, 0.0f);
+    Logger::footer("Validating residues...");
+    ResidueValidator validator(residues, correctedDensity, restraints, previous, next, atomResidue,
+                               dict, map, rama, errorThreshold, meanB);
+    MIParallelFor(0, nres, validator, 8);
+
+    if (found_geom)
+    {
+        refiner->Cancel();
+    }
+
+    if (map)
+    {
+        double sum = 0.0, sum2 = 0.0;
+        int n = 0;
+        for (int i = 0; i < nres; ++i)
+        {
+            if (residues[i].atoms > 0)
+            {
+                sum += correctedDensity[i];
+                sum2 += correctedDensity[i]*correctedDensity[i];
+                n++;
+            }
+        }
+        if (n > 1)
+        {
+            double mean = sum/n;
+            double sd = sqrt(std::max(sum2/n - mean*mean, 0.0));
+            for (int i = 0; i < nres; ++i)
+            {
+                if (residues[i].atoms > 0 && sd > 0.0)
+                {
+                    residues[i].densityZ = (float)((correctedDensity[i] - mean)/sd);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool ValidationReport::WriteCSV(const std::string &path) const
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp)
+    {
+        return false;
+    }
+    fprintf(fp, "chain,residue,type,atoms,rscc,density,density_z,mean_b,"
+                "bad_bonds,bad_angles,bad_planes,bad_torsions,bumps,worst_deviation,phi,psi,rama\n");
+    for (size_t i = 0; i < residues.size(); ++i)
+    {
+        const ResidueValidation &r = residues[i];
+        std::string chain = r.chain == ' ' ? std::string() : std::string(1, r.chain);
+        fprintf(fp, "%s,%s,%s,%d,", chain.c_str(), r.name.c_str(), r.type.c_str(), r.atoms);
+        if (hasMap)
+        {
+            fprintf(fp, "%0.3f,%0.3f,%0.2f,", r.correlation, r.density, r.densityZ);
+        }
+        else
+        {
+            fprintf(fp, ",,,");
+        }
+        fprintf(fp, "%0.2f,%d,%d,%d,%d,%d,%0.2f,", r.meanB, r.badBonds, r.badAngles, r.badPlanes,
+                r.badTorsions, r.bumps, r.worstDeviation);
+        if (r.hasPhiPsi)
+        {
+            fprintf(fp, "%0.1f,%0.1f,%s\n", r.phi, r.psi, r.ramaRegion.c_str());
+        }
+        else
+        {
+            fprintf(fp, ",,\n");
+        }
+    }
+    return fclose(fp) == 0;
+}
+
+bool ValidationReport::WriteJSON(const std::string &path) const
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp)
+    {
+        return false;
+    }
+    fprintf(fp, "[\n");
+    for (size_t i = 0; i < residues.size(); ++i)
+    {
+        const ResidueValidation &r = residues[i];
+        std::string chain = r.chain == ' ' ? std::string() : std::string(1, r.chain);
+        fprintf(fp, "  {\"chain\": %s, \"residue\": %s, \"type\": %s, \"atoms\": %d, ",
+                JSONString(chain).c_str(), JSONString(r.name).c_str(), JSONString(r.type).c_str(), r.atoms);
+        if (hasMap)
+        {
+            fprintf(fp, "\"rscc\": %0.3f, \"density\": %0.3f, \"density_z\": %0.2f, ",
+                    r.correlation, r.density, r.densityZ);
+        }
+        else
+        {
+            fprintf(fp, "\"rscc\": null, \"density\": null, \"density_z\": null, ");
+        }
+        fprintf(fp, "\"mean_b\": %0.2f, \"bad_bonds\": %d, \"bad_angles\": %d, \"bad_planes\": %d, "
+                    "\"bad_torsions\": %d, \"bumps\": %d, \"worst_deviation\": %0.2f, ",
+                r.meanB, r.badBonds, r.badAngles, r.badPlanes, r.badTorsions, r.bumps, r.worstDeviation);
+        if (r.hasPhiPsi)
+        {
+            fprintf(fp, "\"phi\": %0.1f, \"psi\": %0.1f, \"rama\": %s}",
+                    r.phi, r.psi, r.ramaRegion.empty() ? "null" : JSONString(r.ramaRegion).c_str());
+        }
+        else
+        {
+            fprintf(fp, "\"phi\": null, \"psi\": null, \"rama\": null}");
+        }
+        fprintf(fp, i+1 < residues.size() ? ",\n" : "\n");
+    }
+    fprintf(fp, "]\n");
+    return fclose(fp) == 0;
+}
+
+bool ValidationReport::Write(const std::string &path) const
+{
+    if (path.size() >= 5 && path.compare(path.size()-5, 5, ".json") == 0)
+    {
+        return WriteJSON(path);
+    }
+    return WriteCSV(path);
+}
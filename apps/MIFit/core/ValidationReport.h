@@ -0,0 +1,88 @@
+#ifndef MIFIT_VALIDATION_REPORT_H
+#define MIFIT_VALIDATION_REPORT_H
+
+#include <string>
+#include <vector>
+
+#include <chemlib/chemlib.h>
+
+class EMapBase;
+class GeomRefiner;
+class Molecule;
+class RamaTable;
+
+//@{
+// Density fit and geometry of one residue of a model.
+//@}
+struct ResidueValidation
+{
+    chemlib::Residue *residue;
+    char chain;
+    std::string name;
+    std::string type;
+    int atoms;
+
+    //@{
+    // Real-space correlation with the map, the mean density at the atoms
+    // in map sigmas and the Z-score of that density among the residues
+    // of the model after each atom's density is corrected for its
+    // B-factor. Zero when there is no map.
+    //@}
+    float correlation;
+    float density;
+    float densityZ;
+    float meanB;
+
+    //@{
+    // Restraints of the residue deviating by at least the error threshold
+    // times their tolerance, and the largest deviation in tolerances.
+    //@}
+    int badBonds;
+    int badAngles;
+    int badPlanes;
+    int badTorsions;
+    int bumps;
+    float worstDeviation;
+
+    //@{
+    // Backbone torsions in degrees and their Ramachandran region; the
+    // region is empty for residues without both neighbors.
+    //@}
+    bool hasPhiPsi;
+    float phi;
+    float psi;
+    std::string ramaRegion;
+};
+
+//@{
+// Per-residue validation of a whole model against a map and the
+// dictionary restraints, computed in one parallel pass over the residues.
+//@}
+class ValidationReport
+{
+public:
+    std::vector<ResidueValidation> residues;
+    bool hasMap;
+
+    ValidationReport();
+
+    //@{
+    // Replaces the report with the validation of the model against the
+    // restraints of the refiner's dictionary. The map and the
+    // Ramachandran tables may be NULL, in which case the density and
+    // Ramachandran columns are left empty. Returns false if the model has
+    // no residues.
+    //@}
+    bool Build(Molecule *model, EMapBase *map, GeomRefiner *refiner, const RamaTable *rama,
+               float errorThreshold = 6.0f);
+
+    bool WriteCSV(const std::string &path) const;
+    bool WriteJSON(const std::string &path) const;
+
+    //@{
+    // Writes CSV unless the file name ends in .json.
+    //@}
+    bool Write(const std::string &path) const;
+};
+
+#endif // ifndef MIFIT_VALIDATION_REPORT_H
@@ -1,11 +1,120 @@
+#include <algorithm>
+#include <cmath>
+
 #include <util/utillib.h>
 #include <chemlib/Monomer.h>
+#include <map/maplib.h>
 
 #include "clusterList.h"
 
 using namespace chemlib;
 using namespace std;
 
+namespace
+{
+    int FindRoot(vector<int> &parent, int i)
+    {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    // Joins the sets of i and j keeping the smaller root so that a set is
+    // named by its first atom
+    void Unite(vector<int> &parent, int i, int j)
+    {
+        i = FindRoot(parent, i);
+        j = FindRoot(parent, j);
+        if (i < j)
+        {
+            parent[j] = i;
+        }
+        else if (j < i)
+        {
+            parent[i] = j;
+        }
+    }
+
+    bool MoreDensity(const Cluster &a, const Cluster &b)
+    {
+        return a.integrated > b.integrated;
+    }
+
+    // Sums the map points at or above level within radius of the atoms.
+    // Each point is counted once however many atoms it is near.
+    void MeasureCluster(Cluster &cluster, EMapBase *map, float level, float radius)
+    {
+        CMapHeaderBase *mh = map->mapheader;
+        int nx = mh->nx, ny = mh->ny, nz = mh->nz;
+        float (*f)[3] = mh->ftoc;
+        double cellVolume = f[0][0]*(f[1][1]*f[2][2]-f[1][2]*f[2][1])
+                            - f[0][1]*(f[1][0]*f[2][2]-f[1][2]*f[2][0])
+                            + f[0][2]*(f[1][0]*f[2][1]-f[1][1]*f[2][0]);
+        float voxel = (float)(fabs(cellVolume)/((double)nx*ny*nz));
+        int n[3] = { nx, ny, nz };
+        float span[3];
+        for (int d = 0; d < 3; ++d)
+        {
+            span[d] = radius*sqrt(mh->ctof[d][0]*mh->ctof[d][0] + mh->ctof[d][1]*mh->ctof[d][1]
+                                  + mh->ctof[d][2]*mh->ctof[d][2]);
+        }
+        float r2 = radius*radius;
+        vector<int> points;
+        for (size_t i = 0; i < cluster.atoms.size(); ++i)
+        {
+            MIAtom *atom = cluster.atoms[i];
+            float c[3] = { atom->x(), atom->y(), atom->z() };
+            mh->CtoF(&c[0], &c[1], &c[2]);
+            int lo[3], hi[3];
+            for (int d = 0; d < 3; ++d)
+            {
+                lo[d] = (int)ceil((c[d] - span[d])*n[d]);
+                hi[d] = (int)floor((c[d] + span[d])*n[d]);
+            }
+            for (int iz = lo[2]; iz <= hi[2]; ++iz)
+            {
+                for (int iy = lo[1]; iy <= hi[1]; ++iy)
+                {
+                    for (int ix = lo[0]; ix <= hi[0]; ++ix)
+                    {
+                        float x = (float)ix/nx, y = (float)iy/ny, z = (float)iz/nz;
+                        mh->FtoC(&x, &y, &z);
+                        float dx = x - atom->x(), dy = y - atom->y(), dz = z - atom->z();
+                        if (dx*dx + dy*dy + dz*dz <= r2)
+                        {
+                            points.push_back(map->mapdex(ix, iy, iz));
+                        }
+                    }
+                }
+            }
+        }
+        sort(points.begin(), points.end());
+        points.erase(unique(points.begin(), points.end()), points.end());
+
+        int count = 0;
+        cluster.peak = 0.0f;
+        cluster.integrated = 0.0f;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            int ix = points[i]%nx;
+            int iy = (points[i]/nx)%ny;
+            int iz = points[i]/(nx*ny);
+            float rho = map->avgrho((float)ix/nx, (float)iy/ny, (float)iz/nz);
+            if (rho < level)
+            {
+                continue;
+            }
+            ++count;
+            cluster.peak = max(cluster.peak, rho/50.0f);
+            cluster.integrated += rho/50.0f*voxel;
+        }
+        cluster.volume = count*voxel;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////
 // Construction/Destruction
 //////////////////////////////////////////////////////////////////////
@@ -20,14 +129,11 @@ ClusterList::~ClusterList()
 
 }
 
-Residue*ClusterList::BuildClusters(Residue *first, Residue *last, int min_size)
+Residue*ClusterList::BuildClusters(Residue *first, Residue *last, int min_size, EMapBase *map, float level)
 {
     vector<MIAtom*> atom_list;
     Residue *res = first;
-    MIAtom *a1, *a2;
     unsigned int i, j;
-    int found, more;
-    Cluster cluster;
     if (last != NULL)
     {
         last = last->next();
@@ -44,48 +150,133 @@ Residue*ClusterList::BuildClusters(Residue *first, Residue *last, int min_size)
     {
         return 0;
     }
+    clusters.clear();
 
+    // Bin the atoms into cells dmax wide so that linked atoms are in the
+    // same or adjacent cells, keeping the grid no larger than needed.
+    int natoms = (int)atom_list.size();
+    float lo[3] = { atom_list[0]->x(), atom_list[0]->y(), atom_list[0]->z() };
+    float hi[3] = { lo[0], lo[1], lo[2] };
+    for (i = 1; i < atom_list.size(); i++)
+    {
+        float c[3] = { atom_list[i]->x(), atom_list[i]->y(), atom_list[i]->z() };
+        for (int d = 0; d < 3; ++d)
+        {
+            lo[d] = min(lo[d], c[d]);
+            hi[d] = max(hi[d], c[d]);
+        }
+    }
+    float cellSize = max(dmax, 0.1F);
+    int dims[3];
+    size_t ncells;
     do
     {
-        a1 = atom_list[0];
-        cluster.atoms.push_back(a1);
-        atom_list.erase(atom_list.begin());
-        do
+        ncells = 1;
+        for (int d = 0; d < 3; ++d)
         {
-            i = 0;
-            found = 0;
-            while (i < atom_list.size())
+            dims[d] = (int)((hi[d] - lo[d])/cellSize) + 1;
+            ncells *= dims[d];
+        }
+        if (ncells > 8*atom_list.size() + 64)
+        {
+            cellSize *= 2.0F;
+        }
+    } while (ncells > 8*atom_list.size() + 64);
+
+    vector<int> cellOf(natoms);
+    vector<int> cellStart(ncells+1, 0);
+    for (int a = 0; a < natoms; ++a)
+    {
+        int cx = (int)((atom_list[a]->x() - lo[0])/cellSize);
+        int cy = (int)((atom_list[a]->y() - lo[1])/cellSize);
+        int cz = (int)((atom_list[a]->z() - lo[2])/cellSize);
+        cellOf[a] = (cz*dims[1] + cy)*dims[0] + cx;
+        cellStart[cellOf[a]+1]++;
+    }
+    for (size_t c = 0; c < ncells; ++c)
+    {
+        cellStart[c+1] += cellStart[c];
+    }
+    vector<int> cellAtoms(natoms);
+    vector<int> fill(cellStart.begin(), cellStart.end()-1);
+    for (int a = 0; a < natoms; ++a)
+    {
+        cellAtoms[fill[cellOf[a]]++] = a;
+    }
+
+    vector<int> parent(natoms);
+    for (int a = 0; a < natoms; ++a)
+    {
+        parent[a] = a;
+    }
+    float dmax2 = dmax*dmax;
+    for (int a = 0; a < natoms; ++a)
+    {
+        MIAtom *a1 = atom_list[a];
+        int c = cellOf[a];
+        int cx = c%dims[0];
+        int cy = (c/dims[0])%dims[1];
+        int cz = c/(dims[0]*dims[1]);
+        for (int z = max(cz-1, 0); z <= min(cz+1, dims[2]-1); ++z)
+        {
+            for (int y = max(cy-1, 0); y <= min(cy+1, dims[1]-1); ++y)
             {
-                a2 = atom_list[i];
-                more = 0;
-                for (j = 0; j < cluster.atoms.size(); j++)
+                for (int x = max(cx-1, 0); x <= min(cx+1, dims[0]-1); ++x)
                 {
-                    a1 = cluster.atoms[j];
-                    if (AtomDist(*a1, *a2) < dmax)
+                    int cell = (z*dims[1] + y)*dims[0] + x;
+                    for (int k = cellStart[cell]; k < cellStart[cell+1]; ++k)
                     {
-                        cluster.atoms.push_back(a2);
-                        atom_list.erase(atom_list.begin()+i);
-                        found++;
-                        more++;
-                        break;
+                        int b = cellAtoms[k];
+                        if (b <= a)
+                        {
+                            continue;
+                        }
+                        MIAtom *a2 = atom_list[b];
+                        float dx = a1->x() - a2->x();
+                        float dy = a1->y() - a2->y();
+                        float dz = a1->z() - a2->z();
+                        if (dx*dx + dy*dy + dz*dz < dmax2)
+                        {
+                            Unite(parent, a, b);
+                        }
                     }
                 }
-                if (more > 0)
-                {
-                    i = 0;
-                }
-                else
-                {
-                    i++;
-                }
             }
-        } while (found > 0);
-        if ((int)cluster.atoms.size() > min_size)
+        }
+    }
+
+    // Roots are the first atoms of their sets, so numbering the sets as
+    // their roots are met keeps the clusters in order of their first atoms
+    vector<int> setOf(natoms, -1);
+    vector<Cluster> sets;
+    for (int a = 0; a < natoms; ++a)
+    {
+        int root = FindRoot(parent, a);
+        if (setOf[root] < 0)
         {
-            clusters.push_back(cluster);
+            setOf[root] = (int)sets.size();
+            sets.push_back(Cluster());
         }
-        cluster.atoms.clear();
-    } while (atom_list.size() > 0);
+        sets[setOf[root]].atoms.push_back(atom_list[a]);
+    }
+    for (i = 0; i < sets.size(); i++)
+    {
+        if ((int)sets[i].atoms.size() > min_size)
+        {
+            clusters.push_back(Cluster());
+            clusters.back().atoms.swap(sets[i].atoms);
+        }
+    }
+    if (map != NULL && map->HasDensity())
+    {
+        // A point within half the link distance of atoms of two clusters
+        // would have linked them, so no point is counted twice
+        for (i = 0; i < clusters.size(); i++)
+        {
+            MeasureCluster(clusters[i], map, level, dmax/2.0F);
+        }
+        stable_sort(clusters.begin(), clusters.end(), MoreDensity);
+    }
 
     Residue *reslist = NULL, *newres;
     int color = 1;
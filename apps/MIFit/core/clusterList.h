@@ -3,10 +3,27 @@
 
 #include <chemlib/chemlib.h>
 
+class EMapBase;
+
 class Cluster
 {
 public:
     std::vector<chemlib::MIAtom*> atoms;
+    //@{
+    // Volume in cubic Angstroms of the map points above the contour level
+    // near the atoms, the highest density among them in sigmas and their
+    // density summed over the volume. Zero if no map was given.
+    //@}
+    float volume;
+    float peak;
+    float integrated;
+
+    Cluster()
+        : volume(0.0f),
+          peak(0.0f),
+          integrated(0.0f)
+    {
+    }
 };
 
 class ClusterList
@@ -19,6 +36,11 @@ public:
         return clusters.size();
     }
 
+    const Cluster &operator[](size_t i) const
+    {
+        return clusters[i];
+    }
+
     float GetMaxDistance()
     {
         return dmax;
@@ -29,7 +51,16 @@ public:
         dmax = d;
     }
 
-    chemlib::Residue *BuildClusters(chemlib::Residue *first, chemlib::Residue *last = NULL, int min_size = 5);
+    //@{
+    // Groups the atoms of the residues from first to last into clusters of
+    // atoms linked by distances under the maximum distance and returns a
+    // residue for each cluster of more than min_size atoms. Given a map,
+    // the clusters are measured against it at the level, in map units,
+    // and ranked by integrated density; otherwise they are in the order
+    // of their first atoms.
+    //@}
+    chemlib::Residue *BuildClusters(chemlib::Residue *first, chemlib::Residue *last = NULL, int min_size = 5,
+                                    EMapBase *map = NULL, float level = 50.0F);
     ClusterList();
     virtual ~ClusterList();
 
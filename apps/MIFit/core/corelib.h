@@ -25,6 +25,7 @@
 #include "Stack.h"
 #include "SurfaceSphere.h"
 #include "SURFDOT.h"
+#include "ValidationReport.h"
 #include "Version.h"
 #include "ViewPoint.h"
 #include "xmlarchive.h"
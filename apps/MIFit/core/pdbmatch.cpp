@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <climits>
+#include <map>
+
 #include <chemlib/chemlib.h>
 #include <chemlib/Monomer.h>
 #include "corelib.h"
@@ -39,12 +43,6 @@ int atomvector(const MIAtom *atom1, const MIAtom *atom2)
     return ((int)d);
 }
 
-int hcompare(const void *i, const void *j)
-{
-    hit *hj = (hit*)j;
-    hit *hi = (hit*)i;
-    return (hj->sum - hi->sum);
-}
 
 
 static void copya(double a[3], MIAtom *atom)
@@ -56,16 +54,7 @@ static void copya(double a[3], MIAtom *atom)
 
 Residue *pdbvec(std::string &pentdir, const MIAtomList &CA, const MIAtomList &CB)
 {
-    FILE *fvec;
-    std::string vectorfile = pentdir + "/pdbvec.list";
-    if ((fvec = fopen(vectorfile.c_str(), "r")) == NULL)
-    {
-        Logger::message("Error: Unable to find pdbvec.list in data directory - incorrect installation?");
-        return NULL;
-    }
-
-    Residue *hit = matchvec(CA, CB, pentdir, fvec);
-    fclose(fvec);
+    Residue *hit = matchvec(CA, CB, pentdir);
     if (!hit)
     {
         return NULL;
@@ -326,25 +315,358 @@ static MIAtom *scan_atom(const char *linebuf)
 #define MAXHITS 1
 #define column(n) (buf+(n)-1)
 
-Residue *matchvec(const MIAtomList &CA, const MIAtomList &CB, std::string &pentdir, FILE *fvec)
+namespace
+{
+    const int NPENTVEC = 12;
+
+    //@{
+    // One pentamer of pdbvec.list: its CA/CB distance signature (in
+    // hundredths of an Angstrom) and where to find it.
+    //@}
+    struct PentamerEntry
+    {
+        int v[NPENTVEC];
+        int penalty;            // 40 for each GLY or PRO in the sequence
+        int astart, aend;
+        char rchain;
+        int file;
+    };
+
+    //@{
+    // Node of the k-d tree over the signatures. Each node keeps the bounding
+    // box of its entries so that a search can skip whole subtrees.
+    //@}
+    struct PentamerNode
+    {
+        int begin, end;         // range in PentamerIndex::order
+        int left, right;        // child nodes, -1 for a leaf
+        int minPenalty;
+        int minEntry;           // lowest line order, for ties
+        int lo[NPENTVEC], hi[NPENTVEC];
+    };
+
+    //@{
+    // In-memory index of data/pdbvec. Parsed once per session and then
+    // searched with a k-d tree. The PDB fragment files are read on first
+    // use and kept.
+    //@}
+    class PentamerIndex
+    {
+    public:
+        bool Load(const std::string &pentdir);
+        const std::string &Directory() const
+        {
+            return pentdir;
+        }
+
+        int Size() const
+        {
+            return (int)entries.size();
+        }
+
+        //@{
+        // Finds the entry with the lowest matchvec score, the first in file
+        // order among equals. Only the signature elements flagged in use
+        // take part, as with the linear scan it replaces.
+        //@}
+        int Best(const int query[NPENTVEC], const bool use[NPENTVEC], int &score) const;
+
+        const PentamerEntry &Entry(int i) const
+        {
+            return entries[i];
+        }
+
+        const std::string &FileName(int file) const
+        {
+            return files[file];
+        }
+
+        const std::vector<std::string> *FileLines(int file);
+
+    private:
+        enum { LEAF_SIZE = 8 };
+
+        std::string pentdir;
+        std::vector<PentamerEntry> entries;
+        std::vector<int> order;
+        std::vector<PentamerNode> nodes;
+        std::vector<std::string> files;
+        std::map<int, std::vector<std::string> > fileLines;
+
+        int Build(int begin, int end);
+        void Search(int node, const int query[NPENTVEC], const bool use[NPENTVEC], int nuse,
+                    int &best, int &bestEntry) const;
+    };
+
+    struct PentamerDimLess
+    {
+        const std::vector<PentamerEntry> &entries;
+        int dim;
+        PentamerDimLess(const std::vector<PentamerEntry> &e, int d)
+            : entries(e),
+              dim(d)
+        {
+        }
+
+        bool operator()(int a, int b) const
+        {
+            return entries[a].v[dim] < entries[b].v[dim];
+        }
+    };
+
+    bool PentamerIndex::Load(const std::string &dir)
+    {
+        std::string vectorfile = dir + "/pdbvec.list";
+        FILE *fvec = fopen(vectorfile.c_str(), "r");
+        if (fvec == NULL)
+        {
+            return false;
+        }
+        pentdir = dir;
+        entries.clear();
+        files.clear();
+        fileLines.clear();
+
+        char buf[1024];
+        char file[1024];
+        char seq[10];
+        int n;
+        PentamerEntry e;
+        memset(&e, 0, sizeof(e));
+        while (fgets(buf, sizeof(buf), fvec) != NULL)
+        {
+            if (!strncmp(buf, "START", 5))
+            {
+                sscanf(buf, "%*s%s", file);
+                files.push_back(file);
+                continue;
+            }
+            // as in the original scan, a short line keeps the previous values
+            sscanf(buf, "%d%d%d%d%d%d%d%d%d%d%d%d%d", &n, &e.v[0], &e.v[1], &e.v[2], &e.v[3], &e.v[4], &e.v[5],
+                   &e.v[6], &e.v[7], &e.v[8], &e.v[9], &e.v[10], &e.v[11]);
+            seq[0] = '\0';
+            sscanf(buf, "%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%d%d %c %9s", &e.astart, &e.aend, &e.rchain, seq);
+            e.penalty = 0;
+            for (int is = 0; is < 5 && seq[is] != '\0'; is++)
+            {
+                if (seq[is] == 'G' || seq[is] == 'P')
+                {
+                    e.penalty += 40;
+                }
+            }
+            e.file = (int)files.size() - 1;
+            if (e.file < 0)
+            {
+                continue;
+            }
+            entries.push_back(e);
+        }
+        fclose(fvec);
+
+        order.resize(entries.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = (int)i;
+        }
+        nodes.clear();
+        if (!entries.empty())
+        {
+            Build(0, (int)entries.size());
+        }
+        return !entries.empty();
+    }
+
+    int PentamerIndex::Build(int begin, int end)
+    {
+        int index = (int)nodes.size();
+        nodes.push_back(PentamerNode());
+        PentamerNode node;
+        node.begin = begin;
+        node.end = end;
+        node.left = node.right = -1;
+        node.minPenalty = INT_MAX;
+        node.minEntry = INT_MAX;
+        for (int d = 0; d < NPENTVEC; ++d)
+        {
+            node.lo[d] = INT_MAX;
+            node.hi[d] = INT_MIN;
+        }
+        for (int i = begin; i < end; ++i)
+        {
+            const PentamerEntry &e = entries[order[i]];
+            node.minPenalty = std::min(node.minPenalty, e.penalty);
+            node.minEntry = std::min(node.minEntry, order[i]);
+            for (int d = 0; d < NPENTVEC; ++d)
+            {
+                node.lo[d] = std::min(node.lo[d], e.v[d]);
+                node.hi[d] = std::max(node.hi[d], e.v[d]);
+            }
+        }
+        if (end - begin > LEAF_SIZE)
+        {
+            int split = 0;
+            for (int d = 1; d < NPENTVEC; ++d)
+            {
+                if (node.hi[d] - node.lo[d] > node.hi[split] - node.lo[split])
+                {
+                    split = d;
+                }
+            }
+            int mid = (begin + end)/2;
+            std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                             PentamerDimLess(entries, split));
+            node.left = Build(begin, mid);
+            node.right = Build(mid, end);
+        }
+        nodes[index] = node;
+        return index;
+    }
+
+    void PentamerIndex::Search(int inode, const int query[NPENTVEC], const bool use[NPENTVEC], int nuse,
+                               int &best, int &bestEntry) const
+    {
+        const PentamerNode &node = nodes[inode];
+        // lower bound of the score of anything in this box
+        int bound = 0;
+        for (int d = 0; d < NPENTVEC; ++d)
+        {
+            if (!use[d])
+            {
+                continue;
+            }
+            int q = query[d];
+            int dd = q < node.lo[d] ? node.lo[d] - q : (q > node.hi[d] ? q - node.hi[d] : 0);
+            bound += dd*dd;
+        }
+        bound = bound/nuse + node.minPenalty;
+        if (bound > best || (bound == best && node.minEntry > bestEntry))
+        {
+            return;
+        }
+
+        if (node.left < 0)
+        {
+            for (int i = node.begin; i < node.end; ++i)
+            {
+                const PentamerEntry &e = entries[order[i]];
+                int d = 0;
+                for (int k = 0; k < NPENTVEC; ++k)
+                {
+                    if (use[k])
+                    {
+                        d += (query[k] - e.v[k])*(query[k] - e.v[k]);
+                    }
+                }
+                d = d/nuse + e.penalty;
+                if (d < best || (d == best && order[i] < bestEntry))
+                {
+                    best = d;
+                    bestEntry = order[i];
+                }
+            }
+            return;
+        }
+
+        // descend into the child whose box is nearer the query first
+        int first = node.left, second = node.right;
+        const PentamerNode &l = nodes[node.left];
+        const PentamerNode &r = nodes[node.right];
+        int dl = 0, dr = 0;
+        for (int d = 0; d < NPENTVEC; ++d)
+        {
+            if (use[d])
+            {
+                int q = query[d];
+                int a = q < l.lo[d] ? l.lo[d] - q : (q > l.hi[d] ? q - l.hi[d] : 0);
+                int b = q < r.lo[d] ? r.lo[d] - q : (q > r.hi[d] ? q - r.hi[d] : 0);
+                dl += a*a;
+                dr += b*b;
+            }
+        }
+        if (dr < dl)
+        {
+            std::swap(first, second);
+        }
+        Search(first, query, use, nuse, best, bestEntry);
+        Search(second, query, use, nuse, best, bestEntry);
+    }
+
+    int PentamerIndex::Best(const int query[NPENTVEC], const bool use[NPENTVEC], int &score) const
+    {
+        int nuse = 0;
+        for (int d = 0; d < NPENTVEC; ++d)
+        {
+            if (use[d])
+            {
+                nuse++;
+            }
+        }
+        int bestEntry = INT_MAX;
+        score = 9999999;
+        if (!nodes.empty() && nuse > 0)
+        {
+            Search(0, query, use, nuse, score, bestEntry);
+        }
+        return bestEntry == INT_MAX ? -1 : bestEntry;
+    }
+
+    const std::vector<std::string> *PentamerIndex::FileLines(int file)
+    {
+        std::map<int, std::vector<std::string> >::iterator cached = fileLines.find(file);
+        if (cached != fileLines.end())
+        {
+            return &cached->second;
+        }
+        std::string path = pentdir + "/" + files[file];
+        FILE *fpdb = fopen(path.c_str(), "r");
+        if (!fpdb)
+        {
+            return NULL;
+        }
+        std::vector<std::string> &lines = fileLines[file];
+        char buf[1024];
+        while (fgets(buf, sizeof(buf), fpdb) != NULL)
+        {
+            if (!strncmp("ATOM", buf, 4))
+            {
+                lines.push_back(buf);
+            }
+        }
+        fclose(fpdb);
+        return &lines;
+    }
+
+    PentamerIndex *GetPentamerIndex(const std::string &pentdir)
+    {
+        static PentamerIndex *index = NULL;
+        if (index != NULL && index->Directory() == pentdir)
+        {
+            return index;
+        }
+        PentamerIndex *newIndex = new PentamerIndex;
+        if (!newIndex->Load(pentdir))
+        {
+            delete newIndex;
+            return NULL;
+        }
+        delete index;
+        index = newIndex;
+        return index;
+    }
+}
+
+Residue *matchvec(const MIAtomList &CA, const MIAtomList &CB, std::string &pentdir)
 {
-    FILE *fpdb;
-    int nvec = 0, i, n, d, best = 9999999;
-    //int noCB = false;
+    int i, n;
     MIAtom *a1, *a2, *a3, *a4, *a5;
     MIAtom *b1, *b2, *b3, *b4, *b5;
-    char file[1024];
     hit top[MAXHITS];
     char buf[1024];
-    char seq[10];
     int found;
-    int d1 = 0, d2 = 0, d3 = 0, d4 = 0, d5 = 0, d6 = 0;
-    int d7 = 0, d8 = 0, d9 = 0, d10 = 0, d11 = 0, d12 = 0;
-    int v1 = 0, v2 = 0, v3 = 0, v4 = 0, v5 = 0, v6 = 0;
-    int v7 = 0, v8 = 0, v9 = 0, v10 = 0, v11 = 0, v12 = 0;
-    int is;
-    char rchain, chain;
-    int atomnumber, astart, aend;
+    int d[NPENTVEC];
+    bool use[NPENTVEC];
+    char chain;
+    int atomnumber;
 
     if (CA.size() < 4 || CB.size() < 4)
     {
@@ -352,6 +674,13 @@ Residue *matchvec(const MIAtomList &CA, const MIAtomList &CB, std::string &pentd
         return NULL;
     }
 
+    PentamerIndex *index = GetPentamerIndex(pentdir);
+    if (index == NULL)
+    {
+        Logger::message("Error: Unable to find pdbvec.list in data directory - incorrect installation?");
+        return NULL;
+    }
+
     for (i = 0; i < MAXHITS; i++)
     {
         top[i].sum = 9999999;
@@ -372,119 +701,62 @@ Residue *matchvec(const MIAtomList &CA, const MIAtomList &CB, std::string &pentd
     b3 = CB[2];
     b4 = CB[3];
     b5 = CB[4];
-    /* if no CB's at all then we switch how we do match */
-    //if( !b1 && !b2 && !b3 && !b4 && !b5)noCB = true;
-    /* if no CB (i.e. GLY) use CA instead */
-    //if(b1 == NULL)b1=a1;
-    //if(b2 == NULL)b2=a2;
-    //if(b3 == NULL)b3=a3;
-    //if(b4 == NULL)b4=a4;
-    //if(b5 == NULL)b5=a5;
-    d1 = atomvector(a1, a3);
-    d2 = atomvector(a1, a4);
-    d3 = atomvector(a1, a5);
-    d4 = atomvector(a2, a4);
-    d5 = atomvector(a2, a5);
-    d6 = atomvector(a3, a5);
-    //if( !noCB){
+    for (i = 0; i < NPENTVEC; i++)
+    {
+        d[i] = 0;
+    }
+    d[0] = atomvector(a1, a3);
+    d[1] = atomvector(a1, a4);
+    d[2] = atomvector(a1, a5);
+    d[3] = atomvector(a2, a4);
+    d[4] = atomvector(a2, a5);
+    d[5] = atomvector(a3, a5);
     if (b1 && b2)
     {
-        d7 = atomvector(b1, b2);
+        d[6] = atomvector(b1, b2);
     }
     if (b5 && b3)
     {
-        d8 = atomvector(b5, b3);
+        d[7] = atomvector(b5, b3);
     }
     if (b2 && a4)
     {
-        d9 = atomvector(b2, a4);
+        d[8] = atomvector(b2, a4);
     }
     if (b3 && a1)
     {
-        d10 = atomvector(b3, a1);
+        d[9] = atomvector(b3, a1);
     }
     if (b3 && a5)
     {
-        d11 = atomvector(b3, a5);
+        d[10] = atomvector(b3, a5);
     }
     if (b4 && a2)
     {
-        d12 = atomvector(b4, a2);
+        d[11] = atomvector(b4, a2);
     }
-    //}
-    while (fgets(buf, 1024, fvec) != NULL)
+    // the first five distances always count, the rest only if present
+    for (i = 0; i < NPENTVEC; i++)
     {
-        if (!strncmp(buf, "START", 5))
-        {
-            sscanf(buf, "%*s%s", file);
-            continue;
-        }
-        sscanf(buf, "%d%d%d%d%d%d%d%d%d%d%d%d%d", &n, &v1, &v2, &v3, &v4, &v5, &v6, &v7, &v8, &v9, &v10, &v11, &v12);
-        d =  (d1-v1)*(d1-v1);
-        d += (d2-v2)*(d2-v2);
-        d += (d3-v3)*(d3-v3);
-        d += (d4-v4)*(d4-v4);
-        d += (d5-v5)*(d5-v5);
-        int n = 5;
-        //if( !noCB){
-        if (d6 != 0)
-        {
-            d += (d6-v6)*(d6-v6);
-            n++;
-        }
-        /* non-use of d7 is deliberate */
-        if (d8 != 0)
-        {
-            d += (d8-v8)*(d8-v8);
-            n++;
-        }
-        if (d9 != 0)
-        {
-            d += (d9-v9)*(d9-v9);
-            n++;
-        }
-        if (d10 != 0)
-        {
-            d += (d10-v10)*(d10-v10);
-            n++;
-        }
-        if (d11 != 0)
-        {
-            d += (d11-v11)*(d11-v11);
-            n++;
-        }
-        if (d12 != 0)
-        {
-            d += (d12-v12)*(d12-v12);
-            n++;
-        }
-        d /= n;
-        //}
-        /* if no CB's then
-         * calculate gly,pro penalty see if still best */
-        sscanf(buf, "%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d %*c %s",
-               seq);
-        for (is = 0; is < 5; is++)
-        {
-            if (seq[is] == 'G' || seq[is] == 'P')
-            {
-                d +=  40;
-            }
-        }
-        if (d < best)
-        {
-            sscanf(buf, "%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%*d%d%d %c %s", &astart, &aend, &rchain, seq);
-            top[0].sum = d;
-            top[0].astart = astart;
-            top[0].aend = aend;
-            top[0].rchain = rchain;
-            strcpy(top[0].file, file);
-            qsort(top, MAXHITS, sizeof(hit), hcompare);
-            best = top[0].sum;
-        }
-        nvec++;
+        use[i] = i < 5 || d[i] != 0;
     }
-    sprintf(buf, "Checked %d pentamer vectors", nvec);
+    /* non-use of d7 is deliberate */
+    use[6] = false;
+
+    int best = index->Best(d, use, top[0].sum);
+    if (best < 0)
+    {
+        Logger::log("No pentamer vectors found");
+        return (0);
+    }
+    const PentamerEntry &entry = index->Entry(best);
+    top[0].astart = entry.astart;
+    top[0].aend = entry.aend;
+    top[0].rchain = entry.rchain;
+    strncpy(top[0].file, index->FileName(entry.file).c_str(), sizeof(top[0].file)-1);
+    top[0].file[sizeof(top[0].file)-1] = '\0';
+
+    sprintf(buf, "Checked %d pentamer vectors", index->Size());
     Logger::log(buf);
     found = 0;
     /* write out in reverse order so that best hit is first in xfit
@@ -498,11 +770,8 @@ Residue *matchvec(const MIAtomList &CA, const MIAtomList &CB, std::string &pentd
     {
         /* now find this sequence and write it out to stdout */
         char type[20], rname[20], aname[20];
-        strcpy(buf, pentdir.c_str());
-        strcat(buf, "/");
-        strcat(buf, top[i].file);
-        fpdb = fopen(buf, "r");
-        if (!fpdb)
+        const std::vector<std::string> *lines = index->FileLines(entry.file);
+        if (!lines)
         {
             Logger::log("cannot open pdb source file");
             return (0);
@@ -514,12 +783,9 @@ Residue *matchvec(const MIAtomList &CA, const MIAtomList &CB, std::string &pentd
         atoms.clear();
         char oldname[20], oldtype[20];
         oldname[0] = '\0';
-        while (fgets(buf, 1024, fpdb) != NULL)
+        for (size_t iline = 0; iline < lines->size(); ++iline)
         {
-            if (strncmp("ATOM", buf, 4))
-            {
-                continue;
-            }
+            strcpy(buf, (*lines)[iline].c_str());
             sscanf(column(7), "%d", &atomnumber);
             chain = *column(22);
             sscanf(column(18), "%3s", type);
@@ -603,7 +869,6 @@ Residue *matchvec(const MIAtomList &CA, const MIAtomList &CB, std::string &pentd
             res->setSecstr('U');
             res->set_linkage_type(CTERMINUS);
         }
-        fclose(fpdb);
         n++;
     }
     printf("END\n");
@@ -617,4 +882,3 @@ Residue *matchvec(const MIAtomList &CA, const MIAtomList &CB, std::string &pentd
     Logger::log(buf);
     return (reslist);
 }
-
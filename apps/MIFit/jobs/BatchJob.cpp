@@ -2,10 +2,13 @@
 #include <QDialogButtonBox>
 #include <QDir>
 #include <QFile>
+#include <QHash>
 #include <QMessageBox>
 #include <QProcess>
+#include <QRegExp>
 #include <QStatusBar>
 #include <QTextBrowser>
+#include <QTextStream>
 #include <QTimer>
 #include <QVBoxLayout>
 #include <util/utillib.h>
@@ -16,22 +19,100 @@
 #ifdef _WIN32
 #include <process.h>
 #include <time.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
 #endif
 
+#ifdef Q_OS_LINUX
+namespace
+{
+    // The fields of /proc/<pid>/stat after the command name, which is in
+    // parentheses and may contain spaces; the first is the state, then
+    // the parent pid, and utime, stime, cutime and cstime from the 12th
+    QStringList procStat(const QString &pid)
+    {
+        QFile statFile("/proc/" + pid + "/stat");
+        if (!statFile.open(QFile::ReadOnly))
+            return QStringList();
+        QString stat = statFile.readAll();
+        return stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+    }
+
+    // A memory line of /proc/<pid>/status, such as VmRSS, in bytes
+    qint64 procMemory(const QString &status, const QString &field)
+    {
+        int start = status.indexOf(field + ":");
+        if (start < 0)
+            return 0;
+        start += field.size() + 1;
+        int end = status.indexOf('\n', start);
+        return status.mid(start, end - start).trimmed().split(' ').front().toLongLong() * 1024;
+    }
+}
+#endif
+
+void ProcessTable::scan()
+{
+    stats.clear();
+    children.clear();
+#ifdef Q_OS_LINUX
+    foreach (QString pid, QDir("/proc").entryList(QDir::Dirs))
+    {
+        if (!pid[0].isDigit())
+            continue;
+        QStringList fields = procStat(pid);
+        if (fields.size() > 14)
+        {
+            stats.insert(pid, fields);
+            children.insert(fields[1], pid);
+        }
+    }
+#endif
+}
+
+// CPU time of the children MIFit has reaped, each with the children it
+// reaped in turn; -1 where not available
+double BatchJob::reapedCpuTime()
+{
+#ifdef Q_OS_LINUX
+    struct rusage usage;
+    if (getrusage(RUSAGE_CHILDREN, &usage) != 0)
+        return -1.0;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6
+           + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+#else
+    return -1.0;
+#endif
+}
+
 BatchJob::BatchJob()
     : workingDirectory_(QDir::current().absolutePath()),
       process(NULL)
 {
-    setJobId();
-    logFile = Application::instance()->jobLogsDirectory().absoluteFilePath(QString("mifit%1.log").arg(jobId()));
+    init();
 }
 
 BatchJob::BatchJob(const QString &dir)
     : workingDirectory_(dir),
       process(NULL)
+{
+    init();
+}
+
+void BatchJob::init()
 {
     setJobId();
     logFile = Application::instance()->jobLogsDirectory().absoluteFilePath(QString("mifit%1.log").arg(jobId()));
+    queued_ = false;
+    cancelled_ = false;
+    threads_ = 1;
+    priority_ = 0;
+    waitTime_ = 0;
+    wallTime_ = 0;
+    cpuTime_ = -1.0;
+    peakMemory_ = -1;
+    reapedCpuTime_ = -1.0;
 }
 
 void BatchJob::setWorkingDirectory(const QString &dir)
@@ -71,6 +152,9 @@ bool BatchJob::StartJob()
     env += QString("MIFIT_DIR=") + Application::instance()->GetMolimageHome().c_str();
     env += QString("MIFIT_JOB_ID=") + QString::number(jobId_);
     env += QString("MIFIT_SOCKET_ID=") + MIMainWindow::instance()->scriptPort();
+    env += QString("MIFIT_JOB_THREADS=") + QString::number(threads_);
+    if (env.filter(QRegExp("^OMP_NUM_THREADS=")).isEmpty())
+        env += QString("OMP_NUM_THREADS=") + QString::number(threads_);
     process->setEnvironment(env);
 
     connect(process, SIGNAL(finished(int)),
@@ -87,11 +171,111 @@ bool BatchJob::StartJob()
         QMessageBox::warning(NULL, "Job Error", QString("Unable to start job %1").arg(jobId_));
         delete process;
         process = NULL;
+        cancelled_ = true;
+    }
+    else
+    {
+        startTime_.start();
+        reapedCpuTime_ = reapedCpuTime();
+        if (submitTime_.isValid())
+            waitTime_ = submitTime_.elapsed();
     }
     jobChanged(this);
     return started;
 }
 
+bool BatchJob::isDone()
+{
+    return cancelled_ || (process && !isRunning());
+}
+
+void BatchJob::addDependency(BatchJob *job)
+{
+    if (job && job != this && !dependencies_.contains(job))
+        dependencies_.append(job);
+}
+
+void BatchJob::removeDependency(BatchJob *job)
+{
+    dependencies_.removeAll(job);
+}
+
+void BatchJob::cancel(const QString &reason)
+{
+    queued_ = false;
+    cancelled_ = true;
+    writeAccounting(QString("Job %1 cancelled: %2").arg(jobId_).arg(reason));
+    Logger::log("Job %lu cancelled: %s", jobId_, reason.toAscii().constData());
+    jobChanged(this);
+}
+
+void BatchJob::writeAccounting(const QString &text)
+{
+    QFile file(logFile);
+    if (file.open(QFile::WriteOnly | QFile::Append | QFile::Text))
+    {
+        QTextStream out(&file);
+        out << "\n" << text << "\n";
+    }
+}
+
+void BatchJob::sampleResources(const ProcessTable &processes)
+{
+    // Only Linux exposes the usage of other processes without extra
+    // libraries; elsewhere the CPU time and memory are left unknown
+#ifdef Q_OS_LINUX
+    reapedCpuTime_ = reapedCpuTime();
+    if (!process || process->pid() <= 0)
+        return;
+
+    // The job's process and everything it started that still runs: a
+    // script usually does its work in the programs it calls
+    const QHash<QString, QStringList> &stats = processes.stats;
+    QStringList tree(QString::number(process->pid()));
+    if (!stats.contains(tree.front()))
+        return;
+    for (int i = 0; i < tree.size(); ++i)
+        tree += processes.children.values(tree[i]);
+
+    // Each process's cutime and cstime hold the children it has reaped,
+    // which are no longer in the tree, so nothing is counted twice
+    double ticks = 0.0;
+    qint64 resident = 0;
+    qint64 peak = 0;
+    foreach (QString pid, tree)
+    {
+        const QStringList &fields = stats[pid];
+        ticks += fields[11].toDouble() + fields[12].toDouble()
+                 + fields[13].toDouble() + fields[14].toDouble();
+
+        QFile statusFile("/proc/" + pid + "/status");
+        if (statusFile.open(QFile::ReadOnly | QFile::Text))
+        {
+            QString status = statusFile.readAll();
+            resident += procMemory(status, "VmRSS");
+            peak = qMax(peak, procMemory(status, "VmHWM"));
+        }
+    }
+    cpuTime_ = qMax(cpuTime_, ticks / sysconf(_SC_CLK_TCK));
+    peakMemory_ = qMax(peakMemory_, qMax(resident, peak));
+#else
+    Q_UNUSED(processes)
+#endif
+}
+
+void BatchJob::sampleFinalResources()
+{
+#ifdef Q_OS_LINUX
+    // The process has just been reaped, which added all of its CPU time,
+    // including what it ran after the last sample, to MIFit's children.
+    // The manager moves the baseline of the other running jobs past it.
+    double reaped = reapedCpuTime();
+    if (reapedCpuTime_ >= 0.0 && reaped - reapedCpuTime_ > cpuTime_)
+        cpuTime_ = reaped - reapedCpuTime_;
+    reapedCpuTime_ = reaped;
+#endif
+}
+
 void BatchJob::signalJobChanged()
 {
     jobChanged(this);
@@ -118,6 +302,19 @@ void JobFinishedStatusLabel::remove()
 
 void BatchJob::doJobFinished()
 {
+    wallTime_ = startTime_.elapsed();
+    sampleFinalResources();
+    QString accounting = QString("Job %1 used %2 thread(s), waited %3 s, ran %4 s")
+                         .arg(jobId_).arg(threads_)
+                         .arg(waitTime_ / 1000.0, 0, 'f', 1)
+                         .arg(wallTime_ / 1000.0, 0, 'f', 1);
+    if (cpuTime_ >= 0.0)
+        accounting += QString(", CPU time %1 s").arg(cpuTime_, 0, 'f', 1);
+    if (peakMemory_ >= 0)
+        accounting += QString(", peak memory %1 MB").arg(peakMemory_ / (1024.0 * 1024.0), 0, 'f', 1);
+    writeAccounting(accounting);
+    Logger::log("%s", accounting.toAscii().constData());
+
     QString message;
     if (!jobName_.isEmpty())
         message = QString("%1 finished (job %2)").arg(jobName_).arg(jobId_);
@@ -131,19 +328,23 @@ void BatchJob::doJobFinished()
 
 void BatchJob::AbortJob()
 {
-    process->kill();
+    if (queued_)
+        cancel("aborted while queued");
+    else if (process)
+        process->kill();
 }
 
 QString BatchJob::Info()
 {
-    return QString("Job name: %1\n"
+    QString info = QString("Job name: %1\n"
                    "Job id: %2\n"
                    "Program: %3\n"
                    "Arguments: \"%4\"\n"
                    "Log file: %5\n"
                    "Job directory: %6\n"
                    "Running: %7\n"
-                   "Success: %8\n")
+                   "Success: %8\n"
+                   "Queued: %9\n")
            .arg(jobName_.toAscii().constData())
            .arg(jobId_)
            .arg(program_.toAscii().constData())
@@ -151,7 +352,21 @@ QString BatchJob::Info()
            .arg(logFile.toAscii().constData())
            .arg(workingDirectory_.toAscii().constData())
            .arg(isRunning() ? "true" : "false")
-           .arg(isSuccess() ? "true" : "false");
+           .arg(isSuccess() ? "true" : "false")
+           .arg(queued_ ? "true" : "false");
+    info += QString("Threads: %1\nPriority: %2\n").arg(threads_).arg(priority_);
+    if (!dependencies_.isEmpty())
+    {
+        QStringList ids;
+        foreach (BatchJob *job, dependencies_)
+            ids += QString::number(job->jobId());
+        info += QString("Depends on: %1\n").arg(ids.join(", "));
+    }
+    if (cpuTime_ >= 0.0)
+        info += QString("CPU time: %1 s\n").arg(cpuTime_, 0, 'f', 1);
+    if (peakMemory_ >= 0)
+        info += QString("Peak memory: %1 MB\n").arg(peakMemory_ / (1024.0 * 1024.0), 0, 'f', 1);
+    return info;
 }
 
 void BatchJob::ShowLog()
@@ -2,18 +2,35 @@
 #define mifit_jobs_BatchJob_h
 
 #include <string>
+#include <QHash>
 #include <QLabel>
+#include <QList>
 #include <QObject>
 #include <QProcess>
 #include <QString>
 #include <QStringList>
+#include <QTime>
 
 class QStatusBar;
 
+/**
+ * The processes running on the machine, read from /proc once for all
+ * the jobs sampled at a time. Empty where /proc is not available.
+ */
+struct ProcessTable
+{
+    QHash<QString, QStringList> stats;      // fields of /proc/<pid>/stat by pid
+    QMultiHash<QString, QString> children;  // pids by parent pid
+
+    void scan();
+};
+
 class BatchJob : public QObject
 {
     Q_OBJECT
 
+    friend class BatchJobManager;
+
 public:
 
     BatchJob();
@@ -44,12 +61,14 @@ public:
     void setCommandLine(const QString &command);
 
     /**
-     * Start the job running
+     * Start the job running now. Jobs are normally given to
+     * BatchJobManager::SubmitJob, which starts them when workers are free.
      */
     virtual bool StartJob();
 
     /**
-     * Aborts the job by sending a kill to the operating system
+     * Aborts the job by sending a kill to the operating system, or
+     * cancels it if it is still queued
      */
     void AbortJob();
 
@@ -58,6 +77,87 @@ public:
      */
     bool isRunning();
 
+    /**
+     * returns true if the job is waiting in the queue to be started
+     */
+    bool isQueued() const
+    {
+        return queued_;
+    }
+
+    /**
+     * returns true if the job was cancelled before it ran or could not
+     * be started
+     */
+    bool isCancelled() const
+    {
+        return cancelled_;
+    }
+
+    /**
+     * returns true if the job has run or will not run
+     */
+    bool isDone();
+
+    /**
+     * Number of threads the job uses. The job is started when that many
+     * workers are free and it is told the count through the
+     * OMP_NUM_THREADS and MIFIT_JOB_THREADS environment variables.
+     */
+    int threads() const
+    {
+        return threads_;
+    }
+
+    void setThreads(int threads)
+    {
+        threads_ = threads < 1 ? 1 : threads;
+    }
+
+    /**
+     * Queued jobs with a higher priority are started first, those with
+     * equal priorities in the order submitted.
+     */
+    int priority() const
+    {
+        return priority_;
+    }
+
+    void setPriority(int priority)
+    {
+        priority_ = priority;
+        jobChanged(this);
+    }
+
+    /**
+     * The job is not started until job has finished successfully, and is
+     * cancelled if job fails.
+     */
+    void addDependency(BatchJob *job);
+    void removeDependency(BatchJob *job);
+
+    const QList<BatchJob*> &dependencies() const
+    {
+        return dependencies_;
+    }
+
+    /**
+     * CPU time in seconds and peak resident memory in bytes of the job's
+     * process and the processes it starts, sampled while it runs and the
+     * CPU time again when it exits; -1 where not available.
+     */
+    double cpuTime() const
+    {
+        return cpuTime_;
+    }
+
+    qint64 peakMemory() const
+    {
+        return peakMemory_;
+    }
+
+    void sampleResources(const ProcessTable &processes);
+
     /**
      * returns true if the job is a success
      */
@@ -106,6 +206,29 @@ protected:
 
     QProcess *process;
 
+    bool queued_;
+    bool cancelled_;
+    int threads_;
+    int priority_;
+    QList<BatchJob*> dependencies_;
+    QTime submitTime_;
+    QTime startTime_;
+    int waitTime_;
+    int wallTime_;
+    double cpuTime_;
+    qint64 peakMemory_;
+    // CPU time of the children MIFit had reaped when the job was last
+    // sampled, or when another job finished since, so that what MIFit
+    // reaps when this job exits is its own
+    double reapedCpuTime_;
+
+    static double reapedCpuTime();
+
+    void init();
+    void sampleFinalResources();
+    void cancel(const QString &reason);
+    void writeAccounting(const QString &text);
+
 protected slots:
     virtual void doJobFinished();
     void signalJobChanged();
@@ -1,15 +1,25 @@
+#include <algorithm>
 #include <QAction>
 #include <QDir>
 #include <QFile>
 #include <QFileDialog>
 #include <QMenu>
 #include <QMessageBox>
+#include <QSet>
 #include <QSettings>
+#include <QThread>
 #include "ui/Application.h"
 #include "BatchJob.h"
 #include "BatchJobManager.h"
 #include "core/corelib.h"
 
+#ifdef Q_OS_WIN32
+#include <windows.h>
+#endif
+#ifdef Q_OS_MAC
+#include <sys/sysctl.h>
+#endif
+
 using namespace std;
 
 namespace
@@ -70,6 +80,54 @@ namespace
         return QString::null;
     }
 
+    int physicalCoreCount()
+    {
+        int count = 0;
+#if defined(Q_OS_LINUX)
+        // Count the distinct (physical id, core id) pairs
+        QFile cpuinfo("/proc/cpuinfo");
+        if (cpuinfo.open(QFile::ReadOnly | QFile::Text))
+        {
+            QSet<QString> cores;
+            QString physicalId;
+            foreach (QString line, QString(cpuinfo.readAll()).split('\n'))
+            {
+                if (line.startsWith("physical id"))
+                    physicalId = line.section(':', 1).trimmed();
+                else if (line.startsWith("core id"))
+                    cores.insert(physicalId + "/" + line.section(':', 1).trimmed());
+            }
+            count = cores.size();
+        }
+#elif defined(Q_OS_MAC)
+        int cores = 0;
+        size_t size = sizeof(cores);
+        if (sysctlbyname("hw.physicalcpu", &cores, &size, NULL, 0) == 0)
+            count = cores;
+#elif defined(Q_OS_WIN32)
+        DWORD size = 0;
+        GetLogicalProcessorInformation(NULL, &size);
+        std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION) + 1);
+        if (GetLogicalProcessorInformation(&info[0], &size))
+        {
+            for (size_t i = 0; i < size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION); ++i)
+            {
+                if (info[i].Relationship == RelationProcessorCore)
+                    ++count;
+            }
+        }
+#endif
+        if (count < 1)
+            count = QThread::idealThreadCount();
+        return count < 1 ? 1 : count;
+    }
+
+    // Higher priority first; stable sorting keeps submission order
+    bool higherPriority(BatchJob *a, BatchJob *b)
+    {
+        return a->priority() > b->priority();
+    }
+
 } // anonymous namespace
 
 QString BatchJobManager::pythonExe()
@@ -159,9 +217,14 @@ Q_DECLARE_METATYPE(CustomJob);
 
 
 BatchJobManager::BatchJobManager()
+    : scheduling(false),
+      rescheduled(false)
 {
     qRegisterMetaType<CustomJob>("CustomJob");
     qRegisterMetaTypeStreamOperators<CustomJob>("CustomJob");
+
+    resourceTimer.setInterval(1000);
+    connect(&resourceTimer, SIGNAL(timeout()), this, SLOT(sampleResources()));
 }
 
 BatchJobManager::~BatchJobManager()
@@ -248,7 +311,7 @@ void BatchJobManager::handleCustomJobAction()
     }
     job->setArguments(customJob.arguments);
     job->setWorkingDirectory(customJob.workingDirectory);
-    job->StartJob();
+    SubmitJob(job);
 }
 
 BatchJob *BatchJobManager::CreateJob()
@@ -259,6 +322,141 @@ BatchJob *BatchJobManager::CreateJob()
     return job;
 }
 
+void BatchJobManager::SubmitJob(BatchJob *job)
+{
+    if (!job || job->isQueued() || job->isRunning() || job->isDone())
+        return;
+    job->queued_ = true;
+    job->submitTime_.start();
+    queue.push_back(job);
+    connect(job, SIGNAL(jobChanged(BatchJob*)),
+            this, SLOT(schedule()), Qt::QueuedConnection);
+    job->jobChanged(job);
+    schedule();
+}
+
+int BatchJobManager::workerCount()
+{
+    int count = Application::instance()->jobWorkers;
+    return count > 0 ? count : physicalCoreCount();
+}
+
+int BatchJobManager::busyWorkers()
+{
+    int workers = workerCount();
+    int busy = 0;
+    for (size_t i = 0; i < JobList.size(); ++i)
+    {
+        if (JobList[i]->isRunning())
+            busy += std::min(JobList[i]->threads(), workers);
+    }
+    return busy;
+}
+
+void BatchJobManager::schedule()
+{
+    // Starting a job may show a message box, whose event loop can call
+    // back in here; run again afterwards instead
+    if (scheduling)
+    {
+        rescheduled = true;
+        return;
+    }
+    scheduling = true;
+
+    vector<BatchJob*> waiting;
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        if (queue[i]->isQueued())
+            waiting.push_back(queue[i]);
+    }
+    std::stable_sort(waiting.begin(), waiting.end(), higherPriority);
+    queue = waiting;
+
+    int workers = workerCount();
+    int busy = busyWorkers();
+    for (size_t i = 0; i < waiting.size(); ++i)
+    {
+        BatchJob *job = waiting[i];
+        bool ready = true;
+        BatchJob *failed = NULL;
+        foreach (BatchJob *dependency, job->dependencies())
+        {
+            if (!dependency->isDone())
+                ready = false;
+            else if (!dependency->isSuccess())
+                failed = dependency;
+        }
+        if (failed)
+        {
+            queue.erase(std::find(queue.begin(), queue.end(), job));
+            job->cancel(QString("job %1 it depends on failed").arg(failed->jobId()));
+            continue;
+        }
+        if (!ready)
+            continue;
+
+        // Jobs start in order: a job that does not fit holds back the
+        // ones after it until workers free up, unless nothing is running
+        int needed = std::min(job->threads(), workers);
+        if (busy > 0 && busy + needed > workers)
+            break;
+
+        queue.erase(std::find(queue.begin(), queue.end(), job));
+        job->queued_ = false;
+        if (job->StartJob())
+        {
+            connect(job->process, SIGNAL(finished(int)), this, SLOT(jobFinished()));
+            busy += needed;
+            resourceTimer.start();
+        }
+    }
+
+    scheduling = false;
+    if (rescheduled)
+    {
+        rescheduled = false;
+        QTimer::singleShot(0, this, SLOT(schedule()));
+    }
+}
+
+void BatchJobManager::sampleResources()
+{
+    // One scan of the processes serves all the running jobs
+    ProcessTable processes;
+    bool running = false;
+    for (size_t i = 0; i < JobList.size(); ++i)
+    {
+        if (JobList[i]->isRunning())
+        {
+            if (!running)
+                processes.scan();
+            JobList[i]->sampleResources(processes);
+            running = true;
+        }
+    }
+    if (!running)
+        resourceTimer.stop();
+}
+
+void BatchJobManager::jobFinished()
+{
+    // The finished job has taken what MIFit reaped since its last sample;
+    // the jobs still running have had nothing reaped yet, so what is
+    // reaped next starts from here
+    double reaped = BatchJob::reapedCpuTime();
+    for (size_t i = 0; i < JobList.size(); ++i)
+    {
+        if (JobList[i]->isRunning())
+            JobList[i]->reapedCpuTime_ = reaped;
+    }
+}
+
+int BatchJobManager::numberOfQueuedJobs()
+{
+    return queue.size();
+}
+
 void BatchJobManager::CleanSucc()
 {
     int i, size;
@@ -289,7 +487,7 @@ void BatchJobManager::CleanAll()
     for (i = 0; i < size; i++)
     {
         job = *(JobList.begin()+i);
-        if (!job->isRunning())
+        if (!job->isRunning() && !job->isQueued())
         {
             tokill.push_back(job);
         }
@@ -310,6 +508,19 @@ bool BatchJobManager::DeleteJob(BatchJob *job)
         Logger::message("You cannot delete a job while it is still running");
         return false;
     }
+    vector<BatchJob*>::iterator queued = std::find(queue.begin(), queue.end(), job);
+    if (queued != queue.end())
+        queue.erase(queued);
+    for (size_t i = 0; i < JobList.size(); i++)
+    {
+        BatchJob *dependent = JobList[i];
+        if (!dependent->dependencies().contains(job))
+            continue;
+        // Without the job's output the jobs waiting for it cannot run
+        if (!job->isSuccess() && !dependent->isRunning() && !dependent->isDone())
+            dependent->cancel(QString("job %1 it depends on was deleted").arg(job->jobId()));
+        dependent->removeDependency(job);
+    }
     for (size_t i = 0; i < JobList.size(); i++)
     {
         if (job == JobList[i])
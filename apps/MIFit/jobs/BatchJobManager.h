@@ -11,15 +11,21 @@ class QAction;
 class QMenu;
 
 /**
- * Runs a batch job in the background.
- * It can start a job but the user has to pick the output up manually
- * and there is no way to track jobs currently.
+ * Runs batch jobs in the background.
+ * Submitted jobs wait in a queue until their dependencies have finished
+ * and enough workers are free for their threads, so that starting many
+ * jobs does not oversubscribe the processors. The user has to pick the
+ * output up manually.
  */
 class BatchJobManager : public QObject
 {
     Q_OBJECT
 
     std::vector<BatchJob*> JobList;
+    std::vector<BatchJob*> queue;
+    bool scheduling;
+    bool rescheduled;
+    QTimer resourceTimer;
     uint _customJobIndex;
 
 public:
@@ -30,6 +36,12 @@ public:
      */
     BatchJob *CreateJob();
 
+    /**
+     * Queues a job created by CreateJob to be started when its
+     * dependencies are done and workers are free.
+     */
+    void SubmitJob(BatchJob *job);
+
     /**
      *  Constructor - should be just one copy per program.
      */
@@ -49,7 +61,8 @@ public:
     }
 
     /**
-     * Deletes a job in the list given its pointer.
+     * Deletes a job in the list given its pointer. Jobs that depend on it
+     * and have not run are cancelled unless it succeeded.
      * returns true if it finds the job in the lsit and destroys it, else false.
      */
     bool DeleteJob(BatchJob *p_job);
@@ -73,6 +86,14 @@ public:
     void CleanAll();
 
     int numberOfRunningJobs();
+    int numberOfQueuedJobs();
+
+    /**
+     * Number of threads that running jobs may use together, from the
+     * preferences or by default the number of physical processor cores.
+     */
+    int workerCount();
+    int busyWorkers();
 
     void setupJobMenu(QMenu *menu);
     void saveJobMenu(QMenu *menu);
@@ -85,6 +106,9 @@ signals:
 
 private slots:
     void handleCustomJobAction();
+    void schedule();
+    void sampleResources();
+    void jobFinished();
 
 };
 
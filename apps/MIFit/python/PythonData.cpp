@@ -0,0 +1,454 @@
+#include "PythonData.h"
+
+#include <cstddef>
+#include <cstring>
+#include <map/maplib.h>
+#include <ui/uilib.h>
+
+using namespace chemlib;
+
+namespace
+{
+    PythonData *sharedData = 0;
+
+    MIGLWidget *currentDocument()
+    {
+        MIGLWidget *doc = MIMainWindow::instance()->currentMIGLWidget();
+        if (!doc)
+        {
+            PyErr_SetString(PyExc_RuntimeError, "no current document");
+        }
+        return doc;
+    }
+
+    EMapBase *currentMap()
+    {
+        MIGLWidget *doc = currentDocument();
+        if (!doc)
+        {
+            return 0;
+        }
+        EMapBase *map = doc->GetDisplaylist()->GetCurrentMap();
+        if (!map)
+        {
+            PyErr_SetString(PyExc_RuntimeError, "no current map");
+        }
+        return map;
+    }
+
+    MIMoleculeBase *currentModel()
+    {
+        MIGLWidget *doc = currentDocument();
+        if (!doc)
+        {
+            return 0;
+        }
+        MIMoleculeBase *model = doc->GetDisplaylist()->GetCurrentModel();
+        if (!model)
+        {
+            PyErr_SetString(PyExc_RuntimeError, "no current model");
+        }
+        return model;
+    }
+
+    // pull and push only use the buffers the script got from model(), so
+    // that its edits are never lost to new buffers
+    bool checkCurrentModel()
+    {
+        MIMoleculeBase *model = currentModel();
+        if (!model)
+        {
+            return false;
+        }
+        if (!sharedData->isCurrent(model))
+        {
+            PyErr_SetString(PyExc_RuntimeError, "the model() buffers are stale: the current model "
+                            "or its atoms changed, call model() again");
+            return false;
+        }
+        return true;
+    }
+
+    PyObject *pyModel(PyObject*, PyObject*)
+    {
+        MIMoleculeBase *model = currentModel();
+        if (!model)
+        {
+            return 0;
+        }
+        sharedData->attach(model);
+        return sharedData->modelArrays();
+    }
+
+    PyObject *pyPull(PyObject*, PyObject*)
+    {
+        if (!checkCurrentModel())
+        {
+            return 0;
+        }
+        sharedData->pull();
+        Py_RETURN_NONE;
+    }
+
+    PyObject *pyPush(PyObject*, PyObject*)
+    {
+        if (!checkCurrentModel())
+        {
+            return 0;
+        }
+        sharedData->push();
+        Py_RETURN_NONE;
+    }
+
+    // A new buffer holding a copy of size bytes at data
+    PyObject *copyToBuffer(const void *data, size_t size)
+    {
+        PyObject *buffer = PyBuffer_New(size);
+        if (!buffer)
+        {
+            return 0;
+        }
+        void *p = 0;
+        Py_ssize_t length;
+        if (PyObject_AsWriteBuffer(buffer, &p, &length) != 0)
+        {
+            Py_DECREF(buffer);
+            return 0;
+        }
+        memcpy(p, data, size);
+        return buffer;
+    }
+
+    // Copies the contents of the buffer object into size bytes at data
+    bool copyFromBuffer(PyObject *buffer, void *data, size_t size)
+    {
+        const void *p = 0;
+        Py_ssize_t length;
+        if (PyObject_AsReadBuffer(buffer, &p, &length) != 0)
+        {
+            return false;
+        }
+        if ((size_t)length != size)
+        {
+            PyErr_Format(PyExc_ValueError, "expected %lu bytes, got %lu",
+                         (unsigned long)size, (unsigned long)length);
+            return false;
+        }
+        memcpy(data, p, size);
+        return true;
+    }
+
+    PyObject *pyMap(PyObject*, PyObject*)
+    {
+        EMapBase *emap = currentMap();
+        if (!emap)
+        {
+            return 0;
+        }
+        if (!emap->HasDensity())
+        {
+            PyErr_SetString(PyExc_RuntimeError, "current map has no density");
+            return 0;
+        }
+        CMapHeaderBase *mh = emap->GetMapHeader();
+        PyObject *points = copyToBuffer(emap->MapPoints(), emap->MapPointCount()*sizeof(float));
+        if (!points)
+        {
+            return 0;
+        }
+        return Py_BuildValue("(N(iii))", points, mh->nx, mh->ny, mh->nz);
+    }
+
+    PyObject *pySetMap(PyObject*, PyObject *args)
+    {
+        PyObject *points;
+        if (!PyArg_ParseTuple(args, "O", &points))
+        {
+            return 0;
+        }
+        EMapBase *emap = currentMap();
+        if (!emap)
+        {
+            return 0;
+        }
+        if (!copyFromBuffer(points, emap->MapPoints(), emap->MapPointCount()*sizeof(float)))
+        {
+            return 0;
+        }
+        sharedData->notifyMapChanged(emap);
+        Py_RETURN_NONE;
+    }
+
+    PyObject *pyReflections(PyObject*, PyObject*)
+    {
+        EMapBase *emap = currentMap();
+        if (!emap)
+        {
+            return 0;
+        }
+        if (emap->refls.empty())
+        {
+            PyErr_SetString(PyExc_RuntimeError, "current map has no reflections");
+            return 0;
+        }
+        PyObject *refls = copyToBuffer(&emap->refls[0], emap->refls.size()*sizeof(CREFL));
+        if (!refls)
+        {
+            return 0;
+        }
+
+        // Layout of a record for a numpy dtype: name, format and offset
+        PyObject *fields = Py_BuildValue("[(ssi)(ssi)(ssi)(ssi)(ssi)(ssi)(ssi)(ssi)(ssi)(ssi)(ssi)]",
+                                         "ind", "3i4", (int)offsetof(CREFL, ind),
+                                         "fo", "f4", (int)offsetof(CREFL, fo),
+                                         "sigma", "f4", (int)offsetof(CREFL, sigma),
+                                         "fc", "f4", (int)offsetof(CREFL, fc),
+                                         "phi", "f4", (int)offsetof(CREFL, phi),
+                                         "sthol", "f4", (int)offsetof(CREFL, sthol),
+                                         "coef", "f4", (int)offsetof(CREFL, coef),
+                                         "fom", "f4", (int)offsetof(CREFL, fom),
+                                         "acalc", "f4", (int)offsetof(CREFL, acalc),
+                                         "bcalc", "f4", (int)offsetof(CREFL, bcalc),
+                                         "freeRflag", "i2", (int)offsetof(CREFL, freeRflag));
+        return Py_BuildValue("(NNi)", refls, fields, (int)sizeof(CREFL));
+    }
+
+    PyObject *pySetReflections(PyObject*, PyObject *args)
+    {
+        PyObject *records;
+        if (!PyArg_ParseTuple(args, "O", &records))
+        {
+            return 0;
+        }
+        EMapBase *emap = currentMap();
+        if (!emap)
+        {
+            return 0;
+        }
+        if (emap->refls.empty())
+        {
+            PyErr_SetString(PyExc_RuntimeError, "current map has no reflections");
+            return 0;
+        }
+        if (!copyFromBuffer(records, &emap->refls[0], emap->refls.size()*sizeof(CREFL)))
+        {
+            return 0;
+        }
+        sharedData->notifyReflectionsChanged(emap);
+        Py_RETURN_NONE;
+    }
+
+    PyMethodDef methods[] =
+    {
+        { "model", pyModel, METH_NOARGS,
+          "model() -> (xyz, b, occ): float32 buffers of the current model's atoms" },
+        { "pull", pyPull, METH_NOARGS,
+          "pull(): copy the atoms of the current model into the model() buffers, "
+          "RuntimeError if they are stale" },
+        { "push", pyPush, METH_NOARGS,
+          "push(): copy the model() buffers back into the atoms and redraw, "
+          "RuntimeError if they are stale" },
+        { "map", pyMap, METH_NOARGS,
+          "map() -> (points, (nx, ny, nz)): float32 copy of the current map, x fastest" },
+        { "set_map", pySetMap, METH_VARARGS,
+          "set_map(points): copy points, of the size of map(), into the current map and recontour" },
+        { "reflections", pyReflections, METH_NOARGS,
+          "reflections() -> (records, fields, size): copy of the current map's reflections, "
+          "the (name, format, offset) of the record fields and the record size" },
+        { "set_reflections", pySetReflections, METH_VARARGS,
+          "set_reflections(records): copy records, of the size of reflections(), into the current map" },
+        { 0, 0, 0, 0 }
+    };
+}
+
+PythonData::PythonData()
+    : model(0),
+      xyz(0),
+      bvalue(0),
+      occupancy(0),
+      valid(false)
+{
+}
+
+PythonData::~PythonData()
+{
+    release();
+}
+
+void PythonData::release()
+{
+    Py_XDECREF(xyz);
+    Py_XDECREF(bvalue);
+    Py_XDECREF(occupancy);
+    xyz = bvalue = occupancy = 0;
+    atoms.clear();
+    valid = false;
+}
+
+void PythonData::gather(MIAtomList &modelAtoms) const
+{
+    for (ResidueListIterator res = model->residuesBegin(); res != model->residuesEnd(); ++res)
+    {
+        modelAtoms.insert(modelAtoms.end(), res->atoms().begin(), res->atoms().end());
+    }
+}
+
+bool PythonData::isCurrent(MIMoleculeBase *current)
+{
+    if (!current || current != model || !xyz)
+    {
+        return false;
+    }
+    if (!valid)
+    {
+        // The model reports many changes that keep its atoms
+        MIAtomList modelAtoms;
+        gather(modelAtoms);
+        valid = modelAtoms == atoms;
+    }
+    return valid;
+}
+
+bool PythonData::attach(MIMoleculeBase *newModel)
+{
+    if (!newModel)
+    {
+        return false;
+    }
+    if (isCurrent(newModel))
+    {
+        return true;
+    }
+    if (newModel != model)
+    {
+        if (model)
+        {
+            disconnect(model, 0, this, 0);
+        }
+        model = newModel;
+        connect(model, SIGNAL(atomsDeleted(chemlib::MIMoleculeBase*)),
+                this, SLOT(invalidate(chemlib::MIMoleculeBase*)));
+        connect(model, SIGNAL(residuesDeleted(chemlib::MIMoleculeBase*)),
+                this, SLOT(invalidate(chemlib::MIMoleculeBase*)));
+        connect(model, SIGNAL(moleculeChanged(chemlib::MIMoleculeBase*)),
+                this, SLOT(invalidate(chemlib::MIMoleculeBase*)));
+        connect(model, SIGNAL(moleculeToBeDeleted(chemlib::MIMoleculeBase*)),
+                this, SLOT(detach(chemlib::MIMoleculeBase*)));
+    }
+
+    // New buffers rather than resizing the old ones, which scripts may
+    // still hold
+    release();
+    gather(atoms);
+    xyz = PyBuffer_New(3*atoms.size()*sizeof(float));
+    bvalue = PyBuffer_New(atoms.size()*sizeof(float));
+    occupancy = PyBuffer_New(atoms.size()*sizeof(float));
+    valid = true;
+    pull();
+    return true;
+}
+
+PyObject *PythonData::modelArrays()
+{
+    return Py_BuildValue("(OOO)", xyz, bvalue, occupancy);
+}
+
+namespace
+{
+    float *bufferData(PyObject *buffer)
+    {
+        void *p = 0;
+        Py_ssize_t size;
+        if (PyObject_AsWriteBuffer(buffer, &p, &size) != 0)
+        {
+            return 0;
+        }
+        return static_cast<float*>(p);
+    }
+}
+
+void PythonData::pull()
+{
+    float *x = bufferData(xyz);
+    float *b = bufferData(bvalue);
+    float *o = bufferData(occupancy);
+    if (!x || !b || !o)
+    {
+        return;
+    }
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        const MIAtom *atom = atoms[i];
+        x[3*i] = atom->x();
+        x[3*i+1] = atom->y();
+        x[3*i+2] = atom->z();
+        b[i] = atom->BValue();
+        o[i] = atom->occ();
+    }
+}
+
+void PythonData::push()
+{
+    float *x = bufferData(xyz);
+    float *b = bufferData(bvalue);
+    float *o = bufferData(occupancy);
+    if (!x || !b || !o)
+    {
+        return;
+    }
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        MIAtom *atom = atoms[i];
+        atom->setPosition(x[3*i], x[3*i+1], x[3*i+2]);
+        atom->setBValue(b[i]);
+        atom->setOcc(o[i]);
+    }
+    model->SetCoordsChanged(true);
+    model->SetModified(true);
+    modelChanged(model);
+    MIGLWidget *doc = MIMainWindow::instance()->currentMIGLWidget();
+    if (doc)
+    {
+        doc->ReDraw();
+    }
+}
+
+void PythonData::notifyMapChanged(EMapBase *map)
+{
+    mapChanged(map);
+    MIGLWidget *doc = MIMainWindow::instance()->currentMIGLWidget();
+    if (doc)
+    {
+        doc->doMapContour(map);
+        doc->ReDraw();
+    }
+}
+
+void PythonData::notifyReflectionsChanged(EMapBase *map)
+{
+    reflectionsChanged(map);
+}
+
+void PythonData::invalidate(MIMoleculeBase *changed)
+{
+    if (changed == model)
+    {
+        valid = false;
+    }
+}
+
+void PythonData::detach(MIMoleculeBase *deleted)
+{
+    if (deleted == model)
+    {
+        release();
+        model = 0;
+    }
+}
+
+void initMIFitData(PythonData *pythonData)
+{
+    sharedData = pythonData;
+    Py_InitModule3("MIFitData", methods,
+                   "Views of the current model, map and reflections of MIFit for numpy.frombuffer");
+}
@@ -0,0 +1,87 @@
+#ifndef PythonData_h
+#define PythonData_h
+
+#include <Python.h>
+#include <qobject.h>
+#include <chemlib/chemlib.h>
+
+class EMapBase;
+
+/**
+ * Shares the data of the current document with Python through the MIFitData
+ * module as buffer objects, which numpy.frombuffer wraps without a copy.
+ *
+ * The atom coordinates, B-values and occupancies of the current model are
+ * kept packed in buffers owned by Python, gathered when a model is first
+ * used or its atoms change, refreshed from the atoms by pull and written
+ * back by push. Fetching the arrays again costs the same whatever the size
+ * of the model. Once the atoms change the buffers are stale: pull and push
+ * refuse them, and the next model() call hands out new ones.
+ *
+ * The map grid and reflections are copied in and out, since a map
+ * recalculates, reloads and closes without notice and a view of its arrays
+ * would be left dangling.
+ */
+class PythonData : public QObject
+{
+    Q_OBJECT
+
+    chemlib::MIMoleculeBase *model;
+    chemlib::MIAtomList atoms;
+    PyObject *xyz;
+    PyObject *bvalue;
+    PyObject *occupancy;
+    bool valid;
+
+    PythonData(const PythonData&);
+    PythonData&operator=(const PythonData&);
+
+    void release();
+    void gather(chemlib::MIAtomList &modelAtoms) const;
+
+public:
+    PythonData();
+    ~PythonData();
+
+    /**
+     * Makes model the one shared, gathering its atoms into new buffers if it
+     * is a different model or its atoms changed since. Buffers handed out
+     * before are left to the scripts holding them. Returns false if model is
+     * NULL.
+     */
+    bool attach(chemlib::MIMoleculeBase *model);
+
+    /**
+     * Whether model is the one shared and its atoms are those in the
+     * buffers, so that pull and push may use them.
+     */
+    bool isCurrent(chemlib::MIMoleculeBase *model);
+
+    /**
+     * New references to the coordinate (x, y, z per atom), B-value and
+     * occupancy buffers of the attached model.
+     */
+    PyObject *modelArrays();
+
+    void pull();
+    void push();
+
+    void notifyMapChanged(EMapBase *map);
+    void notifyReflectionsChanged(EMapBase *map);
+
+Q_SIGNALS:
+    void modelChanged(chemlib::MIMoleculeBase *model);
+    void mapChanged(EMapBase *map);
+    void reflectionsChanged(EMapBase *map);
+
+private Q_SLOTS:
+    void invalidate(chemlib::MIMoleculeBase *model);
+    void detach(chemlib::MIMoleculeBase *model);
+};
+
+/**
+ * Creates the MIFitData module backed by data.
+ */
+void initMIFitData(PythonData *data);
+
+#endif // ifndef PythonData_h
@@ -1,4 +1,5 @@
 #include "PythonEngine.h"
+#include "PythonData.h"
 
 #include <Python.h>
 #include <sip.h>
@@ -14,7 +15,8 @@ QString PythonEngine::ps2("... ");
 
 PythonEngine::PythonEngine()
     : currentPrompt(ps1),
-      started(false)
+      started(false),
+      data(0)
 {
 }
 
@@ -28,6 +30,10 @@ void PythonEngine::start()
     // Initialize bindings to this class
     initPythonEngine();
 
+    // and the views of the document data
+    data = new PythonData;
+    initMIFitData(data);
+
     try
     {
         // Get a reference to the main module.
@@ -93,13 +99,15 @@ void PythonEngine::start()
         PyErr_Print();
     }
 
-    command("import PythonEngine, PyQt4");
+    command("import PythonEngine, PyQt4, MIFitData");
 }
 
 PythonEngine::~PythonEngine()
 {
     if (started)
     {
+        // Drops the buffers held for scripts while Python is still up
+        delete data;
         Py_Finalize();
     }
 }
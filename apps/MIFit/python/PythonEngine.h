@@ -4,6 +4,8 @@
 #include <Python.h>
 #include <qobject.h>
 
+class PythonData;
+
 class PythonEngine : public QObject
 {
 
@@ -15,6 +17,7 @@ class PythonEngine : public QObject
     PyObject *main_dict;
     QString currentPrompt;
     bool started;
+    PythonData *data;
 
     PythonEngine(const PythonEngine&);
     PythonEngine&operator=(const PythonEngine&);
@@ -26,6 +29,15 @@ public:
 
     void start();
 
+    /**
+     * The data shared with scripts through the MIFitData module, NULL
+     * until started.
+     */
+    PythonData *scriptData() const
+    {
+        return data;
+    }
+
     void write(const char *text);
     void writeln(const char *text);
     void flush(void);
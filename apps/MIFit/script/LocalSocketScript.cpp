@@ -5,6 +5,8 @@
 #include <QLocalSocket>
 #include <QScriptEngine>
 #include <QStringList>
+#include <QTimer>
+#include <QtEndian>
 #include <ui/Logger.h>
 #include "MIFitScriptObject.h"
 
@@ -12,9 +14,18 @@
 #include <process.h>
 #endif
 
+// Longest script accepted, in bytes of UTF-16
+static const quint32 maxScriptBytes = 64 * 1024 * 1024;
+
 LocalSocketScript::LocalSocketScript(QObject *parent)
     : QObject(parent),
-      engine(0)
+      engine(0),
+      runningClient(0),
+      runningId(0),
+      nextId(1),
+      running(false),
+      runningCancelled(false),
+      progress(0)
 {
     uint id = static_cast<uint>(getpid());
     name_ = "MIFit-" + QString::number(id, 16);
@@ -32,73 +43,343 @@ QString LocalSocketScript::name() const
     return name_;
 }
 
+void LocalSocketScript::setProgress(int percent)
+{
+    progress = qBound(0, percent, 100);
+}
+
+void LocalSocketScript::createEngine()
+{
+    engine = new QScriptEngine(this);
+    // Let the GUI repaint and other clients be read while a script runs
+    engine->setProcessEventsInterval(100);
+    QObject *mifitObject = new MIFitScriptObject(engine, this);
+    QScriptValue objectValue = engine->newQObject(mifitObject);
+    engine->globalObject().setProperty("mifit", objectValue);
+}
+
 void LocalSocketScript::handleConnection()
 {
     if (!engine)
+        createEngine();
+
+    while (QLocalSocket *connection = localServer->nextPendingConnection())
     {
-        engine = new QScriptEngine(this);
-        QObject *mifitObject = new MIFitScriptObject(engine, this);
-        QScriptValue objectValue = engine->newQObject(mifitObject);
-        engine->globalObject().setProperty("mifit", objectValue);
+        input.insert(connection, QByteArray());
+        connect(connection, SIGNAL(readyRead()),
+                this, SLOT(readClient()));
+        connect(connection, SIGNAL(disconnected()),
+                this, SLOT(clientDisconnected()));
     }
+}
 
-    QLocalSocket *connection = localServer->nextPendingConnection();
-    connect(connection, SIGNAL(disconnected()),
-            connection, SLOT(deleteLater()));
-    if (connection)
+bool LocalSocketScript::readFrame(QByteArray &buffer, quint32 &type, QString &script, bool &error, bool &untyped)
+{
+    // A frame is a quint32 count of the bytes after it, a quint32 type and
+    // a QString, which is its own quint32 byte count and UTF-16 data
+    error = false;
+    untyped = false;
+    if (buffer.size() < 8)
+        return false;
+    const uchar *data = reinterpret_cast<const uchar*>(buffer.constData());
+    quint32 size = qFromBigEndian<quint32>(data);
+
+    // An untyped frame has the QString's count straight after its own,
+    // which a typed one, at least 8 bytes with a type under 4, cannot
+    quint32 second = qFromBigEndian<quint32>(data + 4);
+    if (second == size - 4 || (size == 4 && second == 0xffffffff))
     {
-        QString script;
-        bool moreInput = true;
-        QDataStream stream(connection);
-        stream.setVersion(QDataStream::Qt_4_5);
-        quint32 dataSize = 0;
-        while (moreInput)
+        untyped = true;
+        return false;
+    }
+    if (size < 8 || size > 8 + maxScriptBytes)
+    {
+        error = true;
+        return false;
+    }
+    if (static_cast<quint32>(buffer.size()) < 4 + size)
+        return false;
+    quint32 length = qFromBigEndian<quint32>(data + 8);
+    if (length == 0xffffffff)
+        length = 0;
+    if (length != size - 8 || (length & 1))
+    {
+        error = true;
+        return false;
+    }
+
+    QDataStream stream(buffer);
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream >> size >> type >> script;
+    buffer.remove(0, 4 + size);
+    return true;
+}
+
+void LocalSocketScript::sendFrame(QLocalSocket *client, ReplyType type, const QString &text)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_5);
+
+    out << quint32(0) << quint32(type) << text;
+
+    out.device()->seek(0);
+    out << quint32(data.size() - sizeof(quint32));
+    client->write(data);
+    client->flush();
+}
+
+void LocalSocketScript::readClient()
+{
+    QLocalSocket *client = qobject_cast<QLocalSocket*>(sender());
+    if (!client || !input.contains(client))
+        return;
+
+    // Work on a copy: a reply that fails to send disconnects the client,
+    // and the disconnect removes its buffer
+    QByteArray buffer = input.value(client) + client->readAll();
+    input.insert(client, QByteArray());
+
+    quint32 type;
+    QString script;
+    bool error;
+    bool untyped;
+    bool queued = false;
+    while (readFrame(buffer, type, script, error, untyped))
+    {
+        if (type == CancelRequest)
         {
-            if (!connection->waitForReadyRead())
-                break;
-            if (dataSize == 0)
-            {
-                if (connection->bytesAvailable() < sizeof(quint32))
-                    continue;
-                stream >> dataSize;
-            }
-            if (connection->bytesAvailable() < dataSize)
-                continue;
-            stream >> script;
-            moreInput = false;
+            if (script.isEmpty())
+                cancel(client, 0);
+            else
+                cancel(script);
+            continue;
         }
-        Logger::debug(("script: " + script).toStdString());
-
-        QString result;
-        QScriptValue scriptResult = engine->evaluate(script, name_);
-        if (engine->hasUncaughtException())
+        if (type == StatusRequest && !hasRepliesDue(client))
+        {
+            sendStatus(client);
+            if (!input.contains(client))
+                return;
+            continue;
+        }
+        if (type != ScriptRequest && type != StatusRequest)
+        {
+            error = true;
+            break;
+        }
+        if (type == ScriptRequest)
+            Logger::debug(("script: " + script).toStdString());
+        Request request;
+        request.client = client;
+        request.type = static_cast<RequestType>(type);
+        request.id = 0;
+        request.script = script;
+        request.cancelled = false;
+        if (type == ScriptRequest)
         {
-            QScriptValue exception = engine->uncaughtException();
-            int lineNumber = engine->uncaughtExceptionLineNumber();
-            QStringList backtrace = engine->uncaughtExceptionBacktrace();
-            result = QString("Exception %1 on line %2\n\t%3")
-                     .arg(exception.toString()).arg(lineNumber)
-                     .arg(backtrace.join("\n\t"));
+            request.id = nextId++;
+            sendFrame(client, AcceptedReply, QString::number(request.id));
+            if (!input.contains(client))
+                return;
         }
-        else
+        requests.enqueue(request);
+        queued = true;
+    }
+    if (untyped)
+    {
+        rejectUntyped(client);
+        return;
+    }
+    if (error)
+    {
+        Logger::log("Script client sent an invalid frame, disconnecting");
+        input.remove(client);
+        client->abort();
+        return;
+    }
+    input.insert(client, buffer);
+    if (queued && !running)
+        QTimer::singleShot(0, this, SLOT(runNext()));
+}
+
+void LocalSocketScript::rejectUntyped(QLocalSocket *client)
+{
+    // Answered the way such a client reads a result, a count and a QString
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_5);
+    out << quint32(0)
+        << QString("Exception: the script socket now takes typed frames; use the mifit.py of this MIFit");
+    out.device()->seek(0);
+    out << quint32(data.size() - sizeof(quint32));
+    client->write(data);
+    client->flush();
+
+    Logger::log("Script client sent an untyped frame, disconnecting");
+    input.remove(client);
+    client->disconnectFromServer();
+}
+
+void LocalSocketScript::sendStatus(QLocalSocket *client)
+{
+    // "running <percent> queued <count> ids <running> <queued>..." or
+    // "idle queued <count> ids <queued>..."
+    QString text = running ? QString("running %1").arg(progress) : QString("idle");
+    text += QString(" queued %1 ids").arg(queuedCount());
+    if (running)
+        text += QString(" %1").arg(runningId);
+    foreach (const Request &request, requests)
+    {
+        if (request.type == ScriptRequest && !request.cancelled)
+            text += QString(" %1").arg(request.id);
+    }
+    sendFrame(client, StatusReply, text);
+}
+
+bool LocalSocketScript::cancel(const QString &target)
+{
+    if (target == "all")
+        return cancel(0, 0);
+    bool ok;
+    int id = target.toInt(&ok);
+    return ok && id > 0 && cancel(0, id);
+}
+
+bool LocalSocketScript::cancel(QLocalSocket *client, int id)
+{
+    // Cancels the scripts of the client, or the one with the id, or every
+    // one when neither is given. Cancelled scripts stay queued so that
+    // their replies keep their order.
+    bool found = false;
+    for (QQueue<Request>::iterator i = requests.begin(); i != requests.end(); ++i)
+    {
+        if (i->type != ScriptRequest || i->cancelled)
+            continue;
+        if ((client && i->client == client) || (id && i->id == id) || (!client && !id))
         {
-            result = scriptResult.toString();
+            i->cancelled = true;
+            found = true;
         }
+    }
+    if (running && !runningCancelled
+        && ((client && runningClient == client) || (id && runningId == id) || (!client && !id)))
+    {
+        runningCancelled = true;
+        found = true;
+        if (engine->isEvaluating())
+            engine->abortEvaluation();
+    }
+    return found;
+}
 
-        Logger::debug(("script result: " + result).toStdString());
+bool LocalSocketScript::hasRepliesDue(QLocalSocket *client) const
+{
+    if (running && runningClient == client)
+        return true;
+    foreach (const Request &request, requests)
+    {
+        if (request.client == client)
+            return true;
+    }
+    return false;
+}
 
-        QByteArray data;
-        QDataStream out(&data, QIODevice::WriteOnly);
-        out.setVersion(QDataStream::Qt_4_5);
+int LocalSocketScript::queuedCount() const
+{
+    int count = 0;
+    foreach (const Request &request, requests)
+    {
+        if (request.type == ScriptRequest && !request.cancelled)
+            ++count;
+    }
+    return count;
+}
 
-        out << quint32(0) << result;
+void LocalSocketScript::clientDisconnected()
+{
+    QLocalSocket *client = qobject_cast<QLocalSocket*>(sender());
+    if (!client)
+        return;
+    input.remove(client);
+    cancel(client, 0);
+    client->deleteLater();
+}
+
+QString LocalSocketScript::evaluate(const QString &script, bool &exception)
+{
+    QString result;
+    QScriptValue scriptResult = engine->evaluate(script, name_);
+    exception = engine->hasUncaughtException();
+    if (exception)
+    {
+        QScriptValue exception = engine->uncaughtException();
+        int lineNumber = engine->uncaughtExceptionLineNumber();
+        QStringList backtrace = engine->uncaughtExceptionBacktrace();
+        result = QString("Exception %1 on line %2\n\t%3")
+                 .arg(exception.toString()).arg(lineNumber)
+                 .arg(backtrace.join("\n\t"));
+    }
+    else
+    {
+        result = scriptResult.toString();
+    }
+    return result;
+}
+
+void LocalSocketScript::runNext()
+{
+    // Scripts are run from the event loop one at a time. The engine yields
+    // to the event loop while a script runs, which can call this again
+    // from a timer or a nested dialog; only the outermost call runs.
+    if (running)
+        return;
+
+    while (!requests.isEmpty())
+    {
+        Request request = requests.dequeue();
+        if (request.client.isNull())
+            continue;
+
+        if (request.type == StatusRequest)
+        {
+            // Its turn has come, so every earlier reply has been sent
+            if (request.client->state() == QLocalSocket::ConnectedState)
+                sendStatus(request.client);
+            continue;
+        }
 
-        out.device()->seek(0);
-        out << quint32(data.size() - sizeof(quint32));
-        connection->write(data);
-        connection->flush();
-        connection->waitForDisconnected();
-        connection->close();
+        ReplyType type = CancelledReply;
+        QString result;
+        if (!request.cancelled)
+        {
+            running = true;
+            runningCancelled = false;
+            runningClient = request.client;
+            runningId = request.id;
+            progress = 0;
+
+            bool exception;
+            result = evaluate(request.script, exception);
+            type = exception ? ExceptionReply : ResultReply;
+            Logger::debug(("script result: " + result).toStdString());
+
+            running = false;
+            runningClient = 0;
+            runningId = 0;
+            // A cancel during the script aborts it, which is not an
+            // exception of the script's own
+            if (runningCancelled)
+                type = CancelledReply;
+        }
+        if (!request.client.isNull() && request.client->state() == QLocalSocket::ConnectedState)
+            sendFrame(request.client, type, type == CancelledReply ? QString() : result);
         Logger::debug("script done");
+
+        // Give the event loop a turn between scripts
+        if (type != CancelledReply)
+            break;
     }
+
+    if (!requests.isEmpty())
+        QTimer::singleShot(0, this, SLOT(runNext()));
 }
@@ -1,27 +1,115 @@
 #ifndef script_LocalSocketScript_h
 #define script_LocalSocketScript_h
 
+#include <QByteArray>
+#include <QHash>
 #include <QObject>
+#include <QPointer>
+#include <QQueue>
 #include <QString>
 class QLocalServer;
+class QLocalSocket;
 class QScriptEngine;
 
+/**
+ * Serves scripts sent over a local socket. Any number of clients may be
+ * connected at once. Each frame, in either direction, is a quint32 count
+ * of the bytes that follow, a quint32 type and a QString. Several frames
+ * may be sent without waiting; each script and status request gets one
+ * reply, in the order the client sent them. Input is read as it arrives,
+ * so a slow client never blocks the GUI. Scripts from all clients run one
+ * at a time in a shared engine that processes events while it runs, so
+ * rendering continues during long scripts.
+ *
+ * Each script is given an id when it arrives, which is sent back at once
+ * in an accepted frame ahead of the replies still due. A status request
+ * is answered with the progress of the running script, as set by
+ * mifit.progress(), the number of scripts queued and the ids of the
+ * running and queued scripts; it is answered at once unless the client
+ * still has replies due, so a second connection can watch a long script.
+ * A cancel request, which has no reply, names what it cancels: a script
+ * id, "all", or nothing for the client's own scripts. A cancelled script
+ * that is running is aborted, and each cancelled script replies with a
+ * cancelled frame in turn.
+ *
+ * Frames of the earlier untyped format, a count and a QString, are
+ * answered in that format with an error and the client is disconnected.
+ */
 class LocalSocketScript : public QObject
 {
     Q_OBJECT
 
 public:
+    // The type of a frame sent by a client
+    enum RequestType
+    {
+        ScriptRequest = 0,
+        StatusRequest = 1,
+        CancelRequest = 2
+    };
+
+    // The type of a frame sent back
+    enum ReplyType
+    {
+        ResultReply = 0,
+        ExceptionReply = 1,
+        CancelledReply = 2,
+        StatusReply = 3,
+        AcceptedReply = 4
+    };
+
     LocalSocketScript(QObject *parent = 0);
 
     QString name() const;
 
+    /**
+     * Progress in percent of the script now running, for status replies.
+     */
+    void setProgress(int percent);
+
+    /**
+     * Cancels the script with the id given, or every script for "all".
+     * Returns false if nothing matched.
+     */
+    bool cancel(const QString &target);
+
 private:
+    struct Request
+    {
+        QPointer<QLocalSocket> client;
+        RequestType type;
+        int id;
+        QString script;
+        bool cancelled;
+    };
+
     QString name_;
     QLocalServer *localServer;
     QScriptEngine *engine;
+    QHash<QLocalSocket*, QByteArray> input;
+    QQueue<Request> requests;
+    QPointer<QLocalSocket> runningClient;
+    int runningId;
+    int nextId;
+    bool running;
+    bool runningCancelled;
+    int progress;
+
+    void createEngine();
+    bool readFrame(QByteArray &buffer, quint32 &type, QString &script, bool &error, bool &untyped);
+    void sendFrame(QLocalSocket *client, ReplyType type, const QString &text);
+    void rejectUntyped(QLocalSocket *client);
+    void sendStatus(QLocalSocket *client);
+    bool cancel(QLocalSocket *client, int id);
+    bool hasRepliesDue(QLocalSocket *client) const;
+    int queuedCount() const;
+    QString evaluate(const QString &script, bool &exception);
 
 private slots:
     void handleConnection();
+    void readClient();
+    void clientDisconnected();
+    void runNext();
 };
 
 #endif // ifndef script_LocalSocketScript_h
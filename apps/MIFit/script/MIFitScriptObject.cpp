@@ -5,6 +5,7 @@
 #include <QFileInfo>
 #include <QScriptEngine>
 #include <ui/uilib.h>
+#include "LocalSocketScript.h"
 
 MIFitScriptObject::MIFitScriptObject(QScriptEngine *engine, QObject *parent)
     : QObject(parent),
@@ -49,6 +50,26 @@ bool MIFitScriptObject::writeCurrentModel(const QString &file)
     return model->SavePDBFile(fileInfo.absoluteFilePath().toAscii().constData());
 }
 
+bool MIFitScriptObject::writeValidationReport(const QString &file)
+{
+    MIGLWidget *doc = MIMainWindow::instance()->currentMIGLWidget();
+    if (!doc)
+    {
+        engine->currentContext()->throwError("no current document");
+        return false;
+    }
+    Molecule *model = doc->GetDisplaylist()->GetCurrentModel();
+    if (!model)
+    {
+        engine->currentContext()->throwError("no current model");
+        return false;
+    }
+    ValidationReport report;
+    report.Build(model, doc->GetDisplaylist()->GetCurrentMap(), MIFitGeomRefiner(), MIFitRamaTable());
+    QFileInfo fileInfo(file);
+    return report.Write(fileInfo.absoluteFilePath().toAscii().constData());
+}
+
 QStringList MIFitScriptObject::dictionaryResidueList()
 {
     QStringList result;
@@ -77,7 +98,7 @@ void MIFitScriptObject::addJob(const QString &menuName, const QString &jobName,
     MIMainWindow::instance()->addJob(menuName, jobName, executable, arguments, workingDirectory);
 }
 
-void MIFitScriptObject::setJobWorkDir(const QString &jobId, const QString &workDir)
+BatchJob *MIFitScriptObject::findJob(const QString &jobId)
 {
     bool ok;
     unsigned long jobIdNum = jobId.toULong(&ok);
@@ -87,11 +108,72 @@ void MIFitScriptObject::setJobWorkDir(const QString &jobId, const QString &workD
         foreach (BatchJob *job, jobs)
         {
             if (jobIdNum == job->jobId())
-            {
-                job->setWorkingDirectory(workDir);
-                break;
-            }
+                return job;
         }
     }
+    return NULL;
+}
 
+void MIFitScriptObject::setJobWorkDir(const QString &jobId, const QString &workDir)
+{
+    BatchJob *job = findJob(jobId);
+    if (job)
+        job->setWorkingDirectory(workDir);
+}
+
+QString MIFitScriptObject::submitJob(const QString &jobName, const QString &executable, const QStringList &arguments, const QString &workingDirectory, int threads, int priority, const QStringList &after)
+{
+    QList<BatchJob*> dependencies;
+    foreach (QString jobId, after)
+    {
+        BatchJob *dependency = findJob(jobId);
+        if (!dependency)
+        {
+            engine->currentContext()->throwError("no job " + jobId);
+            return QString();
+        }
+        dependencies += dependency;
+    }
+
+    BatchJobManager *manager = MIMainWindow::instance()->GetJobManager();
+    BatchJob *job = manager->CreateJob();
+    job->setJobName(jobName);
+    if (executable == "python")
+        job->setProgram(BatchJobManager::pythonExe());
+    else
+        job->setProgram(executable);
+    job->setArguments(arguments);
+    job->setWorkingDirectory(workingDirectory);
+    job->setThreads(threads);
+    job->setPriority(priority);
+    foreach (BatchJob *dependency, dependencies)
+    {
+        job->addDependency(dependency);
+    }
+    manager->SubmitJob(job);
+    return QString::number(job->jobId());
+}
+
+bool MIFitScriptObject::setJobPriority(const QString &jobId, int priority)
+{
+    BatchJob *job = findJob(jobId);
+    if (!job)
+        return false;
+    job->setPriority(priority);
+    return true;
+}
+
+void MIFitScriptObject::progress(int percent)
+{
+    LocalSocketScript *server = qobject_cast<LocalSocketScript*>(parent());
+    if (server)
+        server->setProgress(percent);
+}
+
+bool MIFitScriptObject::cancel(const QString &target)
+{
+    LocalSocketScript *server = qobject_cast<LocalSocketScript*>(parent());
+    if (!server)
+        return false;
+    return server->cancel(target);
 }
@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <QStringList>
+class BatchJob;
 class QMenu;
 class QScriptEngine;
 
@@ -20,12 +21,19 @@ public slots:
     QString version();
     QString directory();
     bool writeCurrentModel(const QString &file);
+    bool writeValidationReport(const QString &file);
     QStringList dictionaryResidueList();
     QStringList spacegroupList();
     void addJob(const QString &menuName, const QString &jobName, const QString &executable, const QStringList &arguments, const QString &workingDirectory);
     void setJobWorkDir(const QString &jobId, const QString &workDir);
+    QString submitJob(const QString &jobName, const QString &executable, const QStringList &arguments, const QString &workingDirectory, int threads, int priority, const QStringList &after);
+    bool setJobPriority(const QString &jobId, int priority);
+    void progress(int percent);
+    bool cancel(const QString &target);
 
 private:
+    BatchJob *findJob(const QString &jobId);
+
     QScriptEngine *engine;
     QMenu *jobMenu;
 };
@@ -21,6 +21,7 @@
 
 #include <QApplication>
 #include <QColorDialog>
+#include <QDesktopServices>
 #include <QDir>
 #include <QFileDialog>
 #include <QFileInfo>
@@ -204,7 +205,9 @@ Application::~Application()
     settings.setValue("Options/MouseMode", xfitMouseMode);
     settings.setValue("Options/IncrementallyColorModels", incrementallyColorModels);
     settings.setValue("Options/DimNonactiveModels", dimNonactiveModels);
-    settings.setValue("Options/ConcurrentJobLimit", concurrentJobLimit);
+    settings.setValue("Options/JobWorkers", jobWorkers);
+    settings.setValue("Options/SessionSnapshots", sessionSnapshots);
+    settings.setValue("Options/UndoMemory", undoMemory);
 
     Write();
 
@@ -680,7 +683,9 @@ void Application::Init()
     xfitMouseMode = settings.value("Options/MouseMode", false).toBool();
     incrementallyColorModels = settings.value("Options/IncrementallyColorModels", true).toBool();
     dimNonactiveModels = settings.value("Options/DimNonactiveModels", true).toBool();
-    concurrentJobLimit = settings.value("Options/ConcurrentJobLimit", 1).toInt();
+    jobWorkers = settings.value("Options/JobWorkers", 0).toInt();
+    sessionSnapshots = settings.value("Options/SessionSnapshots", false).toBool();
+    undoMemory = settings.value("Options/UndoMemory", 32).toInt();
 
     SetGammaCorrection(1.0);
     BuildPalette();
@@ -718,6 +723,7 @@ void Application::Init()
     }
 
     geomrefiner = new GeomRefiner();
+    geomrefiner->SetUndoMemoryBudget((size_t)undoMemory * 1024 * 1024);
 
     // enable setting of colors when reading files
     MIRegisterColorSetter(new myColorSetter());
@@ -728,6 +734,7 @@ void Application::Init()
 void Application::AfterInit()
 {
     LoadDictionary();
+    geomrefiner->SetRamaTable(MIFitRamaTable());
 }
 
 //FIXME: previous dictionary is leaked!
@@ -1251,6 +1258,31 @@ chemlib::MIMolDictionary *MIFitDictionary()
     return &MIFitGeomRefiner()->dict;
 }
 
+const RamaTable *MIFitRamaTable()
+{
+    static RamaTable table;
+    static bool loaded = false;
+    if (!loaded)
+    {
+        std::string dataDir = Application::instance()->GetMolimageHome();
+#ifndef _WIN32
+        dataDir += "/data";
+#else
+        dataDir += "\\data";
+#endif
+        // The splines are kept in a binary cache to skip parsing the tables
+        QDir cacheDir(QDesktopServices::storageLocation(QDesktopServices::CacheLocation));
+        cacheDir.mkpath(".");
+        std::string cacheFile = cacheDir.absoluteFilePath("rama500.bin").toStdString();
+        if (!table.Load(dataDir, cacheFile))
+        {
+            Logger::log("Unable to read the Ramachandran tables from %s", dataDir.c_str());
+        }
+        loaded = true;
+    }
+    return table.IsLoaded() ? &table : NULL;
+}
+
 QString Application::latestFileBrowseDirectory(const QString &path)
 {
     const QString LATEST_FILE_BROWSE_DIRECTORY("latestFileBrowseDirectory");
@@ -13,6 +13,7 @@
 class MISingleInstanceChecker;
 class GeomRefiner;
 class QSettings;
+class RamaTable;
 
 class Application : public QApplication
 {
@@ -56,7 +57,9 @@ class Application : public QApplication
     void BuildPalette();
     PaletteColor BackgroundColor;
     int GammaCorrection;
-    int concurrentJobLimit;
+    int jobWorkers; // threads for batch jobs, 0 for one per physical core
+    bool sessionSnapshots; // write a binary snapshot beside each saved session
+    int undoMemory; // megabytes of refinement history kept for Undo
 
     chemlib::Residue *ResidueBuffer;
 
@@ -194,6 +197,8 @@ public:
 
 GeomRefiner *MIFitGeomRefiner();
 chemlib::MIMolDictionary *MIFitDictionary();
+// Ramachandran tables from the data directory, or NULL if they are missing
+const RamaTable *MIFitRamaTable();
 
 class QProgressDialog;
 
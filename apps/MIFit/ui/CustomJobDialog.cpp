@@ -31,6 +31,8 @@ CustomJobDialog::CustomJobDialog(QWidget *parent)
     new MIBrowsePair(modelPushButton, modelLineEdit, "PDB file (*.pdb *.ent)");
     new MIBrowsePair(dataPushButton, dataLineEdit, "PDB file (*.pdb *.ent)");
 
+    clearAfterJobs();
+
     _okButton = buttonBox->button(QDialogButtonBox::Ok);
     _okButton->setDefault(true);
 
@@ -110,6 +112,27 @@ void CustomJobDialog::setDataFile(const QString &dataFile)
     dataLineEdit->setText(dataFile);
 }
 
+void CustomJobDialog::setThreads(int threads)
+{
+    threadsSpinBox->setValue(threads);
+}
+
+void CustomJobDialog::setPriority(int priority)
+{
+    prioritySpinBox->setValue(priority);
+}
+
+void CustomJobDialog::clearAfterJobs()
+{
+    afterComboBox->clear();
+    afterComboBox->addItem("None", 0);
+}
+
+void CustomJobDialog::addAfterJob(const QString &label, unsigned long jobId)
+{
+    afterComboBox->addItem(label, qulonglong(jobId));
+}
+
 QString CustomJobDialog::jobName() const
 {
     return jobNameLineEdit->text();
@@ -148,6 +171,21 @@ QString CustomJobDialog::dataFile() const
     return dataLineEdit->text();
 }
 
+int CustomJobDialog::threads() const
+{
+    return threadsSpinBox->value();
+}
+
+int CustomJobDialog::priority() const
+{
+    return prioritySpinBox->value();
+}
+
+unsigned long CustomJobDialog::afterJob() const
+{
+    return static_cast<unsigned long>(afterComboBox->itemData(afterComboBox->currentIndex()).toULongLong());
+}
+
 void CustomJobDialog::showControls()
 {
     stackedWidget->setCurrentIndex(1);
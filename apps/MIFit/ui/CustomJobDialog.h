@@ -29,6 +29,11 @@ public:
     void setWorkingDirectory(const QString &dir);
     void setModelFile(const QString &modelFile);
     void setDataFile(const QString &dataFile);
+    void setThreads(int threads);
+    void setPriority(int priority);
+    // The jobs the new one can be made to wait for
+    void clearAfterJobs();
+    void addAfterJob(const QString &label, unsigned long jobId);
 
     QString jobName() const;
     QString program() const;
@@ -37,6 +42,10 @@ public:
     QString workingDirectory() const;
     QString modelFile() const;
     QString dataFile() const;
+    int threads() const;
+    int priority() const;
+    // The job to wait for, or 0 for none
+    unsigned long afterJob() const;
 
 private slots:
     void validateTimeout();
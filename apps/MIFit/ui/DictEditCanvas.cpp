@@ -2775,11 +2775,17 @@ void DictEditCanvas::generateConformers(bool replace)
         confs.Clear();
     }
 
+    ConfEnsemble generated;
     int nConf = conflib::GenerateEnsemble(model->residuesBegin(),
-                                          model,
                                           geomrefiner->dict.RefiBonds,
                                           geomrefiner->dict.RefiTorsions,
-                                          confs);
+                                          generated);
+    // the editor keeps its conformers in a GeomSaver on the model
+    for (int i = 0; i < generated.NumberSets(); ++i)
+    {
+        generated.Restore(i);
+        confs.Save(model->residuesBegin(), 1, model);
+    }
     on_conformerSpinbox_valueChanged(1);
 
     std::string message = ::format("Generated %d conformers", nConf);
@@ -16,7 +16,9 @@ GeneralPreferences::GeneralPreferences(QWidget *parent)
     incrementallyColorCheckBox->setChecked(app->incrementallyColorModels);
     xfitMouseCheckBox->setChecked(app->xfitMouseMode);
     saveOnCloseCheckBox->setChecked(app->onCloseSaveActiveModelToPdb);
-    concurrentJobsSpinBox->setValue(app->concurrentJobLimit);
+    sessionSnapshotCheckBox->setChecked(app->sessionSnapshots);
+    jobWorkersSpinBox->setValue(app->jobWorkers);
+    undoMemorySpinBox->setValue(app->undoMemory);
 
     bool breakByDiscontinuityPref = settings.value("Options/breakByDiscontinuity", true).toBool();
     bool breakByNonpeptidePref = settings.value("Options/breakByNonpeptide", false).toBool();
@@ -34,7 +36,10 @@ void GeneralPreferences::savePreferences()
     app->incrementallyColorModels = incrementallyColorCheckBox->isChecked();
     app->xfitMouseMode = xfitMouseCheckBox->isChecked();
     app->onCloseSaveActiveModelToPdb = saveOnCloseCheckBox->isChecked();
-    app->concurrentJobLimit = concurrentJobsSpinBox->value();
+    app->sessionSnapshots = sessionSnapshotCheckBox->isChecked();
+    app->jobWorkers = jobWorkersSpinBox->value();
+    app->undoMemory = undoMemorySpinBox->value();
+    MIFitGeomRefiner()->SetUndoMemoryBudget((size_t)app->undoMemory * 1024 * 1024);
 
     settings.setValue("Options/breakByDiscontinuity", breakOnDiscontinuityCheckBox->isChecked());
     settings.setValue("Options/breakByNonpeptide", breakOnNonPeptideCheckBox->isChecked());
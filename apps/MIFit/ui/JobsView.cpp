@@ -326,7 +326,11 @@ void JobsView::addJobToTree(BatchJob *job)
 void JobsView::stylizeItem(QTreeWidgetItem *id, BatchJob *job)
 {
     int image = 1;
-    if (job->isRunning())
+    if (job->isQueued())
+    {
+        image = 1;
+    }
+    else if (job->isRunning())
     {
         image = 2;
     }
@@ -48,6 +48,8 @@
 #include <QLabel>
 #include <QInputDialog>
 #include <QSettings>
+#include <QCryptographicHash>
+#include <QFile>
 #include <QFileDialog>
 #include <QGraphicsItem>
 #include <QGraphicsObject>
@@ -61,6 +63,7 @@
 #include "core/corelib.h"
 #include "core/ViewPointIO.h"
 #include <util/utillib.h>
+#include <util/SnapshotFile.h>
 #include "ui/MIColorPickerDlg.h"
 #include "ui/MIDialog.h"
 
@@ -8756,7 +8759,6 @@ void MIGLWidget::findLigandFit()
     }
 
     GeomRefiner *geomRefiner = MIFitGeomRefiner();
-    GeomSaver entryConfs;
     const char *type = fitres->type().c_str();
     Residue *res = geomRefiner->dict.GetDictResidue(type, 0);
     if (res == NULL)
@@ -8765,20 +8767,20 @@ void MIGLWidget::findLigandFit()
         Logger::log("Unable to find dictionary entry for residue %s", type);
         return;
     }
-    GetConfs(entryConfs, res, &geomRefiner->dict, fitmol);
-    Logger::debug("%d conformations before generation", entryConfs.NumberSets());
-    if (entryConfs.NumberSets() <= 2)
+    int entryConfs = geomRefiner->dict.CountConformers(type);
+    Logger::debug("%d conformations before generation", entryConfs);
+    if (entryConfs <= 1)
     {
         int numberOfConformations = conflib::GenerateEnsemble(geomRefiner->dict.GetDictResidue(type, 0),
                                                               *(geomRefiner->dict.GetDictBonds(type, 0)), &geomRefiner->dict, true);
         Logger::log("Generated %d confirmations", numberOfConformations);
     }
 
-    GeomSaver confs;
+    ConfEnsemble confs;
     if (fitres != 0
         && fitres->atomCount() == (int)CurrentAtoms.size()
         && AtomVectMatchesRes(CurrentAtoms, fitres)
-        && GetConfs(confs, fitres, &geomRefiner->dict, fitmol))
+        && GetConfs(confs, fitres, &geomRefiner->dict))
     {
         Logger::log("Using %d conformations of residue %s to fit", confs.NumberSets(), fitres->type().c_str());
     }
@@ -8970,6 +8972,47 @@ void MIGLWidget::OnUpdateFindGeomErrors(QAction *action)
     action->setEnabled(GetDisplaylist()->CurrentItem() != NULL && MIBusyManager::instance()->Busy() == false);
 }
 
+void MIGLWidget::OnValidationReport()
+{
+    if (MIBusyManager::instance()->Busy())
+    {
+        return;
+    }
+    Molecule *model = GetDisplaylist()->GetCurrentModel();
+    if (!model)
+    {
+        return;
+    }
+    const std::string &pathname = MIFileSelector("Save Validation Report", "", "", "csv",
+                                                 "CSV files (*.csv)|*.csv|JSON files (*.json)|*.json|All files (*.*)|*.*", MI_SAVE_MODE);
+    if (pathname.empty())
+    {
+        return;
+    }
+    ValidationReport report;
+    report.Build(model, GetDisplaylist()->GetCurrentMap(), MIFitGeomRefiner(), MIFitRamaTable());
+    if (!report.Write(pathname))
+    {
+        Logger::message("Unable to write the validation report to %s", pathname.c_str());
+        return;
+    }
+    int geometry = 0, rama = 0;
+    for (size_t i = 0; i < report.residues.size(); ++i)
+    {
+        const ResidueValidation &r = report.residues[i];
+        if (r.badBonds + r.badAngles + r.badPlanes + r.badTorsions + r.bumps > 0)
+        {
+            geometry++;
+        }
+        if (r.ramaRegion == "outlier")
+        {
+            rama++;
+        }
+    }
+    Logger::log("Validated %d residues: %d with geometry errors, %d Ramachandran outliers. Report written to %s",
+                (int)report.residues.size(), geometry, rama, pathname.c_str());
+}
+
 void MIGLWidget::OnClearGeomAnnotations()
 {
     Molecule *model = GetDisplaylist()->CurrentItem();
@@ -9053,10 +9096,16 @@ void MIGLWidget::OnFindLigandDensity()
         std::string s = ::format("Added %d atoms from %s to %s", n, resid(first).c_str(), resid(last).c_str());
         Logger::log(s.c_str());
         clusters.SetMaxDistance(2.3F);
-        Residue *clusterResidues = clusters.BuildClusters(first, last, ClusterSize);
+        Residue *clusterResidues = clusters.BuildClusters(first, last, ClusterSize, emap, 50.0F);
         //FreeResidueList(first);
         s = ::format("Found %d clusters (labeled as CLUST and put at the end of the model)", (int)clusters.size());
         Logger::log(s.c_str());
+        for (size_t i = 0; i < clusters.size(); ++i)
+        {
+            Logger::log("Cluster %d: %d atoms, volume %0.1f A^3, peak %0.2f sigma, integrated density %0.1f",
+                        (int)i+1, (int)clusters[i].atoms.size(), clusters[i].volume, clusters[i].peak,
+                        clusters[i].integrated);
+        }
         Logger::footer(s.c_str());
         if (clusterResidues)
         {
@@ -9217,6 +9266,83 @@ void MIGLWidget::OnMapReindex()
     map->Reindex(reindex_mat);
 }
 
+// Atoms of the chain of the picked atom, or of the current model if
+// there is no pick
+static void NCSMaskAtoms(Stack *stack, Molecule *model, std::vector<MIAtom*> &atoms)
+{
+    atoms.clear();
+    Residue *first = model->residuesBegin();
+    Residue *last = NULL;
+    if (!stack->empty())
+    {
+        MIAtom *a;
+        Residue *res;
+        Molecule *m;
+        stack->Peek(a, res, m);
+        if (m == model && Monomer::isValid(res))
+        {
+            getchain(res->chain_id(), model->residuesBegin(), first, last);
+        }
+    }
+    for (Residue *res = first; res != NULL; res = res->next())
+    {
+        atoms.insert(atoms.end(), res->atoms().begin(), res->atoms().end());
+        if (res == last)
+        {
+            break;
+        }
+    }
+}
+
+void MIGLWidget::OnMapNCSAverage()
+{
+    Displaylist *Models = GetDisplaylist();
+    EMap *map = Models->GetCurrentMap();
+    Molecule *model = Models->CurrentItem();
+    if (!map || !map->HasDensity())
+    {
+        return;
+    }
+    if (map->mapheader->nNCRSymmops == 0)
+    {
+        Logger::message("The crystal of this map has no NCS operators");
+        return;
+    }
+    std::vector<MIAtom*> atoms;
+    if (Molecule::isValid(model))
+    {
+        NCSMaskAtoms(AtomStack, model, atoms);
+    }
+    EMap *averaged = new EMap;
+    if (!map->NCSAverage(averaged, atoms))
+    {
+        delete averaged;
+        return;
+    }
+    Models->AddMap(averaged);
+    doMapContour(averaged);
+}
+
+void MIGLWidget::OnMapRefineNCS()
+{
+    Displaylist *Models = GetDisplaylist();
+    EMap *map = Models->GetCurrentMap();
+    Molecule *model = Models->CurrentItem();
+    if (!map || !map->HasDensity() || !Molecule::isValid(model))
+    {
+        return;
+    }
+    if (map->mapheader->nNCRSymmops == 0)
+    {
+        Logger::message("The crystal of this map has no NCS operators");
+        return;
+    }
+    std::vector<MIAtom*> atoms;
+    NCSMaskAtoms(AtomStack, model, atoms);
+    int changed = map->RefineNCSOperators(atoms);
+    Logger::log("Refined %d NCS operators", changed);
+}
+
 void MIGLWidget::OnUpdateMapReindex(QAction *action)
 {
     EMap *map = GetDisplaylist()->GetCurrentMap();
@@ -11229,7 +11355,11 @@ bool MIGLWidget::OnOpenDocument(const std::string &path)
     {
         if (IsXMLDocument(pathname))
         {
-            LoadPDBFile(pathname);
+            bool fromSnapshot = LoadSessionSnapshot(pathname);
+            if (!fromSnapshot)
+            {
+                LoadPDBFile(pathname);
+            }
             if (!file.open(pathname, "r"))
             {
                 std::string s("MIGLWidget::OnOpenDocument:Can't open file: ");
@@ -11243,7 +11373,7 @@ bool MIGLWidget::OnOpenDocument(const std::string &path)
             file.rewind();
             // scan for maps
             std::string col_names("");
-            while (file.gets(buf, sizeof buf) != NULL)
+            while (!fromSnapshot && file.gets(buf, sizeof buf) != NULL)
             {
                 if (strncasecmp(buf, "mapcolumns", 10) == 0)
                 {
@@ -11488,19 +11618,25 @@ bool MIGLWidget::OnNewDocument()
 
 bool MIGLWidget::SaveDocument(const std::string &pathname)
 {
-    XMLArchive ar(pathname.c_str(), CArchive::store);
-    // check to see if file was opened
-    if (!ar.IsOpened())
     {
-        return false;
+        XMLArchive ar(pathname.c_str(), CArchive::store);
+        // check to see if file was opened
+        if (!ar.IsOpened())
+        {
+            return false;
+        }
+        Serialize(ar);
     }
-    Serialize(ar);
     std::string ext = file_extension(pathname.c_str());
     if (strcasecmp("mlw", ext.c_str()) == 0)
     {
         Modify(false);
         SetFilename(pathname);
         SetDocumentSaved(true);
+        if (Application::instance()->sessionSnapshots)
+        {
+            SaveSessionSnapshot(pathname);
+        }
     }
     std::string s = "Saved ";
     s += pathname;
@@ -11508,6 +11644,165 @@ bool MIGLWidget::SaveDocument(const std::string &pathname)
     return true;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Binary session snapshots.
+// The .mlw file remains the session of record; the snapshot beside it holds
+// the models and the computed map grids in a form that can be mapped and
+// restored directly. It is only used when the size and MD5 digest of the
+// .mlw file it recorded still match, since a copy or a save within the same
+// second can leave the modification time unchanged. Writing one is opt-in
+// (Options/SessionSnapshots) as it holds full map grids and reflections.
+
+static const quint32 SESSION_SNAPSHOT_VERSION = 2;
+
+static std::string SessionSnapshotPath(const std::string &pathname)
+{
+    return pathname + ".snapshot";
+}
+
+static std::string SessionFileDigest(const char *pathname)
+{
+    QFile file(pathname);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return std::string();
+    }
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    while (!file.atEnd())
+    {
+        hash.addData(file.read(1 << 16));
+    }
+    QByteArray digest = hash.result();
+    return std::string(digest.constData(), digest.size());
+}
+
+bool MIGLWidget::SaveSessionSnapshot(const std::string &pathname)
+{
+    QFileInfo info(pathname.c_str());
+    std::string path = SessionSnapshotPath(pathname);
+    SnapshotWriter out;
+    if (!out.open(path.c_str(), SESSION_SNAPSHOT_VERSION))
+    {
+        Logger::log("Unable to write session snapshot %s", path.c_str());
+        return false;
+    }
+
+    quint32 nmodels = 0;
+    std::list<Molecule*>::iterator node;
+    for (node = Models->begin(); node != Models->end(); ++node)
+    {
+        ++nmodels;
+    }
+    out.beginSection(MISnapshotTag('D', 'O', 'C', ' '));
+    out.write((qint64)info.size());
+    out.writeString(SessionFileDigest(pathname.c_str()));
+    out.write(nmodels);
+    out.write((quint32)Models->MapCount());
+    out.endSection();
+
+    quint32 i = 0;
+    for (node = Models->begin(); node != Models->end(); ++node, ++i)
+    {
+        out.beginSection(MISnapshotTag('M', 'O', 'D', 'L'), i);
+        (*node)->SaveSnapshot(out);
+        out.endSection();
+    }
+    for (int imap = 0; imap < Models->MapCount(); ++imap)
+    {
+        out.beginSection(MISnapshotTag('E', 'M', 'A', 'P'), imap);
+        Models->GetMap(imap)->WriteSnapshot(out);
+        out.endSection();
+    }
+    if (!out.close())
+    {
+        Logger::log("Unable to write session snapshot %s", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool MIGLWidget::LoadSessionSnapshot(const char *pathname)
+{
+    SnapshotReader snapshot;
+    if (!snapshot.open(SessionSnapshotPath(pathname).c_str(), SESSION_SNAPSHOT_VERSION))
+    {
+        return false;
+    }
+
+    QFileInfo info(pathname);
+    SnapshotSection doc;
+    qint64 size = -1;
+    std::string digest;
+    quint32 nmodels = 0, nmaps = 0;
+    if (!snapshot.section(MISnapshotTag('D', 'O', 'C', ' '), 0, doc)
+        || !doc.read(size) || !doc.readString(digest) || !doc.read(nmodels) || !doc.read(nmaps)
+        || size != (qint64)info.size() || digest.empty()
+        || digest != SessionFileDigest(pathname))
+    {
+        return false;
+    }
+
+    // Restore everything before touching the display list, so that a
+    // damaged snapshot leaves the caller free to load the .mlw instead
+    std::vector<Molecule*> molecules;
+    std::vector<EMap*> maps;
+    bool ok = true;
+    for (quint32 i = 0; ok && i < nmodels; ++i)
+    {
+        SnapshotSection section;
+        Molecule *molecule = new Molecule(MoleculeType::XML);
+        molecules.push_back(molecule);
+        ok = snapshot.section(MISnapshotTag('M', 'O', 'D', 'L'), i, section)
+             && molecule->LoadSnapshot(section);
+    }
+    for (quint32 i = 0; ok && i < nmaps; ++i)
+    {
+        SnapshotSection section;
+        EMap *map = new EMap;
+        maps.push_back(map);
+        ok = snapshot.section(MISnapshotTag('E', 'M', 'A', 'P'), i, section)
+             && map->ReadSnapshot(section);
+    }
+    if (!ok)
+    {
+        Logger::log("Session snapshot for %s is damaged, reading the session file", pathname);
+        for (size_t i = 0; i < molecules.size(); ++i)
+        {
+            delete molecules[i];
+        }
+        for (size_t i = 0; i < maps.size(); ++i)
+        {
+            delete maps[i];
+        }
+        return false;
+    }
+
+    int nmodel = 1;
+    for (size_t i = 0; i < molecules.size(); ++i)
+    {
+        if (molecules[i]->residuesBegin() != molecules[i]->residuesEnd())
+        {
+            Models->AddItem(molecules[i]);
+            molecules[i]->modelnumber = nmodel;
+            nmodel++;
+        }
+        else
+        {
+            delete molecules[i];
+        }
+    }
+    for (size_t i = 0; i < maps.size(); ++i)
+    {
+        GetDisplaylist()->AddMap(maps[i]);
+        maps[i]->Read(pathname);
+        doMapContour(maps[i]);
+    }
+    newfile = 1;
+    SetTitle(pathname);
+    Modify(true);
+    return true;
+}
+
 bool MIGLWidget::OnSaveDocument(const std::string &pathname)
 {
     std::string filename = pathname;
@@ -261,6 +261,18 @@ public:
     //@}
     bool SaveDocument(const std::string &pathname);
     //@{
+    // Write a binary snapshot of the models and computed maps next to a
+    // saved session, so that reopening it needs no XML parsing or FFTs.
+    // Only called on save when the SessionSnapshots option is on.
+    //@}
+    bool SaveSessionSnapshot(const std::string &pathname);
+    //@{
+    // Restore the models and maps of a session from its snapshot. Returns
+    // false, having loaded nothing, unless the snapshot was written
+    // from the current contents of the .mlw file.
+    //@}
+    bool LoadSessionSnapshot(const char *pathname);
+    //@{
     // Returns true if the file is an XML .mlw file.
     // Otherwise it is assumed to
     // be the older Molw .mlw file format.
@@ -854,11 +866,22 @@ public slots:
     void OnFullScreen();
     void OnFindLigandDensity();
     void OnUpdateFindLigandDensity(QAction *action);
+    //@{
+    // Average the current map over the NCS copies of the picked chain, or
+    // of the whole model if nothing is picked, into a new map.
+    //@}
+    void OnMapNCSAverage();
+    //@{
+    // Refine the NCS operators of the current map against its density in
+    // the picked chain or the whole model.
+    //@}
+    void OnMapRefineNCS();
     void OnUpdateLabelEveryNth(QAction *action);
     void OnLabelEveryNth();
     void OnClearGeomAnnotations();
     void OnUpdateFindGeomErrors(QAction *action);
     void OnFindGeomErrors();
+    void OnValidationReport();
     /**
      * Handler for 'W' key which places an H2O at the poistion of the cursor
      * and then refines the position.
@@ -936,10 +936,6 @@ BatchJobManager *MIMainWindow::GetJobManager()
 {
     return JobManager;
 }
-bool MIMainWindow::isJobLimit()
-{
-    return JobManager->numberOfRunningJobs() >= Application::instance()->concurrentJobLimit;
-}
 
 void MIMainWindow::updateToolBar()
 {
@@ -1907,6 +1903,12 @@ void MIMainWindow::createMenus()
                                 analyze_menu,
                                 SLOT(OnClearGeomAnnotations()));
 
+    new CurrentMIGLWidgetAction("&Validation Report...",
+                                "Write the density fit and geometry of every residue of the model to a CSV or JSON file",
+                                analyze_menu,
+                                SLOT(OnValidationReport()),
+                                SLOT(OnUpdateFindGeomErrors(QAction*)));
+
     analyze_menu->addSeparator();
     new CurrentMIGLWidgetAction("Add &H-bond",
                                 "Build an H-bond between the last two picked atoms",
@@ -2426,5 +2428,5 @@ void MIMainWindow::runPythonScript(const std::string &file)
     pythonJob->setProgram(BatchJobManager::pythonExe());
     pythonJob->setArguments(file.c_str());
 
-    pythonJob->StartJob();
+    GetJobManager()->SubmitJob(pythonJob);
 }
@@ -98,7 +98,6 @@ public:
     void OpenFiles(const std::vector<std::string> &files, bool newWindow = false);
 
     BatchJobManager *GetJobManager();
-    bool isJobLimit();
 
     void updateNavigator();
     RamaPlotMgr *RamaPlotManager();
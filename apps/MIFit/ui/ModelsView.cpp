@@ -1447,6 +1447,8 @@ private:
     QAction *reindexAction_;
     QAction *addFreeRAction_;
     QAction *findLigandDensityAction_;
+    QAction *ncsAverageAction_;
+    QAction *refineNCSAction_;
     QAction *mapExportAction_;
     QAction *modelExportAction_;
     QAction *saveCrystalAction_;
@@ -1539,6 +1541,8 @@ ModelsTree::ModelsTree(QWidget *parent)
     reindexAction_ = _menu->addAction("Reindex Reflections");
     addFreeRAction_ = _menu->addAction("Add Free R-flag");
     findLigandDensityAction_ = _menu->addAction("Find Ligand Density");
+    ncsAverageAction_ = _menu->addAction("NCS Average");
+    refineNCSAction_ = _menu->addAction("Refine NCS Operators");
 
     mapExportAction_ = _menu->addAction("Export");
     connect(mapExportAction_, SIGNAL(triggered()), SLOT(MapExport()));
@@ -1658,6 +1662,10 @@ void ModelsTree::contextActionTriggered(QAction *action)
         view->OnMapAddFree();
     else if (action == findLigandDensityAction_)
         view->OnFindLigandDensity();
+    else if (action == ncsAverageAction_)
+        view->OnMapNCSAverage();
+    else if (action == refineNCSAction_)
+        view->OnMapRefineNCS();
 }
 
 void ModelsTree::setCurrentChain(Residue *residue)
@@ -1845,6 +1853,8 @@ void ModelsTree::ResetMenu(bool show_all)
         reindexAction_->setVisible(true);
         addFreeRAction_->setVisible(true);
         findLigandDensityAction_->setVisible(true);
+        ncsAverageAction_->setVisible(true);
+        refineNCSAction_->setVisible(true);
         mapExportAction_->setVisible(true);
         fftPhasesAction_->setEnabled(mapHasPhases);
         mapExportAction_->setEnabled(mapHasPhases);
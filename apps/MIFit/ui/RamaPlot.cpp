@@ -4,6 +4,7 @@
 #include <math/mathlib.h>
 #include <chemlib/Monomer.h>
 
+#include "Application.h"
 #include "MIMainWindow.h"
 #include "MIGLWidget.h"
 #include <QDockWidget>
@@ -343,7 +344,17 @@ void RamaPlotMgr::GraphResidue(ResidueListIterator prev,
         {
             typ = RamaPlotType::PrePro;
         }
-        region = ramadat[typ]->region(x, y);
+        // Classify with the same tables as refinement and validation,
+        // the contour grids are only a fallback if they are missing
+        const RamaTable *rama = MIFitRamaTable();
+        if (rama && !MIIsNan(x) && !MIIsNan(y))
+        {
+            region = rama->GetRegion(RamaTable::Classify(res->type(), next->type()), x, y);
+        }
+        else
+        {
+            region = ramadat[typ]->region(x, y);
+        }
 
         switch (region)
         {
@@ -49,6 +49,8 @@ void Tools::OnCustom()
     bool useCurrentModel = settings.value("useCurrentModel", true).toBool();
     QString modelFile = settings.value("modelFile").toString();
     QString dataFile = settings.value("dataFile").toString();
+    int threads = settings.value("threads", 1).toInt();
+    int priority = settings.value("priority", 0).toInt();
     settings.endGroup();
 
     MIGLWidget *doc = MIMainWindow::instance()->currentMIGLWidget();
@@ -80,6 +82,16 @@ void Tools::OnCustom()
     dlg->setWorkingDirectory(workingDirectory);
     dlg->setModelFile(modelFile);
     dlg->setDataFile(dataFile);
+    dlg->setThreads(threads);
+    dlg->setPriority(priority);
+    BatchJobManager *manager = MIMainWindow::instance()->GetJobManager();
+    std::vector<BatchJob*> &jobs = *manager->GetJobList();
+    dlg->clearAfterJobs();
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (!jobs[i]->isDone())
+            dlg->addAfterJob(QString("%1 (job %2)").arg(jobs[i]->jobName()).arg(jobs[i]->jobId()), jobs[i]->jobId());
+    }
 
     if (dlg->exec() != QDialog::Accepted)
     {
@@ -93,8 +105,11 @@ void Tools::OnCustom()
     workingDirectory = dlg->workingDirectory();
     modelFile = dlg->modelFile();
     dataFile = dlg->dataFile();
+    threads = dlg->threads();
+    priority = dlg->priority();
+    unsigned long afterJob = dlg->afterJob();
 
-    BatchJob *job = MIMainWindow::instance()->GetJobManager()->CreateJob();
+    BatchJob *job = manager->CreateJob();
 
     typedef std::map<QString, QString> SubstitutionMap;
     SubstitutionMap subs;
@@ -135,8 +150,15 @@ void Tools::OnCustom()
     job->setJobName(jobName);
     job->setProgram(program);
     job->setArguments(args);
+    job->setThreads(threads);
+    job->setPriority(priority);
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (jobs[i]->jobId() == afterJob)
+            job->addDependency(jobs[i]);
+    }
 
-    job->StartJob();
+    manager->SubmitJob(job);
 
     settings.beginGroup("CustomJob");
     settings.setValue("executable", program);
@@ -145,33 +167,21 @@ void Tools::OnCustom()
     settings.setValue("workingDirectory", workingDirectory);
     settings.setValue("modelFile", modelFile);
     settings.setValue("dataFile", dataFile);
+    settings.setValue("threads", threads);
+    settings.setValue("priority", priority);
     settings.endGroup();
 
 }
 
 void Tools::FillToolsMenu(QMenu *parent)
 {
-    connect(parent, SIGNAL(aboutToShow()),
-            this, SLOT(OnUpdateForJobLimit()));
-
     parent->addAction("Run Custom Job", this, SLOT(OnCustom()));
     parent->addAction("Manage menu...", this, SLOT(manageMenu()));
     parent->addSeparator();
 
     MIMainWindow::instance()->GetJobManager()->setupJobMenu(parent);
-
-    actions = parent->actions();
 }
 
-void Tools::OnUpdateForJobLimit()
-{
-    bool enable = !MIMainWindow::instance()->isJobLimit();
-    foreach (QAction* act, actions)
-    {
-        act->setEnabled(enable);
-    }
-
-}
 
 Tools::Tools()
     : QObject(0)
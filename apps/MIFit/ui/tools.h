@@ -2,7 +2,6 @@
 #define MI_TOOLS_H
 
 #include <QObject>
-#include <QList>
 
 class QAction;
 class QMenu;
@@ -19,11 +18,8 @@ public:
 private:
     Tools();
 
-    QList<QAction*> actions;
-
 private slots:
     void OnCustom();
-    void OnUpdateForJobLimit();
     void manageMenu();
 
 };
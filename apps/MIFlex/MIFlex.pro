@@ -18,4 +18,4 @@ LIBS += -L../../libs -lligand -lmiutil -lmolopt -lmap  -lmtz -lconflib -lchemlib
 
 VPATH += $${PWD}
 HEADERS += *.h
-SOURCES += common.cpp miflex.cpp
+SOURCES += common.cpp batch.cpp miflex.cpp
@@ -0,0 +1,304 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "nongui.h"
+#include <utillib.h>
+#include <util/parallel.h>
+
+#include "batch.h"
+
+bool ReadBatchManifest(const std::string &filename, std::vector<BatchJob> &jobs)
+{
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (fp == NULL)
+    {
+        Logger::log("Can't open batch manifest %s", filename.c_str());
+        return false;
+    }
+    char line[4096];
+    int lineNumber = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        ++lineNumber;
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+        {
+            ++p;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+        {
+            continue;
+        }
+        char name[1024], map[1024], model[1024], ligand[1024];
+        BatchJob job;
+        if (sscanf(p, "%1023s %1023s %1023s %1023s %f %f %f", name, map, model, ligand,
+                   &job.center[0], &job.center[1], &job.center[2]) != 7)
+        {
+            Logger::log("Error in batch manifest %s line %d: expected name map model ligand x y z, skipped",
+                        filename.c_str(), lineNumber);
+            ok = false;
+            continue;
+        }
+        job.name = name;
+        job.map = map;
+        job.model = model;
+        job.ligand = ligand;
+        jobs.push_back(job);
+    }
+    fclose(fp);
+    return ok;
+}
+
+static double WallClock()
+{
+#ifndef _WIN32
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec*1.0e-6;
+#else
+    return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+static void WriteResults(const std::string &resultsFile, const std::vector<BatchJob> &jobs,
+                         const std::vector<BatchResult> &results)
+{
+    FILE *fp = fopen(resultsFile.c_str(), "w");
+    if (fp == NULL)
+    {
+        Logger::log("Can't write batch results to %s", resultsFile.c_str());
+        return;
+    }
+    fprintf(fp, "job\tstatus\tcorrelation\tseconds\tpeak_mb\toutput\n");
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const BatchResult &r = results[i];
+        fprintf(fp, "%s\t%s\t%0.3f\t%0.1f\t%0.1f\t%s\n", jobs[i].name.c_str(), r.status.c_str(),
+                r.score, r.seconds, r.peakKB/1024.0, r.output.c_str());
+    }
+    fclose(fp);
+}
+
+#ifndef _WIN32
+
+namespace
+{
+    struct Worker
+    {
+        pid_t pid;
+        int fd;
+        size_t job;
+        double start;
+    };
+
+    // Runs job in the child process and reports the score on fd. Never
+    // returns.
+    void RunChild(BatchFitter &fitter, const BatchJob &job, const std::string &output, long memoryMB,
+                  int workers, int fd)
+    {
+        if (memoryMB > 0)
+        {
+            struct rlimit limit;
+            limit.rlim_cur = limit.rlim_max = (rlim_t)memoryMB*1024*1024;
+            setrlimit(RLIMIT_AS, &limit);
+        }
+        if (workers > 1)
+        {
+            // The jobs already fill the cores
+            MISetParallelThreadCount(1);
+        }
+        float score = 0.0f;
+        bool ok = false;
+        try
+        {
+            ok = fitter.Fit(job, output, score);
+        }
+        catch (...)
+        {
+            ok = false;
+        }
+        // _exit skips the stdio flush, and the parent reads the log and
+        // output once the score is in
+        fflush(NULL);
+        char buf[64];
+        int len = sprintf(buf, "%d %f\n", ok ? 1 : 0, score);
+        if (write(fd, buf, len) != len)
+        {
+            _exit(2);
+        }
+        close(fd);
+        _exit(ok ? 0 : 1);
+    }
+
+    void Collect(Worker &worker, int status, const struct rusage &usage, BatchResult &result)
+    {
+        char buf[64];
+        ssize_t len = read(worker.fd, buf, sizeof(buf) - 1);
+        close(worker.fd);
+        result.seconds = WallClock() - worker.start;
+        result.peakKB = usage.ru_maxrss;
+        int ok = 0;
+        float score = 0.0f;
+        if (len > 0)
+        {
+            buf[len] = '\0';
+            sscanf(buf, "%d %f", &ok, &score);
+        }
+        if (WIFSIGNALED(status))
+        {
+            result.status = ::format("killed(%d)", WTERMSIG(status));
+        }
+        else if (len <= 0)
+        {
+            // Out of memory under the cap ends in a failed allocation
+            result.status = "crashed";
+        }
+        else
+        {
+            result.status = ok ? "ok" : "failed";
+            result.score = score;
+        }
+    }
+}
+
+int RunBatch(const std::vector<BatchJob> &jobs, BatchFitter &fitter, int workers, long memoryMB,
+             const std::string &resultsFile, std::vector<BatchResult> &results)
+{
+    if (workers < 1)
+    {
+        workers = 1;
+    }
+    results.assign(jobs.size(), BatchResult());
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        results[i].status = "not run";
+        results[i].score = 0.0f;
+        results[i].seconds = 0.0;
+        results[i].peakKB = 0;
+        results[i].output = jobs[i].name + "_out.pdb";
+    }
+    fflush(NULL);
+
+    std::vector<Worker> running;
+    size_t next = 0;
+    int succeeded = 0;
+    while (next < jobs.size() || !running.empty())
+    {
+        while (next < jobs.size() && (int)running.size() < workers)
+        {
+            int fds[2];
+            if (pipe(fds) != 0)
+            {
+                results[next].status = "failed";
+                ++next;
+                continue;
+            }
+            Worker worker;
+            worker.job = next;
+            worker.start = WallClock();
+            worker.pid = fork();
+            if (worker.pid == 0)
+            {
+                close(fds[0]);
+                RunChild(fitter, jobs[next], results[next].output, memoryMB, workers, fds[1]);
+            }
+            close(fds[1]);
+            if (worker.pid < 0)
+            {
+                close(fds[0]);
+                results[next].status = "failed";
+                ++next;
+                continue;
+            }
+            worker.fd = fds[0];
+            running.push_back(worker);
+            Logger::log("Started job %s (%d of %d)", jobs[next].name.c_str(), (int)next + 1, (int)jobs.size());
+            ++next;
+        }
+        if (running.empty())
+        {
+            continue;
+        }
+
+        int status;
+        struct rusage usage;
+        pid_t pid;
+        do
+        {
+            pid = wait4(-1, &status, 0, &usage);
+        } while (pid < 0 && errno == EINTR);
+        if (pid < 0)
+        {
+            break;
+        }
+        for (size_t i = 0; i < running.size(); ++i)
+        {
+            if (running[i].pid != pid)
+            {
+                continue;
+            }
+            BatchResult &result = results[running[i].job];
+            Collect(running[i], status, usage, result);
+            if (result.status == "ok")
+            {
+                ++succeeded;
+            }
+            Logger::log("Finished job %s: %s, correlation %0.3f, %0.1f s", jobs[running[i].job].name.c_str(),
+                        result.status.c_str(), result.score, result.seconds);
+            running.erase(running.begin() + i);
+            break;
+        }
+    }
+    WriteResults(resultsFile, jobs, results);
+    return succeeded;
+}
+
+#else // ifndef _WIN32
+
+int RunBatch(const std::vector<BatchJob> &jobs, BatchFitter &fitter, int /* workers */, long /* memoryMB */,
+             const std::string &resultsFile, std::vector<BatchResult> &results)
+{
+    // No fork here: the jobs run one after another in this process
+    // without a memory cap
+    int succeeded = 0;
+    results.assign(jobs.size(), BatchResult());
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        BatchResult &result = results[i];
+        result.output = jobs[i].name + "_out.pdb";
+        result.score = 0.0f;
+        result.peakKB = 0;
+        double start = WallClock();
+        bool ok = false;
+        try
+        {
+            ok = fitter.Fit(jobs[i], result.output, result.score);
+        }
+        catch (...)
+        {
+            ok = false;
+        }
+        result.seconds = WallClock() - start;
+        result.status = ok ? "ok" : "failed";
+        if (ok)
+        {
+            ++succeeded;
+        }
+    }
+    WriteResults(resultsFile, jobs, results);
+    return succeeded;
+}
+
+#endif // ifndef _WIN32
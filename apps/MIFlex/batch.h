@@ -0,0 +1,59 @@
+#ifndef MIFLEX_BATCH_H
+#define MIFLEX_BATCH_H
+
+#include <string>
+#include <vector>
+
+// One ligand fit of a batch: the ligand file (any format the ligand
+// readers know, e.g. .smi, .cif, .mol, .pdb) fit into the map around
+// center, with the model supplying the map phases and the protein to
+// avoid.
+struct BatchJob
+{
+    std::string name;
+    std::string map;
+    std::string model;
+    std::string ligand;
+    float center[3];
+};
+
+struct BatchResult
+{
+    std::string status;
+    float score;
+    double seconds;
+    long peakKB;
+    std::string output;
+};
+
+// Fits a single job. Called in a separate worker process per job, so it
+// may change the shared dictionary and other global state freely.
+class BatchFitter
+{
+public:
+    virtual ~BatchFitter()
+    {
+    }
+
+    // Fits job writing the ligand to output; returns false on failure and
+    // the correlation of the fit ligand with the map in score.
+    virtual bool Fit(const BatchJob &job, const std::string &output, float &score) = 0;
+};
+
+// Reads a manifest with one job per line:
+//   name map model ligand x y z
+// Blank lines and lines starting with # are skipped. A malformed line is
+// logged and skipped, so that the other jobs can still run, and false is
+// returned.
+bool ReadBatchManifest(const std::string &filename, std::vector<BatchJob> &jobs);
+
+// Runs the jobs on up to workers processes at once, each limited to
+// memoryMB megabytes of address space if memoryMB is positive, writing
+// the ligand of job name to name_out.pdb and a tab separated table of
+// scores and timings to resultsFile. Anything loaded before the call,
+// such as the dictionary and scattering tables, is shared by all jobs.
+// Returns the number of jobs that succeeded.
+int RunBatch(const std::vector<BatchJob> &jobs, BatchFitter &fitter, int workers, long memoryMB,
+             const std::string &resultsFile, std::vector<BatchResult> &results);
+
+#endif // MIFLEX_BATCH_H
@@ -0,0 +1,133 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "nongui.h"
+
+#include "batch.h"
+
+// The batch runner on a manifest with good jobs around one bad entry of
+// each kind: a malformed line, a job whose ligand file is missing and a
+// job whose worker crashes. The good jobs must still run and write their
+// output, and each bad one must be reported.
+// Not part of MIFlex.pro: build it from batch.cpp and the MIFlex libraries.
+//
+// usage: batchtest [workers]
+
+static const char *manifestText =
+    "# name map model ligand x y z\n"
+    "first map.mtz model.pdb good.smi 0.5 0 0\n"
+    "truncated map.mtz model.pdb\n"
+    "missing map.mtz model.pdb missing.smi 1 2 3\n"
+    "crashed map.mtz model.pdb crash 1 2 3\n"
+    "\n"
+    "second map.mtz model.pdb good.smi 0.75 0 0\n";
+
+// Copies the ligand file to the output in place of a fit and scores it
+// with the x of the center. The ligand "crash" aborts the worker.
+class CopyFitter
+    : public BatchFitter
+{
+public:
+    bool Fit(const BatchJob &job, const std::string &output, float &score)
+    {
+        if (job.ligand == "crash")
+        {
+            abort();
+        }
+        FILE *in = fopen(job.ligand.c_str(), "r");
+        if (in == NULL)
+        {
+            return false;
+        }
+        FILE *out = fopen(output.c_str(), "w");
+        int c;
+        while ((c = fgetc(in)) != EOF)
+        {
+            fputc(c, out);
+        }
+        fclose(in);
+        fclose(out);
+        score = job.center[0];
+        return true;
+    }
+};
+
+static bool WriteFile(const char *name, const char *text)
+{
+    FILE *fp = fopen(name, "w");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    fputs(text, fp);
+    fclose(fp);
+    return true;
+}
+
+static bool Check(bool condition, const char *what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+    }
+    return condition;
+}
+
+int main(int argc, char **argv)
+{
+    int workers = argc > 1 ? atoi(argv[1]) : 2;
+    char dir[] = "/tmp/batchtestXXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0
+        || !WriteFile("manifest.txt", manifestText) || !WriteFile("good.smi", "c1ccccc1O phenol\n"))
+    {
+        printf("Cannot set up %s\n", dir);
+        return 1;
+    }
+
+    std::vector<BatchJob> jobs;
+    bool manifestOk = ReadBatchManifest("manifest.txt", jobs);
+    bool ok = Check(!manifestOk, "the malformed line was not reported");
+    ok = Check(jobs.size() == 4, "the jobs around the malformed line were not all read") && ok;
+    if (!ok)
+    {
+        return 1;
+    }
+
+    CopyFitter fitter;
+    std::vector<BatchResult> results;
+    int succeeded = RunBatch(jobs, fitter, workers, 0, "results.txt", results);
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        printf("%-8s %-10s %0.2f %s\n", jobs[i].name.c_str(), results[i].status.c_str(), results[i].score,
+               results[i].output.c_str());
+    }
+
+    ok = Check(succeeded == 2, "two jobs should succeed") && ok;
+    ok = Check(results[0].status == "ok" && results[0].score == 0.5f, "the first job did not run") && ok;
+    ok = Check(results[1].status == "failed", "the missing ligand was not reported") && ok;
+    ok = Check(results[2].status.compare(0, 6, "killed") == 0, "the crash was not reported") && ok;
+    ok = Check(results[3].status == "ok" && results[3].score == 0.75f, "the second job did not run") && ok;
+    ok = Check(access("first_out.pdb", R_OK) == 0 && access("second_out.pdb", R_OK) == 0,
+               "the good jobs did not write their output") && ok;
+    ok = Check(access("missing_out.pdb", F_OK) != 0, "the missing ligand wrote output") && ok;
+
+    int lines = 0;
+    FILE *fp = fopen("results.txt", "r");
+    char line[1024];
+    while (fp != NULL && fgets(line, sizeof(line), fp) != NULL)
+    {
+        ++lines;
+    }
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+    ok = Check(lines == 5, "the results table should have a header and four jobs") && ok;
+
+    printf("%s in %s\n", ok ? "OK" : "FAILED", dir);
+    return ok ? 0 : 1;
+}
@@ -11,7 +11,7 @@
 using namespace chemlib;
 using namespace conflib;
 
-bool MIGenConfs(GeomSaver confs, MIMoleculeBase *fitmol, MIMolOpt *opt, bool print)
+bool MIGenConfs(ConfEnsemble &confs, MIMoleculeBase *fitmol, MIMolOpt *opt, bool print)
 {
     RESIDUE *fitres = fitmol->getResidues();
     if (fitres != 0 && fitres->natoms() > 60)
@@ -21,11 +21,10 @@ bool MIGenConfs(GeomSaver confs, MIMoleculeBase *fitmol, MIMolOpt *opt, bool pri
         return false;
     }
 
-    GeomSaver entryConfs;
     const char *type = fitres->type.c_str();
-    GetConfs(entryConfs, opt->dict.GetDictResidue(type, 0), &opt->dict, fitmol);
-    Logger::debug("%d conformations before generation", entryConfs.NumberSets());
-    if (entryConfs.NumberSets() <= 2)
+    int entryConfs = opt->dict.CountConformers(type);
+    Logger::debug("%d conformations before generation", entryConfs);
+    if (entryConfs <= 1)
     {
         int numberOfConformations =
             conflib::GenerateEnsemble(opt->dict.GetDictResidue(type, 0),
@@ -34,7 +33,7 @@ bool MIGenConfs(GeomSaver confs, MIMoleculeBase *fitmol, MIMolOpt *opt, bool pri
         Logger::log("Generated %d confirmations", numberOfConformations);
     }
 
-    if (!GetConfs(confs, fitres, &opt->dict, fitmol))
+    if (!GetConfs(confs, fitres, &opt->dict))
     {
         Logger::log("Error getting conformers");
         return false;
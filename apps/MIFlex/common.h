@@ -6,7 +6,7 @@
 #include "chemlib.h"
 #include "moloptlib.h"
 
-bool MIGenConfs(chemlib::GeomSaver confs, chemlib::MIMoleculeBase *fitmol, MIMolOpt *opt, bool print = false);
+bool MIGenConfs(chemlib::ConfEnsemble &confs, chemlib::MIMoleculeBase *fitmol, MIMolOpt *opt, bool print = false);
 chemlib::MIMoleculeBase *LoadMol(const char *fname);
 chemlib::MIMoleculeBase *EditEntry(MIMolOpt *opt, const char *type);
 chemlib::MIMoleculeBase *LoadLigand(const std::string &filename,
@@ -39,7 +39,7 @@ bool MILigandConfs(const std::string &ligand_filename)
         return false;
     }
     // get and load emap
-    GeomSaver confs;
+    ConfEnsemble confs;
     int retval = MIGenConfs(confs, fitmol, &geomrefiner, true);
 
     // clean up
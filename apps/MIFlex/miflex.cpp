@@ -7,6 +7,7 @@
 #include <utillib.h>
 
 #include "common.h"
+#include "batch.h"
 
 #ifdef _WIN32
 #define _MVS
@@ -54,6 +55,8 @@ bool MIFlexLigandFit(EMapBase *currentmap,
                      MIMolOpt *opt,
                      std::vector<MIAtom*> &CurrentAtoms,
                      float *center,
+                     const std::string &output = "miflex_out.pdb",
+                     float *score = 0,
                      MIMolOptCheckPoint *ckpt = 0,
                      InterpBox *BoundingBox = 0)
 {
@@ -81,7 +84,7 @@ bool MIFlexLigandFit(EMapBase *currentmap,
         return false;
     }
 
-    GeomSaver confs;
+    ConfEnsemble confs;
     if (!MIGenConfs(confs, fitmol, opt))
     {
         Logger::log("Couldn't generate conformers");
@@ -107,7 +110,17 @@ bool MIFlexLigandFit(EMapBase *currentmap,
     BoundingBox = NULL;
 
 
-    FILE *fil = fopen("miflex_out.pdb", "w");
+    if (score)
+    {
+        *score = currentmap->LocalCorrelation(CurrentAtoms, fitmol->getResidues());
+    }
+
+    FILE *fil = fopen(output.c_str(), "w");
+    if (!fil)
+    {
+        Logger::log("Can't write %s", output.c_str());
+        return false;
+    }
     SavePDB(fil, fitres, NULL, 0, false);
     fclose(fil);
 
@@ -119,6 +132,8 @@ bool MIFlexLigandFit(EMapBase *currentmap,
                      MIMoleculeBase *fitmol,
                      MIMolOpt *opt,
                      float *center,
+                     const std::string &output = "miflex_out.pdb",
+                     float *score = 0,
                      MIMolOptCheckPoint *ckpt = 0,
                      InterpBox *BoundingBox = 0)
 {
@@ -129,7 +144,7 @@ bool MIFlexLigandFit(EMapBase *currentmap,
         CurrentAtoms.push_back(fitres->atoms[i]);
     }
     return MIFlexLigandFit(currentmap, model, fitmol, opt, CurrentAtoms,
-                           center, ckpt, BoundingBox);
+                           center, output, score, ckpt, BoundingBox);
 }
 
 
@@ -155,14 +170,10 @@ public:
 
 
 
-bool MIFlexLigandFit(const std::string &model_filename,
-                     const std::string &ligand_filename,
-                     const std::string &map_filename,
-                     float center[3])
+// Loads the dictionary and the scattering factor tables, which are
+// shared by every fit of a batch
+static bool LoadSharedTables(MIMolOpt &geomrefiner)
 {
-
-    // create geomrefiner and dictionary
-    MIMolOpt geomrefiner;
     char *MOLIMAGEHOME = getenv("MOLIMAGEHOME");
     if (!MOLIMAGEHOME)
     {
@@ -182,14 +193,25 @@ bool MIFlexLigandFit(const std::string &model_filename,
     /* set default scattering factors */
     Logger::log("Read in %d scattering factors",
                 MIMapInitializeScatteringFactorTables("", MOLIMAGEHOME));
+    return true;
+}
 
-
+static bool MIFlexLigandFit(MIMolOpt &geomrefiner,
+                            const std::string &model_filename,
+                            const std::string &ligand_filename,
+                            const std::string &map_filename,
+                            const float center[3],
+                            const std::string &output = "miflex_out.pdb",
+                            float *score = 0)
+{
     // load molecule, model
     MIMoleculeBase *model = LoadMol(model_filename.c_str());
     MIMoleculeBase *fitmol = LoadLigand(ligand_filename.c_str(), &geomrefiner);
     if (!model || !fitmol)
     {
         Logger::log("Missing model or fitmol, aborting.");
+        delete model;
+        delete fitmol;
         return false;
     }
 
@@ -220,7 +242,8 @@ bool MIFlexLigandFit(const std::string &model_filename,
         map->FFTMap(maptype);
     }
 
-    int retval = MIFlexLigandFit(map, model, fitmol, &geomrefiner, center);
+    float fitcenter[3] = { center[0], center[1], center[2] };
+    int retval = MIFlexLigandFit(map, model, fitmol, &geomrefiner, fitcenter, output, score);
 
     // clean up
     delete map;
@@ -230,11 +253,93 @@ bool MIFlexLigandFit(const std::string &model_filename,
     return retval;
 }
 
+bool MIFlexLigandFit(const std::string &model_filename,
+                     const std::string &ligand_filename,
+                     const std::string &map_filename,
+                     float center[3])
+{
+    // create geomrefiner and dictionary
+    MIMolOpt geomrefiner;
+    if (!LoadSharedTables(geomrefiner))
+    {
+        return false;
+    }
+    return MIFlexLigandFit(geomrefiner, model_filename, ligand_filename, map_filename, center);
+}
+
+// Each job runs in its own process forked after the shared tables are
+// loaded, so the ligand it adds to the dictionary goes away with it
+class MIFlexBatchFitter
+    : public BatchFitter
+{
+    MIMolOpt &geomrefiner;
+
+public:
+    MIFlexBatchFitter(MIMolOpt &refiner)
+        : geomrefiner(refiner)
+    {
+    }
+
+    bool Fit(const BatchJob &job, const std::string &output, float &score)
+    {
+        return MIFlexLigandFit(geomrefiner, job.model, job.ligand, job.map, job.center, output, &score);
+    }
+};
+
+static int MIFlexBatch(int argc, char **argv)
+{
+    std::string manifest;
+    std::string resultsFile = "miflex_results.txt";
+    int workers = 1;
+    long memoryMB = 0;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+        {
+            workers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-m") == 0 && i+1 < argc)
+        {
+            memoryMB = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+        {
+            resultsFile = argv[++i];
+        }
+        else
+        {
+            manifest = argv[i];
+        }
+    }
+    std::vector<BatchJob> jobs;
+    bool manifestOk = !manifest.empty() && ReadBatchManifest(manifest, jobs);
+    if (jobs.empty())
+    {
+        return -1;
+    }
+
+    MIMolOpt geomrefiner;
+    if (!LoadSharedTables(geomrefiner))
+    {
+        return -1;
+    }
+    MIFlexBatchFitter fitter(geomrefiner);
+    std::vector<BatchResult> results;
+    int succeeded = RunBatch(jobs, fitter, workers, memoryMB, resultsFile, results);
+    Logger::log("%d of %d jobs succeeded, results in %s", succeeded, (int)jobs.size(), resultsFile.c_str());
+    return manifestOk && succeeded == (int)jobs.size() ? 0 : 1;
+}
+
 int main(int argc, char **argv)
 {
+    if (argc > 2 && strcmp(argv[1], "-batch") == 0)
+    {
+        return MIFlexBatch(argc, argv);
+    }
     if (argc < 7)
     {
         Logger::log("Usage: %s model_file ligand_file map_file x y z", argv[0]);
+        Logger::log("   or: %s -batch [-j workers] [-m memory_mb] [-o results_file] manifest", argv[0]);
         return -1;
     }
 
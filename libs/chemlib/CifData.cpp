@@ -10,12 +10,15 @@
 using namespace std;
 
 CifLoop::CifLoop()
+    : _valuesBegin(0),
+      _valuesEnd(0)
 {
 }
 
 void CifLoop::Clear()
 {
-    _values.clear();
+    _valuesBegin = 0;
+    _valuesEnd = 0;
     _category.clear();
     _names.clear();
 }
@@ -32,15 +35,22 @@ void CifLoop::PrintNames(std::string &out)
 CifDataBlock::CifDataBlock()
 {
     _isParsed = false;
+    _begin = 0;
+    _end = 0;
 }
 
 void CifDataBlock::SetInput(const char *input)
 {
     _block = input;
-    //	CifLoop loop;
-    //	loop._values = new char[strlen(input)] ;
-    //	strcpy(loop._values, input);
-    //	_loops.push_back(loop);
+    _begin = _block.data();
+    _end = _begin + _block.size();
+}
+
+void CifDataBlock::SetInput(const char *begin, const char *end)
+{
+    _block.clear();
+    _begin = begin;
+    _end = end;
 }
 
 void CifDataBlock::Clear()
@@ -48,6 +58,8 @@ void CifDataBlock::Clear()
     _items.clear();
     _loops.clear();
     _block.clear();
+    _begin = 0;
+    _end = 0;
     _isParsed = false;
 }
 
@@ -77,15 +89,15 @@ bool CifDataBlock::FindLoop(std::string category, CifLoop &loop)
 
 void CifDataBlock::Parse()
 {
-    CifTokenizer toker(_block.c_str());
+    CifTokenizer toker(_begin, _end);
     int state = CTP_WANTNAME;
     std::string name;
     CifLoop loop;
 
-    std::string t;
+    CifStringView t;
     while (toker.GetToken(t))
     {
-        if (t[0] == '#')
+        if (!t.empty() && t.begin[0] == '#')
         {
             continue;
         }
@@ -93,16 +105,16 @@ void CifDataBlock::Parse()
         switch (state)
         {
         case CTP_WANTNAME:
-            if (t[0] == '_')
+            if (!t.empty() && t.begin[0] == '_')
             {
-                name = t;
+                name = t.str();
                 state = CTP_WANTVALUE;
             }
-            else if (strncmp(t.c_str(), "loop_", 5) == 0)
+            else if (t.length >= 5 && strncmp(t.begin, "loop_", 5) == 0)
             {
                 loop.Clear();
                 toker.SlurpNames(loop._names);
-                toker.SlurpValues(loop._values);
+                toker.SlurpValues(loop._valuesBegin, loop._valuesEnd);
                 loop._category = GetCategory(loop._names);
                 if (!loop._category.empty())
                 {
@@ -114,13 +126,13 @@ void CifDataBlock::Parse()
             break;
 
         case CTP_WANTVALUE:
-            _items[name] = t;
+            _items[name] = t.str();
             state = CTP_WANTNAME;
             break;
         }
     }
 
-    _block.clear();
+    //Loops reference the block text, so it is kept until Clear()
     _isParsed = true;
 }
 
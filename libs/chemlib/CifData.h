@@ -4,6 +4,54 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <cstring>
+
+/////////////////////////////////////////////////////////////////////////////
+// Class:        CifStringView
+// Purpose:     Non-owning reference to a token inside an mmCIF buffer
+/////////////////////////////////////////////////////////////////////////////
+struct CifStringView
+{
+    const char *begin;
+    size_t length;
+
+    CifStringView()
+        : begin(0),
+          length(0)
+    {
+    }
+
+    CifStringView(const char *b, size_t len)
+        : begin(b),
+          length(len)
+    {
+    }
+
+    bool empty() const
+    {
+        return length == 0;
+    }
+
+    const char *end() const
+    {
+        return begin + length;
+    }
+
+    std::string str() const
+    {
+        return length ? std::string(begin, length) : std::string();
+    }
+
+    bool operator==(const char *s) const
+    {
+        return strncmp(begin, s, length) == 0 && s[length] == 0;
+    }
+
+    bool operator!=(const char *s) const
+    {
+        return !(*this == s);
+    }
+};
 
 /////////////////////////////////////////////////////////////////////////////
 // Class:        CifLoop
@@ -15,7 +63,8 @@ class CifLoop
 public:
     std::string _category;              //e.g. "chem_comp", "chem_comp_atom", "chem_comp_bond"
     std::vector<std::string> _names;            //array of all the keywords, e.g. "chem_comp_atom.atom_id"
-    std::string _values;                //The concatenation of all the values
+    const char *_valuesBegin;           //The concatenation of all the values, as a
+    const char *_valuesEnd;             //view into the data block
 
     CifLoop();
     void Clear();
@@ -31,15 +80,22 @@ class CifDataBlock
 {
 private:
     bool _isParsed;
+    const char *_begin;                         //Unparsed text of the block; points
+    const char *_end;                           //either into _block or a CifMappedFile
 
     void Parse();
+    CifDataBlock(const CifDataBlock&);
+    CifDataBlock &operator=(const CifDataBlock&);
 public:
     std::map<std::string, std::string> _items;      //Name-Value pairs defined outside of loops
     std::vector<CifLoop> _loops;                //Loop data
     std::string _block;
     CifDataBlock();
 
+    //Copies the input; loops found later point into the copy
     void SetInput(const char *input);
+    //References the input without copying; it must outlive the block
+    void SetInput(const char *begin, const char *end);
     void Clear();
 
     bool FindLoop(std::string category, CifLoop &loop);
@@ -8,6 +8,7 @@
 #endif
 
 #include "CifParser.h"
+#include <util/system.h>
 
 /////////////////////////////////////////////////////////////////////////////
 // Function:    CifParser (constructor)
@@ -20,35 +21,63 @@ CifParser::CifParser(FILE *fp)
 {
     _file = fp;
     _start = true;
+    _mapped = false;
+    _cur = 0;
+}
+
+const char *CifParser::NextLine(const char *line) const
+{
+    const char *end = _contents.end();
+    const char *eol = static_cast<const char*>(memchr(line, '\n', end - line));
+    return eol ? eol + 1 : end;
+}
+
+static inline bool StartsDataBlock(const char *line, const char *end)
+{
+    return end - line >= 5 && !strncmp(line, "data_", 5);
 }
 
 /////////////////////////////////////////////////////////////////////////////
 // Function:    GetNextBlock
 // Purpose:
 // Input:       None
-// Output:      Stores a C string with the next block in the given CifDataBlock
+// Output:      Points the given CifDataBlock at the text of the next block.
+//				The text stays owned by the parser, which must outlive the block.
 // Requires:	The CIF file is delimited by lines starting with "data_"
 /////////////////////////////////////////////////////////////////////////////
 bool CifParser::GetNextBlock(CifDataBlock &block)
 {
-    static const int MAX_CIF_LINE = 180;    //The spec is technically 80
-
     block.Clear();
-    std::string buffer;
-    char line[MAX_CIF_LINE];
-    bool found = false;
+
+    if (!_mapped)
+    {
+        _mapped = true;
+        if (!_contents.map(_file))
+        {
+            return false;
+        }
+        _cur = _contents.begin();
+    }
+    const char *end = _contents.end();
+    if (_cur == 0 || _cur >= end)
+    {
+        return false;
+    }
 
     //Advance to the start of the data block, searching
     //for a line starting with "data_"
     if (_start)
     {
-        while (fgets(line, MAX_CIF_LINE, _file) != 0)
+        bool found = false;
+        while (_cur < end)
         {
-            if (!strncmp(line, "data_", 5))
+            const char *line = _cur;
+            _cur = NextLine(line);
+            if (StartsDataBlock(line, end))
             {
                 found = true;
                 _start = false;
-                _data = line;
+                _data.assign(line, _cur - line);
                 break;
             }
         }
@@ -58,48 +87,49 @@ bool CifParser::GetNextBlock(CifDataBlock &block)
         }
     }
 
-    //Load block line-by-line into buffer, until we can't
-    //read any more lines or we hit another line starting with "_data"
-    while (fgets(line, MAX_CIF_LINE, _file) != 0)
+    //The block runs until we can't read any more lines
+    //or we hit another line starting with "data_"
+    const char *blockStart = _cur;
+    while (_cur < end)
     {
-        if (!strncmp(line, "data_", 5))
+        const char *line = _cur;
+        _cur = NextLine(line);
+        if (StartsDataBlock(line, end))
         {
-            _data = line;
-            block.SetInput(buffer.c_str()); //Pass the lines to the CifDataBlock
+            _data.assign(line, _cur - line);
+            block.SetInput(blockStart, line);
             return true;
         }
-        else
-        {
-            buffer += line;             //Load the line into the buffer
-            found = true;
-        }
     }
 
     //If we reach here, we're at the end of the file
-
-    if (ferror(_file) || found == false)
+    if (blockStart == end)
     {
         return false;
     }
-    else
-    {
-        block.SetInput(buffer.c_str()); //Pass the lines to the CifDataBlock
-        return true;
-    }
+    block.SetInput(blockStart, end);
+    return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////
 // Function:    CifTokenizer (constructor)
 // Purpose:		Constructs the CifDataBlock tokenizer and binds to an
-//				existing string containing a CifDataBlock
-// Input:       std::string with the data block
+//				existing buffer containing a CifDataBlock
+// Input:       The bounds of the data block text, which is not copied
 // Output:      None
 // Requires:
 /////////////////////////////////////////////////////////////////////////////
-CifTokenizer::CifTokenizer(std::string input)
+CifTokenizer::CifTokenizer(const char *begin, const char *end)
+{
+    _str = begin;
+    _length = begin ? end - begin : 0;
+    _cur_pos = 0;
+}
+
+CifTokenizer::CifTokenizer(const CifLoop &loop)
 {
-    _str = input;
-    _length = _str.length();
+    _str = loop._valuesBegin;
+    _length = _str ? loop._valuesEnd - loop._valuesBegin : 0;
     _cur_pos = 0;
 }
 
@@ -121,7 +151,24 @@ CifTokenizer::CifTokenizer(std::string input)
 /////////////////////////////////////////////////////////////////////////////
 bool CifTokenizer::GetToken(std::string &token)
 {
-    token.clear();
+    CifStringView view;
+    if (!GetToken(view))
+    {
+        token.clear();
+        return false;
+    }
+    token.assign(view.begin, view.length);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Function:    GetToken
+// Purpose:		As above, but returns the token as a view into the block
+//				instead of a copy
+/////////////////////////////////////////////////////////////////////////////
+bool CifTokenizer::GetToken(CifStringView &token)
+{
+    token = CifStringView();
     int state = PT_BETWEENTOKENS;
 
     if (_length == 0 || _cur_pos >= _length)
@@ -136,7 +183,7 @@ bool CifTokenizer::GetToken(std::string &token)
         case PT_INTOKEN:
             if (IsCifWhitespace(_str[i]))
             {
-                token = _str.substr(_cur_pos, i - _cur_pos);
+                token = CifStringView(_str + _cur_pos, i - _cur_pos);
                 _cur_pos = i;
                 return true;
             }
@@ -183,7 +230,7 @@ bool CifTokenizer::GetToken(std::string &token)
                 && (i+1 == _length
                     || IsCifWhitespace(_str[i+1])))
             {
-                token = _str.substr(_cur_pos, i - _cur_pos);
+                token = CifStringView(_str + _cur_pos, i - _cur_pos);
                 _cur_pos = i + 1;
                 return true;
                 //				token = std::string(_str + tok_start, i - tok_start);
@@ -203,7 +250,7 @@ bool CifTokenizer::GetToken(std::string &token)
                 && (i+1 == _length
                     || IsCifWhitespace(_str[i+1])))
             {
-                token = _str.substr(_cur_pos, i - _cur_pos);
+                token = CifStringView(_str + _cur_pos, i - _cur_pos);
                 _cur_pos = i + 1;
                 return true;
                 //				(IsCifWhitespace(_str[i+1]) ||
@@ -230,7 +277,7 @@ bool CifTokenizer::GetToken(std::string &token)
             }
             else if (_str[i] == ';' && _str[i-1] == '\n')
             {
-                token = _str.substr(_cur_pos, i - _cur_pos - 1);
+                token = CifStringView(_str + _cur_pos, i > _cur_pos ? i - _cur_pos - 1 : 0);
                 _cur_pos = i + 1;
                 return true;
             }
@@ -246,7 +293,7 @@ bool CifTokenizer::GetToken(std::string &token)
         _cur_pos = _length;
         return false;
     case PT_INTOKEN:
-        token = _str.substr(_cur_pos);
+        token = CifStringView(_str + _cur_pos, _length - _cur_pos);
         _cur_pos = _length;
         return true;
     default:
@@ -254,14 +301,14 @@ bool CifTokenizer::GetToken(std::string &token)
     }
 }
 
-void CifTokenizer::SlurpValues(std::string &input)
+void CifTokenizer::SlurpValues(const char *&begin, const char *&end)
 {
     //	int tok_start;
     //	char *values;
     //	int state = PT_BETWEENTOKENS;
     //	int n = strlen(_str);
 
-    input.clear();
+    begin = end = _str + _cur_pos;
     int state = PT_BETWEENTOKENS;
 
     if (_length == 0 || _cur_pos >= _length)
@@ -291,13 +338,10 @@ void CifTokenizer::SlurpValues(std::string &input)
             }
             else if (_str[i] == '_')
             {
+                begin = end = _str + _cur_pos;
                 if (i > _cur_pos)
                 {
-                    input = _str.substr(_cur_pos, i - _cur_pos - 1);
-                }
-                else
-                {
-                    input = "";
+                    end += i - _cur_pos - 1;
                 }
                 _cur_pos = (i > 0) ? i-1 : 0;
                 return;
@@ -308,12 +352,14 @@ void CifTokenizer::SlurpValues(std::string &input)
                 //				return values;
             }
             else if (_str[i] == 'l'
+                     && i + 4 < _length
                      && _str[i+1] == 'o'
                      && _str[i+2] == 'o'
                      && _str[i+3] == 'p'
                      && _str[i+4] == '_')
             {
-                input = _str.substr(_cur_pos, i - _cur_pos - 1);
+                begin = _str + _cur_pos;
+                end = begin + (i > _cur_pos ? i - _cur_pos - 1 : 0);
                 _cur_pos = (i > 0) ? i-1 : 0;
                 return;
                 //				input = std::string(_str,i);
@@ -385,7 +431,8 @@ void CifTokenizer::SlurpValues(std::string &input)
         } //switch(case)
     } //for(i=0...)
 
-    input = _str.substr(_cur_pos);
+    begin = _str + _cur_pos;
+    end = _str + _length;
     _cur_pos = _length;
 }
 
@@ -411,7 +458,7 @@ void CifTokenizer::SlurpNames(std::vector<std::string> &names)
                     break;
                 }
                 //				names.Add( std::string( _str + tok_start, i - tok_start ) );
-                names.push_back(_str.substr(_cur_pos, i - _cur_pos) );
+                names.push_back(std::string(_str + _cur_pos, i - _cur_pos) );
                 _cur_pos = i;
                 state = PT_BETWEENTOKENS;
             }
@@ -447,3 +494,70 @@ void CifTokenizer::SlurpNames(std::vector<std::string> &names)
                                         //in the middle of a loop header
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Function:    CifLoopIterator (constructor)
+// Purpose:		Prepares to walk the rows of the given loop
+// Input:       A loop whose values point into a live data block
+// Output:      None
+// Requires:
+/////////////////////////////////////////////////////////////////////////////
+CifLoopIterator::CifLoopIterator(const CifLoop &loop)
+    : _toker(loop),
+      _row(loop._names.size())
+{
+}
+
+bool CifLoopIterator::Next()
+{
+    if (_row.empty())
+    {
+        return false;
+    }
+    for (size_t col = 0; col < _row.size(); ++col)
+    {
+        if (!_toker.GetToken(_row[col]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+CifStringView CifLoopIterator::Value(int col) const
+{
+    if (col < 0 || col >= (int)_row.size())
+    {
+        return CifStringView();
+    }
+    return _row[col];
+}
+
+bool CifLoopIterator::IsNull(int col) const
+{
+    if (col < 0 || col >= (int)_row.size())
+    {
+        return true;
+    }
+    const CifStringView &v = _row[col];
+    return v.length == 1 && (v.begin[0] == '?' || v.begin[0] == '.');
+}
+
+std::string CifLoopIterator::String(int col) const
+{
+    return Value(col).str();
+}
+
+bool CifLoopIterator::GetFloat(int col, float &value) const
+{
+    if (IsNull(col))
+    {
+        return false;
+    }
+    double d;
+    if (!MIParseDouble(_row[col].begin, _row[col].end(), d))
+    {
+        return false;
+    }
+    value = (float)d;
+    return true;
+}
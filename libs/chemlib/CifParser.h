@@ -1,9 +1,12 @@
 #ifndef MMCIF_PARSER_H
 #define MMCIF_PARSER_H
 
+#include <cstdio>
 #include <string>
+#include <vector>
 
 #include "CifData.h"
+#include <util/MappedFile.h>
 
 //Class to parse a file in mmCif format into individual
 //data blocks (denoted by keywords of the form _data_comp_XX)
@@ -12,25 +15,31 @@ class CifParser
 private:
     FILE *_file;
     bool _start;                                // Flag for when we're in the header
+    bool _mapped;
+    MappedFile _contents;                       // Whole file; blocks point into it
+    const char *_cur;                           // Start of the next line to examine
     std::string _data;                              // Line of input starting the block (e.g. "data_2SA")
 
+    const char *NextLine(const char *line) const;
+
 public:
     CifParser(FILE *fp);
     bool GetNextBlock(CifDataBlock &block);
 };
 
 //Class to parse an individual data block in mmCif format into individual
-//tokens (names, values, keywords)
+//tokens (names, values, keywords).  The tokenizer does not copy its input;
+//tokens are returned as views into the original text.
 class CifTokenizer
 {
-    std::string _str;
+    const char *_str;
     size_t _cur_pos;
     size_t _length;
 public:
-    CifTokenizer(std::string input);
-    //	CifTokenizer(const char *input);
-    //	CifTokenizer::~CifTokenizer();
+    CifTokenizer(const char *begin, const char *end);
+    explicit CifTokenizer(const CifLoop &loop);
 
+    bool  GetToken(CifStringView&);
     bool  GetToken(std::string&);
 
     //Used when a parsing the list of values in a loop
@@ -40,7 +49,36 @@ public:
     }
 
     void SlurpNames(std::vector<std::string> &names);
-    void SlurpValues(std::string &values);
+    void SlurpValues(const char *&begin, const char *&end);
+};
+
+//Class to walk the rows of a loop, exposing each value of the current
+//row as a view so that numeric columns can be converted in place
+class CifLoopIterator
+{
+    CifTokenizer _toker;
+    std::vector<CifStringView> _row;
+
+public:
+    explicit CifLoopIterator(const CifLoop &loop);
+
+    //Advances to the next complete row; a trailing partial row is dropped
+    bool Next();
+
+    int Columns() const
+    {
+        return (int)_row.size();
+    }
+
+    //Value of the given column in the current row.  Negative columns (as
+    //used by the *KeyIndices classes for missing names) give an empty view.
+    CifStringView Value(int col) const;
+
+    //True if the column is missing or its value is unknown ('?') or undefined ('.')
+    bool IsNull(int col) const;
+
+    std::string String(int col) const;
+    bool GetFloat(int col, float &value) const;
 };
 
 //Macro to define whitespace characters that delimit CIF tokens
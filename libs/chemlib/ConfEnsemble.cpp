@@ -0,0 +1,67 @@
+#include "ConfEnsemble.h"
+#include "MIAtom.h"
+
+using namespace std;
+
+namespace chemlib
+{
+
+ConfEnsemble::ConfEnsemble()
+{
+}
+
+ConfEnsemble::ConfEnsemble(const MIAtomList &atoms)
+    : _atoms(atoms)
+{
+}
+
+void ConfEnsemble::SetAtoms(const MIAtomList &atoms)
+{
+    _atoms = atoms;
+    _coords.clear();
+}
+
+void ConfEnsemble::Reserve(int nSets)
+{
+    _coords.reserve(3 * nSets * _atoms.size());
+}
+
+void ConfEnsemble::Clear()
+{
+    _coords.clear();
+}
+
+int ConfEnsemble::Save()
+{
+    size_t start = _coords.size();
+    _coords.resize(start + 3 * _atoms.size());
+    float *xyz = &_coords[start];
+    for (size_t i = 0; i < _atoms.size(); ++i)
+    {
+        xyz[3 * i] = _atoms[i]->x();
+        xyz[3 * i + 1] = _atoms[i]->y();
+        xyz[3 * i + 2] = _atoms[i]->z();
+    }
+    return NumberSets() - 1;
+}
+
+int ConfEnsemble::Save(const float *coords)
+{
+    _coords.insert(_coords.end(), coords, coords + 3 * _atoms.size());
+    return NumberSets() - 1;
+}
+
+void ConfEnsemble::Restore(int set) const
+{
+    if (set < 0 || set >= NumberSets())
+    {
+        return;
+    }
+    const float *xyz = Coords(set);
+    for (size_t i = 0; i < _atoms.size(); ++i)
+    {
+        _atoms[i]->setPosition(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+    }
+}
+
+} //namespace chemlib
@@ -0,0 +1,73 @@
+#ifndef mifit_ConfEnsemble_h
+#define mifit_ConfEnsemble_h
+
+#include <vector>
+
+#include "MIAtom_fwd.h"
+
+namespace chemlib
+{
+
+/**
+ * A packed set of conformers of the same atoms: the coordinates of all
+ * conformers in one contiguous array, x, y, z of each atom in the order of
+ * Atoms(), one conformer after another. Conformers are numbered from 0.
+ * Restoring a conformer is a straight copy, so the atoms must outlive the
+ * ensemble or be replaced with SetAtoms.
+ */
+    class ConfEnsemble
+    {
+        MIAtomList _atoms;
+        std::vector<float> _coords;
+
+    public:
+        ConfEnsemble();
+        explicit ConfEnsemble(const MIAtomList &atoms);
+
+        /**
+         * Changes the atoms and removes all conformers.
+         */
+        void SetAtoms(const MIAtomList &atoms);
+        const MIAtomList &Atoms() const
+        {
+            return _atoms;
+        }
+
+        int AtomCount() const
+        {
+            return (int)_atoms.size();
+        }
+
+        int NumberSets() const
+        {
+            return _atoms.empty() ? 0 : (int)(_coords.size() / (3 * _atoms.size()));
+        }
+
+        void Reserve(int nSets);
+        void Clear();
+
+        /**
+         * Appends the current positions of the atoms; returns the index of
+         * the new conformer.
+         */
+        int Save();
+
+        /**
+         * Appends a conformer from 3 * AtomCount() coordinates.
+         */
+        int Save(const float *coords);
+
+        /**
+         * Moves the atoms to conformer set.
+         */
+        void Restore(int set) const;
+
+        const float *Coords(int set) const
+        {
+            return &_coords[3 * set * _atoms.size()];
+        }
+    };
+
+}
+
+#endif // ifndef mifit_ConfEnsemble_h
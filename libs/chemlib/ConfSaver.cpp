@@ -9,11 +9,9 @@ namespace chemlib
 {
 
 ConfSaver::ConfSaver(Residue *res)
-    : _res(res)
+    : _res(res),
+      _confs(res->atoms())
 {
-    // the first position is empty. A value of 0 for a save token
-    // indicates an error condition
-    SaveSets.push_back(vector< list<SaveAtom>::iterator >() );
     _natoms = _res->atomCount();
 }
 
@@ -28,41 +26,18 @@ void ConfSaver::Save()
         throw "Residue has been modified in the middle of a conformation save";
     }
 
-    SaveSets.push_back(vector< confAtomIter >()); //Add a vector of atoms for this conformer,
-    SaveSets.back().reserve(_natoms);     //and make sure we have space for the atoms
-
-    vector< confAtomIter > &current = SaveSets.back(); //Store a ref to the current conformer
-
-    for (int i = 0; i < _natoms; i++)
-    {
-        if (_res->atom(i)->search_flag() || SaveSets.size() == 2)
-        {
-            current.push_back(
-                atom_store.insert(atom_store.end(), SaveAtom(_res->atom(i))));
-        }
-        else
-        {
-            current.push_back(SaveSets[SaveSets.size()-2][i]);
-        }
-    }
+    _confs.Save();
 }
 
+// Sets are numbered from 1; a save token of 0 indicates an error condition
 void ConfSaver::Restore(unsigned int token) const
 {
-    vector< list<SaveAtom>::iterator >::const_iterator i, e = SaveSets[token].end();
-    for (i = SaveSets[token].begin(); i < e; ++i)
-    {
-        (*i)->Restore();
-    }
+    _confs.Restore((int)token - 1);
 }
 
 void ConfSaver::RestoreLast() const
 {
-    vector< list<SaveAtom>::iterator >::const_iterator i, e = SaveSets.back().end();
-    for (i = SaveSets.back().begin(); i < e; ++i)
-    {
-        (*i)->Restore();
-    }
+    _confs.Restore(_confs.NumberSets() - 1);
 }
 
 void ConfSaver::ConvertToGeomSaver(GeomSaver &gs, MIMoleculeBase *model)
@@ -76,7 +51,7 @@ void ConfSaver::ConvertToGeomSaver(GeomSaver &gs, MIMoleculeBase *model)
 
 int ConfSaver::NumberSets() const
 {
-    return SaveSets.size() - 1;
+    return _confs.NumberSets();
 }
 
 const Residue*ConfSaver::GetResidue() const
@@ -2,10 +2,9 @@
 #define mifit_ConfSaver_h
 
 #include <vector>
-#include <list>
 
+#include "ConfEnsemble.h"
 #include "GeomSaver.h"
-#include "SaveAtom.h"
 
 namespace chemlib
 {
@@ -13,8 +12,6 @@ namespace chemlib
     class Residue;
     class MIMoleculeBase;
 
-    typedef  std::list<SaveAtom>::iterator confAtomIter;
-
     class ConfSaver
     {
         Residue *_res;
@@ -22,8 +19,7 @@ namespace chemlib
         ConfSaver(const ConfSaver &rhs);
         ConfSaver&operator=(const ConfSaver &rhs);
 
-        std::list<SaveAtom> atom_store;
-        std::vector < std::vector < confAtomIter > > SaveSets;
+        ConfEnsemble _confs;
 
     public:
 
@@ -34,6 +30,11 @@ namespace chemlib
         void RestoreLast() const;
         int NumberSets() const;
         const Residue *GetResidue() const;
+        const ConfEnsemble &Ensemble() const
+        {
+            return _confs;
+        }
+
         void ConvertToGeomSaver(GeomSaver &gs, MIMoleculeBase *model);
     };
 }
@@ -1,5 +1,6 @@
 #include <vector>
 #include <string>
+#include <QtCore/QMutex>
 
 #include <util/utillib.h>
 
@@ -47,12 +48,17 @@ int MIAtom::MIGetAtomTypeFromName(const char *name)
 
 MIAtom::AtomRefCountMap MIAtom::refCounts;
 
+// Guards refCounts, which objects built on different threads all update
+static QMutex refCountMutex;
+
 bool MIAtom::isValid(const MIAtom *atom)
 {
     bool result = false;
-    if (atom != NULL && refCounts.find(atom) != refCounts.end())
+    if (atom != NULL)
     {
-        result = refCounts[atom] > 0;
+        QMutexLocker lock(&refCountMutex);
+        MIAtom::AtomRefCountMap::iterator i = refCounts.find(atom);
+        result = i != refCounts.end() && i->second > 0;
     }
 #ifdef MEMORY_CORRUPTION_DEBUG
     if (!result && atom)
@@ -96,7 +102,10 @@ MIAtom::MIAtom()
       chiral_order_(-1),
       U_(NULL)
 {
-    ++refCounts[this];
+    {
+        QMutexLocker lock(&refCountMutex);
+        ++refCounts[this];
+    }
     name_[0] = '\0';
     bondnumbers_.clear();
     nabors_.clear();
@@ -105,10 +114,12 @@ MIAtom::MIAtom()
 MIAtom::~MIAtom()
 {
     deleteAnisotropicity();
-    --refCounts[this];
-    if (refCounts[this] == 0)
     {
-        refCounts.erase(this);
+        QMutexLocker lock(&refCountMutex);
+        if (--refCounts[this] == 0)
+        {
+            refCounts.erase(this);
+        }
     }
 #if defined(MEMORY_CORRUPTION_DEBUG)
     if (DELETION_COUNT==magic_delete)
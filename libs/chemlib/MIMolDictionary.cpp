@@ -1,5 +1,6 @@
 #include <vector>
 #include <algorithm>
+#include <QtCore/QThreadStorage>
 
 #include <math/mathlib.h>
 
@@ -260,6 +261,7 @@ MIMolDictionary::~MIMolDictionary()
     {
         FreeResidueList(Beta2);
     }
+    DeleteConformerEnsembles();
     if (RefiPlanes.size() > 0)
     {
         for (i = 0; i < RefiPlanes.size(); i++)
@@ -312,6 +314,11 @@ int MIMolDictionary::CountConformers(const std::string &type) const
         }
         p++;
     }
+    const ConfEnsemble *packed = GetConformerEnsemble(type);
+    if (packed != NULL)
+    {
+        n += packed->NumberSets();
+    }
     return n;
 }
 
@@ -1658,7 +1665,9 @@ int MIMolDictionary::BuildBumps(Residue *RefiRes, int nRefiRes)
     }
 
     /* loop thru every atom in the reslist and add a bump if
-     * reasonably close */
+     * reasonably close. Each pair is taken once, in the order of the
+     * list rather than of the atoms' addresses, so that the bumps and the
+     * refinement do not depend on where the atoms were allocated */
     n = 0;
     RefiBumps.clear();
     while (Monomer::isValid(res) && n < nres)
@@ -1673,7 +1682,7 @@ int MIMolDictionary::BuildBumps(Residue *RefiRes, int nRefiRes)
                 for (j = 0; j < res2->atomCount(); j++)
                 {
                     a2 = res2->atom(j);
-                    if (a1 < a2
+                    if ((n2 > n || (n2 == n && j > i))
                         && !MIAtom::MIIsHydrogen(a1) && !MIAtom::MIIsHydrogen(a2)
                         && (d = (float)AtomDist(*a1, *res2->atom(j))) < 4.3f)
                     {
@@ -1958,6 +1967,33 @@ void MIMolDictionary::DeleteConformers(const std::string &type)
         }
         oldres = next;
     }
+    DeleteConformerEnsemble(type);
+}
+
+void MIMolDictionary::DeleteConformerEnsemble(const std::string &type)
+{
+    std::map<std::string, EntryConformers>::iterator p = ConfDict.find(type);
+    if (p != ConfDict.end())
+    {
+        delete p->second.residue;
+        ConfDict.erase(p);
+    }
+}
+
+void MIMolDictionary::DeleteConformerEnsembles()
+{
+    std::map<std::string, EntryConformers>::iterator p;
+    for (p = ConfDict.begin(); p != ConfDict.end(); ++p)
+    {
+        delete p->second.residue;
+    }
+    ConfDict.clear();
+}
+
+const ConfEnsemble*MIMolDictionary::GetConformerEnsemble(const std::string &type) const
+{
+    std::map<std::string, EntryConformers>::const_iterator p = ConfDict.find(type);
+    return p == ConfDict.end() ? NULL : &p->second.confs;
 }
 
 static bool ContainsAdjacentAtoms(const TORSDICT &t)
@@ -2042,6 +2078,7 @@ int MIMolDictionary::LoadRes(Residue *respdb, bool append, bool replace_old, boo
                         ResDict = next;
                     }
                     FreeResidueList(oldres);
+                    DeleteConformerEnsemble(oldtype);
                     j = 0;
                     while (j < PlaneDict.size())
                     {
@@ -2181,6 +2218,7 @@ int MIMolDictionary::LoadRes(Residue *respdb, bool append, bool replace_old, boo
         {
             FreeResidueList(ResDict);
         }
+        DeleteConformerEnsembles();
         ResDict = newres;
     }
     else
@@ -2245,53 +2283,48 @@ bool MIMolDictionary::AddConfs(const ConfSaver &confs, bool replace)
 {
     int n = std::min(confs.NumberSets(), 999999);
     Residue *dictres = GetDictResidue(confs.GetResidue()->type().c_str(), 0);
-    if (dictres != confs.GetResidue())
+    if (dictres != confs.GetResidue() || n == 0)
     {
         return false;
     }
 
-
-    ConfSaver orig(dictres);
-    orig.Save();
-
-    Residue *first_new, *current_new, *prev_new;
-    for (int i = 0; i < n; ++i)
+    if (replace)
     {
-        char buf[MAXNAME];
-        confs.Restore(i+1);
-        current_new = new Residue(*dictres);
-        sprintf(buf, "%d", i+1);
-        current_new->setName(std::string(buf));
-
-        if (i == 0)
-        {
-            first_new = current_new;
-        }
-        else
+        // the entry itself stays; its other conformers go
+        Residue *oldres = ResDict;
+        while (oldres != NULL)
         {
-            prev_new->insertResidue(current_new);
+            Residue *next = oldres->next();
+            if (oldres != dictres && oldres->type() == dictres->type())
+            {
+                oldres->removeFromList();
+                if (oldres == ResDict)
+                {
+                    ResDict = next;
+                }
+                FreeResidueList(oldres);
+            }
+            oldres = next;
         }
-        prev_new = current_new;
+        DeleteConformerEnsemble(dictres->type());
+        build_map();
     }
-    if (replace)
+
+    // The conformers are kept packed rather than as a residue each, over a
+    // copy of the entry's atoms that the dictionary owns
+    const ConfEnsemble &added = confs.Ensemble();
+    EntryConformers &entry = ConfDict[dictres->type()];
+    if (entry.residue == NULL || entry.confs.AtomCount() != added.AtomCount())
     {
-        DeleteConformers(dictres->type());
+        delete entry.residue;
+        entry.residue = new Residue(*dictres);
+        entry.confs.SetAtoms(entry.residue->atoms());
     }
-    else
+    entry.confs.Reserve(entry.confs.NumberSets() + n);
+    for (int i = 0; i < n; ++i)
     {
-        orig.Restore(1);
+        entry.confs.Save(added.Coords(i));
     }
-
-    Residue *last = ResDict;
-    if (last)
-    {
-        while (last->next())
-        {
-            last = last->next();
-        }
-        last->insertResidue(first_new);
-    }
-    build_map();
     SetModified(true);
     return true;
 }
@@ -2311,28 +2344,110 @@ bool MIMolDictionary::AddConfs(const ConfSaver &confs, bool replace)
 
 bool GetConfs(GeomSaver &confs, Residue *res, MIMolDictionary *dict, MIMoleculeBase *model, unsigned int max)
 {
+    ConfEnsemble ensemble;
+    if (!GetConfs(ensemble, res, dict, max))
+    {
+        return false;
+    }
+
     //First save the current coords of res, to restore at the end of this ftn
     GeomSaver tmp;
     tmp.Save(res, 1, model);
 
-    //Now loop through the conformers in the dictionary, temporarily setting the coords
-    //of res to that conformer and then saving it to the geomsaver
-    int i, nFound = 0;
+    for (int i = 0; i < ensemble.NumberSets(); ++i)
+    {
+        ensemble.Restore(i);
+        confs.Save(res, 1, model);
+    }
+
+    tmp.Restore(1);
+    return true;
+}
+
+// The index in atoms of the atom of the same name as each atom of res
+static bool MatchAtomNames(const Residue *res, const MIAtomList &atoms, std::vector<int> &index)
+{
+    std::map<std::string, int> indexOf;
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        indexOf.insert(std::make_pair(std::string(atoms[i]->name()), (int)i));
+    }
+    index.resize(res->atomCount());
+    for (int i = 0; i < res->atomCount(); ++i)
+    {
+        std::map<std::string, int>::iterator a = indexOf.find(std::string(res->atom(i)->name()));
+        if (a == indexOf.end())
+        {
+            return false;
+        }
+        index[i] = a->second;
+    }
+    return true;
+}
+
+bool GetConfs(ConfEnsemble &confs, Residue *res, MIMolDictionary *dict, unsigned int max)
+{
+    confs.SetAtoms(res->atoms());
     int nConf = std::min(dict->GetNumberInDict(res->type().c_str()), max);
-    Residue *conf;
+    if (nConf <= 0 || res->atomCount() == 0)
+    {
+        return false;
+    }
+    const ConfEnsemble *packed = dict->GetConformerEnsemble(res->type());
+    int nPacked = packed != NULL ? std::min(packed->NumberSets(), (int)max - nConf) : 0;
+    confs.Reserve(nConf + nPacked);
 
-    for (i = 0; i < nConf; ++i)
+    //The conformers are copies of the first, so the atoms of res are looked
+    //up by name in it once and the indices checked against each conformer
+    Residue *first = dict->GetDictResidue(res->type().c_str(), 0);
+    std::vector<int> index;
+    if (!Monomer::isValid(first) || !MatchAtomNames(res, first->atoms(), index))
     {
-        conf = dict->GetDictResidue(res->type().c_str(), i);
-        if (MICopyCoords(res, conf))
+        return false;
+    }
+
+    std::vector<float> xyz(3 * res->atomCount());
+    int i;
+    for (int c = 0; c < nConf; ++c)
+    {
+        Residue *conf = dict->GetDictResidue(res->type().c_str(), c);
+        if (!Monomer::isValid(conf) || conf->atomCount() != first->atomCount())
+        {
+            continue;
+        }
+        for (i = 0; i < res->atomCount(); ++i)
+        {
+            const MIAtom *atom = conf->atom(index[i]);
+            if (strcmp(atom->name(), res->atom(i)->name()) != 0)
+            {
+                break;
+            }
+            xyz[3 * i] = atom->x();
+            xyz[3 * i + 1] = atom->y();
+            xyz[3 * i + 2] = atom->z();
+        }
+        if (i == res->atomCount())
         {
-            confs.Save(res, 1, model);
-            nFound++;
+            confs.Save(&xyz[0]);
         }
     }
 
-    tmp.Restore(1);
-    return nFound > 0;
+    //The packed conformers are a straight copy once their atoms are matched
+    if (nPacked > 0 && MatchAtomNames(res, packed->Atoms(), index))
+    {
+        for (int c = 0; c < nPacked; ++c)
+        {
+            const float *coords = packed->Coords(c);
+            for (i = 0; i < res->atomCount(); ++i)
+            {
+                xyz[3 * i] = coords[3 * index[i]];
+                xyz[3 * i + 1] = coords[3 * index[i] + 1];
+                xyz[3 * i + 2] = coords[3 * index[i] + 2];
+            }
+            confs.Save(&xyz[0]);
+        }
+    }
+    return confs.NumberSets() > 0;
 }
 
 Residue *ExpandConfs(const Residue *single, const GeomSaver &confs)
@@ -2402,6 +2517,7 @@ int MIMolDictionary::LoadDict(FILE *fp, bool append, bool replace_old)
                         ResDict = next;
                     }
                     FreeResidueList(oldres);
+                    DeleteConformerEnsemble(oldtype);
 
                     j = 0;
                     while (j < PlaneDict.size())
@@ -2521,6 +2637,7 @@ int MIMolDictionary::LoadDict(FILE *fp, bool append, bool replace_old)
         {
             FreeResidueList(ResDict);
         }
+        DeleteConformerEnsembles();
         ResDict = respdb;
     }
     else
@@ -3200,7 +3317,11 @@ bool MIMolDictionary::SaveDictionary(const char *pathname, const char *res_type)
     }
 
     if (res_type != NULL)
-        return fwriteDictEntry(fp, res_type);
+    {
+        bool result = fwriteDictEntry(fp, res_type);
+        fclose(fp);
+        return result;
+    }
 
     // save the entire dictionary
     std::set<std::string> residue_set;
@@ -3242,6 +3363,23 @@ bool MIMolDictionary::fwriteDictEntry(FILE *fp, const char *res_type)
             return false;
     }
 
+    // then the packed conformers, as residues numbered on from the others
+    // so that reading the file back does not run two together
+    std::map<std::string, EntryConformers>::iterator packed = ConfDict.find(res_type);
+    if (packed != ConfDict.end())
+    {
+        Residue *conf = packed->second.residue;
+        for (int c = 0; c < packed->second.confs.NumberSets(); c++)
+        {
+            char buf[MAXNAME];
+            sprintf(buf, "%d", (int)nconf+c+1);
+            conf->setName(std::string(buf));
+            packed->second.confs.Restore(c);
+            if (!SavePDB(fp, conf, NULL, 0, false))
+                return false;
+        }
+    }
+
     vector<Bond> *bonds = GetDictBonds(res_type);
     vector<ANGLE> *angles = GetDictAngles(res_type);
 
@@ -3455,8 +3593,16 @@ bool CreateDictAngles(Residue *res, const multimap<std::string, ANGLEDICT> &angl
 }
 
 static MIMolDictionary *DICTIONARY = NULL;
+
+// Dictionaries set for single threads by MIDictionaryScope
+static QThreadStorage<MIMolDictionary**> threadDictionary;
+
 MIMolDictionary *MIGetDictionary()
 {
+    if (threadDictionary.hasLocalData() && *threadDictionary.localData() != NULL)
+    {
+        return *threadDictionary.localData();
+    }
     return DICTIONARY;
 }
 
@@ -3465,4 +3611,19 @@ void MISetDictionary(MIMolDictionary *d)
     DICTIONARY = d;
 }
 
+MIDictionaryScope::MIDictionaryScope(MIMolDictionary *dict)
+{
+    if (!threadDictionary.hasLocalData())
+    {
+        threadDictionary.setLocalData(new MIMolDictionary*(NULL));
+    }
+    previous_ = *threadDictionary.localData();
+    *threadDictionary.localData() = dict;
+}
+
+MIDictionaryScope::~MIDictionaryScope()
+{
+    *threadDictionary.localData() = previous_;
+}
+
 }
@@ -108,6 +108,10 @@ namespace chemlib
         bool AddConfs(Residue *res, const std::string res_type);
         bool AddConfs(const ConfSaver &confs, bool replace = false);
 
+        // The conformers added to the entry for type with AddConfs, packed
+        // over a copy of the entry's atoms; 0 if there are none
+        const ConfEnsemble *GetConformerEnsemble(const std::string &type) const;
+
         int AddTorsion(const TORSION &torsion);
         int AddPlane(const PLANE &plane);
         int AddChiral(const CHIRAL &chiral, const char *res_type);
@@ -241,6 +245,8 @@ namespace chemlib
         unsigned int BuildInternalBumpBonds(MIAtomList &CurrentAtoms, std::vector<Bond> &bonds);
         void Clear();
         void build_map();
+        void DeleteConformerEnsemble(const std::string &type);
+        void DeleteConformerEnsembles();
 
         bool RefiHBonds;
         bool RefiSecStruct;
@@ -257,6 +263,18 @@ namespace chemlib
 
         dict_map DictMap;
 
+        struct EntryConformers
+        {
+            EntryConformers()
+                : residue(0)
+            {
+            }
+
+            Residue *residue;
+            ConfEnsemble confs;
+        };
+        std::map<std::string, EntryConformers> ConfDict;
+
         float sigmaangle;
         float sigmabond;
         float sigmabump;
@@ -276,14 +294,41 @@ namespace chemlib
 //with the given residue and molecule
     bool GetConfs(GeomSaver &confs, Residue *res, MIMolDictionary *dict, MIMoleculeBase *model, unsigned int max = 10000);
 
+//Retrieves conformations from the dictionary, the entries of the residue's
+//type and then the ensemble added with AddConfs, into a packed ensemble of
+//the atoms of the given residue, matching atom names only once
+    bool GetConfs(ConfEnsemble &confs, Residue *res, MIMolDictionary *dict, unsigned int max = 10000);
+
 //Converts conformation data from a GeomSaver to a list of residues
     Residue *ExpandConfs(const Residue *single, const GeomSaver &confs);
 
 
 
+    //@{
+    // The dictionary of the calling thread if one is set by a
+    // MIDictionaryScope, otherwise the one set by MISetDictionary.
+    //@}
     MIMolDictionary *MIGetDictionary();
     void MISetDictionary(MIMolDictionary*);
 
+    //@{
+    // Makes dict the dictionary returned by MIGetDictionary on this thread
+    // for the lifetime of the scope, so that fits with their own
+    // dictionaries can run on different threads.
+    //@}
+    class MIDictionaryScope
+    {
+    public:
+        explicit MIDictionaryScope(MIMolDictionary *dict);
+        ~MIDictionaryScope();
+
+    private:
+        MIMolDictionary *previous_;
+
+        MIDictionaryScope(const MIDictionaryScope&);
+        MIDictionaryScope &operator=(const MIDictionaryScope&);
+    };
+
 }
 #endif // mifit_legacy_MIMolDictionary_h
 
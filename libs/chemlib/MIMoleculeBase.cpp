@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <QtCore/QMutex>
 
 #include <math/mathlib.h>
 
@@ -25,12 +26,17 @@ static std::map<MIMoleculeBase*, unsigned int> DELETED_MOLECULES;
 
 MIMoleculeBase::MoleculeRefCountMap MIMoleculeBase::refCounts;
 
+// Guards refCounts, which objects built on different threads all update
+static QMutex refCountMutex;
+
 bool MIMoleculeBase::isValid(MIMoleculeBase *mol)
 {
     bool result = false;
-    if (mol != NULL && refCounts.find(mol) != refCounts.end())
+    if (mol != NULL)
     {
-        result = refCounts[mol] > 0;
+        QMutexLocker lock(&refCountMutex);
+        MIMoleculeBase::MoleculeRefCountMap::iterator i = refCounts.find(mol);
+        result = i != refCounts.end() && i->second > 0;
     }
 #ifdef MEMORY_CORRUPTION_DEBUG
     if (!result && mol)
@@ -44,7 +50,10 @@ bool MIMoleculeBase::isValid(MIMoleculeBase *mol)
 MIMoleculeBase::MIMoleculeBase()
     : SymmResidues(NULL)
 {
-    ++refCounts[this];
+    {
+        QMutexLocker lock(&refCountMutex);
+        ++refCounts[this];
+    }
     compound = "";
 
     Tatom1 = Tatom2 = NULL;
@@ -61,7 +70,10 @@ MIMoleculeBase::MIMoleculeBase()
 MIMoleculeBase::MIMoleculeBase(Residue *reslist, const std::string &cmpd, Bond *conns, int nconns)
     : SymmResidues(NULL)
 {
-    ++refCounts[this];
+    {
+        QMutexLocker lock(&refCountMutex);
+        ++refCounts[this];
+    }
     compound = cmpd;
 
     Tatom1 = Tatom2 = NULL;
@@ -92,10 +104,12 @@ MIMoleculeBase::~MIMoleculeBase()
         FreeResidueList(residues);
         residues = 0;
     }
-    --refCounts[this];
-    if (refCounts[this] == 0)
     {
-        refCounts.erase(this);
+        QMutexLocker lock(&refCountMutex);
+        if (--refCounts[this] == 0)
+        {
+            refCounts.erase(this);
+        }
     }
     moleculeDeleted(this);
 #if defined(MEMORY_CORRUPTION_DEBUG)
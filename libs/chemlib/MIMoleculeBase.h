@@ -63,6 +63,7 @@ namespace chemlib
             if (m)
             {
                 SetModified(m);
+                OnCoordsChanged();
             }
         }
 
@@ -327,6 +328,14 @@ namespace chemlib
         {
         }
 
+        /**
+         * Called whenever atom coordinates are marked as changed, which may
+         * be part way through an edit, so overrides should only note it.
+         */
+        virtual void OnCoordsChanged()
+        {
+        }
+
         void doDeleteAtom(MIAtom *a);
 
     private:
@@ -1,6 +1,7 @@
 #include <vector>
 #include <sstream>
 #include <fstream>
+#include <QtCore/QMutex>
 
 #include "Residue.h"
 #include "mol_util.h"
@@ -20,12 +21,17 @@ static std::map<Residue*, unsigned int> DELETED_RESIDUES;
 
 Monomer::MonomerRefCountMap Monomer::refCounts;
 
+// Guards refCounts, which objects built on different threads all update
+static QMutex refCountMutex;
+
 bool Monomer::isValid(const Monomer *res)
 {
     bool result = false;
-    if (res != NULL && refCounts.find(res) != refCounts.end())
+    if (res != NULL)
     {
-        result = refCounts[res] > 0;
+        QMutexLocker lock(&refCountMutex);
+        Monomer::MonomerRefCountMap::iterator i = refCounts.find(res);
+        result = i != refCounts.end() && i->second > 0;
     }
 #ifdef MEMORY_CORRUPTION_DEBUG
     if (!result && res)
@@ -48,14 +54,20 @@ Monomer::Monomer()
       x_(0.0f),
       y_(0.0f)
 {
-    ++refCounts[this];
+    {
+        QMutexLocker lock(&refCountMutex);
+        ++refCounts[this];
+    }
     type_ = "";
     name_ = "";
 }
 
 Monomer::Monomer(const Monomer &rhs)
 {
-    ++refCounts[this];
+    {
+        QMutexLocker lock(&refCountMutex);
+        ++refCounts[this];
+    }
     *this = rhs;
 
     // must do a deep copy of the atoms
@@ -112,10 +124,12 @@ Monomer::~Monomer()
     {
         delete atoms_[i];
     }
-    --refCounts[this];
-    if (refCounts[this] == 0)
     {
-        refCounts.erase(this);
+        QMutexLocker lock(&refCountMutex);
+        if (--refCounts[this] == 0)
+        {
+            refCounts.erase(this);
+        }
     }
 #if defined(MEMORY_CORRUPTION_DEBUG)
     if (DELETED_RESIDUES.size()==magic_delete)
@@ -1,7 +1,13 @@
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <map>
 
 #include <ui/Logger.h>
 #include <math/mathlib.h>
+#include <util/MappedFile.h>
+#include <util/parallel.h>
+#include <util/system.h>
 
 
 #include <chemlib/Monomer.h>
@@ -95,299 +101,540 @@ void PDB::CreateBond(MIAtom *atom1, MIAtom *atom2, vector<Bond> &bonds)
     bonds.push_back(bond);
 }
 
-#define strkeq(s1, s2, k) /* true if first k chars of string s1 and s2 match */ \
-    ( k <= 0 ? 1 : s1[0] == s2[0] ? !strncmp(s1, s2, (k)) : 0)
-
 static bool IGNORE_DUMMY = true;
 void MISetIgnoreDummyAtomsOnLoad(bool ignore)
 {
     IGNORE_DUMMY = ignore;
 }
 
-Residue *LoadPDB(FILE *f, std::vector<Bond> *connects)
+namespace
 {
-#define column(n) (linebuf+(n)-1)
-    char linebuf[200];
-    double x, y, z;
-    double Bvalue;
-    double occupancy;
-    char abuf[MAXATOMNAME];
-    char rname[MAXNAME];
-    char rtype[MAXNAME];
-    char oldrtype[MAXNAME];
-    char oldrname[MAXNAME];
+
+// Fields of one ATOM/HETATM, TER, ANISOU or CONECT record, converted
+// straight from the fixed columns of the mapped file. Records are
+// independent of each other, so they can be parsed concurrently; the
+// state that links them (TER count, current residue) is applied by a
+// single serial pass in LoadPDB.
+struct PdbRecord
+{
+    enum Kind
+    {
+        ATOM_RECORD,
+        SHORT_ATOM_RECORD,          // too short to contain x,y,z - ignored
+        TER_RECORD,
+        ANISOU_RECORD,
+        CONECT_RECORD
+    };
+
+    unsigned char kind;
+    bool dummy;                     // nonsense coordinates sometimes added by XPLOR
+    bool hasResType;                // otherwise the previous record's values apply
+    bool hasResName;
+    char altloc;
     char chainid;
-    int bonding_group, oldgroup = 0;
-    int ter_count; /* used to form bonding_group value:
-                      low byte is chain ID from PDB file,
-                      next higher byte is ter_count */
-    int is_atom, is_hetatm;
-    long na = 0, n = 0, i, ii;
-    int U11, U22, U33, U12, U13, U23;
-    Residue *res, *res1;
-    int j, ia[11], lb;
-    static int modelno = -1;
-    MIAtom *atom;
-    MIAtomList atoms;
-    na = 0;
-    rewind(f);
-    atoms.clear();
-    connects->clear();
+    char name[MAXATOMNAME];
+    char rtype[MAXNAME];
+    char rname[MAXNAME];
+    int serial;                     // for CONECT, the number of ids in conect
+    int atomicNumber;
+    float x, y, z;
+    float occupancy;
+    float Bvalue;
+    int values[11];                 // ANISOU U*10000, or CONECT atom serials
+};
+
+inline bool LineStartsWith(const char *line, const char *end, const char *s, int k)
+{
+    return end - line >= k && !strncmp(line, s, k);
+}
 
-    if (NULL == (res = new Residue()))
+inline bool IsBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// Equivalent of sscanf("%Ns"): skips blanks and copies up to width
+// non-blank characters. Returns false if the line ends first.
+bool ScanWord(const char *p, const char *end, int width, char *word)
+{
+    while (p < end && IsBlank(*p))
     {
-        return (NULL);
+        ++p;
     }
-    res1 = res;
-    res->set_linkage_type(NTERMINUS);
-    res->setSecstr('U');
+    if (p >= end)
+    {
+        return false;
+    }
+    int n = 0;
+    while (p < end && n < width && !IsBlank(*p))
+    {
+        word[n++] = *p++;
+    }
+    word[n] = '\0';
+    return true;
+}
 
-    ter_count = 0;
-    while (fgets(linebuf, sizeof linebuf, f) != NULL)
+// Equivalent of sscanf("%Nd") advancing p past the converted field
+bool ScanInt(const char *&p, const char *end, int width, int &value)
+{
+    while (p < end && IsBlank(*p))
+    {
+        ++p;
+    }
+    const char *fieldEnd = (end - p > width) ? p + width : end;
+    const char *q = p;
+    if (q < fieldEnd && (*q == '+' || *q == '-'))
+    {
+        ++q;
+    }
+    if (q == fieldEnd || *q < '0' || *q > '9')
+    {
+        return false;
+    }
+    while (q < fieldEnd && *q >= '0' && *q <= '9')
+    {
+        ++q;
+    }
+    MIParseInt(p, q, value);
+    p = q;
+    return true;
+}
+
+// Reads the integer in the given five-column CONECT field
+bool ConectField(const char *line, const char *end, int start, int &value)
+{
+    if (end - line <= start)
+    {
+        return false;
+    }
+    const char *p = line + start;
+    const char *fieldEnd = (end - p > 5) ? p + 5 : end;
+    return ScanInt(p, fieldEnd, 5, value);
+}
+
+unsigned int PackKey(const char *s)
+{
+    unsigned int key = 0;
+    for (int i = 0; i < 4 && s[i] != '\0'; ++i)
+    {
+        key |= (unsigned int)(unsigned char)s[i] << (8 * i);
+    }
+    return key;
+}
+
+void ParseAtomRecord(const char *line, const char *end, PdbRecord &rec)
+{
+#define column(n) (line+(n)-1)
+    // Length as fgets into a 200 character buffer would report it
+    long lb = end - line;
+    if (lb > 199)
     {
-        is_atom = strkeq("ATOM", linebuf, 4) || strkeq("atom", linebuf, 4);
-        is_hetatm = is_atom ? 0 : strkeq("HETATM", linebuf, 6)
-                    || strkeq("hetatm", linebuf, 6) ;
-        if ( (is_atom || is_hetatm) )
+        lb = 199;
+    }
+    if (lb < 53)
+    {
+        rec.kind = PdbRecord::SHORT_ATOM_RECORD;
+        return;
+    }
+    rec.kind = PdbRecord::ATOM_RECORD;
+
+    char abuf[MAXATOMNAME];
+    strncpy(abuf, column(13), 4);
+    abuf[4] = '\0';
+    int i = 3;
+    while (abuf[i] == ' ' && i > 0)
+    {
+        abuf[i] = '\0';
+        i--;
+    }
+    int ii = 0;
+    while (i != 0 && abuf[ii] == ' ' && ii <= 4)
+    {
+        ii++;
+    }
+    strcpy(rec.name, abuf+ii);
+
+    double x = 0.0, y = 0.0, z = 0.0;
+    MIParseDouble(column(30), end, x);
+    MIParseDouble(column(39), end, y);
+    MIParseDouble(column(47), end, z);
+    rec.dummy = (x >= 9999.0 || y >= 9999.0 || z >= 9999.0);
+    rec.x = (float)x;
+    rec.y = (float)y;
+    rec.z = (float)z;
+
+    double occupancy = 1.0;
+    if (lb > 55)
+    {
+        occupancy = 0.0;
+        MIParseDouble(column(55), end, occupancy);
+    }
+    rec.occupancy = (float)occupancy;
+    double Bvalue = 15.0;
+    if (lb > 61)
+    {
+        Bvalue = 0.0;
+        MIParseDouble(column(61), end, Bvalue);
+    }
+    if (Bvalue < 0.0)
+    {
+        Bvalue = 15.0;
+    }
+    rec.Bvalue = (float)Bvalue;
+
+    rec.serial = 0;
+    MIParseInt(column(7), end, rec.serial);
+    rec.chainid = *column(22);
+    rec.altloc = line[16];
+    rec.atomicNumber = Atomic_Number(column(13));
+
+    if (line[17] == ' ' || line[17] == '\''
+        || (isalnum((unsigned char)line[17]) && isalnum((unsigned char)line[20])
+            && isalnum((unsigned char)line[16]) && isalnum((unsigned char)line[15])))
+    {
+        /* the ' is a special case from hyram leffert */
+        rec.hasResType = ScanWord(column(19), end, 3, rec.rtype);
+    }
+    else
+    {
+        rec.hasResType = ScanWord(column(18), end, 3, rec.rtype);
+    }
+    rec.hasResName = ScanWord(column(23), end, 4, rec.rname);
+#undef column
+}
+
+void ParseAnisouRecord(const char *line, const char *end, PdbRecord &rec)
+{
+    rec.kind = PdbRecord::ANISOU_RECORD;
+    // "%*s%d": skip the record name, then the atom serial number
+    const char *p = line;
+    while (p < end && !IsBlank(*p))
+    {
+        ++p;
+    }
+    if (!ScanInt(p, end, 64, rec.serial))
+    {
+        rec.serial = 0;
+    }
+    for (int i = 0; i < 6; ++i)
+    {
+        rec.values[i] = 0;
+    }
+    if (end - line > 28)
+    {
+        p = line + 28;
+        for (int i = 0; i < 6 && ScanInt(p, end, 7, rec.values[i]); ++i)
         {
-            atom = new MIAtom;
-            lb = strlen(linebuf);
-            if (lb < 53)
-            {
-                static int ntimes = 0;
-                if (ntimes < 10)
-                {
-                    std::string m;
-                    m = "ATOM record too short - not long enough to contain x,y,z info - ignored\n:";
-                    m += linebuf;
-                } //else if(ntimes == 10) Logger::message("Length message will not be repeated - more than 10 occurences");
-                ntimes++;
-                continue;
-            }
-            strncpy(abuf, column(13), 4);
-            abuf[4] = '\0';
-            i = 3;
-            while (abuf[i] == ' ' && i > 0)
-            {
-                abuf[i] = '\0';
-                i--;
-            }
-            ii = 0;
-            while (i != 0 && abuf[ii] == ' ' && ii <= 4)
-            {
-                ii++;
-            }
-            atom->setName(abuf+ii);
+        }
+    }
+}
 
-            //Give the atom a color
-            if (MIGetColorSetter())
-            {
-                (*MIGetColorSetter())(atom);
-            }
+void ParseConectRecord(const char *line, const char *end, PdbRecord &rec)
+{
+    rec.kind = PdbRecord::CONECT_RECORD;
+    rec.serial = 0;
+    for (int i = 0; i < 11; ++i)
+    {
+        if (!ConectField(line, end, 5*i+6, rec.values[i]))
+        {
+            break;
+        }
+        rec.serial++;
+    }
+}
 
-            x  = atof(column(30));
-            y  = atof(column(39));
-            z  = atof(column(47));
-            // catch nonsense atoms sometimes added by XPLOR
-            if (x >= 9999.0 || y >= 9999.0 || z >= 9999.0)
-            {
-                if (IGNORE_DUMMY)
-                {
-                    continue;
-                }
-            }
-            atom->setPosition((float)x, (float)y, (float)z);
-            if (lb > 55)
-            {
-                occupancy = atof(column(55));
-            }
-            else
-            {
-                occupancy = 1.0;
-            }
-            atom->setOcc((float)occupancy);
-            if (lb > 61)
-            {
-                Bvalue = atof(column(61));
-            }
-            else
-            {
-                Bvalue = 15.0;
-            }
-            if (Bvalue < 0.0)
+// Parses the records of one piece of the file. Pieces start and end on
+// line boundaries.
+class PdbChunkParser
+{
+    const std::vector<const char*> &bounds_;
+    std::vector<std::vector<PdbRecord> > &records_;
+
+public:
+    PdbChunkParser(const std::vector<const char*> &bounds,
+                   std::vector<std::vector<PdbRecord> > &records)
+        : bounds_(bounds),
+          records_(records)
+    {
+    }
+
+    void operator()(int begin, int end)
+    {
+        for (int chunk = begin; chunk < end; ++chunk)
+        {
+            parse(bounds_[chunk], bounds_[chunk+1], records_[chunk]);
+        }
+    }
+
+    void parse(const char *p, const char *end, std::vector<PdbRecord> &records)
+    {
+        // Most lines of a coordinate file are 81 characters
+        records.reserve((end - p) / 81 + 1);
+        PdbRecord rec;
+        while (p < end)
+        {
+            const char *eol = static_cast<const char*>(memchr(p, '\n', end - p));
+            const char *next = eol ? eol + 1 : end;
+            if (LineStartsWith(p, next, "ATOM", 4) || LineStartsWith(p, next, "atom", 4)
+                || LineStartsWith(p, next, "HETATM", 6) || LineStartsWith(p, next, "hetatm", 6))
             {
-                Bvalue = 15.0;
+                ParseAtomRecord(p, next, rec);
+                records.push_back(rec);
             }
-            atom->setBValue((float)Bvalue);
-            atom->set_radius_type(0);
-            atom->setType(MIAtom::MIGetAtomTypeFromName(atom->name()));
-            atom->setMass(atoi(column(7))); // temporary storage for atomnumber
-            // used for figuring CONECT info later on
-            chainid = *column(22);
-            atom->setAltloc(linebuf[16]);
-            atom->setAtomicnumber(Atomic_Number(column(13)));
-            atom->setAtomnumber(n + 1);
-            atom->setSymmop(0);
-            atom->setCharge(0);
-            atom->set_formal_charge(0);
-            atoms.push_back(atom);
-
-            bonding_group = (ter_count<<8)|chainid;
-            if (linebuf[17] == ' ' || linebuf[17] == '\''
-                || (isalnum(linebuf[17]) && isalnum(linebuf[20])
-                    && isalnum(linebuf[16]) && isalnum(linebuf[15])))
+            else if (LineStartsWith(p, next, "TER", 3) || LineStartsWith(p, next, "ter", 3))
             {
-                /* the ' is a special case from hyram leffert */
-                sscanf(column(19), "%3s", rtype);
+                rec.kind = PdbRecord::TER_RECORD;
+                records.push_back(rec);
             }
-            else
+            else if (LineStartsWith(p, next, "ANISOU", 6))
             {
-                sscanf(column(18), "%3s", rtype);
+                ParseAnisouRecord(p, next, rec);
+                records.push_back(rec);
             }
-            sscanf(column(23), "%4s", rname);
-            n++;
-            na++;
-            if (n == 1) // initialize firt residue.
+            else if (LineStartsWith(p, next, "CONECT", 6))
             {
-                strcpy(oldrname, rname);
-                strcpy(oldrtype, rtype);
-                oldgroup = bonding_group;
-                res->setName(rname);
-                res->setType(rtype);
-                res->set_chain_id(bonding_group);
-            }
-            else if (bonding_group != oldgroup
-                     || strcmp(oldrname, rname)
-                     || strcmp(oldrtype, rtype) )
-            {
-                /* new residue */
-                res->clearAtoms();
-                for (j = 0; j < na-1; j++)
-                {
-                    res->addAtom(atoms[n-na+j]);
-                }
-                res->set_linkage_type(MIDDLE);
-                res->setSecstr('U');
-                res = res->insertResidue(new Residue());
-                res->setName(rname);
-                res->setType(rtype);
-                res->set_chain_id(bonding_group);
-                strcpy(oldrname, rname);
-                strcpy(oldrtype, rtype);
-                oldgroup = bonding_group;
-                na = 1;
+                ParseConectRecord(p, next, rec);
+                records.push_back(rec);
             }
+            p = next;
         }
-        else if (strkeq("TER", linebuf, 3) || strkeq("ter", linebuf, 3))
+    }
+};
+
+// Don't bother splitting files smaller than this
+const long MIN_PDB_CHUNK = 256*1024;
+
+} // anonymous namespace
+
+Residue *LoadPDB(FILE *f, std::vector<Bond> *connects)
+{
+    connects->clear();
+
+    rewind(f);
+    MappedFile contents;
+    if (!contents.map(f) || contents.size() == 0)
+    {
+        Logger::message("Error: No atoms found in file!");
+        return NULL;
+    }
+
+    // Split the file into pieces on line boundaries and parse them in parallel
+    long size = (long)contents.size();
+    int nChunks = MIParallelThreadCount() * 4;
+    if (nChunks > size / MIN_PDB_CHUNK)
+    {
+        nChunks = (int)(size / MIN_PDB_CHUNK);
+    }
+    if (nChunks < 1)
+    {
+        nChunks = 1;
+    }
+    std::vector<const char*> bounds;
+    bounds.push_back(contents.begin());
+    for (int i = 1; i < nChunks; ++i)
+    {
+        const char *p = contents.begin() + (long)((double)size * i / nChunks);
+        if (p < bounds.back())
         {
-            ter_count++;
+            p = bounds.back();
         }
-        else if (strkeq("ANISOU", linebuf, 6))
+        const char *eol = static_cast<const char*>(memchr(p, '\n', contents.end() - p));
+        bounds.push_back(eol ? eol + 1 : contents.end());
+    }
+    bounds.push_back(contents.end());
+
+    std::vector<std::vector<PdbRecord> > records(nChunks);
+    PdbChunkParser parser(bounds, records);
+    MIParallelFor(0, nChunks, parser);
+
+    size_t natoms = 0;
+    for (int chunk = 0; chunk < nChunks; ++chunk)
+    {
+        natoms += records[chunk].size();
+    }
+
+    // Single pass in file order: create the atoms and link them into residues
+    Residue *res, *res1;
+    res = new Residue();
+    res1 = res;
+    res->set_linkage_type(NTERMINUS);
+    res->setSecstr('U');
+
+    MIAtomList atoms;
+    atoms.reserve(natoms);
+    std::vector<const PdbRecord*> conects;
+    char rtype[MAXNAME] = "";
+    char rname[MAXNAME] = "";
+    unsigned int typeKey = 0, nameKey = 0;
+    unsigned int oldTypeKey = 0, oldNameKey = 0;
+    int bonding_group = 0, oldgroup = 0;
+    int ter_count = 0; /* used to form bonding_group value:
+                          low byte is chain ID from PDB file,
+                          next higher byte is ter_count */
+    size_t resStart = 0;
+    MIAtom *atom = NULL;
+
+    for (int chunk = 0; chunk < nChunks; ++chunk)
+    {
+        std::vector<PdbRecord>::const_iterator rec = records[chunk].begin();
+        std::vector<PdbRecord>::const_iterator recEnd = records[chunk].end();
+        for (; rec != recEnd; ++rec)
         {
-            if (atom)
+            switch (rec->kind)
+            {
+            case PdbRecord::SHORT_ATOM_RECORD:
+                atom = NULL;
+                break;
+
+            case PdbRecord::ATOM_RECORD:
             {
-                int an;
-                sscanf(linebuf, "%*s%d", &an);
-                if (an == atom->mass())
+                if (rec->dummy && IGNORE_DUMMY)
                 {
-                    atom->newAnisotropicity();
-                    sscanf(column(29), "%7d%7d%7d%7d%7d%7d", &U11, &U22, &U33, &U12, &U13, &U23);
-                    atom->U(0, U11/10000.0f);
-                    atom->U(1, U22/10000.0f);
-                    atom->U(2, U33/10000.0f);
-                    atom->U(3, U12/10000.0f);
-                    atom->U(4, U13/10000.0f);
-                    atom->U(5, U23/10000.0f);
+                    atom = NULL;
+                    break;
                 }
-                else
+                atom = new MIAtom;
+                atom->setName(rec->name);
+
+                //Give the atom a color
+                if (MIGetColorSetter())
+                {
+                    (*MIGetColorSetter())(atom);
+                }
+
+                atom->setPosition(rec->x, rec->y, rec->z);
+                atom->setOcc(rec->occupancy);
+                atom->setBValue(rec->Bvalue);
+                atom->set_radius_type(0);
+                atom->setType(MIAtom::MIGetAtomTypeFromName(atom->name()));
+                atom->setMass(rec->serial); // temporary storage for atomnumber
+                // used for figuring CONECT info later on
+                atom->setAltloc(rec->altloc);
+                atom->setAtomicnumber(rec->atomicNumber);
+                atom->setAtomnumber(atoms.size() + 1);
+                atom->setSymmop(0);
+                atom->setCharge(0);
+                atom->set_formal_charge(0);
+                atoms.push_back(atom);
+
+                bonding_group = (ter_count<<8)|rec->chainid;
+                if (rec->hasResType)
+                {
+                    strcpy(rtype, rec->rtype);
+                    typeKey = PackKey(rtype);
+                }
+                if (rec->hasResName)
+                {
+                    strcpy(rname, rec->rname);
+                    nameKey = PackKey(rname);
+                }
+
+                if (atoms.size() == 1) // initialize first residue.
+                {
+                    res->setName(rname);
+                    res->setType(rtype);
+                    res->set_chain_id(bonding_group);
+                }
+                else if (bonding_group != oldgroup
+                         || nameKey != oldNameKey
+                         || typeKey != oldTypeKey)
+                {
+                    /* new residue */
+                    size_t resEnd = atoms.size() - 1;
+                    res->clearAtoms();
+                    res->reserveAtoms(resEnd - resStart);
+                    for (size_t j = resStart; j < resEnd; j++)
+                    {
+                        res->addAtom(atoms[j]);
+                    }
+                    res->set_linkage_type(MIDDLE);
+                    res->setSecstr('U');
+                    res = res->insertResidue(new Residue());
+                    res->setName(rname);
+                    res->setType(rtype);
+                    res->set_chain_id(bonding_group);
+                    resStart = resEnd;
+                }
+                oldNameKey = nameKey;
+                oldTypeKey = typeKey;
+                oldgroup = bonding_group;
+                break;
+            }
+
+            case PdbRecord::TER_RECORD:
+                ter_count++;
+                break;
+
+            case PdbRecord::ANISOU_RECORD:
+                if (atom && rec->serial == atom->mass())
                 {
-                    //emess("ANISOU out of order");
-                    //emess(linebuf);
+                    atom->newAnisotropicity();
+                    for (int i = 0; i < 6; ++i)
+                    {
+                        atom->U(i, rec->values[i]/10000.0f);
+                    }
                 }
+                break;
+
+            case PdbRecord::CONECT_RECORD:
+                conects.push_back(&*rec);
+                break;
             }
         }
     }
+
     // if no residues, return NULL
-    if (n == 0)
+    if (atoms.empty())
     {
         Logger::message("Error: No atoms found in file!");
+        delete res1;
         return NULL;
     }
     // last residue
     res->clearAtoms();
-    for (j = 0; j < na; j++)
+    res->reserveAtoms(atoms.size() - resStart);
+    for (size_t j = resStart; j < atoms.size(); j++)
     {
-        res->addAtom(atoms[n-na+j]);
+        res->addAtom(atoms[j]);
     }
     res->setSecstr('U');
     res->set_chain_id(bonding_group);
     res->set_linkage_type(CTERMINUS);
 
-    //  find the CONECT records and store them
-    int nid, k, found;
-    char fbuf[10];
-    rewind(f);
-    long ja;
-    MIAtom *a1 = NULL;
-    Bond connect;
-    while (fgets(linebuf, sizeof linebuf, f) != NULL)
+    //  resolve the CONECT records, which refer to the first atom with each number
+    if (!conects.empty())
     {
-        if (strkeq("CONECT", linebuf, 6))
+        std::map<int, MIAtom*> atomsBySerial;
+        for (size_t ja = 0; ja < atoms.size(); ++ja)
+        {
+            atomsBySerial.insert(std::make_pair(atoms[ja]->mass(), atoms[ja]));
+        }
+        Bond connect;
+        for (size_t c = 0; c < conects.size(); ++c)
         {
-            nid = 1;
-            fbuf[5] = '\0';
-            for (j = 0; j < 5; j++)
+            const PdbRecord &rec = *conects[c];
+            if (rec.serial == 0)
             {
-                fbuf[j] = linebuf[j+6];
+                continue;
             }
-            if (sscanf(fbuf, "%d", &ia[0]) == 1)
+            std::map<int, MIAtom*>::const_iterator a1 = atomsBySerial.find(rec.values[0]);
+            if (a1 == atomsBySerial.end())
             {
-                found = 0;
-                for (ja = 0; ja < n; ja++)
-                {
-                    if (atoms[ja]->mass() == ia[0])
-                    {
-                        found = 1;
-                        a1 = atoms[ja];
-                        break;
-                    }
-                }
-                if (!found)
-                {
-                    continue; //go back to searching for CONECT's
-                }
-                for (i = 1; i < 11; i++)
+                continue; //go back to searching for CONECT's
+            }
+            for (int i = 1; i < rec.serial; ++i)
+            {
+                std::map<int, MIAtom*>::const_iterator a2 = atomsBySerial.find(rec.values[i]);
+                if (a2 != atomsBySerial.end())
                 {
-                    j = 5*i+6;
-                    for (k = 0; k < 5; k++)
-                    {
-                        fbuf[k] = linebuf[k+j];
-                    }
-                    if (sscanf(fbuf, "%d", &ia[i]) == 1)
-                    {
-                        nid++;
-                    }
-                    else
-                    {
-                        break;
-                    }
-                    // search for these atoms numbers in atom list
-                    for (ja = 0; ja < n; ja++)
-                    {
-                        if (atoms[ja]->mass() == ia[i])
-                        {
-                            // found it! make connect
-                            connect.setAtom1(a1);
-                            connect.setAtom2(atoms[ja]);
-                            connects->push_back(connect);
-                            break;
-                        }
-                    }
+                    // found it! make connect
+                    connect.setAtom1(a1->second);
+                    connect.setAtom2(a2->second);
+                    connects->push_back(connect);
                 }
             }
         }
     }
-    modelno++;
     return (res1);
 }
 
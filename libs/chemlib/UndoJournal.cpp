@@ -0,0 +1,549 @@
+#include <climits>
+#include <cstring>
+
+#include "UndoJournal.h"
+#include "MIAtom.h"
+#include "Residue.h"
+
+using namespace std;
+
+namespace chemlib
+{
+
+namespace
+{
+
+// Each step is a run of records: the atom id as a varint, a byte of the
+// fields changed and for each of those the old value followed by the new.
+// Floats are stored as the old bits and the new bits xor'ed with them as
+// a varint, which is short for the small moves of most edits.
+
+void PutVarint(vector<unsigned char> &data, unsigned int value)
+{
+    while (value >= 0x80)
+    {
+        data.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    data.push_back((unsigned char)value);
+}
+
+unsigned int GetVarint(const unsigned char *&p)
+{
+    unsigned int value = 0;
+    int shift = 0;
+    while (*p & 0x80)
+    {
+        value |= (unsigned int)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= (unsigned int)(*p++) << shift;
+    return value;
+}
+
+unsigned int FloatBits(float f)
+{
+    unsigned int bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+float BitsFloat(unsigned int bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+void PutFloats(vector<unsigned char> &data, float oldValue, float newValue)
+{
+    unsigned int oldBits = FloatBits(oldValue);
+    for (int i = 0; i < 4; ++i)
+    {
+        data.push_back((unsigned char)(oldBits >> (8 * i)));
+    }
+    PutVarint(data, oldBits ^ FloatBits(newValue));
+}
+
+float GetFloat(const unsigned char *&p, bool redo)
+{
+    unsigned int oldBits = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+    p += 4;
+    unsigned int delta = GetVarint(p);
+    return BitsFloat(redo ? oldBits ^ delta : oldBits);
+}
+
+void SkipFields(const unsigned char *&p, unsigned int changed)
+{
+    int floats = 0;
+    if (changed & UndoJournal::PositionField)
+    {
+        floats += 3;
+    }
+    if (changed & UndoJournal::BValueField)
+    {
+        ++floats;
+    }
+    if (changed & UndoJournal::OccupancyField)
+    {
+        ++floats;
+    }
+    for (int i = 0; i < floats; ++i)
+    {
+        GetFloat(p, false);
+    }
+    if (changed & UndoJournal::ColorField)
+    {
+        GetVarint(p);
+        GetVarint(p);
+    }
+    if (changed & UndoJournal::RadiusTypeField)
+    {
+        p += 2;
+    }
+}
+
+// What an entry of the atom table costs: its slot and its map node
+const size_t IdCost = sizeof(MIAtom*) + sizeof(std::pair<MIAtom* const, unsigned int>) + 4 * sizeof(void*);
+
+}
+
+UndoJournal::UndoJournal(size_t memoryBudget)
+    : _budget(memoryBudget),
+      _used(0),
+      _fields(AllFields),
+      _position(0)
+{
+}
+
+void UndoJournal::SetMemoryBudget(size_t bytes)
+{
+    _budget = bytes;
+    Trim();
+}
+
+size_t UndoJournal::MemoryUsed() const
+{
+    return _used + _atoms.size() * IdCost;
+}
+
+unsigned int UndoJournal::AtomId(MIAtom *atom)
+{
+    map<MIAtom*, unsigned int>::iterator i = _idOf.find(atom);
+    if (i != _idOf.end())
+    {
+        return i->second;
+    }
+    unsigned int id = _atoms.size();
+    _atoms.push_back(atom);
+    _idOf[atom] = id;
+    return id;
+}
+
+void UndoJournal::Track(const MIAtomList &atoms, unsigned int fields)
+{
+    _baseline.clear();
+    _baseline.reserve(atoms.size());
+    _fields = fields;
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        MIAtom *atom = atoms[i];
+        Baseline b;
+        b.id = AtomId(atom);
+        b.x = atom->x();
+        b.y = atom->y();
+        b.z = atom->z();
+        b.b = atom->BValue();
+        b.occ = atom->occ();
+        b.color = atom->color();
+        b.radius = atom->radius_type();
+        _baseline.push_back(b);
+    }
+}
+
+void UndoJournal::Track(Residue *res, int nres, unsigned int fields)
+{
+    MIAtomList atoms;
+    for (int n = 0; res != NULL && n < nres; res = res->next(), ++n)
+    {
+        atoms.insert(atoms.end(), res->atoms().begin(), res->atoms().end());
+    }
+    Track(atoms, fields);
+}
+
+bool UndoJournal::Commit(MIMoleculeBase *model, const string &title)
+{
+    Step step;
+    step.model = model;
+    step.title = title;
+    for (size_t i = 0; i < _baseline.size(); ++i)
+    {
+        const Baseline &b = _baseline[i];
+        MIAtom *atom = _atoms[b.id];
+        if (atom == NULL || !MIAtom::isValid(atom))
+        {
+            continue;
+        }
+        unsigned int changed = 0;
+        if ((_fields & PositionField) && (atom->x() != b.x || atom->y() != b.y || atom->z() != b.z))
+        {
+            changed |= PositionField;
+        }
+        if ((_fields & BValueField) && atom->BValue() != b.b)
+        {
+            changed |= BValueField;
+        }
+        if ((_fields & OccupancyField) && atom->occ() != b.occ)
+        {
+            changed |= OccupancyField;
+        }
+        if ((_fields & ColorField) && atom->color() != b.color)
+        {
+            changed |= ColorField;
+        }
+        if ((_fields & RadiusTypeField) && atom->radius_type() != b.radius)
+        {
+            changed |= RadiusTypeField;
+        }
+        if (changed == 0)
+        {
+            continue;
+        }
+
+        PutVarint(step.data, b.id);
+        step.data.push_back((unsigned char)changed);
+        if (changed & PositionField)
+        {
+            PutFloats(step.data, b.x, atom->x());
+            PutFloats(step.data, b.y, atom->y());
+            PutFloats(step.data, b.z, atom->z());
+        }
+        if (changed & BValueField)
+        {
+            PutFloats(step.data, b.b, atom->BValue());
+        }
+        if (changed & OccupancyField)
+        {
+            PutFloats(step.data, b.occ, atom->occ());
+        }
+        if (changed & ColorField)
+        {
+            PutVarint(step.data, (unsigned short)b.color);
+            PutVarint(step.data, (unsigned short)atom->color());
+        }
+        if (changed & RadiusTypeField)
+        {
+            step.data.push_back(b.radius);
+            step.data.push_back(atom->radius_type());
+        }
+    }
+    _baseline.clear();
+    if (step.data.empty())
+    {
+        return false;
+    }
+
+    while ((int)_steps.size() > _position)
+    {
+        _used -= _steps.back().data.size() + _steps.back().title.size() + sizeof(Step);
+        _steps.pop_back();
+    }
+    std::vector<unsigned char>(step.data).swap(step.data);
+    _used += step.data.size() + step.title.size() + sizeof(Step);
+    _steps.push_back(step);
+    ++_position;
+    Trim();
+    return true;
+}
+
+void UndoJournal::Discard()
+{
+    _baseline.clear();
+}
+
+void UndoJournal::Revert()
+{
+    for (size_t i = 0; i < _baseline.size(); ++i)
+    {
+        const Baseline &b = _baseline[i];
+        MIAtom *atom = _atoms[b.id];
+        if (atom == NULL || !MIAtom::isValid(atom))
+        {
+            continue;
+        }
+        if (_fields & PositionField)
+        {
+            atom->setPosition(b.x, b.y, b.z);
+        }
+        if (_fields & BValueField)
+        {
+            atom->setBValue(b.b);
+        }
+        if (_fields & OccupancyField)
+        {
+            atom->setOcc(b.occ);
+        }
+        if (_fields & ColorField)
+        {
+            atom->setColor(b.color);
+        }
+        if (_fields & RadiusTypeField)
+        {
+            atom->set_radius_type(b.radius);
+        }
+    }
+    _baseline.clear();
+}
+
+void UndoJournal::Apply(const Step &step, bool redo)
+{
+    const unsigned char *p = step.data.empty() ? NULL : &step.data[0];
+    const unsigned char *end = p + step.data.size();
+    while (p < end)
+    {
+        MIAtom *atom = _atoms[GetVarint(p)];
+        if (atom != NULL && !MIAtom::isValid(atom))
+        {
+            atom = NULL;
+        }
+        unsigned int changed = *p++;
+        if (changed & PositionField)
+        {
+            float x = GetFloat(p, redo);
+            float y = GetFloat(p, redo);
+            float z = GetFloat(p, redo);
+            if (atom != NULL)
+            {
+                atom->setPosition(x, y, z);
+            }
+        }
+        if (changed & BValueField)
+        {
+            float b = GetFloat(p, redo);
+            if (atom != NULL)
+            {
+                atom->setBValue(b);
+            }
+        }
+        if (changed & OccupancyField)
+        {
+            float occ = GetFloat(p, redo);
+            if (atom != NULL)
+            {
+                atom->setOcc(occ);
+            }
+        }
+        if (changed & ColorField)
+        {
+            unsigned int oldColor = GetVarint(p);
+            unsigned int newColor = GetVarint(p);
+            if (atom != NULL)
+            {
+                atom->setColor((short)(redo ? newColor : oldColor));
+            }
+        }
+        if (changed & RadiusTypeField)
+        {
+            unsigned char oldRadius = *p++;
+            unsigned char newRadius = *p++;
+            if (atom != NULL)
+            {
+                atom->set_radius_type(redo ? newRadius : oldRadius);
+            }
+        }
+    }
+}
+
+bool UndoJournal::Undo()
+{
+    if (!CanUndo())
+    {
+        return false;
+    }
+    _baseline.clear();
+    --_position;
+    Apply(_steps[_position], false);
+    return true;
+}
+
+bool UndoJournal::Redo()
+{
+    if (!CanRedo())
+    {
+        return false;
+    }
+    _baseline.clear();
+    Apply(_steps[_position], true);
+    ++_position;
+    return true;
+}
+
+bool UndoJournal::RestoreTo(int position)
+{
+    if (position < 0 || position > (int)_steps.size())
+    {
+        return false;
+    }
+    while (_position > position)
+    {
+        Undo();
+    }
+    while (_position < position)
+    {
+        Redo();
+    }
+    return true;
+}
+
+MIMoleculeBase*UndoJournal::Model(int step) const
+{
+    if (step < 0 || step >= (int)_steps.size())
+    {
+        return NULL;
+    }
+    return _steps[step].model;
+}
+
+const string&UndoJournal::Title(int step) const
+{
+    static const string empty;
+    if (step < 0 || step >= (int)_steps.size())
+    {
+        return empty;
+    }
+    return _steps[step].title;
+}
+
+void UndoJournal::Trim()
+{
+    if (MemoryUsed() <= _budget)
+    {
+        return;
+    }
+
+    // Drop the oldest steps but never one that is undone, which would
+    // break the chain to the steps after it. Trimming to three quarters of
+    // the budget leaves room for a few steps before the next Compact.
+    size_t target = _budget - _budget / 4;
+    bool dropped = false;
+    while (MemoryUsed() > target && _steps.size() > 1 && _position > 0)
+    {
+        _used -= _steps.front().data.size() + _steps.front().title.size() + sizeof(Step);
+        _steps.pop_front();
+        --_position;
+        dropped = true;
+    }
+    if (dropped)
+    {
+        Compact();
+    }
+}
+
+void UndoJournal::Compact()
+{
+    // Renumber the atoms the kept steps and the open edit refer to so the
+    // table shrinks with the history; records of purged atoms are dropped
+    vector<unsigned int> newId(_atoms.size(), UINT_MAX);
+    MIAtomList atoms;
+    for (size_t s = 0; s < _steps.size(); ++s)
+    {
+        Step &step = _steps[s];
+        vector<unsigned char> data;
+        const unsigned char *p = step.data.empty() ? NULL : &step.data[0];
+        const unsigned char *end = p + step.data.size();
+        while (p < end)
+        {
+            unsigned int id = GetVarint(p);
+            const unsigned char *record = p;
+            unsigned int changed = *p++;
+            SkipFields(p, changed);
+            if (_atoms[id] == NULL)
+            {
+                continue;
+            }
+            if (newId[id] == UINT_MAX)
+            {
+                newId[id] = atoms.size();
+                atoms.push_back(_atoms[id]);
+            }
+            PutVarint(data, newId[id]);
+            data.insert(data.end(), record, p);
+        }
+        _used -= step.data.size();
+        _used += data.size();
+        std::vector<unsigned char>(data).swap(step.data);
+    }
+
+    vector<Baseline> baseline;
+    for (size_t i = 0; i < _baseline.size(); ++i)
+    {
+        Baseline b = _baseline[i];
+        if (_atoms[b.id] == NULL)
+        {
+            continue;
+        }
+        if (newId[b.id] == UINT_MAX)
+        {
+            newId[b.id] = atoms.size();
+            atoms.push_back(_atoms[b.id]);
+        }
+        b.id = newId[b.id];
+        baseline.push_back(b);
+    }
+    _baseline.swap(baseline);
+
+    _atoms.swap(atoms);
+    _idOf.clear();
+    for (size_t i = 0; i < _atoms.size(); ++i)
+    {
+        _idOf[_atoms[i]] = i;
+    }
+}
+
+void UndoJournal::Purge(MIAtom *atom)
+{
+    map<MIAtom*, unsigned int>::iterator i = _idOf.find(atom);
+    if (i != _idOf.end())
+    {
+        _atoms[i->second] = NULL;
+        _idOf.erase(i);
+    }
+}
+
+void UndoJournal::Purge(MIMoleculeBase *model)
+{
+    for (size_t i = 0; i < _steps.size(); )
+    {
+        if (_steps[i].model != model)
+        {
+            ++i;
+            continue;
+        }
+        _used -= _steps[i].data.size() + _steps[i].title.size() + sizeof(Step);
+        _steps.erase(_steps.begin() + i);
+        if ((int)i < _position)
+        {
+            --_position;
+        }
+    }
+    if (_steps.empty() && _baseline.empty())
+    {
+        Clear();
+    }
+    else
+    {
+        Compact();
+    }
+}
+
+void UndoJournal::Clear()
+{
+    _steps.clear();
+    _baseline.clear();
+    _atoms.clear();
+    _idOf.clear();
+    _used = 0;
+    _position = 0;
+}
+
+}
@@ -0,0 +1,147 @@
+#ifndef mifit_UndoJournal_h
+#define mifit_UndoJournal_h
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MIAtom_fwd.h"
+
+namespace chemlib
+{
+
+    class Residue;
+    class MIMoleculeBase;
+
+/**
+ * Undo history that records only what changed. An edit is bracketed by
+ * Track, which remembers the atoms about to change, and Commit, which
+ * stores for each atom only the fields that differ, old and new values, as
+ * one compactly encoded block. Undo, Redo and RestoreTo set the recorded
+ * values, so stepping to any point in the history touches only the atoms
+ * edited in between. The oldest steps are dropped to keep the blocks and
+ * the table of atoms they refer to within a memory budget.
+ */
+    class UndoJournal
+    {
+    public:
+        enum Field
+        {
+            PositionField = 1,
+            BValueField = 2,
+            OccupancyField = 4,
+            ColorField = 8,
+            RadiusTypeField = 16,
+            AllFields = 31
+        };
+
+        explicit UndoJournal(size_t memoryBudget = 32 * 1024 * 1024);
+
+        /**
+         * Bytes of history to keep, at least the newest step is always kept.
+         */
+        void SetMemoryBudget(size_t bytes);
+        size_t MemoryBudget() const
+        {
+            return _budget;
+        }
+
+        size_t MemoryUsed() const;
+
+        /**
+         * Starts an edit of the atoms, replacing any edit not yet committed.
+         */
+        void Track(const MIAtomList &atoms, unsigned int fields = AllFields);
+        void Track(Residue *res, int nres, unsigned int fields = AllFields);
+        bool IsTracking() const
+        {
+            return !_baseline.empty();
+        }
+
+        /**
+         * Ends the edit, recording the changes as a new step after the
+         * current one, which drops any steps that were undone. Returns false
+         * if nothing changed.
+         */
+        bool Commit(MIMoleculeBase *model, const std::string &title);
+
+        /**
+         * Ends the edit without recording it; Revert also puts the atoms
+         * back as they were at Track.
+         */
+        void Discard();
+        void Revert();
+
+        bool CanUndo() const
+        {
+            return _position > 0;
+        }
+
+        bool CanRedo() const
+        {
+            return _position < (int)_steps.size();
+        }
+
+        bool Undo();
+        bool Redo();
+
+        /**
+         * Undoes or redoes steps until position steps are applied.
+         */
+        bool RestoreTo(int position);
+        int Position() const
+        {
+            return _position;
+        }
+
+        int NumberSteps() const
+        {
+            return (int)_steps.size();
+        }
+
+        MIMoleculeBase *Model(int step) const;
+        const std::string &Title(int step) const;
+
+        /**
+         * Forgets an atom about to be deleted or all steps of a model.
+         */
+        void Purge(MIAtom *atom);
+        void Purge(MIMoleculeBase *model);
+        void Clear();
+
+    private:
+        struct Baseline
+        {
+            unsigned int id;
+            float x, y, z;
+            float b;
+            float occ;
+            short color;
+            unsigned char radius;
+        };
+
+        struct Step
+        {
+            MIMoleculeBase *model;
+            std::string title;
+            std::vector<unsigned char> data;
+        };
+
+        unsigned int AtomId(MIAtom *atom);
+        void Apply(const Step &step, bool redo);
+        void Trim();
+        void Compact();
+
+        size_t _budget;
+        size_t _used;
+        MIAtomList _atoms;          // by id, NULL once purged
+        std::map<MIAtom*, unsigned int> _idOf;
+        std::vector<Baseline> _baseline;
+        unsigned int _fields;
+        std::deque<Step> _steps;
+        int _position;              // number of steps applied
+    };
+
+}
+#endif // ifndef mifit_UndoJournal_h
@@ -20,6 +20,7 @@
 #include "Bond.h"
 #include "Box.h"
 #include "Chiral.h"
+#include "ConfEnsemble.h"
 #include "ConfSaver.h"
 #include "Constraint.h"
 #include "CovalentGeom.h"
@@ -32,6 +33,7 @@
 #include "math_util.h"
 #include "Matrix.h"
 #include "MIMolDictionary.h"
+#include "UndoJournal.h"
 #include "CHIRALDICT.h"
 #include "ANGLE.h"
 #include "TORSION.h"
@@ -0,0 +1,297 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "CifParser.h"
+
+// Parsing throughput of the memory-mapped CIF tokenizer against the
+// line-buffered, copying parser it replaced, which is kept below.
+// Both must find the same tokens and numeric values.
+// named cxx to avoid being put into compilation of library
+//
+// usage: ciftest [file.cif [repeats]]
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// The previous parser: 180-byte fgets lines appended to a string per
+// block, and tokens returned as substr copies.
+class OldCifParser
+{
+    FILE *_file;
+    bool _start;
+
+public:
+    OldCifParser(FILE *fp)
+        : _file(fp),
+          _start(true)
+    {
+    }
+
+    bool GetNextBlock(std::string &buffer)
+    {
+        static const int MAX_CIF_LINE = 180;
+        char line[MAX_CIF_LINE];
+        bool found = false;
+        buffer.clear();
+
+        if (_start)
+        {
+            while (fgets(line, MAX_CIF_LINE, _file) != 0)
+            {
+                if (!strncmp(line, "data_", 5))
+                {
+                    found = true;
+                    _start = false;
+                    break;
+                }
+            }
+            if (!found)
+            {
+                return false;
+            }
+        }
+        while (fgets(line, MAX_CIF_LINE, _file) != 0)
+        {
+            if (!strncmp(line, "data_", 5))
+            {
+                return true;
+            }
+            buffer += line;
+            found = true;
+        }
+        return !ferror(_file) && found;
+    }
+};
+
+class OldCifTokenizer
+{
+    std::string _str;
+    size_t _cur_pos;
+    size_t _length;
+
+public:
+    OldCifTokenizer(std::string input)
+        : _str(input),
+          _cur_pos(0),
+          _length(input.length())
+    {
+    }
+
+    bool GetToken(std::string &token)
+    {
+        enum { INTOKEN, BETWEEN, SINGLEQUOTE, DOUBLEQUOTE, MULTILINE };
+        token.clear();
+        int state = BETWEEN;
+        if (_length == 0 || _cur_pos >= _length)
+        {
+            return false;
+        }
+        for (size_t i = _cur_pos; i < _length; ++i)
+        {
+            switch (state)
+            {
+            case INTOKEN:
+                if (IsCifWhitespace(_str[i]))
+                {
+                    token = _str.substr(_cur_pos, i - _cur_pos);
+                    _cur_pos = i;
+                    return true;
+                }
+                break;
+            case BETWEEN:
+                if (IsCifWhitespace(_str[i]))
+                {
+                    continue;
+                }
+                else if (_str[i] == '\'')
+                {
+                    state = SINGLEQUOTE;
+                    _cur_pos = i + 1;
+                }
+                else if (_str[i] == '"')
+                {
+                    state = DOUBLEQUOTE;
+                    _cur_pos = i + 1;
+                }
+                else if (_str[i] == ';' && i > 0 && _str[i-1] == '\n')
+                {
+                    state = MULTILINE;
+                    _cur_pos = i + 1;
+                }
+                else if (_str[i] == '#')
+                {
+                    while (i < _length && _str[i] != '\n')
+                    {
+                        i++;
+                    }
+                }
+                else
+                {
+                    state = INTOKEN;
+                    _cur_pos = i;
+                }
+                break;
+            case SINGLEQUOTE:
+            case DOUBLEQUOTE:
+                if (_str[i] == (state == SINGLEQUOTE ? '\'' : '"')
+                    && (i+1 == _length || IsCifWhitespace(_str[i+1])))
+                {
+                    token = _str.substr(_cur_pos, i - _cur_pos);
+                    _cur_pos = i + 1;
+                    return true;
+                }
+                else if (i+1 == _length)
+                {
+                    state = INTOKEN;
+                    _cur_pos--;
+                    i = _cur_pos;
+                }
+                break;
+            case MULTILINE:
+                if (i == _cur_pos && IsCifWhitespace(_str[i]))
+                {
+                    _cur_pos++;
+                    continue;
+                }
+                else if (_str[i] == ';' && _str[i-1] == '\n')
+                {
+                    token = _str.substr(_cur_pos, i - _cur_pos - 1);
+                    _cur_pos = i + 1;
+                    return true;
+                }
+                break;
+            }
+        }
+        if (state == INTOKEN)
+        {
+            token = _str.substr(_cur_pos);
+            _cur_pos = _length;
+            return true;
+        }
+        _cur_pos = _length;
+        return false;
+    }
+};
+
+struct Totals
+{
+    long tokens;
+    long numbers;
+    double sum;
+};
+
+static void Count(const char *begin, const char *end, Totals &totals)
+{
+    char *stop;
+    double d = strtod(begin, &stop);
+    totals.tokens++;
+    if (stop == end && stop != begin)
+    {
+        totals.numbers++;
+        totals.sum += d;
+    }
+}
+
+static Totals ParseOld(const char *path)
+{
+    Totals totals = { 0, 0, 0.0 };
+    FILE *fp = fopen(path, "r");
+    OldCifParser parser(fp);
+    std::string block, token;
+    while (parser.GetNextBlock(block))
+    {
+        OldCifTokenizer toker(block);
+        while (toker.GetToken(token))
+        {
+            Count(token.c_str(), token.c_str() + token.size(), totals);
+        }
+    }
+    fclose(fp);
+    return totals;
+}
+
+static Totals ParseMapped(const char *path)
+{
+    Totals totals = { 0, 0, 0.0 };
+    FILE *fp = fopen(path, "r");
+    CifParser parser(fp);
+    CifDataBlock block;
+    CifLoop all;
+    while (parser.GetNextBlock(block))
+    {
+        // FindLoop parses the block; every token then lies in an item
+        // value or a loop, so tokenize both through views
+        block.FindLoop("", all);
+        std::map<std::string, std::string>::iterator item = block._items.begin();
+        for (; item != block._items.end(); ++item)
+        {
+            Count(item->first.c_str(), item->first.c_str() + item->first.size(), totals);
+            Count(item->second.c_str(), item->second.c_str() + item->second.size(), totals);
+        }
+        for (size_t i = 0; i < block._loops.size(); ++i)
+        {
+            // loop_ and the names
+            totals.tokens += 1 + block._loops[i]._names.size();
+            CifTokenizer toker(block._loops[i]);
+            CifStringView t;
+            while (toker.GetToken(t))
+            {
+                Count(t.begin, t.end(), totals);
+            }
+        }
+    }
+    fclose(fp);
+    return totals;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "../../examples/7FD1.cif";
+    int repeats = argc > 2 ? atoi(argv[2]) : 20;
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        printf("Cannot open %s\n", path);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    double megabytes = ftell(fp) / (1024.0 * 1024.0) * repeats;
+    fclose(fp);
+
+    Totals oldTotals = { 0, 0, 0.0 };
+    Totals newTotals = { 0, 0, 0.0 };
+    double start = Now();
+    for (int i = 0; i < repeats; ++i)
+    {
+        oldTotals = ParseOld(path);
+    }
+    double oldTime = Now() - start;
+    start = Now();
+    for (int i = 0; i < repeats; ++i)
+    {
+        newTotals = ParseMapped(path);
+    }
+    double newTime = Now() - start;
+
+    printf("old:    %ld tokens, %ld numbers, %8.1f MB/s\n", oldTotals.tokens, oldTotals.numbers, megabytes / oldTime);
+    printf("mapped: %ld tokens, %ld numbers, %8.1f MB/s\n", newTotals.tokens, newTotals.numbers, megabytes / newTime);
+    printf("speedup %.1fx\n", oldTime / newTime);
+
+    if (oldTotals.tokens != newTotals.tokens || oldTotals.numbers != newTotals.numbers
+        || oldTotals.sum != newTotals.sum)
+    {
+        printf("FAILED: tokens or numeric values differ (sum %.6f vs %.6f)\n", oldTotals.sum, newTotals.sum);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -938,81 +938,43 @@ bool mmCIF::Read(FILE *fp, MIMolInfo &mol)
 
 bool mmCIF::SlurpAtoms(CifLoop &loop, Residue *res)
 {
-
-    CifTokenizer toker(loop._values);
-    int nCols = loop._names.size();
-
+    CifLoopIterator row(loop);
     AtomKeyIndices index(loop._names);
 
-    int col = 0;
-    MIAtom *atom;
     MIAtomList atoms;
-    std::string token, restype;
-    bool hasX = false;
-    bool hasY = false;
-    bool hasZ = false;
-    while (toker.GetToken(token) )
+    std::string restype;
+    float x, y, z;
+    while (row.Next())
     {
-        if (col == 0)                       //Allocate a new atom each
-        {
-            atom = new MIAtom;              //time we start thru the columns
-            atom->setAtomnumber(atoms.size() + 1);
-            hasX = false;
-            hasY = false;
-            hasZ = false;
-        }
-
-        if (token == "?" || token == ".") //Skip values that are unknown
+        //Rows without a complete set of coordinates are skipped
+        if (!row.GetFloat(index.xX, x)
+            || !row.GetFloat(index.xY, y)
+            || !row.GetFloat(index.xZ, z))
         {
-            col++;                          //or undefined
             continue;
         }
 
-        if (col == index.xName)
-        {
-            atom->setName(token.c_str());
-        }
-        else if (col == index.xSymbol)
-        {
-            atom->setAtomicnumber(Atomic_Number_Nformat(token));
-        }
-        else if (col == index.xCharge)
-        {
-            atom->setCharge((float)atof(token.c_str()));
-        }
-        else if (col == index.xX)
+        MIAtom *atom = new MIAtom;
+        atom->setAtomnumber(atoms.size() + 1);
+        atom->setPosition(x, y, z);
+        if (!row.IsNull(index.xName))
         {
-            atom->setX((float)atof(token.c_str()));
-            hasX = true;
+            atom->setName(row.String(index.xName).c_str());
         }
-        else if (col == index.xY)
+        if (!row.IsNull(index.xSymbol))
         {
-            atom->setY((float)atof(token.c_str()));
-            hasY = true;
+            atom->setAtomicnumber(Atomic_Number_Nformat(row.String(index.xSymbol)));
         }
-        else if (col == index.xZ)
+        float charge;
+        if (row.GetFloat(index.xCharge, charge))
         {
-            atom->setZ((float)atof(token.c_str()));
-            hasZ = true;
+            atom->setCharge(charge);
         }
-        else if (col == index.xRes)
+        if (!row.IsNull(index.xRes))
         {
-            restype = token;
-        }
-
-        col++;
-        if (col == nCols)
-        {
-            if (hasX && hasY && hasZ)
-            {
-                atoms.push_back(atom);
-            }
-            else
-            {
-                delete atom;
-            }
-            col = 0;
+            restype = row.String(index.xRes);
         }
+        atoms.push_back(atom);
     }
 
     if (atoms.empty())
@@ -1035,75 +997,33 @@ bool mmCIF::SlurpAtoms(CifLoop &loop, Residue *res)
 
 bool mmCIF::SlurpBonds(CifLoop &loop, map<std::string, MIAtom*> &atom_map, vector<Bond> &bonds)
 {
-    CifTokenizer toker(loop._values);
-    int nCols = loop._names.size();
-
+    CifLoopIterator row(loop);
     BondKeyIndices index(loop._names);
 
-    std::string token, res, name1, name2;
-    int col = 0;
     Bond bond;
-    bool hasAtom1 = false;
-    bool hasAtom2 = false;
-    while (toker.GetToken(token))
+    while (row.Next())
     {
-        if (col == 0)                       //Initialize the bond each
+        bond.Clear();
+        if (row.IsNull(index.xAtom1) || row.IsNull(index.xAtom2))
         {
-            bond.Clear();
-            hasAtom1 = false;
-            hasAtom2 = false;
-        }
-
-        if (token == "?" || token == ".") //Skip values that are unknown
-        {
-            col++;                          //or undefined
             continue;
         }
-
-        if (col == index.xRes)
-        {
-            res = token;
-        }
-        else if (col == index.xAtom1)
-        {
-            MIAtom *atom = atom_map[token];
-            if (atom != NULL)
-            {
-                bond.setAtom1(atom);
-                hasAtom1 = true;
-            }
-        }
-        else if (col == index.xAtom2)
+        map<std::string, MIAtom*>::iterator atom1 = atom_map.find(row.String(index.xAtom1));
+        map<std::string, MIAtom*>::iterator atom2 = atom_map.find(row.String(index.xAtom2));
+        if (atom1 == atom_map.end() || atom1->second == NULL
+            || atom2 == atom_map.end() || atom2->second == NULL)
         {
-            MIAtom *atom = atom_map[token];
-            if (atom != NULL)
-            {
-                bond.setAtom2(atom);
-                hasAtom2 = true;
-            }
-        }
-        else if (col == index.xOrder)
-        {
-            bond.setOrder(DecodeCifBondOrder(token));
-        }
-        else if (col == index.xLength)
-        {
-            bond.ideal_length = (float)atof(token.c_str());
-        }
-        else if (col == index.xTolerance)
-        {
-            bond.tolerance = (float)atof(token.c_str());
+            continue;
         }
-
-        col++;
-        if (col == nCols)
+        bond.setAtom1(atom1->second);
+        bond.setAtom2(atom2->second);
+        if (!row.IsNull(index.xOrder))
         {
-            if (hasAtom1 && hasAtom2)
-            {
-                bonds.push_back(bond);
-            }
-            col = 0;
+            bond.setOrder(DecodeCifBondOrder(row.String(index.xOrder)));
         }
+        row.GetFloat(index.xLength, bond.ideal_length);
+        row.GetFloat(index.xTolerance, bond.tolerance);
+        bonds.push_back(bond);
     }
     return true;
 }
@@ -1113,7 +1033,7 @@ bool mmCIF::SlurpAngles(CifLoop &loop,
                         vector<ANGLE> &angles,
                         Residue *current_res)
 {
-    CifTokenizer toker(loop._values);
+    CifTokenizer toker(loop);
     int nCols = loop._names.size();
 
     AngleKeyIndices index(loop._names);
@@ -1187,7 +1107,7 @@ bool mmCIF::SlurpAngles(CifLoop &loop,
 bool mmCIF::SlurpTorsions(CifLoop &loop, map<std::string, TORSDICT> &torsion_map)
 {
     //bool mmCIF::SlurpTorsions(CifLoop &loop, vector<TORSDICT> &torsions) {
-    CifTokenizer toker(loop._values);
+    CifTokenizer toker(loop);
     int nCols = loop._names.size();
 
     TorsionKeyIndices index(loop._names);
@@ -1300,7 +1220,7 @@ bool mmCIF::SlurpTorsions(CifLoop &loop, map<std::string, TORSDICT> &torsion_map
 bool mmCIF::SlurpTorsionValues(CifLoop &loop,
                                map<std::string, TORSDICT> &torsion_map)
 {
-    CifTokenizer toker(loop._values);
+    CifTokenizer toker(loop);
     int nCols = loop._names.size();
 
     TorsionValueKeyIndices index(loop._names);
@@ -1351,7 +1271,7 @@ bool mmCIF::SlurpPlanes(CifLoop &loop,
                         map<std::string, PLANEDICT> &plane_map)
 {
 
-    CifTokenizer toker(loop._values);
+    CifTokenizer toker(loop);
     int nCols = loop._names.size();
 
     PlaneKeyIndices index(loop._names);
@@ -1447,7 +1367,7 @@ bool mmCIF::SlurpPlaneAtoms(CifLoop &loop,
                             map<std::string, PLANEDICT> &plane_map)
 {
 
-    CifTokenizer toker(loop._values);
+    CifTokenizer toker(loop);
     int nCols = loop._names.size();
 
     PlaneAtomKeyIndices index(loop._names);
@@ -1511,7 +1431,7 @@ bool mmCIF::SlurpPlaneAtoms(CifLoop &loop,
 bool mmCIF::SlurpChirals(CifLoop &loop, map<std::string, CHIRALDICT> &chiral_map)
 {
 
-    CifTokenizer toker(loop._values);
+    CifTokenizer toker(loop);
     int nCols = loop._names.size();
 
     ChiralKeyIndices index(loop._names);
@@ -1589,7 +1509,7 @@ bool mmCIF::SlurpChirals(CifLoop &loop, map<std::string, CHIRALDICT> &chiral_map
 
 bool mmCIF::SlurpChiralAtoms(CifLoop &loop, map<std::string, CHIRALDICT> &chiral_map)
 {
-    CifTokenizer toker(loop._values);
+    CifTokenizer toker(loop);
     int nCols = 0;
 
     ChiralAtomKeyIndices index(loop._names);
@@ -1639,7 +1559,7 @@ bool mmCIF::SlurpChiralAtoms(CifLoop &loop, map<std::string, CHIRALDICT> &chiral
 bool mmCIF::SlurpHeader(CifLoop &loop, Residue *res)
 {
 
-    CifTokenizer toker(loop._values);
+    CifTokenizer toker(loop);
     HeaderKeyIndices index(loop._names);
 
     int col = 0;
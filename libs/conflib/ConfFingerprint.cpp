@@ -2,6 +2,7 @@
 
 #include <climits>
 #include <algorithm>
+#include <cmath>
 #include <cstdio>
 
 #include "ConfFingerprint.h"
@@ -12,43 +13,149 @@ using namespace chemlib;
 using namespace conflib;
 using namespace std;
 
-ConfFingerprint::ConfFingerprint(const vector<Bond> &distances)
+ConfFingerprint::ConfFingerprint(const vector<Bond> &distances, float tolerance)
+    : _tolerance(tolerance > 0.0f ? tolerance : 0.5f),
+      _pairHash(0)
 {
+    //Order the pairs by kind, then by distance, so that conformations
+    //differing only by swapping equivalent atoms line up
+    vector< pair<int, float> > pairs;
+    pairs.reserve(distances.size());
     vector<Bond>::const_iterator i, e = distances.end();
     for (i = distances.begin(); i != e; ++i)
     {
-        AddCode(*i);
+        pairs.push_back(make_pair(CodePair(*i), (float)SquaredAtomDist(*i->getAtom1(), *i->getAtom2())));
     }
-    sort(_distanceCodes.begin(), _distanceCodes.end(), greater<int>());
-#if 0
-    FILE *f = fopen("./test.log", "a");
-    for (unsigned int n = 0; n < _distanceCodes.size(); ++n)
+    sort(pairs.begin(), pairs.end());
+
+    _pairCodes.resize(pairs.size());
+    _distances.resize(pairs.size());
+    double sum[KEY_SIZE];
+    int count[KEY_SIZE];
+    for (int k = 0; k < KEY_SIZE; ++k)
+    {
+        sum[k] = 0.0;
+        count[k] = 0;
+    }
+    //FNV-1a over the pair kinds
+    size_t h = 2166136261u;
+    for (unsigned int n = 0; n < pairs.size(); ++n)
+    {
+        _pairCodes[n] = pairs[n].first;
+        _distances[n] = pairs[n].second;
+        h = (h ^ (size_t)(unsigned int)pairs[n].first) * 16777619u;
+        sum[n % KEY_SIZE] += pairs[n].second;
+        count[n % KEY_SIZE]++;
+    }
+    _pairHash = h;
+    for (int k = 0; k < KEY_SIZE; ++k)
     {
-        fprintf(f, "%d,", _distanceCodes[n]);
+        _key[k] = count[k] > 0 ? (int)floor(sum[k] / count[k] / _tolerance) : 0;
     }
-    fprintf(f, "\n");
-    fclose(f);
-#endif
 }
 
-bool ConfFingerprint::operator ==(const ConfFingerprint &rhs)
+bool ConfFingerprint::operator ==(const ConfFingerprint &rhs) const
 {
-    return _distanceCodes == rhs._distanceCodes;
+    if (_pairHash != rhs._pairHash || _pairCodes != rhs._pairCodes)
+    {
+        return false;
+    }
+    for (unsigned int n = 0; n < _distances.size(); ++n)
+    {
+        if (fabs(_distances[n] - rhs._distances[n]) > _tolerance)
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
-#ifdef ROUND
-#undef ROUND
-#endif
-#define ROUND(a) ((a) > 0 ? (int)((a)+0.5) : (int)((a)-0.5))
-
-int ConfFingerprint::CodeDistance(const Bond &dist)
+size_t ConfFingerprint::Hash(const int key[KEY_SIZE]) const
 {
-    float d = (float)(2.0 * SquaredAtomDist(*dist.getAtom1(), *dist.getAtom2()));
+    size_t h = _pairHash;
+    for (int k = 0; k < KEY_SIZE; ++k)
+    {
+        h = (h ^ (size_t)(unsigned int)key[k]) * 16777619u;
+    }
+    return h;
+}
 
+int ConfFingerprint::CodePair(const Bond &dist)
+{
     return std::min(dist.getAtom1()->atomicnumber() - 1, 53)
            +54 * std::min(dist.getAtom1()->hybrid() - 1, 2)
            +162 * std::min(dist.getAtom2()->atomicnumber() - 1, 53)
-           +8748 * std::min(dist.getAtom2()->hybrid() - 1, 2)
-           +26244 * std::min(ROUND(d), 81000);
+           +8748 * std::min(dist.getAtom2()->hybrid() - 1, 2);
+}
+
+
+ConfFingerprintSet::ConfFingerprintSet(float tolerance)
+    : _tolerance(tolerance),
+      _size(0),
+      _buckets(64)
+{
+}
+
+void ConfFingerprintSet::SetTolerance(float tolerance)
+{
+    _tolerance = tolerance;
+    clear();
+}
+
+void ConfFingerprintSet::clear()
+{
+    _buckets.assign(64, vector<ConfFingerprint>());
+    _size = 0;
 }
 
+bool ConfFingerprintSet::Contains(const ConfFingerprint &fp) const
+{
+    //A match lies in the key cell of fp or one of its neighbours
+    int cells = 1;
+    for (int k = 0; k < ConfFingerprint::KEY_SIZE; ++k)
+    {
+        cells *= 3;
+    }
+    int key[ConfFingerprint::KEY_SIZE];
+    for (int cell = 0; cell < cells; ++cell)
+    {
+        int offset = cell;
+        for (int k = 0; k < ConfFingerprint::KEY_SIZE; ++k)
+        {
+            key[k] = fp.Key()[k] + offset % 3 - 1;
+            offset /= 3;
+        }
+        const vector<ConfFingerprint> &bucket = _buckets[fp.Hash(key) % _buckets.size()];
+        if (find(bucket.begin(), bucket.end(), fp) != bucket.end())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ConfFingerprintSet::Insert(const vector<Bond> &distances)
+{
+    ConfFingerprint fp(distances, _tolerance);
+    if (Contains(fp))
+    {
+        return false;
+    }
+    _buckets[fp.Hash() % _buckets.size()].push_back(fp);
+    ++_size;
+
+    //Keep about one fingerprint per bucket
+    if (_size > _buckets.size())
+    {
+        vector< vector<ConfFingerprint> > buckets(_buckets.size() * 2);
+        for (unsigned int i = 0; i < _buckets.size(); ++i)
+        {
+            for (unsigned int j = 0; j < _buckets[i].size(); ++j)
+            {
+                buckets[_buckets[i][j].Hash() % buckets.size()].push_back(_buckets[i][j]);
+            }
+        }
+        _buckets.swap(buckets);
+    }
+    return true;
+}
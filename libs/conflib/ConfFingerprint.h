@@ -1,6 +1,7 @@
 #ifndef CONFLIB_CONFORMATION_FINGERPRINT_H
 #define CONFLIB_CONFORMATION_FINGERPRINT_H
 
+#include <cstddef>
 #include <vector>
 
 namespace chemlib
@@ -14,18 +15,74 @@ namespace conflib
     class ConfFingerprint
     {
     public:
-        ConfFingerprint(const std::vector<chemlib::Bond> &distances);
-        bool operator==(const ConfFingerprint &rhs);
+        //Conformations match when they have the same atom pairs and, taking
+        //the pairs of each kind in order of distance, no squared distance
+        //differs by more than tolerance square Angstroms
+        ConfFingerprint(const std::vector<chemlib::Bond> &distances, float tolerance = 0.5f);
+        bool operator==(const ConfFingerprint &rhs) const;
 
-        void AddCode(const chemlib::Bond &dist)
+        //The key is the mean squared distance over each third of the pairs,
+        //in units of the tolerance; the keys of matching fingerprints differ
+        //by at most one in each component
+        enum { KEY_SIZE = 3 };
+
+        const int *Key() const
+        {
+            return _key;
+        }
+
+        //Hash of the atom pair kinds together with a key
+        size_t Hash(const int key[KEY_SIZE]) const;
+
+        size_t Hash() const
         {
-            _distanceCodes.push_back(CodeDistance(dist));
+            return Hash(_key);
         }
 
     protected:
-        static int CodeDistance(const chemlib::Bond &dist);
+        static int CodePair(const chemlib::Bond &dist);
+
+        float _tolerance;
+        std::vector<int> _pairCodes;
+        std::vector<float> _distances;
+        size_t _pairHash;
+        int _key[KEY_SIZE];
+    };
+
+    //Set of the fingerprints of the conformations generated so far. They
+    //are hashed by key, and a new conformation is compared with those in
+    //its own and the neighbouring key cells, so a check takes constant
+    //expected time and still finds matches across a cell boundary
+    class ConfFingerprintSet
+    {
+    public:
+        explicit ConfFingerprintSet(float tolerance = 0.5f);
+
+        //Changes the similarity tolerance and empties the set
+        void SetTolerance(float tolerance);
+
+        float Tolerance() const
+        {
+            return _tolerance;
+        }
+
+        //Adds the fingerprint of the conformation measured by distances;
+        //returns false if a matching one is already in the set
+        bool Insert(const std::vector<chemlib::Bond> &distances);
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        void clear();
+
+    private:
+        bool Contains(const ConfFingerprint &fp) const;
 
-        std::vector<int> _distanceCodes;
+        float _tolerance;
+        size_t _size;
+        std::vector< std::vector<ConfFingerprint> > _buckets;
     };
 
 }
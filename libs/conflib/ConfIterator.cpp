@@ -4,6 +4,9 @@
 #include "ConfIterator.h"
 #include "bumps.h"
 
+#include <algorithm>
+#include <map>
+
 using namespace chemlib;
 using namespace std;
 
@@ -13,6 +16,19 @@ namespace conflib
 //ConfIterator::ConfIterator(RESIDUE *res, vector<Bond> &bonds) {}
 //ConfIterator::~ConfItereator() {}
 
+namespace
+{
+    //Orders torsions so that those moving more atoms, nearer the middle of
+    //the molecule, are placed first
+    struct MovesMoreAtoms
+    {
+        bool operator()(const FlexTorsion &a, const FlexTorsion &b) const
+        {
+            return a.FlexAtoms().size() > b.FlexAtoms().size();
+        }
+    };
+}
+
 ConfEnumerator::ConfEnumerator(Residue *res, vector<Bond> &bonds, vector<TORSION> &torsions)
     : _res(res)
 {
@@ -26,6 +42,7 @@ ConfEnumerator::ConfEnumerator(Residue *res, vector<Bond> &bonds, vector<TORSION
             _flexors.push_back(conflib::FlexTorsion(torsions[i], bonds, false));
         }
     }
+    stable_sort(_flexors.begin(), _flexors.end(), MovesMoreAtoms());
 
     //Create interatomic bumps
     GetBumps(res, _bumps, bonds);
@@ -37,14 +54,52 @@ ConfEnumerator::ConfEnumerator(Residue *res, vector<Bond> &bonds, vector<TORSION
         _nTheory *= _flexors[i].NumAngles();
     }
 
+    //The distance of a bump pair changes only with the torsions that move
+    //one atom of the pair and not the other, so it is settled once the
+    //deepest of those is placed and can be checked right there
+    map<const MIAtom*, int> atomIndex;
+    for (int i = 0; i < _res->atomCount(); ++i)
+    {
+        atomIndex[_res->atom(i)] = i;
+    }
+    vector< vector<char> > moves(_flexors.size(), vector<char>(_res->atomCount(), 0));
+    for (unsigned int t = 0; t < _flexors.size(); ++t)
+    {
+        const vector<MIAtom*> &flex = _flexors[t].FlexAtoms();
+        for (unsigned int k = 0; k < flex.size(); ++k)
+        {
+            map<const MIAtom*, int>::iterator a = atomIndex.find(flex[k]);
+            if (a != atomIndex.end())
+            {
+                moves[t][a->second] = 1;
+            }
+        }
+    }
+    _levelBumps.resize(_flexors.size() + 1);
+    for (unsigned int b = 0; b < _bumps.size(); ++b)
+    {
+        map<const MIAtom*, int>::iterator a1 = atomIndex.find(_bumps[b].getAtom1());
+        map<const MIAtom*, int>::iterator a2 = atomIndex.find(_bumps[b].getAtom2());
+        int level = 0;
+        for (unsigned int t = 0; t < _flexors.size(); ++t)
+        {
+            if (a1 == atomIndex.end() || a2 == atomIndex.end()
+                || moves[t][a1->second] != moves[t][a2->second])
+            {
+                level = t + 1;
+            }
+        }
+        _levelBumps[level].push_back(_bumps[b]);
+    }
 
-    //Mark all of the atoms as modified (i.e. none of the atom pairs are guaranteed bump-free)
+    //Mark all of the atoms as modified until the first conformation is found
     for (int i = 0; i < _res->atomCount(); ++i)
     {
         _res->atom(i)->set_search_flag(1);
     }
 
-    _nTry = 0;
+    _depth = 0;
+    _choice.assign(_flexors.size(), 0);
     _init = false;
 }
 
@@ -52,39 +107,58 @@ ConfEnumerator::~ConfEnumerator()
 {
 }
 
-bool ConfEnumerator::Next()
+bool ConfEnumerator::LevelClear(int level) const
 {
-    if (_flexors.size() == 0)
+    const vector<Bond> &bumps = _levelBumps[level];
+    for (unsigned int i = 0; i < bumps.size(); ++i)
     {
-        return false;
+        if (SquaredAtomDist(*bumps[i].getAtom1(), *bumps[i].getAtom2()) < bumps[i].ideal_length)
+        {
+            return false;
+        }
     }
+    return true;
+}
 
-    ConfSaver orig(_res);
-    orig.Save();
-
-    if (_init == false)
+//Advances the depth-first search over the torsion tree to the next
+//clash-free, non-redundant conformation, leaving it in the residue.
+//Placing a torsion only moves the atoms beyond it, so the coordinates set
+//by the torsions above are reused, and a clash settled at one depth prunes
+//every combination of the torsions below.
+bool ConfEnumerator::NextLeaf()
+{
+    int n = (int)_flexors.size();
+    if (!_init)
     {
         _init = true;
-
-        //Set the initial conformation
-        for_each(_flexors.begin(), _flexors.end(), void_mem_fun_ref(&conflib::FlexTorsion::Set));
+        if (!LevelClear(0))
+        {
+            _depth = -1;
+        }
     }
-
-    vector<FlexTorsion>::iterator ft;
-    for ( ; _nTry < _nTheory; ++_nTry)
+    while (_depth >= 0)
     {
-
-        //Create the next conformation by advancing torsions to
-        //their next value...usually we will only increment the first one, but
-        //if Advance() returns false, that torsion has "rolled over" to its
-        //initial value, and we need to increment the next one, and so on
-        for (ft = _flexors.begin(); ft != _flexors.end() && !ft->Advance(); ft++)
+        if (_depth == n)
         {
+            --_depth;
+            continue;
         }
-
-        //Check for clashes or redundancy. Our work is done if there are none.
-        if (CheckConf())
+        if (_choice[_depth] == _flexors[_depth].NumAngles())
+        {
+            _choice[_depth] = 0;
+            --_depth;
+            continue;
+        }
+        _flexors[_depth].Pick(_choice[_depth]++);
+        if (!LevelClear(_depth + 1))
+        {
+            continue;
+        }
+        ++_depth;
+        if (_depth == n && CheckConf())
         {
+            //Placing torsions flags the atoms they move; clear the flags
+            //for each conformation found, as the odometer loop did
             for (int i = 0; i < _res->atomCount(); ++i)
             {
                 _res->atom(i)->set_search_flag(0);
@@ -92,6 +166,23 @@ bool ConfEnumerator::Next()
             return true;
         }
     }
+    return false;
+}
+
+bool ConfEnumerator::Next()
+{
+    if (_flexors.size() == 0)
+    {
+        return false;
+    }
+
+    ConfSaver orig(_res);
+    orig.Save();
+
+    if (NextLeaf())
+    {
+        return true;
+    }
 
     //if we reach here, we went through all the confs without finding a bump-free one
     orig.Restore(1);
@@ -109,34 +200,11 @@ int ConfEnumerator::GenerateConfs(ConfSaver &confs, int max)
     ConfSaver orig(_res);
     orig.Save();
 
-    //Set all the torsion angles in the molecule to those currently held in
-    //the flexors
-    _init = true;
-    for_each(_flexors.begin(), _flexors.end(), void_mem_fun_ref(&conflib::FlexTorsion::Set));
-
     int nFound = 0;
-    vector<FlexTorsion>::iterator ft;
-    for ( ; _nTry < _nTheory && nFound < max; ++_nTry)
+    while (nFound < max && NextLeaf())
     {
-
-        //Create the next conformation by advancing torsions to
-        //their next value...usually we will only increment the first one, but
-        //if Advance() returns false, that torsion has "rolled over" to its
-        //initial value, and we need to increment the next one, and so on
-        for (ft = _flexors.begin(); ft != _flexors.end() && !ft->Advance(); ft++)
-        {
-        }
-
-        if (CheckConf())
-        {
-            confs.Save();
-            nFound++;
-
-            for (int i = 0; i < _res->atomCount(); ++i)
-            {
-                _res->atom(i)->set_search_flag(0);
-            }
-        }
+        confs.Save();
+        nFound++;
     }
 
     //Restore the initial conformation
@@ -144,29 +212,11 @@ int ConfEnumerator::GenerateConfs(ConfSaver &confs, int max)
     return nFound;
 }
 
+//Checks a complete conformation for redundancy; the bumps have been
+//checked on the way down the tree
 bool ConfEnumerator::CheckConf()
 {
-    std::vector<Bond>::iterator i = _bumps.begin();
-    std::vector<Bond>::iterator e = _bumps.end();
-    while (i < e)
-    {
-        //Only check atom pair for bumps if at least one has been moved
-        if ((i->getAtom1()->search_flag() || i->getAtom2()->search_flag())
-            && SquaredAtomDist(*i->getAtom1(), *i->getAtom2()) < i->ideal_length)
-        {
-            return false;
-        }
-        i++;
-    }
-
-    ConfFingerprint fp(_bumps);
-    if (find(_prints.begin(), _prints.end(), fp) != _prints.end())
-    {
-        return false;
-    }
-
-    _prints.push_back(fp);
-    return true;
+    return _prints.Insert(_bumps);
 }
 
 ConfSampler::ConfSampler(Residue *res, vector<Bond> &bonds, vector<TORSION> &torsions)
@@ -288,14 +338,7 @@ bool ConfSampler::CheckConf()
         i++;
     }
 
-    ConfFingerprint fp(_bumps);
-    if (find(_prints.begin(), _prints.end(), fp) != _prints.end())
-    {
-        return false;
-    }
-
-    _prints.push_back(fp);
-    return true;
+    return _prints.Insert(_bumps);
 }
 
 } // namespace conflib
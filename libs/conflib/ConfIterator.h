@@ -57,17 +57,33 @@ namespace conflib
             return _nTheory;
         }
 
+        //Largest difference, in square Angstroms, of the squared distances
+        //of conformations that count as the same; resets the generated set
+        void SetSimilarityTolerance(float tolerance)
+        {
+            _prints.SetTolerance(tolerance);
+        }
+
         chemlib::Residue *_res;
 
     private:
-        int _nTry;
         int _nTheory;
         bool _init;
+        //Torsions ordered root-outward, from the one moving the most atoms
         std::vector<FlexTorsion> _flexors;
         std::vector<chemlib::Bond> _bumps;
-        std::vector<ConfFingerprint> _prints;
+        //Bumps grouped by the deepest torsion that changes their distance;
+        //the first group is changed by none and is checked once
+        std::vector< std::vector<chemlib::Bond> > _levelBumps;
+        ConfFingerprintSet _prints;
+        //Depth-first search state: the torsion being placed, and the next
+        //angle to try at each depth
+        int _depth;
+        std::vector<int> _choice;
         //	vector< vector< int > > _distanceHashKeys;
 
+        bool NextLeaf();
+        bool LevelClear(int level) const;
         bool CheckConf();
 
         //Declare these private to prevent use
@@ -106,12 +122,19 @@ namespace conflib
             return -1;
         }
 
+        //Largest difference, in square Angstroms, of the squared distances
+        //of conformations that count as the same; resets the generated set
+        void SetSimilarityTolerance(float tolerance)
+        {
+            _prints.SetTolerance(tolerance);
+        }
+
         chemlib::Residue *_res;
 
     private:
         std::vector<FlexTorsion> _flexors;
         std::vector<chemlib::Bond> _bumps;
-        std::vector<ConfFingerprint> _prints;   //Tracks which conformations have been generated already
+        ConfFingerprintSet _prints;   //Tracks which conformations have been generated already
 
         bool CheckConf();                   //Checks for bumps and redundancy
 
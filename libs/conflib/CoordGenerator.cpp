@@ -120,7 +120,7 @@ void PositionAtom(MIAtom *atom,
 
 }
 
-void CoordGenerator::sdgGenMolStruct()
+void CoordGenerator::sdgGenMolStruct(unsigned int seed)
 {
     //	GenMolStruct();
 
@@ -178,11 +178,15 @@ void CoordGenerator::sdgGenMolStruct()
     }
 
     sdgEngine engine(dists, vols, _res->atoms());
-    engine.DoOptimize();
-
+    std::vector<sdgEmbedding> best;
+    engine.MultiStart(sdg_params::SDG_NSTARTS, seed, 1, best);
+    if (!best.empty())
+    {
+        engine.Apply(best.front());
+    }
 }
 
-double CoordGenerator::sdgRefine()
+double CoordGenerator::sdgRefine(unsigned int seed)
 {
 
     std::vector<sdgDistance> dists;
@@ -288,20 +292,17 @@ double CoordGenerator::sdgRefine()
         }
     }
 
+    //Independent starts from random coordinates, keeping the best that
+    //has its chiral centers right
     sdgEngine engine(dists, vols, _res->atoms());
-    //	for(int i=0; i<10, ++i) {
-    //		srand(87531);
-    pair<double, double> interval(-20, 20);
-    double score = 1.0;
-    int nTrials = 0;
-    while (score > 0.2 && nTrials < 50)
+    std::vector<sdgEmbedding> best;
+    engine.MultiStart(sdg_params::SDG_NSTARTS, seed, 1, best, 20.0);
+    if (best.empty())
     {
-        _lig->RandomizeCoords(interval, interval, interval);
-        score = engine.DoOptimize();
-        nTrials++;
+        return 1.0;
     }
-    //	}
-    return score;
+    engine.Apply(best.front());
+    return best.front().score;
     //	LigRefiner lr;
     //	lr.SetModel(_lig);
     //	lr.AddRefiRes(_res);
@@ -2,6 +2,7 @@
 #define COORD_GENERATOR_H
 
 #include <chemlib/chemlib.h>
+#include "sdg_parms.h"
 
 namespace conflib
 {
@@ -30,8 +31,10 @@ namespace conflib
             _res = res;
         }
 
-        double sdgRefine();
-        void sdgGenMolStruct();
+        //Both embed by stochastic distance geometry, running several
+        //trajectories in parallel; the result depends only on seed.
+        double sdgRefine(unsigned int seed = sdg_params::SDG_SEED);
+        void sdgGenMolStruct(unsigned int seed = sdg_params::SDG_SEED);
         double GenMolStruct(std::string &log);
         void PlaceAtom(chemlib::MIAtom*);
         void SetExtended(chemlib::MIAtom*);
@@ -37,6 +37,12 @@ namespace conflib
             return _dihedrals.size();
         }
 
+        //Atoms moved when the torsion is set
+        const std::vector<chemlib::MIAtom*> &FlexAtoms() const
+        {
+            return _flex_atoms;
+        }
+
     protected:
         chemlib::MIAtom *_a1;
         chemlib::MIAtom *_a2;
@@ -115,10 +115,9 @@ int GenerateEnsemble(Residue *res,
 }
 
 int GenerateEnsemble(Residue *res,
-                     MIMoleculeBase *model,
                      std::vector<Bond> &bonds,
                      std::vector<TORSION> &torsions,
-                     GeomSaver &confs)
+                     ConfEnsemble &confs)
 {
     int nConfs = 0;
 
@@ -144,7 +143,7 @@ int GenerateEnsemble(Residue *res,
         return 0;
     }
 
-    tmp.ConvertToGeomSaver(confs, model);
+    confs = tmp.Ensemble();
     return nConfs;
 }
 
@@ -19,10 +19,9 @@ namespace conflib
                          bool replace = false);
 
     int GenerateEnsemble(chemlib::Residue *res,
-                         chemlib::MIMoleculeBase *model,
                          std::vector<chemlib::Bond> &bonds,
                          std::vector<chemlib::TORSION> &torsions,
-                         chemlib::GeomSaver &confs);
+                         chemlib::ConfEnsemble &confs);
 
     void GenerateCoordinates(chemlib::Residue *res,
                              const std::vector<chemlib::Bond> &bonds,
@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <chemlib/chemlib.h>
+#include <chemlib/Residue.h>
+
+#include "ConfFingerprint.h"
+#include "ConfIterator.h"
+#include "FlexTorsion.h"
+#include "bumps.h"
+#include "confgen.h"
+#include "testligands.cxx"
+
+// Time to the first clash-free conformers of drug-like ligands, for the
+// depth-first ConfEnumerator against the odometer loop it replaced, which
+// is kept below. On a smaller ligand both enumerate every combination and
+// must find the same number of clash-free conformers.
+// named cxx to avoid being put into compilation of library
+//
+// usage: enumtest [count [smiles ...]]
+
+static const char *exhaustiveLigand = "CCCOC(=O)CCc1ccc(OCC)cc1";
+
+// The previous enumeration: step an odometer over every combination of
+// torsion values and check all the bumps of moved atoms once a conformer
+// is complete
+static int OdometerConfs(Residue *res, std::vector<Bond> &bonds, std::vector<TORSION> &torsions,
+                         int max, float tolerance)
+{
+    std::vector<FlexTorsion> flexors;
+    int nTheory = 1;
+    for (unsigned int i = 0; i < torsions.size(); ++i)
+    {
+        flexors.push_back(FlexTorsion(torsions[i], bonds, false));
+        nTheory *= flexors.back().NumAngles();
+    }
+    std::vector<Bond> bumps;
+    GetBumps(res, bumps, bonds);
+    ConfFingerprintSet prints(tolerance);
+
+    ConfSaver orig(res);
+    orig.Save();
+    for (int i = 0; i < res->atomCount(); ++i)
+    {
+        res->atom(i)->set_search_flag(1);
+    }
+    for (unsigned int i = 0; i < flexors.size(); ++i)
+    {
+        flexors[i].Set();
+    }
+
+    int nFound = 0;
+    for (int nTry = 0; nTry < nTheory && nFound < max; ++nTry)
+    {
+        std::vector<FlexTorsion>::iterator ft = flexors.begin();
+        while (ft != flexors.end() && !ft->Advance())
+        {
+            ++ft;
+        }
+        if (CheckBumps(res, bumps) && prints.Insert(bumps))
+        {
+            nFound++;
+            for (int i = 0; i < res->atomCount(); ++i)
+            {
+                res->atom(i)->set_search_flag(0);
+            }
+        }
+    }
+    orig.Restore(1);
+    return nFound;
+}
+
+static int TreeConfs(Residue *res, std::vector<Bond> &bonds, std::vector<TORSION> &torsions,
+                     int max, float tolerance)
+{
+    ConfSaver confs(res);
+    ConfEnumerator ce(res, bonds, torsions);
+    ce.SetSimilarityTolerance(tolerance);
+    return ce.GenerateConfs(confs, max);
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 1000;
+    std::vector<const char*> ligands;
+    for (int i = 2; i < argc; ++i)
+    {
+        ligands.push_back(argv[i]);
+    }
+    for (int i = 0; argc < 3 && druglikeLigands[i] != 0; ++i)
+    {
+        ligands.push_back(druglikeLigands[i]);
+    }
+
+    for (unsigned int i = 0; i < ligands.size(); ++i)
+    {
+        std::vector<Bond> bonds;
+        std::vector<TORSION> torsions;
+        Residue *res = BuildLigand(ligands[i], bonds, torsions);
+        if (res == 0)
+        {
+            return 1;
+        }
+        double start = Now();
+        int oldFound = OdometerConfs(res, bonds, torsions, count, 0.5f);
+        double oldTime = Now() - start;
+        start = Now();
+        int treeFound = TreeConfs(res, bonds, torsions, count, 0.5f);
+        double treeTime = Now() - start;
+        printf("  odometer: %4d in %8.4f s\n  tree:     %4d in %8.4f s\n  speedup %.1fx\n",
+               oldFound, oldTime, treeFound, treeTime, oldTime / treeTime);
+        delete res;
+    }
+
+    // Near-exact matching makes the conformers found independent of order.
+    // The odometer moves atoms incrementally and drifts over many steps, so
+    // a pair close to its bump limit may tip over on a larger ligand
+    std::vector<Bond> bonds;
+    std::vector<TORSION> torsions;
+    Residue *res = BuildLigand(exhaustiveLigand, bonds, torsions);
+    if (res == 0)
+    {
+        return 1;
+    }
+    double start = Now();
+    int oldFound = OdometerConfs(res, bonds, torsions, 1 << 30, 0.01f);
+    double oldTime = Now() - start;
+    start = Now();
+    int treeFound = TreeConfs(res, bonds, torsions, 1 << 30, 0.01f);
+    double treeTime = Now() - start;
+    delete res;
+    printf("  all conformers: odometer %d in %.4f s, tree %d in %.4f s\n",
+           oldFound, oldTime, treeFound, treeTime);
+    if (oldFound != treeFound)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
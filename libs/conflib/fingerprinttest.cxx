@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <chemlib/chemlib.h>
+#include <chemlib/Residue.h>
+
+#include "ConfFingerprint.h"
+#include "ConfIterator.h"
+#include "FlexTorsion.h"
+#include "bumps.h"
+#include "confgen.h"
+#include "testligands.cxx"
+
+// Conformer deduplication on drug-like ligands: the hashed fingerprint set
+// against a linear search of the same fingerprints, which must keep exactly
+// the same conformers, and against the binned fingerprints and pairwise
+// std::find it replaced. Every other conformation is a copy of the one
+// before with the atoms moved by up to 0.005 A, which should be dropped.
+// Then generation time against conformer count.
+// named cxx to avoid being put into compilation of library
+//
+// usage: fingerprinttest [smiles ...]
+
+// The previous fingerprint: squared distances rounded into 0.5 A^2 bins,
+// compared code for code
+class OldFingerprint
+{
+public:
+    OldFingerprint(const std::vector<Bond> &distances)
+    {
+        for (unsigned int i = 0; i < distances.size(); ++i)
+        {
+            const Bond &dist = distances[i];
+            float d = (float)(2.0 * SquaredAtomDist(*dist.getAtom1(), *dist.getAtom2()));
+            int r = d > 0 ? (int)(d + 0.5) : (int)(d - 0.5);
+            _codes.push_back(std::min(dist.getAtom1()->atomicnumber() - 1, 53)
+                             +54 * std::min(dist.getAtom1()->hybrid() - 1, 2)
+                             +162 * std::min(dist.getAtom2()->atomicnumber() - 1, 53)
+                             +8748 * std::min(dist.getAtom2()->hybrid() - 1, 2)
+                             +26244 * std::min(r, 81000));
+        }
+        std::sort(_codes.begin(), _codes.end(), std::greater<int>());
+    }
+
+    bool operator==(const OldFingerprint &rhs) const
+    {
+        return _codes == rhs._codes;
+    }
+
+private:
+    std::vector<int> _codes;
+};
+
+// Moves every atom by up to 0.005 A along each axis
+static void Jitter(Residue *res)
+{
+    for (int i = 0; i < res->atomCount(); ++i)
+    {
+        MIAtom *atom = res->atom(i);
+        atom->setPosition(atom->x() + 0.01f * (rand() / (float)RAND_MAX - 0.5f),
+                          atom->y() + 0.01f * (rand() / (float)RAND_MAX - 0.5f),
+                          atom->z() + 0.01f * (rand() / (float)RAND_MAX - 0.5f));
+    }
+}
+
+// Steps through torsion combinations without clash checks, feeding each
+// conformation and a slightly jittered copy of it to the three
+// deduplications; returns false if the hashed set and the linear search of
+// the same fingerprints disagree
+static bool CompareDedup(Residue *res, std::vector<Bond> &bonds, std::vector<TORSION> &torsions)
+{
+    std::vector<FlexTorsion> flexors;
+    for (unsigned int i = 0; i < torsions.size(); ++i)
+    {
+        flexors.push_back(FlexTorsion(torsions[i], bonds, false));
+    }
+    std::vector<Bond> bumps;
+    GetBumps(res, bumps, bonds);
+
+    std::vector<OldFingerprint> oldPrints;
+    std::vector<ConfFingerprint> linearPrints;
+    ConfFingerprintSet hashedPrints;
+    double oldTime = 0.0, linearTime = 0.0, hashedTime = 0.0;
+    static const int checkpoints[] = { 250, 500, 1000, 2000, 4000 };
+    unsigned int next = 0;
+    srand(1);
+
+    printf("  %6s %8s %8s %8s %10s %10s %10s\n", "confs", "old", "linear", "hashed",
+           "old s", "linear s", "hashed s");
+    for (int n = 1; next < sizeof(checkpoints) / sizeof(checkpoints[0]); ++n)
+    {
+        ConfSaver exact(res);
+        if (n % 2 == 1)
+        {
+            std::vector<FlexTorsion>::iterator ft = flexors.begin();
+            while (ft != flexors.end() && !ft->Advance())
+            {
+                ++ft;
+            }
+            if (ft == flexors.end())
+            {
+                break;
+            }
+        }
+        else
+        {
+            exact.Save();
+            Jitter(res);
+        }
+
+        double start = Now();
+        OldFingerprint oldfp(bumps);
+        if (std::find(oldPrints.begin(), oldPrints.end(), oldfp) == oldPrints.end())
+        {
+            oldPrints.push_back(oldfp);
+        }
+        oldTime += Now() - start;
+
+        start = Now();
+        ConfFingerprint fp(bumps, hashedPrints.Tolerance());
+        bool linearNew = std::find(linearPrints.begin(), linearPrints.end(), fp) == linearPrints.end();
+        if (linearNew)
+        {
+            linearPrints.push_back(fp);
+        }
+        linearTime += Now() - start;
+
+        start = Now();
+        bool hashedNew = hashedPrints.Insert(bumps);
+        hashedTime += Now() - start;
+
+        if (n % 2 == 0)
+        {
+            exact.Restore(1);
+        }
+        if (linearNew != hashedNew)
+        {
+            printf("FAILED: conformation %d kept by the %s search only\n", n, linearNew ? "linear" : "hashed");
+            return false;
+        }
+        if (n == checkpoints[next])
+        {
+            printf("  %6d %8d %8d %8d %10.4f %10.4f %10.4f\n", n, (int)oldPrints.size(),
+                   (int)linearPrints.size(), (int)hashedPrints.size(), oldTime, linearTime, hashedTime);
+            ++next;
+        }
+    }
+    return true;
+}
+
+static void TimeGeneration(Residue *res, std::vector<Bond> &bonds, std::vector<TORSION> &torsions)
+{
+    static const int counts[] = { 100, 250, 500, 1000 };
+    for (unsigned int i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i)
+    {
+        ConfSaver confs(res);
+        double start = Now();
+        ConfEnumerator ce(res, bonds, torsions);
+        int found = ce.GenerateConfs(confs, counts[i]);
+        printf("  generate %4d: %4d found in %.4f s\n", counts[i], found, Now() - start);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> ligands;
+    for (int i = 1; i < argc; ++i)
+    {
+        ligands.push_back(argv[i]);
+    }
+    for (int i = 0; argc < 2 && druglikeLigands[i] != 0; ++i)
+    {
+        ligands.push_back(druglikeLigands[i]);
+    }
+
+    bool ok = true;
+    for (unsigned int i = 0; i < ligands.size(); ++i)
+    {
+        std::vector<Bond> bonds;
+        std::vector<TORSION> torsions;
+        Residue *res = BuildLigand(ligands[i].c_str(), bonds, torsions);
+        if (res == 0)
+        {
+            return 1;
+        }
+
+        ConfSaver orig(res);
+        orig.Save();
+        ok = CompareDedup(res, bonds, torsions) && ok;
+        orig.Restore(1);
+        TimeGeneration(res, bonds, torsions);
+        delete res;
+    }
+    printf(ok ? "OK\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
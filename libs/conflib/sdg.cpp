@@ -1,7 +1,9 @@
 #include <chemlib/chemlib.h>
+#include <util/parallel.h>
 #include "sdg.h"
 #include "sdg_parms.h"
 #include <algorithm>
+#include <set>
 
 using namespace chemlib;
 using namespace std;
@@ -9,10 +11,51 @@ using namespace std;
 namespace conflib
 {
 
+sdgRandom::sdgRandom(unsigned int seed, unsigned int stream)
+{
+    Seed(seed, stream);
+}
+
+void sdgRandom::Seed(unsigned int seed, unsigned int stream)
+{
+    //Scramble seed and stream together (murmur3 finalizer) so that
+    //neighboring streams are unrelated
+    unsigned int h = seed ^ (stream * 0x9E3779B9U);
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35U;
+    h ^= h >> 16;
+    _state = (h != 0) ? h : 0x6D2B79F5U;
+}
+
+unsigned int sdgRandom::Next()
+{
+    _state ^= _state << 13;
+    _state ^= _state >> 17;
+    _state ^= _state << 5;
+    return _state;
+}
+
+double sdgRandom::Uniform()
+{
+    return Next() / 4294967296.0;
+}
+
+int sdgRandom::Pick(int range)
+{
+    if (range < 1)
+    {
+        return 0;
+    }
+    return (int)(Uniform() * range);
+}
+
 sdgEngine::sdgEngine(vector<sdgDistance> &dists, vector<sdgVolume> &vols, const vector<MIAtom*> &atoms)
     : _distances(dists),
       _volumes(vols),
-      _atoms(atoms)
+      _atoms(atoms),
+      _random(sdg_params::SDG_SEED)
 {
     _nDist = _distances.size();
     _nVol = _volumes.size();
@@ -28,6 +71,11 @@ sdgEngine::sdgEngine(vector<sdgDistance> &dists, vector<sdgVolume> &vols, const
     }
 }
 
+void sdgEngine::SetSeed(unsigned int seed, unsigned int stream)
+{
+    _random.Seed(seed, stream);
+}
+
 double sdgEngine::DoOptimize()
 {
     float dist_pace = sdg_params::SDG_DIST_TEMP;
@@ -86,17 +134,15 @@ void sdgEngine::DoStep(float dist_pace, float vol_pace)
     int x;
 
     //Decide whether to tweak a volume or a distance
-    float r = (float)rand();
-    float rm =  RAND_MAX;
-    if (_nVol > 0 && r / rm < _vol_odds)
+    if (_nVol > 0 && _random.Uniform() < _vol_odds)
     {
-        x = irand_approx(_nVol);
+        x = _random.Pick(_nVol);
         _volumes[x].Tweak(vol_pace);
     }
     else
     {
-        x = irand_approx(_nDist);
-        _distances[x].Tweak(dist_pace);
+        x = _random.Pick(_nDist);
+        _distances[x].Tweak(dist_pace, _random);
     }
 }
 
@@ -115,6 +161,169 @@ void sdgEngine::Explode(float factor)
     }
 }
 
+//The engine's atoms followed by any other atoms the restraints move, in a
+//fixed order
+void sdgEngine::MovedAtoms(vector<MIAtom*> &moved) const
+{
+    moved.assign(_atoms.begin(), _atoms.end());
+    vector<MIAtom*> restrained;
+    unsigned int i;
+    for (i = 0; i < _distances.size(); ++i)
+    {
+        _distances[i].AddAtoms(restrained);
+    }
+    for (i = 0; i < _volumes.size(); ++i)
+    {
+        _volumes[i].AddAtoms(restrained);
+    }
+    set<MIAtom*> seen(moved.begin(), moved.end());
+    for (i = 0; i < restrained.size(); ++i)
+    {
+        if (seen.insert(restrained[i]).second)
+        {
+            moved.push_back(restrained[i]);
+        }
+    }
+}
+
+void sdgEngine::RunStart(int start, unsigned int seed, double halfWidth, const vector<MIAtom*> &moved,
+                         sdgEmbedding &result) const
+{
+    sdgRandom random(seed, (unsigned int)start);
+    vector<MIAtom*> images(moved.size());
+    sdgAtomMap imageOf;
+    unsigned int i;
+    for (i = 0; i < moved.size(); ++i)
+    {
+        images[i] = new MIAtom;
+        images[i]->setPosition((float)(halfWidth * (2.0 * random.Uniform() - 1.0)),
+                               (float)(halfWidth * (2.0 * random.Uniform() - 1.0)),
+                               (float)(halfWidth * (2.0 * random.Uniform() - 1.0)));
+        imageOf[moved[i]] = images[i];
+    }
+
+    vector<sdgDistance> dists;
+    vector<sdgVolume> vols;
+    dists.reserve(_distances.size());
+    vols.reserve(_volumes.size());
+    for (i = 0; i < _distances.size(); ++i)
+    {
+        dists.push_back(_distances[i].Rebound(imageOf));
+    }
+    for (i = 0; i < _volumes.size(); ++i)
+    {
+        vols.push_back(_volumes[i].Rebound(imageOf));
+    }
+
+    vector<MIAtom*> atoms(images.begin(), images.begin() + _atoms.size());
+    sdgEngine engine(dists, vols, atoms);
+    engine._random = random;
+
+    result.start = start;
+    result.score = engine.DoOptimize();
+    result.chiralErrors = 0;
+    for (i = 0; i < vols.size(); ++i)
+    {
+        if (!vols[i].SignKept())
+        {
+            ++result.chiralErrors;
+        }
+    }
+    result.coords.resize(3 * images.size());
+    for (i = 0; i < images.size(); ++i)
+    {
+        result.coords[3 * i] = images[i]->x();
+        result.coords[3 * i + 1] = images[i]->y();
+        result.coords[3 * i + 2] = images[i]->z();
+        delete images[i];
+    }
+}
+
+namespace
+{
+
+class StartRunner
+{
+    const sdgEngine &_engine;
+    unsigned int _seed;
+    double _halfWidth;
+    const vector<MIAtom*> &_moved;
+    vector<sdgEmbedding> &_results;
+
+public:
+    StartRunner(const sdgEngine &engine, unsigned int seed, double halfWidth, const vector<MIAtom*> &moved,
+                vector<sdgEmbedding> &results)
+        : _engine(engine),
+          _seed(seed),
+          _halfWidth(halfWidth),
+          _moved(moved),
+          _results(results)
+    {
+    }
+
+    void operator()(int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            _engine.RunStart(i, _seed, _halfWidth, _moved, _results[i]);
+        }
+    }
+};
+
+struct BetterEmbedding
+{
+    bool operator()(const sdgEmbedding &e1, const sdgEmbedding &e2) const
+    {
+        if (e1.chiralErrors != e2.chiralErrors)
+        {
+            return e1.chiralErrors < e2.chiralErrors;
+        }
+        if (e1.score != e2.score)
+        {
+            return e1.score < e2.score;
+        }
+        return e1.start < e2.start;
+    }
+};
+
+}
+
+void sdgEngine::MultiStart(int nStarts, unsigned int seed, int nKeep, vector<sdgEmbedding> &best,
+                           double halfWidth) const
+{
+    best.clear();
+    if (nStarts < 1 || nKeep < 1)
+    {
+        return;
+    }
+    vector<MIAtom*> moved;
+    MovedAtoms(moved);
+
+    best.resize(nStarts);
+    StartRunner runner(*this, seed, halfWidth, moved, best);
+    MIParallelFor(0, nStarts, runner);
+
+    sort(best.begin(), best.end(), BetterEmbedding());
+    if ((int)best.size() > nKeep)
+    {
+        best.resize(nKeep);
+    }
+}
+
+void sdgEngine::Apply(const sdgEmbedding &embedding)
+{
+    vector<MIAtom*> moved;
+    MovedAtoms(moved);
+    if (embedding.coords.size() != 3 * moved.size())
+    {
+        return;
+    }
+    for (unsigned int i = 0; i < moved.size(); ++i)
+    {
+        moved[i]->setPosition(embedding.coords[3 * i], embedding.coords[3 * i + 1], embedding.coords[3 * i + 2]);
+    }
+}
+
 sdgDistance::sdgDistance(MIAtom &a1, MIAtom &a2, double lower, double upper, bool isRange)
     : _a1(a1),
       _a2(a2)
@@ -200,7 +409,7 @@ double sdgDistance::Score()
     }
 }
 
-void sdgDistance::Tweak(float pace)
+void sdgDistance::Tweak(float pace, sdgRandom &random)
 {
     double cd = AtomDist(_a1, _a2);              //cd = Current Distance
 
@@ -241,9 +450,9 @@ void sdgDistance::Tweak(float pace)
     BondVector(&_a1, &_a2, v);
     if (cd < sdg_params::SDG_NONZERO)                               //Step in an arbitrary direction if atoms
     {
-        v[0] = rand() * sdg_params::SDG_NONZERO / RAND_MAX;         //are on top of each other
-        v[1] = rand() * sdg_params::SDG_NONZERO / RAND_MAX;
-        v[2] = rand() * sdg_params::SDG_NONZERO / RAND_MAX;
+        v[0] = random.Uniform() * sdg_params::SDG_NONZERO;          //are on top of each other
+        v[1] = random.Uniform() * sdg_params::SDG_NONZERO;
+        v[2] = random.Uniform() * sdg_params::SDG_NONZERO;
     }
 
     //3. Move the atoms
@@ -252,6 +461,19 @@ void sdgDistance::Tweak(float pace)
 
 }
 
+void sdgDistance::AddAtoms(vector<MIAtom*> &atoms) const
+{
+    atoms.push_back(&_a1);
+    atoms.push_back(&_a2);
+}
+
+sdgDistance sdgDistance::Rebound(const sdgAtomMap &images) const
+{
+    sdgDistance dist(*images.find(&_a1)->second, *images.find(&_a2)->second, _lower, _upper, _isRange);
+    dist._isOpenEnd = _isOpenEnd;
+    return dist;
+}
+
 double sdgDistance::GetIdeal()
 {
     if (!_isRange)
@@ -376,6 +598,67 @@ bool sdgVolume::operator==(const sdgVolume &vol2) const
     return true;
 }
 
+int sdgVolume::Sign() const
+{
+    double lower = 0.0;
+    double upper = 0.0;
+    if (!_isRange)
+    {
+        lower = upper = _lower;
+    }
+    else if (_openEnd == sdg_params::SDG_OPENEND_HIGH)
+    {
+        lower = _lower;
+        upper = 1.0;
+    }
+    else if (_openEnd == sdg_params::SDG_OPENEND_LOW)
+    {
+        lower = -1.0;
+        upper = _upper;
+    }
+    else
+    {
+        lower = _lower;
+        upper = _upper;
+    }
+    if (lower >= 0.0 && upper > 0.0)
+    {
+        return 1;
+    }
+    if (upper <= 0.0 && lower < 0.0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+bool sdgVolume::SignKept()
+{
+    int sign = Sign();
+    if (sign == 0)
+    {
+        return true;
+    }
+    double volume = Measure();
+    return sign > 0 ? volume > 0.0 : volume < 0.0;
+}
+
+void sdgVolume::AddAtoms(vector<MIAtom*> &atoms) const
+{
+    atoms.push_back(&_center);
+    atoms.push_back(&_a1);
+    atoms.push_back(&_a2);
+    atoms.push_back(&_a3);
+}
+
+sdgVolume sdgVolume::Rebound(const sdgAtomMap &images) const
+{
+    sdgVolume vol(*images.find(&_center)->second, *images.find(&_a1)->second,
+                  *images.find(&_a2)->second, *images.find(&_a3)->second, _lower, _upper, _openEnd);
+    vol._isRange = _isRange;
+    return vol;
+}
+
 double sdgVolume::Measure()
 {
     return SignedAtomVolume(_center, _a1, _a2, _a3);
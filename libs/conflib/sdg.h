@@ -1,8 +1,35 @@
 #include <chemlib/chemlib.h>
+#include <map>
 
 namespace conflib
 {
 
+    //Maps each atom moved by an SDG trajectory to its private copy
+    typedef std::map<chemlib::MIAtom*, chemlib::MIAtom*> sdgAtomMap;
+
+    //Random number stream for one SDG trajectory (xorshift). Trajectories
+    //each own one, so they are reproducible however they are scheduled.
+    class sdgRandom
+    {
+    private:
+        unsigned int _state;
+    public:
+        explicit sdgRandom(unsigned int seed = 1, unsigned int stream = 0);
+        void Seed(unsigned int seed, unsigned int stream = 0);
+        unsigned int Next();
+        double Uniform();           //In [0, 1)
+        int Pick(int range);        //In [0, range), 0 if range < 1
+    };
+
+    //One embedding found by sdgEngine::MultiStart
+    struct sdgEmbedding
+    {
+        int start;                  //Index of the trajectory that produced it
+        double score;               //Distance score, as returned by DoOptimize
+        int chiralErrors;           //Volume restraints with the wrong sign
+        std::vector<float> coords;  //x, y, z of each atom moved, in engine order
+    };
+
     class sdgDistance
     {
     private:
@@ -23,7 +50,9 @@ namespace conflib
         double Measure();
         double Score();
         double GetIdeal();
-        void Tweak(float pace);
+        void Tweak(float pace, sdgRandom &random);
+        void AddAtoms(std::vector<chemlib::MIAtom*> &atoms) const;
+        sdgDistance Rebound(const sdgAtomMap &images) const;        //Same restraint on the images
     };
 
     class sdgVolume
@@ -47,6 +76,10 @@ namespace conflib
         double Measure();
         double Score();
         void Tweak(float pace);
+        int Sign() const;           //Sign the restraint requires of the volume, 0 if none
+        bool SignKept();            //False if a chiral center came out inverted
+        void AddAtoms(std::vector<chemlib::MIAtom*> &atoms) const;
+        sdgVolume Rebound(const sdgAtomMap &images) const;
     };
 
     class sdgEngine
@@ -59,13 +92,33 @@ namespace conflib
         int _nSteps;            //Steps per cycle (proportional to # of atoms)
         double _vol_odds;       //The chance, for each step, of tweaking a volume constraint (set in constructor)
         const std::vector<chemlib::MIAtom*> &_atoms;
+        sdgRandom _random;
+
+        void MovedAtoms(std::vector<chemlib::MIAtom*> &moved) const;
 
     public:
         sdgEngine(std::vector<sdgDistance> &dists, std::vector<sdgVolume> &vols, const std::vector<chemlib::MIAtom*> &atoms);
+        void SetSeed(unsigned int seed, unsigned int stream = 0);
         double DoOptimize();
         void DoCycle(float, float);
         void DoStep(float, float);
         void Explode(float factor);
+
+        //Runs nStarts independent trajectories, each from random coordinates
+        //within halfWidth of the origin, on private copies of the atoms and
+        //with its own random stream derived from seed. The atoms themselves
+        //are not moved. Returns in best the nKeep best embeddings: those
+        //with the fewest inverted chiral volumes first, then by score, then
+        //by start, so the result depends only on seed and nStarts.
+        void MultiStart(int nStarts, unsigned int seed, int nKeep, std::vector<sdgEmbedding> &best,
+                        double halfWidth = 20.0) const;
+        //Moves the atoms to an embedding from MultiStart
+        void Apply(const sdgEmbedding &embedding);
+        //Trajectory start of MultiStart, moving the given atoms. Only
+        //touches its own copies of the atoms and restraints, so starts can
+        //run concurrently.
+        void RunStart(int start, unsigned int seed, double halfWidth, const std::vector<chemlib::MIAtom*> &moved,
+                      sdgEmbedding &result) const;
     };
 
 /*
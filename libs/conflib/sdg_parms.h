@@ -23,6 +23,10 @@ namespace conflib
         const float SDG_MIN_VOL_ODDS = 0.5;
 //Prevents division by zero
         const double SDG_NONZERO = 1E-10;
+//Independent trajectories run by a multi-start embedding
+        const int SDG_NSTARTS = 16;
+//Default random seed of the trajectories
+        const unsigned int SDG_SEED = 87531;
 
         const int SDG_OPENEND_NONE = 0;
         const int SDG_OPENEND_LOW = 1;
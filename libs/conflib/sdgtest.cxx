@@ -0,0 +1,135 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <chemlib/chemlib.h>
+#include <chemlib/Monomer.h>
+#include <chemlib/Residue.h>
+#include <util/parallel.h>
+
+#include "CoordGenerator.h"
+#include "confgen.h"
+#include "testligands.cxx"
+
+// The multi-start stochastic distance geometry embedding of drug-like
+// ligands run on one thread and on several. For each seed every
+// coordinate and the score must be the same to the bit whatever the
+// thread count, and different seeds must give different embeddings.
+// named cxx to avoid being put into compilation of library
+//
+// usage: sdgtest [threads [smiles ...]]
+
+static const unsigned int seeds[] = { sdg_params::SDG_SEED, 1, 2 };
+static const int numSeeds = sizeof(seeds) / sizeof(seeds[0]);
+
+struct Embedding
+{
+    double score;
+    std::vector<float> coords;
+};
+
+// Embeds the ligand from scratch as GenerateCoordinates does, with the
+// given seed
+static void Embed(Residue *res, const std::vector<Bond> &bonds, unsigned int seed, Embedding &embedding)
+{
+    Ligand lig(*res, bonds);
+    LigandPerceiver lp;
+    lp.AssignHybridization(&lig);
+    lp.AssignAtomGeom(&lig);
+    lp.AssignChirality(&lig);
+    lig.FindRingSystems();
+
+    LigDictionary dict(&lig, lig.residues.front());
+    dict.AnalyzeRings();
+    dict.GenTorsions();
+    dict.GenChirals();
+    dict.GenDoubleBondImpropers();
+    dict.FindAcycPlanes();
+    dict.SetMolGeometry();
+    CovalentGeometry cg(&lig, lig.residues.front());
+    cg.AssignResidue();
+
+    CoordGenerator generator(&lig, lig.residues.front());
+    embedding.score = generator.sdgRefine(seed);
+    Monomer *embedded = lig.residues.front();
+    embedding.coords.clear();
+    for (int i = 0; i < embedded->atomCount(); ++i)
+    {
+        embedding.coords.push_back(embedded->atom(i)->x());
+        embedding.coords.push_back(embedded->atom(i)->y());
+        embedding.coords.push_back(embedded->atom(i)->z());
+    }
+}
+
+static bool Same(const Embedding &a, const Embedding &b)
+{
+    return a.score == b.score && a.coords.size() == b.coords.size()
+           && (a.coords.empty() || memcmp(&a.coords[0], &b.coords[0], a.coords.size() * sizeof(float)) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : 8;
+    std::vector<const char*> ligands;
+    for (int i = 2; i < argc; ++i)
+    {
+        ligands.push_back(argv[i]);
+    }
+    for (int i = 0; argc < 3 && druglikeLigands[i] != 0; ++i)
+    {
+        ligands.push_back(druglikeLigands[i]);
+    }
+
+    bool ok = true;
+    for (unsigned int i = 0; i < ligands.size(); ++i)
+    {
+        std::vector<Bond> bonds;
+        std::vector<TORSION> torsions;
+        Residue *res = BuildLigand(ligands[i], bonds, torsions);
+        if (res == 0)
+        {
+            return 1;
+        }
+
+        std::vector<Embedding> serial(numSeeds);
+        MISetParallelThreadCount(1);
+        double start = Now();
+        for (int s = 0; s < numSeeds; ++s)
+        {
+            Embed(res, bonds, seeds[s], serial[s]);
+            printf("  seed %5u: score %.6g\n", seeds[s], serial[s].score);
+            for (int t = 0; t < s; ++t)
+            {
+                if (serial[s].coords == serial[t].coords)
+                {
+                    printf("FAILED: seeds %u and %u give the same embedding\n", seeds[t], seeds[s]);
+                    ok = false;
+                }
+            }
+        }
+        printf("  1 thread: %.3f s\n", Now() - start);
+
+        for (int threads = 2; threads <= maxThreads; threads *= 2)
+        {
+            MISetParallelThreadCount(threads);
+            start = Now();
+            for (int s = 0; s < numSeeds; ++s)
+            {
+                Embedding embedding;
+                Embed(res, bonds, seeds[s], embedding);
+                if (!Same(embedding, serial[s]))
+                {
+                    printf("FAILED: seed %u on %d threads differs from one\n", seeds[s], threads);
+                    ok = false;
+                }
+            }
+            printf("  %d threads: %.3f s\n", threads, Now() - start);
+        }
+        delete res;
+    }
+    MISetParallelThreadCount(0);
+    printf(ok ? "OK\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
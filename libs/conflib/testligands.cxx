@@ -0,0 +1,128 @@
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include <chemlib/chemlib.h>
+#include <chemlib/Residue.h>
+
+#include "confgen.h"
+
+// The ligands and helpers shared by the test programs in this directory,
+// which include this file: drug-like ligands from SMILES with generated
+// coordinates, and their rotatable torsions.
+// named cxx to avoid being put into compilation of library
+
+using namespace chemlib;
+using namespace conflib;
+
+static const char *druglikeLigands[] =
+{
+    "CCCCCCOc1ccc(CC(=O)NCCCN(CC)CC)cc1",
+    "Cc1ccc(NC(=O)c2ccc(CN3CCN(C)CC3)cc2)cc1Nc1nccc(-c2cccnc2)n1",
+    "COc1ccc(CCN(C)CCCC(C#N)(C(C)C)c2ccc(OC)c(OC)c2)cc1OC",
+    0
+};
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Whether a and b are still connected without the bond between them
+static bool InRing(MIAtom *a, MIAtom *b, const std::vector<Bond> &bonds)
+{
+    std::vector<MIAtom*> stack(1, a);
+    std::map<MIAtom*, bool> seen;
+    seen[a] = true;
+    while (!stack.empty())
+    {
+        MIAtom *atom = stack.back();
+        stack.pop_back();
+        for (unsigned int i = 0; i < bonds.size(); ++i)
+        {
+            MIAtom *next = 0;
+            if (bonds[i].getAtom1() == atom)
+            {
+                next = bonds[i].getAtom2();
+            }
+            else if (bonds[i].getAtom2() == atom)
+            {
+                next = bonds[i].getAtom1();
+            }
+            if (next == 0 || (atom == a && next == b) || seen[next])
+            {
+                continue;
+            }
+            if (next == b)
+            {
+                return true;
+            }
+            seen[next] = true;
+            stack.push_back(next);
+        }
+    }
+    return false;
+}
+
+static MIAtom *OtherNeighbour(MIAtom *atom, MIAtom *not_this, const std::vector<Bond> &bonds)
+{
+    for (unsigned int i = 0; i < bonds.size(); ++i)
+    {
+        if (bonds[i].getAtom1() == atom && bonds[i].getAtom2() != not_this)
+        {
+            return bonds[i].getAtom2();
+        }
+        if (bonds[i].getAtom2() == atom && bonds[i].getAtom1() != not_this)
+        {
+            return bonds[i].getAtom1();
+        }
+    }
+    return 0;
+}
+
+// Acyclic single bonds between two non-terminal atoms
+static void RotatableTorsions(Residue *res, const std::vector<Bond> &bonds, std::vector<TORSION> &torsions)
+{
+    for (unsigned int i = 0; i < bonds.size(); ++i)
+    {
+        MIAtom *a2 = bonds[i].getAtom1();
+        MIAtom *a3 = bonds[i].getAtom2();
+        if (bonds[i].getOrder() != SINGLEBOND || InRing(a2, a3, bonds))
+        {
+            continue;
+        }
+        TORSION t;
+        t.atom1 = OtherNeighbour(a2, a3, bonds);
+        t.atom2 = a2;
+        t.atom3 = a3;
+        t.atom4 = OtherNeighbour(a3, a2, bonds);
+        t.res = res;
+        if (t.atom1 != 0 && t.atom4 != 0)
+        {
+            torsions.push_back(t);
+        }
+    }
+}
+
+// The ligand of the SMILES with generated coordinates and its rotatable
+// torsions, or 0 if the SMILES cannot be read; the caller deletes it
+static Residue *BuildLigand(const char *smiles, std::vector<Bond> &bonds, std::vector<TORSION> &torsions)
+{
+    MIMolInfo mi;
+    SMILES smi;
+    if (!smi.Read(smiles, mi))
+    {
+        printf("Cannot read %s\n", smiles);
+        return 0;
+    }
+    std::string log;
+    GenerateCoordinates(mi.res, mi.bonds, log);
+    bonds = mi.bonds;
+    RotatableTorsions(mi.res, bonds, torsions);
+    printf("%s: %d atoms, %d rotatable bonds\n", smiles, mi.res->atomCount(), (int)torsions.size());
+    return mi.res;
+}
@@ -4,6 +4,7 @@
 #include "CMapHeaderBase.h"
 #include "fft.h"
 #include <util/utillib.h>
+#include <util/SnapshotFile.h>
 
 extern char syminfo[][28];
 extern char hmsymbol[][14];
@@ -213,6 +214,124 @@ CMapHeaderBase::CMapHeaderBase(const std::string &from_label)
     SetSymmOps();
 }
 
+void CMapHeaderBase::WriteSnapshot(SnapshotWriter &out) const
+{
+    out.writeString(crystal_name);
+    out.writeString(spgpname);
+    out.writeString(SymInfoString);
+    out.writeString(title);
+    out.writeString(PG_symbol);
+    out.write((quint32)SymopsString.size());
+    for (size_t i = 0; i < SymopsString.size(); ++i)
+    {
+        out.writeString(SymopsString[i]);
+    }
+    out.write(a);
+    out.write(b);
+    out.write(c);
+    out.write(alpha);
+    out.write(beta);
+    out.write(gamma);
+    out.write(spgpno);
+    out.write(npg_ops);
+    out.write(nNCRSymmops);
+    out.write(NCRSymmops);
+    out.write(nx);
+    out.write(ny);
+    out.write(nz);
+    out.write(scale);
+    out.write(Bsolvent);
+    out.write(Ksolvent);
+    out.write(sc11);
+    out.write(sc22);
+    out.write(sc33);
+    out.write(sc12);
+    out.write(sc13);
+    out.write(sc23);
+    out.write(use_bulksolvent);
+    out.write(use_aniso);
+    out.write(resmax);
+    out.write(resmin);
+    out.write(nsym);
+    out.write(symops);
+    out.write(ctof);
+    out.write(ftoc);
+    out.write(maptype);
+    out.write(fc_is_fom);
+    out.write(hmin);
+    out.write(hmax);
+    out.write(kmin);
+    out.write(kmax);
+    out.write(lmin);
+    out.write(lmax);
+    out.write(M_Coefficient);
+    out.write(N_Coefficient);
+}
+
+bool CMapHeaderBase::ReadSnapshot(SnapshotSection &in)
+{
+    quint32 nops = 0;
+    in.readString(crystal_name);
+    in.readString(spgpname);
+    in.readString(SymInfoString);
+    in.readString(title);
+    in.readString(PG_symbol);
+    in.read(nops);
+    SymopsString.clear();
+    for (quint32 i = 0; i < nops && in.ok(); ++i)
+    {
+        std::string op;
+        in.readString(op);
+        SymopsString.push_back(op);
+    }
+    in.read(a);
+    in.read(b);
+    in.read(c);
+    in.read(alpha);
+    in.read(beta);
+    in.read(gamma);
+    in.read(spgpno);
+    in.read(npg_ops);
+    in.read(nNCRSymmops);
+    in.read(NCRSymmops);
+    in.read(nx);
+    in.read(ny);
+    in.read(nz);
+    in.read(scale);
+    in.read(Bsolvent);
+    in.read(Ksolvent);
+    in.read(sc11);
+    in.read(sc22);
+    in.read(sc33);
+    in.read(sc12);
+    in.read(sc13);
+    in.read(sc23);
+    in.read(use_bulksolvent);
+    in.read(use_aniso);
+    in.read(resmax);
+    in.read(resmin);
+    in.read(nsym);
+    in.read(symops);
+    in.read(ctof);
+    in.read(ftoc);
+    in.read(maptype);
+    in.read(fc_is_fom);
+    in.read(hmin);
+    in.read(hmax);
+    in.read(kmin);
+    in.read(kmax);
+    in.read(lmin);
+    in.read(lmax);
+    in.read(M_Coefficient);
+    in.read(N_Coefficient);
+    if (!in.ok())
+    {
+        return false;
+    }
+    mapHeaderChanged(this);
+    return true;
+}
+
 std::string CMapHeaderBase::Label() const
 {
     return format("%d:%s %0.2f %0.2f %0.2f %0.1f %0.1f %0.1f",
@@ -8,6 +8,9 @@
 
 #include "MAP_POINT.h"
 
+class SnapshotWriter;
+class SnapshotSection;
+
 namespace MISymmop
 {
     const unsigned int MAXSTRING = 1024;
@@ -119,6 +122,12 @@ public:
 
     void EchoCrystal();
 
+    //@{
+    // Write/read all header fields to/from a binary session snapshot.
+    //@}
+    void WriteSnapshot(SnapshotWriter &out) const;
+    bool ReadSnapshot(SnapshotSection &in);
+
 signals:
     void mapHeaderChanged(CMapHeaderBase*);
 
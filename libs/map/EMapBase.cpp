@@ -5,15 +5,19 @@
 #include <chemlib/Residue.h>
 #include <chemlib/MIMoleculeBase.h>
 #include <math/mathlib.h>
+#include <QtCore/QMutex>
 
 #include "EMapBase.h"
 #include "MINATOM.h"
 #include "PEAK.h"
+#include "MapFilter.h"
 
 #include "fssubs.h"  // private to library
 #include "fft.h"     // private to library
 #include "sfcalc.h"  // private to library
 #include "rescalc.h" // private to library
+#include <util/SnapshotFile.h>
+#include <util/parallel.h>
 #include "fssubs.h"  // private to library
 
 typedef float real;
@@ -33,6 +37,10 @@ typedef struct
 #include <umtz/mmtzlib.h>
 #endif
 
+// umtz keeps its open files in one table, so only one thread at a time may
+// read or write an MTZ file
+static QMutex mtzMutex;
+
 using namespace chemlib;
 using namespace std;
 
@@ -74,7 +82,6 @@ unsigned int MapTypeForString(const std::string &str)
 
 
 //defined in sfcalc.cpp
-extern double Bscale;
 extern char **rtypes;
 extern char **atypes;
 extern int *atypelen;
@@ -316,36 +323,25 @@ atom_has_density(MIAtom *a /*, RESIDUE *res*/)
 #define mdex(ix, iy, iz, nx, ny, nz) (nx*(ny*((iz+64*nz)%nz)+(iy+64*ny)%ny)+(ix+64*nx)%nx)
 
 
-static void rhocoefs(MIAtom *atom, Residue *res, int nx, int ny, int nz, CMapHeaderBase *mh, float *ae, float *be, float *boxrad, float *dmax)
+/* real space density coefficients of scattering type type:
+ * rho(d) = sum over k=1..5 of ae[k]*exp(-be[k]*d*d), smeared by B; dmax is
+ * the distance at which the density falls to 1/500 of its peak */
+static void gausscoefs(int type, float occ, double B, float *ae, float *be, float *dmax)
 {
-    float d, dx, dy, dz;
+    float d;
     float r, r0;
     int i;
-    int type;
-    float Bv, occ;
-
-    occ = atom->occ();
-    Bv = atom->BValue();
-    type = 1; /* default = carbon */
-    type = ScattIndex(atom->name(), res->type().c_str());
-
-    if (type==-1)
-    {
-        type = 1;
-        Logger::log("Warning, atom type %s unknown, treated as carbon", atom->name());
-    }
 
-    /* derive real space form factor from reciprocal space version */
-    ae[1] = (float)(occ*a1[type]*pow(sqrt(4.0*PI/(b1[type]+Bv+Bscale)), 3.0));
-    ae[2] = (float)(occ*a2[type]*pow(sqrt(4.0*PI/(b2[type]+Bv+Bscale)), 3.0));
-    ae[3] = (float)(occ*a3[type]*pow(sqrt(4.0*PI/(b3[type]+Bv+Bscale)), 3.0));
-    ae[4] = (float)(occ*a4[type]*pow(sqrt(4.0*PI/(b4[type]+Bv+Bscale)), 3.0));
-    ae[5] = (float)(occ*co[type]*pow(sqrt(4.0*PI/(         Bv+Bscale)), 3.0));
-    be[1] = (float)(4.0*PI*PI/(b1[type]+Bv+Bscale));
-    be[2] = (float)(4.0*PI*PI/(b2[type]+Bv+Bscale));
-    be[3] = (float)(4.0*PI*PI/(b3[type]+Bv+Bscale));
-    be[4] = (float)(4.0*PI*PI/(b4[type]+Bv+Bscale));
-    be[5] = (float)(4.0*PI*PI/(         Bv+Bscale));
+    ae[1] = (float)(occ*a1[type]*pow(sqrt(4.0*PI/(b1[type]+B)), 3.0));
+    ae[2] = (float)(occ*a2[type]*pow(sqrt(4.0*PI/(b2[type]+B)), 3.0));
+    ae[3] = (float)(occ*a3[type]*pow(sqrt(4.0*PI/(b3[type]+B)), 3.0));
+    ae[4] = (float)(occ*a4[type]*pow(sqrt(4.0*PI/(b4[type]+B)), 3.0));
+    ae[5] = (float)(occ*co[type]*pow(sqrt(4.0*PI/(         B)), 3.0));
+    be[1] = (float)(4.0*PI*PI/(b1[type]+B));
+    be[2] = (float)(4.0*PI*PI/(b2[type]+B));
+    be[3] = (float)(4.0*PI*PI/(b3[type]+B));
+    be[4] = (float)(4.0*PI*PI/(b4[type]+B));
+    be[5] = (float)(4.0*PI*PI/(         B));
     /* calculate box bounds */
     /* the density at d = 0.0 */
     r0 = ae[1] + ae[2] + ae[3] + ae[4] + ae[5];
@@ -362,6 +358,35 @@ static void rhocoefs(MIAtom *atom, Residue *res, int nx, int ny, int nz, CMapHea
         }
     }
     *dmax = (float)i*0.3f;
+}
+
+/* the B-value added to every atom of a model density at the resolution of
+ * mh, so that it can be sampled on a coarse grid; the structure factors
+ * are sharpened by the same amount afterwards */
+static double ModelBscale(const CMapHeaderBase *mh)
+{
+    return std::max(exp(mh->resmin+.1)/2.0, 0.0) + 2.0;
+}
+
+static void rhocoefs(MIAtom *atom, Residue *res, int nx, int ny, int nz, CMapHeaderBase *mh, double bscale, float *ae, float *be, float *boxrad, float *dmax)
+{
+    float dx, dy, dz;
+    int type;
+    float Bv, occ;
+
+    occ = atom->occ();
+    Bv = atom->BValue();
+    type = 1; /* default = carbon */
+    type = ScattIndex(atom->name(), res->type().c_str());
+
+    if (type==-1)
+    {
+        type = 1;
+        Logger::log("Warning, atom type %s unknown, treated as carbon", atom->name());
+    }
+
+    /* derive real space form factor from reciprocal space version */
+    gausscoefs(type, occ, Bv+bscale, ae, be, dmax);
     dx = dy = dz = *dmax;
     transform(mh->ctof, &dx, &dy, &dz);
     boxrad[0] = fabs(dx)*(float)nx;
@@ -379,7 +404,10 @@ static double drand48(void)
 
 #endif
 
-static void addrho(MIAtom *atom, micomplex *cmap, int nx, int ny, int nz, CMapHeaderBase *mh, Residue *res, float shake_coords = 0.0)
+/* add the density of an atom with the given coefficients at ax, ay, az
+ * and its symmetry mates to cmap */
+static void addrhoat(const float *ae, const float *be, const float *boxrad, float dmax,
+                     float ax, float ay, float az, micomplex *cmap, int nx, int ny, int nz, const CMapHeaderBase *mh)
 {
     int ix, iy, iz;
     int xl, xu, yl, yu, zl, zu;
@@ -391,33 +419,12 @@ static void addrho(MIAtom *atom, micomplex *cmap, int nx, int ny, int nz, CMapHe
     int isx, isy, isz;
     float r;
     int is;
-    float dmax, ax, ay, az;
-    float ae1[6], be1[6], boxrad1[3];
-    float *ae, *be, *boxrad;
 
-    if (!atom_has_density(atom /*,res*/))
-    {
-        return;
-    }
-    ae = ae1;
-    be = be1;
-    boxrad = boxrad1;
-    rhocoefs(atom, res, nx, ny, nz, mh, ae, be, boxrad, &dmax);
-    ax = atom->x();
-    ay = atom->y();
-    az = atom->z();
-    if (shake_coords > 0.0)
-    {
-        //extern double drand48();
-        ax += (float)drand48()*shake_coords*2.0f - shake_coords;
-        ay += (float)drand48()*shake_coords*2.0f - shake_coords;
-        az += (float)drand48()*shake_coords*2.0f - shake_coords;
-    }
     /* transform to fractional coords */
     fx = ax;
     fy = ay;
     fz = az;
-    transform(mh->ctof, &fx, &fy, &fz);
+    mh->CtoF(&fx, &fy, &fz);
     fx *= (float)nx;
     fy *= (float)ny;
     fz *= (float)nz;
@@ -442,7 +449,7 @@ static void addrho(MIAtom *atom, micomplex *cmap, int nx, int ny, int nz, CMapHe
                 fix = ffx;
                 fiy = ffy;
                 fiz = ffz;
-                transform(mh->ftoc, &fix, &fiy, &fiz);
+                mh->FtoC(&fix, &fiy, &fiz);
 
                 /* distance squared in A from center of atom */
                 dx = fix - ax;
@@ -488,7 +495,30 @@ static void addrho(MIAtom *atom, micomplex *cmap, int nx, int ny, int nz, CMapHe
     }
 }
 
-static micomplex *buildrho(Residue *reslist, CMapHeaderBase *mh)
+static void addrho(MIAtom *atom, micomplex *cmap, int nx, int ny, int nz, CMapHeaderBase *mh, Residue *res, double bscale, float shake_coords = 0.0)
+{
+    float dmax, ax, ay, az;
+    float ae[6], be[6], boxrad[3];
+
+    if (!atom_has_density(atom /*,res*/))
+    {
+        return;
+    }
+    rhocoefs(atom, res, nx, ny, nz, mh, bscale, ae, be, boxrad, &dmax);
+    ax = atom->x();
+    ay = atom->y();
+    az = atom->z();
+    if (shake_coords > 0.0)
+    {
+        //extern double drand48();
+        ax += (float)drand48()*shake_coords*2.0f - shake_coords;
+        ay += (float)drand48()*shake_coords*2.0f - shake_coords;
+        az += (float)drand48()*shake_coords*2.0f - shake_coords;
+    }
+    addrhoat(ae, be, boxrad, dmax, ax, ay, az, cmap, nx, ny, nz, mh);
+}
+
+static micomplex *buildrho(Residue *reslist, CMapHeaderBase *mh, double &Bscale)
 {
     micomplex *cmap;
     int nx, ny, nz;
@@ -498,7 +528,7 @@ static micomplex *buildrho(Residue *reslist, CMapHeaderBase *mh)
     int n = 0;
     sfinit();
 
-    Bscale = std::max(exp(mh->resmin+.1)/2.0, 0.0) + 2.0;
+    Bscale = ModelBscale(mh);
 
     /* first figure out the size of the map given the cell
      * and the resolution desired
@@ -568,7 +598,7 @@ static micomplex *buildrho(Residue *reslist, CMapHeaderBase *mh)
         for (i = 0; i < res->atomCount(); i++)
         {
             a = res->atom(i);
-            addrho(a, cmap, nx, ny, nz, mh, res);
+            addrho(a, cmap, nx, ny, nz, mh, res, Bscale);
             n++;
         }
         //printf(".");
@@ -586,19 +616,10 @@ static micomplex *buildrho(Residue *reslist, CMapHeaderBase *mh)
     return (cmap);
 }
 
-/* invert a P1 map and copy structure factors to refl */
-static int InvertMap(micomplex x[], CMapHeaderBase *mh, std::vector<CREFL> &refl)
+/* complex 3D transform of a P1 grid in place */
+static void TransformGrid(micomplex x[], long int nx, long int ny, long int nz)
 {
-    int j;
-    int ix, iy, iz;
     long int d[5];
-    long int nx, ny, nz;
-    int n = 0;
-    float fact;
-    float Vfact;
-    nx = mh->nx;
-    ny = mh->ny;
-    nz = mh->nz;
 
     /*  transform fast dimension */
     /*  transforms on x. */
@@ -627,6 +648,22 @@ static int InvertMap(micomplex x[], CMapHeaderBase *mh, std::vector<CREFL> &refl
     d[4] = 2;
 
     cmplft_((float*)x, (float*)&(x[0].i), &nz, d);
+}
+
+/* invert a P1 map and copy structure factors to refl */
+static int InvertMap(micomplex x[], CMapHeaderBase *mh, std::vector<CREFL> &refl, double Bscale)
+{
+    int j;
+    int ix, iy, iz;
+    long int nx, ny, nz;
+    int n = 0;
+    float fact;
+    float Vfact;
+    nx = mh->nx;
+    ny = mh->ny;
+    nz = mh->nz;
+
+    TransformGrid(x, nx, ny, nz);
 
     Vfact = Volume(mh->a, mh->b, mh->c, mh->alpha, mh->beta, mh->gamma)
             /((float)nx*(float)ny*(float)nz);
@@ -713,6 +750,7 @@ EMapBase::EMapBase()
     version_string  = std::string(__FILE__);
     version_string += std::string(__DATE__);
     _fostr = _fcstr = _fomstr = _phistr = _sigfstr = _freeRstr = "";
+    densityKernelResolution = 0.0f;
 }
 
 EMapBase::~EMapBase()
@@ -1407,7 +1445,7 @@ long EMapBase::LoadMap(const char *pathname, int type)
     else if (type == EMapBase::XtalView_fin)
     {
     }
-    sthol(1, 1, 1, mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, 1);
+    ReciprocalCell cell(mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma);
     refls_stholmax = -1.0F;
     refls_stholmin = 999999.0F;
     while (fgets(buf, sizeof buf, fp) != NULL)
@@ -1426,7 +1464,7 @@ long EMapBase::LoadMap(const char *pathname, int type)
                 refl.fo = fo;
                 refl.fc = fc;
                 refl.phi = phi;
-                refl.sthol = sthol(ih, ik, il, mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, 0);
+                refl.sthol = cell.sthol(ih, ik, il);
                 if (refl.sthol > refls_stholmax)
                 {
                     refls_stholmax = refl.sthol;
@@ -1471,7 +1509,7 @@ long EMapBase::LoadMap(const char *pathname, int type)
                 refl.sigma = 1.0F/((1.0F/sigf1)+(1.0F/sigf2));
                 refl.fc = refl.fo;
                 refl.phi = 0.0;
-                refl.sthol = sthol(ih, ik, il, mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, 0);
+                refl.sthol = cell.sthol(ih, ik, il);
                 if (refl.sthol > refls_stholmax)
                 {
                     refls_stholmax = refl.sthol;
@@ -1581,7 +1619,7 @@ long EMapBase::LoadMap(const char *pathname, int type)
             refl.sigma = 1.0F/((1.0F/s1)+(1.0F/s2));
             refl.fc = refl.fo;
             refl.phi = 0.0;
-            refl.sthol = sthol(ih, ik, il, mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, 0);
+            refl.sthol = cell.sthol(ih, ik, il);
             if (refl.sthol > refls_stholmax)
             {
                 refls_stholmax = refl.sthol;
@@ -1646,7 +1684,7 @@ long EMapBase::LoadMap(const char *pathname, int type)
             refl.sigma = 1.0F/((1.0F/s1)+(1.0F/s2));
             refl.fc = refl.fo;
             refl.phi = 0.0;
-            refl.sthol = sthol(ih, ik, il, mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, 0);
+            refl.sthol = cell.sthol(ih, ik, il);
             if (refl.sthol > refls_stholmax)
             {
                 refls_stholmax = refl.sthol;
@@ -1684,6 +1722,8 @@ long EMapBase::SaveCCP4Phase(const char *pathname)
         return 0;
     }
 
+    QMutexLocker lock(&mtzMutex);
+
     if ((fileout  = mmtz_open(pathname, "w")) == NULL)
     {
         Logger::message("SaveCCP4Phase:: Error:: Can't open file. Must Abort\n"
@@ -1901,6 +1941,7 @@ bool EMapBase::GetMTZColumnInfo(const std::string &fname,
     mmtz_dataset set;
     unsigned int i;
 
+    QMutexLocker lock(&mtzMutex);
     if ((filein  = mmtz_open(fname.c_str(), "r")) == NULL)
     {
         return false;
@@ -1971,6 +2012,7 @@ long EMapBase::LoadMTZMap(const char *pathname, bool require_fo)
     std::string s;
     int hindex = (-1), kindex = (-1), lindex = (-1), freeRindex = (-1),
         foindex = (-1), fcindex = (-1), phsindex = (-1), fomindex = (-1), sigfindex = (-1);
+    QMutexLocker lock(&mtzMutex);
     if ((filein  = mmtz_open(pathname, "r")) == NULL)
     {
         return 0;
@@ -2212,7 +2254,7 @@ long EMapBase::LoadMTZMap(const char *pathname, bool require_fo)
 
     // finally load data
     CREFL r;
-    sthol(1, 1, 1, mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, 1);
+    ReciprocalCell cell(mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma);
     refls_stholmax = -1.0F;
     refls_stholmin = 999999.0F;
     refls.clear();
@@ -2256,7 +2298,7 @@ long EMapBase::LoadMTZMap(const char *pathname, bool require_fo)
         {
             r.freeRflag = (short int)fdata[freeRindex];
         }
-        r.sthol = sthol(r.ind[0], r.ind[1], r.ind[2], mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, 0);
+        r.sthol = cell.sthol(r.ind[0], r.ind[1], r.ind[2]);
         if (r.sthol > refls_stholmax)
         {
             refls_stholmax = r.sthol;
@@ -2618,7 +2660,7 @@ endcryst:
     rewind(fp);
     orthog(mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, mapheader->ctof);
     uinv(mapheader->ctof, mapheader->ftoc);
-    sthol(1, 1, 1, mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, 1);
+    ReciprocalCell cell(mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma);
     refls_stholmax = -1.0F;
     refls_stholmin = 999999.0F;
     nline = 0;
@@ -2683,7 +2725,7 @@ endcryst:
                 {
                     refl.phi = (float)atof(strings[phsindex]);
                 }
-                refl.sthol = sthol(ih, ik, il, mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, 0);
+                refl.sthol = cell.sthol(ih, ik, il);
                 if (refl.sthol > refls_stholmax)
                 {
                     refls_stholmax = refl.sthol;
@@ -3589,6 +3631,7 @@ int EMapBase::sfFFT(Residue *res, float &scale)
 {
     micomplex *rho;
     float sc;
+    double Bscale;
     int i, nx, ny, nz;
     CMapHeaderBase *mh = mapheader;
 
@@ -3597,12 +3640,12 @@ int EMapBase::sfFFT(Residue *res, float &scale)
     nx = mapheader->nx;
     nz = mapheader->nz;
     Logger::log("Building rho...");
-    if ((rho = buildrho(res, mh)) == NULL)
+    if ((rho = buildrho(res, mh, Bscale)) == NULL)
     {
         return (0);
     }
     Logger::log("Inverting rho...");
-    InvertMap(rho, mh, refls);
+    InvertMap(rho, mh, refls, Bscale);
     free((void*)rho);
     Logger::log("Scaling Fc...");
     sc = ComputeScale(refls, mh);
@@ -3895,6 +3938,80 @@ int EMapBase::Read(const char *file)
     return n;
 }
 
+void EMapBase::WriteSnapshot(SnapshotWriter &out) const
+{
+    mapheader->WriteSnapshot(out);
+    out.writeString(mapName);
+    out.writeString(pathName);
+    out.writeString(fColumnName);
+    out.writeString(_fostr);
+    out.writeString(_fcstr);
+    out.writeString(_fomstr);
+    out.writeString(_phistr);
+    out.writeString(_sigfstr);
+    out.writeString(_freeRstr);
+    out.write(mapnumber);
+    out.write((quint8)FreeRSet);
+    out.write((quint8)FOMsValid);
+    out.write((quint8)FosValid);
+    out.write((quint8)FcsValid);
+    out.write((quint8)PhicsValid);
+    out.write((quint8)predictedAsDifferenceMap);
+    out.write(refls_stholmin);
+    out.write(refls_stholmax);
+    out.write(scale);
+    out.write(mapmin);
+    out.write(mapmax);
+    out.writeArray(refls);
+    out.writeArray(map_points);
+}
+
+bool EMapBase::ReadSnapshot(SnapshotSection &in)
+{
+    quint8 freeRSet = 0, fomsValid = 0, fosValid = 0, fcsValid = 0, phicsValid = 0, differenceMap = 0;
+    if (!mapheader->ReadSnapshot(in))
+    {
+        return false;
+    }
+    in.readString(mapName);
+    in.readString(pathName);
+    in.readString(fColumnName);
+    in.readString(_fostr);
+    in.readString(_fcstr);
+    in.readString(_fomstr);
+    in.readString(_phistr);
+    in.readString(_sigfstr);
+    in.readString(_freeRstr);
+    in.read(mapnumber);
+    in.read(freeRSet);
+    in.read(fomsValid);
+    in.read(fosValid);
+    in.read(fcsValid);
+    in.read(phicsValid);
+    in.read(differenceMap);
+    in.read(refls_stholmin);
+    in.read(refls_stholmax);
+    in.read(scale);
+    in.read(mapmin);
+    in.read(mapmax);
+    in.readArray(refls);
+    in.readArray(map_points);
+    if (!in.ok() || map_points.size() != (size_t)mapheader->nx*mapheader->ny*mapheader->nz)
+    {
+        refls.clear();
+        map_points.clear();
+        return false;
+    }
+    FreeRSet = freeRSet != 0;
+    FOMsValid = fomsValid != 0;
+    FosValid = fosValid != 0;
+    FcsValid = fcsValid != 0;
+    PhicsValid = phicsValid != 0;
+    predictedAsDifferenceMap = differenceMap != 0;
+    Logger::debug("Restored %d reflections and %d map points from snapshot", refls.size(), map_points.size());
+    return true;
+}
+
 //DEL int EMapBase::ReadCrystal(const char *file)
 //DEL {
 //DEL /*  moved into ScriptCommand for greater code consistency
@@ -4088,6 +4205,218 @@ float EMapBase::RCorrelation(MIAtomList &atoms)
     return r;
 }
 
+namespace
+{
+    const int KERNEL_SIZE = 11; // ae[1..5], be[1..5], dmax squared
+
+    // The kernels are smeared to the map resolution the same way the
+    // structure factor calculation smears atoms to the grid
+    double SmearB(float resolution)
+    {
+        return std::max(exp(resolution+.1)/2.0, 0.0) + 2.0;
+    }
+
+    void BuildDensityKernels(float resolution, std::vector<float> &kernels)
+    {
+        sfinit();
+        double B = SmearB(resolution);
+        kernels.assign(MAXFTABLE*KERNEL_SIZE, 0.0f);
+        for (int type = 0; type < MAXFTABLE; ++type)
+        {
+            float ae[6], be[6], dmax;
+            float *kernel = &kernels[type*KERNEL_SIZE];
+            gausscoefs(type, 1.0f, B, ae, be, &dmax);
+            for (int k = 1; k <= 5; ++k)
+            {
+                kernel[k-1] = ae[k];
+                kernel[k+4] = be[k];
+            }
+            kernel[10] = dmax*dmax;
+        }
+    }
+}
+
+float EMapBase::ResolutionB()
+{
+    return (float)SmearB(mapheader->resmin > 0.0f ? mapheader->resmin : 2.5f);
+}
+
+void EMapBase::PrepareDensityKernels()
+{
+    float resolution = mapheader->resmin > 0.0f ? mapheader->resmin : 2.5f;
+    if (densityKernelResolution == resolution)
+    {
+        return;
+    }
+    BuildDensityKernels(resolution, densityKernels);
+    densityKernelResolution = resolution;
+}
+
+float EMapBase::LocalCorrelation(const MIAtomList &atoms, const Residue *res, float maskRadius) const
+{
+    CMapHeaderBase *mh = mapheader;
+    int nx = mh->nx;
+    int ny = mh->ny;
+    int nz = mh->nz;
+    if (atoms.empty() || !HasDensity() || (size_t)nx*ny*nz != map_points.size())
+    {
+        return 0.0f;
+    }
+
+    // the prepared kernels if they are for this resolution, otherwise ones
+    // of our own, so that the map is never changed here
+    float resolution = mh->resmin > 0.0f ? mh->resmin : 2.5f;
+    std::vector<float> ownKernels;
+    const std::vector<float> *densityTable = &densityKernels;
+    if (densityKernelResolution != resolution)
+    {
+        BuildDensityKernels(resolution, ownKernels);
+        densityTable = &ownKernels;
+    }
+
+    // Box of grid points around the atoms. A sphere of radius r spans
+    // r times the length of the corresponding row of ctof in each
+    // fractional direction.
+    float reach = maskRadius;
+    MIAtomList placed;
+    std::vector<const float*> kernels;
+    std::vector<float> fxyz;
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        if (!atom_has_density(atoms[i]))
+        {
+            continue;
+        }
+        placed.push_back(atoms[i]);
+        int type = ScattIndex(atoms[i]->name(), res->type().c_str());
+        if (type < 0)
+        {
+            type = 1;
+        }
+        const float *kernel = &(*densityTable)[type*KERNEL_SIZE];
+        kernels.push_back(kernel);
+        reach = std::max(reach, (float)sqrt(kernel[10]));
+        float fx = atoms[i]->x();
+        float fy = atoms[i]->y();
+        float fz = atoms[i]->z();
+        mh->CtoF(&fx, &fy, &fz);
+        fxyz.push_back(fx*nx);
+        fxyz.push_back(fy*ny);
+        fxyz.push_back(fz*nz);
+    }
+    if (placed.empty())
+    {
+        return 0.0f;
+    }
+    float span[3];
+    int n[3] = { nx, ny, nz };
+    for (int d = 0; d < 3; ++d)
+    {
+        span[d] = (float)sqrt(mh->ctof[d][0]*mh->ctof[d][0] + mh->ctof[d][1]*mh->ctof[d][1]
+                              + mh->ctof[d][2]*mh->ctof[d][2])*n[d];
+    }
+    int lo[3], hi[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        float fmin = fxyz[d], fmax = fxyz[d];
+        for (size_t i = 1; i < placed.size(); ++i)
+        {
+            fmin = std::min(fmin, fxyz[3*i+d]);
+            fmax = std::max(fmax, fxyz[3*i+d]);
+        }
+        lo[d] = (int)floor(fmin - reach*span[d]);
+        hi[d] = (int)ceil(fmax + reach*span[d]);
+    }
+    int bx = hi[0] - lo[0] + 1;
+    int by = hi[1] - lo[1] + 1;
+    int bz = hi[2] - lo[2] + 1;
+    std::vector<float> calc(bx*by*bz, 0.0f);
+    std::vector<char> mask(bx*by*bz, 0);
+
+    float mask2 = maskRadius*maskRadius;
+    for (size_t i = 0; i < placed.size(); ++i)
+    {
+        const float *kernel = kernels[i];
+        float occ = placed[i]->occ();
+        float ax = placed[i]->x();
+        float ay = placed[i]->y();
+        float az = placed[i]->z();
+        float r = std::max(maskRadius, (float)sqrt(kernel[10]));
+        float limit = std::max(mask2, kernel[10]);
+        int ilo[3], ihi[3];
+        for (int d = 0; d < 3; ++d)
+        {
+            ilo[d] = (int)floor(fxyz[3*i+d] - r*span[d]) - lo[d];
+            ihi[d] = (int)ceil(fxyz[3*i+d] + r*span[d]) - lo[d];
+        }
+        for (int iz = ilo[2]; iz <= ihi[2]; ++iz)
+        {
+            for (int iy = ilo[1]; iy <= ihi[1]; ++iy)
+            {
+                for (int ix = ilo[0]; ix <= ihi[0]; ++ix)
+                {
+                    float x = (float)(ix + lo[0])/(float)nx;
+                    float y = (float)(iy + lo[1])/(float)ny;
+                    float z = (float)(iz + lo[2])/(float)nz;
+                    mh->FtoC(&x, &y, &z);
+                    float dx = x - ax;
+                    float dy = y - ay;
+                    float dz = z - az;
+                    float d2 = dx*dx + dy*dy + dz*dz;
+                    if (d2 > limit)
+                    {
+                        continue;
+                    }
+                    int j = (iz*by + iy)*bx + ix;
+                    if (d2 <= mask2)
+                    {
+                        mask[j] = 1;
+                    }
+                    if (d2 <= kernel[10])
+                    {
+                        calc[j] += occ*(kernel[0]*exp(-kernel[5]*d2)
+                                        + kernel[1]*exp(-kernel[6]*d2)
+                                        + kernel[2]*exp(-kernel[7]*d2)
+                                        + kernel[3]*exp(-kernel[8]*d2)
+                                        + kernel[4]*exp(-kernel[9]*d2));
+                    }
+                }
+            }
+        }
+    }
+
+    double sumo = 0.0, sumc = 0.0, sumoo = 0.0, sumcc = 0.0, sumoc = 0.0;
+    int npoints = 0;
+    for (int iz = 0; iz < bz; ++iz)
+    {
+        for (int iy = 0; iy < by; ++iy)
+        {
+            for (int ix = 0; ix < bx; ++ix)
+            {
+                int j = (iz*by + iy)*bx + ix;
+                if (!mask[j])
+                {
+                    continue;
+                }
+                double o = map_points[mapdex(ix + lo[0], iy + lo[1], iz + lo[2])];
+                double c = calc[j];
+                sumo += o;
+                sumc += c;
+                sumoo += o*o;
+                sumcc += c*c;
+                sumoc += o*c;
+                npoints++;
+            }
+        }
+    }
+    double denom = ((double)npoints*sumoo - sumo*sumo)*((double)npoints*sumcc - sumc*sumc);
+    if (npoints < 2 || denom <= 0.0)
+    {
+        return 0.0f;
+    }
+    return (float)(((double)npoints*sumoc - sumo*sumc)/sqrt(denom));
+}
+
 #define N 4
 #ifndef M_PI
 #define M_PI 3.1415926535897932384626433832795
@@ -4228,65 +4557,6 @@ void EMapBase::SetCurrentAtoms(MIAtomList *current)
     CurrentAtoms = current;
 }
 
-//typedef int (__cdecl *) (*comparfunc)();
-static int rcompare(const void *i, const void *j)
-{
-    return ((PEAK*)j)->rho - ((PEAK*)i)->rho;
-}
-
-/* the center in integer map coords */
-static int cix, ciy, ciz;
-
-static int dcompare(const void *ii, const void *jj)
-{
-    int djx, djy, djz, dix, diy, diz;
-    PEAK *i = (PEAK*)ii;
-    PEAK *j = (PEAK*)jj;
-    djx = j->ix - cix;
-    djy = j->iy - ciy;
-    djz = j->iz - ciz;
-    dix = i->ix - cix;
-    diy = i->iy - ciy;
-    diz = i->iz - ciz;
-    return ((dix*dix+diy*diy+diz*diz)- (djx*djx+djy*djy+djz*djz));
-}
-
-static void
-fixcell(MINATOM *a)
-{
-    a->tx = a->ty = a->tz = 0.0;
-    while (a->fx < 0.0)
-    {
-        a->fx += 1.0;
-        a->tx += 1.0;
-    }
-    while (a->fx >= 1.0)
-    {
-        a->fx -= 1.0;
-        a->tx -= 1.0;
-    }
-    while (a->fy < 0.0)
-    {
-        a->fy += 1.0;
-        a->ty += 1.0;
-    }
-    while (a->fy >= 1.0)
-    {
-        a->fy -= 1.0;
-        a->ty -= 1.0;
-    }
-    while (a->fz < 0.0)
-    {
-        a->fz += 1.0;
-        a->tz += 1.0;
-    }
-    while (a->fz >= 1.0)
-    {
-        a->fz -= 1.0;
-        a->tz -= 1.0;
-    }
-}
-
 static void PutNearProtein(float fx, float fy, float fz, MINATOM *atoms, int natoms, float *bx, float *by, float *bz, CMapHeaderBase *mh)
 {
     int j, isymm;
@@ -4377,113 +4647,364 @@ static int FarCheck(float cx, float cy, float cz, MINATOM *atoms, int natoms, fl
     return 0;
 }
 
-static int NearCheck(float fx, float fy, float fz, MINATOM *atoms, int natoms, CMapHeaderBase *mh, int add_water, float dmin)
+namespace
 {
-    float dC = 3.0*3.0;
-    float dO = dmin*dmin;
-    float dsquared;
-    float dx, dy, dz;
-    float fdx, fdy, fdz;
-    int j;
-    char type;
-
-    if (add_water == 0)
-    {
-        dC = dO;
-    }
-    while (fx < 0.0)
+    // Comparisons used to order the peaks: waters are placed in the
+    // highest peaks first, fill atoms outwards from the origin of the grid
+    struct PeakHigher
     {
-        fx += 1.0;
-    }
-    while (fx >= 1.0)
-    {
-        fx -= 1.0;
-    }
-    while (fy < 0.0)
-    {
-        fy += 1.0;
-    }
-    while (fy >= 1.0)
-    {
-        fy -= 1.0;
-    }
-    while (fz < 0.0)
+        bool operator()(const PEAK &a, const PEAK &b) const
+        {
+            return a.rho > b.rho;
+        }
+    };
+
+    struct PeakNearerOrigin
     {
-        fz += 1.0;
-    }
-    while (fz >= 1.0)
+        bool operator()(const PEAK &a, const PEAK &b) const
+        {
+            return a.ix*a.ix + a.iy*a.iy + a.iz*a.iz < b.ix*b.ix + b.iy*b.iy + b.iz*b.iz;
+        }
+    };
+
+    // Length along each fractional axis spanned by one Angstrom
+    void FractionalSpan(CMapHeaderBase *mh, float span[3])
     {
-        fz -= 1.0;
+        for (int d = 0; d < 3; ++d)
+        {
+            span[d] = (float)sqrt(mh->ctof[d][0]*mh->ctof[d][0] + mh->ctof[d][1]*mh->ctof[d][1]
+                                  + mh->ctof[d][2]*mh->ctof[d][2]);
+        }
     }
 
-    /* 3.3 Angstroms in fractional units */
-    fdx = 3.3f/mh->a;
-    fdy = 3.3f/mh->b;
-    fdz = 3.3f/mh->c;
-    /* look for an atom nearby */
-    for (j = 0; j < natoms; j++)
+    // Cell list over all the symmetry images of a set of atoms that fall
+    // in the unit cell extended by a margin, so that every atom within
+    // the margin of a point in the unit cell is found without wrapping.
+    // Each image records the symmetry operator and cell translation that
+    // produced it in symm and tx, ty, tz.
+    class SiteIndex
     {
-        dx = fx-atoms[j].fx;
-        dy = fy-atoms[j].fy;
-        dz = fz-atoms[j].fz;
-        /* take care of cell-wrapping */
-        while (dx < -0.5)
+        CMapHeaderBase *mh_;
+        float lo_[3];
+        float hi_[3];
+        float origin_[3];
+        float cellSize_;
+        int dims_[3];
+        std::vector<std::vector<int> > cells_;
+
+    public:
+        std::vector<MINATOM> sites;
+
+        SiteIndex(CMapHeaderBase *mh, float margin, float cellSize)
+            : mh_(mh)
         {
-            dx += 1.0;
+            float span[3];
+            FractionalSpan(mh, span);
+            float cmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+            float cmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (int d = 0; d < 3; ++d)
+            {
+                lo_[d] = -margin*span[d];
+                hi_[d] = 1.0f + margin*span[d];
+            }
+            for (int corner = 0; corner < 8; ++corner)
+            {
+                float x = (corner & 1) ? hi_[0] : lo_[0];
+                float y = (corner & 2) ? hi_[1] : lo_[1];
+                float z = (corner & 4) ? hi_[2] : lo_[2];
+                mh->FtoC(&x, &y, &z);
+                float c[3] = { x, y, z };
+                for (int d = 0; d < 3; ++d)
+                {
+                    cmin[d] = std::min(cmin[d], c[d]);
+                    cmax[d] = std::max(cmax[d], c[d]);
+                }
+            }
+            // Keep the number of cells bounded for very large cells
+            cellSize_ = std::max(cellSize, 1.0f);
+            size_t ncells;
+            do
+            {
+                ncells = 1;
+                for (int d = 0; d < 3; ++d)
+                {
+                    origin_[d] = cmin[d];
+                    dims_[d] = (int)((cmax[d] - cmin[d])/cellSize_) + 1;
+                    ncells *= dims_[d];
+                }
+                if (ncells > 2000000)
+                {
+                    cellSize_ *= 2.0f;
+                }
+            } while (ncells > 2000000);
+            cells_.resize(ncells);
         }
-        while (dx > 0.5)
+
+        // Adds the images of the atom at Cartesian x, y, z
+        void AddImages(float x, float y, float z, char type)
         {
-            dx -= 1.0;
+            float fx = x, fy = y, fz = z;
+            mh_->CtoF(&fx, &fy, &fz);
+            for (int isymm = 0; isymm < mh_->nsym; ++isymm)
+            {
+                float s[3];
+                symm_mh(fx, fy, fz, &s[0], &s[1], &s[2], mh_, isymm);
+                int kmin[3], kmax[3];
+                for (int d = 0; d < 3; ++d)
+                {
+                    kmin[d] = (int)ceil(lo_[d] - s[d]);
+                    kmax[d] = (int)floor(hi_[d] - s[d]);
+                }
+                for (int kx = kmin[0]; kx <= kmax[0]; ++kx)
+                {
+                    for (int ky = kmin[1]; ky <= kmax[1]; ++ky)
+                    {
+                        for (int kz = kmin[2]; kz <= kmax[2]; ++kz)
+                        {
+                            MINATOM site;
+                            site.fx = s[0] + kx;
+                            site.fy = s[1] + ky;
+                            site.fz = s[2] + kz;
+                            site.tx = (float)kx;
+                            site.ty = (float)ky;
+                            site.tz = (float)kz;
+                            site.cx = site.fx;
+                            site.cy = site.fy;
+                            site.cz = site.fz;
+                            mh_->FtoC(&site.cx, &site.cy, &site.cz);
+                            site.type = type;
+                            site.symm = isymm;
+                            cells_[cellOf(site.cx, site.cy, site.cz)].push_back((int)sites.size());
+                            sites.push_back(site);
+                        }
+                    }
+                }
+            }
         }
-        while (dy < -0.5)
+
+        // Indices of the sites within radius of Cartesian x, y, z
+        void Near(float x, float y, float z, float radius, std::vector<int> &found) const
         {
-            dy += 1.0;
+            found.clear();
+            float c[3] = { x, y, z };
+            int lo[3], hi[3];
+            for (int d = 0; d < 3; ++d)
+            {
+                lo[d] = std::max(0, (int)((c[d] - radius - origin_[d])/cellSize_));
+                hi[d] = std::min(dims_[d]-1, (int)((c[d] + radius - origin_[d])/cellSize_));
+            }
+            float r2 = radius*radius;
+            for (int iz = lo[2]; iz <= hi[2]; ++iz)
+            {
+                for (int iy = lo[1]; iy <= hi[1]; ++iy)
+                {
+                    for (int ix = lo[0]; ix <= hi[0]; ++ix)
+                    {
+                        const std::vector<int> &cell = cells_[(iz*dims_[1] + iy)*dims_[0] + ix];
+                        for (size_t k = 0; k < cell.size(); ++k)
+                        {
+                            const MINATOM &site = sites[cell[k]];
+                            float dx = site.cx - x;
+                            float dy = site.cy - y;
+                            float dz = site.cz - z;
+                            if (dx*dx + dy*dy + dz*dz <= r2)
+                            {
+                                found.push_back(cell[k]);
+                            }
+                        }
+                    }
+                }
+            }
         }
-        while (dy > 0.5)
+
+    private:
+        int cellOf(float x, float y, float z) const
         {
-            dy -= 1.0;
+            float c[3] = { x, y, z };
+            int i[3];
+            for (int d = 0; d < 3; ++d)
+            {
+                i[d] = std::max(0, std::min(dims_[d]-1, (int)((c[d] - origin_[d])/cellSize_)));
+            }
+            return (i[2]*dims_[1] + i[1])*dims_[0] + i[0];
+        }
+    };
+
+    // Grid points at or above the minimum level in slabs of constant x,
+    // with one list per slab so the result does not depend on how the
+    // slabs are split between threads. For waters only local maxima are
+    // kept; of equal neighbors the first in search order is the maximum.
+    class PeakFinder
+    {
+    public:
+        const std::vector<float> &map_;
+        int nx_, ny_, nz_;
+        int sx_, sy_, sz_, ey_, ez_;
+        float minlevel_;
+        bool maxima_;
+        std::vector<std::vector<PEAK> > &slabs_;
+
+        PeakFinder(const std::vector<float> &map, int nx, int ny, int nz,
+                   int sx, int sy, int sz, int ey, int ez, float minlevel, bool maxima,
+                   std::vector<std::vector<PEAK> > &slabs)
+            : map_(map),
+              nx_(nx),
+              ny_(ny),
+              nz_(nz),
+              sx_(sx),
+              sy_(sy),
+              sz_(sz),
+              ey_(ey),
+              ez_(ez),
+              minlevel_(minlevel),
+              maxima_(maxima),
+              slabs_(slabs)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            int nx = nx_, ny = ny_, nz = nz_;
+            for (int ix = begin; ix < end; ++ix)
+            {
+                std::vector<PEAK> &peaks = slabs_[ix - sx_];
+                for (int iy = sy_; iy < ey_; ++iy)
+                {
+                    for (int iz = sz_; iz < ez_; ++iz)
+                    {
+                        float rho = map_[mdex(ix, iy, iz, nx, ny, nz)];
+                        if (rho < minlevel_ || (maxima_ && !isMaximum(ix, iy, iz, rho)))
+                        {
+                            continue;
+                        }
+                        PEAK peak;
+                        peak.ix = ix;
+                        peak.iy = iy;
+                        peak.iz = iz;
+                        peak.rho = (int)rho;
+                        peaks.push_back(peak);
+                    }
+                }
+            }
         }
-        while (dz < -0.5)
+
+    private:
+        bool isMaximum(int ix, int iy, int iz, float rho) const
         {
-            dz += 1.0;
+            int nx = nx_, ny = ny_, nz = nz_;
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                for (int dy = -1; dy <= 1; ++dy)
+                {
+                    for (int dz = -1; dz <= 1; ++dz)
+                    {
+                        if (dx == 0 && dy == 0 && dz == 0)
+                        {
+                            continue;
+                        }
+                        float r = map_[mdex(ix+dx, iy+dy, iz+dz, nx, ny, nz)];
+                        bool before = dx < 0 || (dx == 0 && (dy < 0 || (dy == 0 && dz < 0)));
+                        if (r > rho || (r == rho && before))
+                        {
+                            return false;
+                        }
+                    }
+                }
+            }
+            return true;
         }
-        while (dz > 0.5)
+    };
+
+    // Result of checking a peak against the protein
+    struct PeakSite
+    {
+        bool clear;
+        int nearest;
+        float distance2;
+    };
+
+    // Checks each peak in the unit cell against the symmetry images of
+    // the protein: whether it is clear of the atoms and which image is
+    // nearest within the index margin.
+    class PeakSiteChecker
+    {
+    public:
+        const std::vector<PEAK> &peaks_;
+        const SiteIndex &index_;
+        CMapHeaderBase *mh_;
+        bool water_;
+        float dmin_;
+        float radius_;
+        std::vector<PeakSite> &sites_;
+
+        PeakSiteChecker(const std::vector<PEAK> &peaks, const SiteIndex &index, CMapHeaderBase *mh,
+                        bool water, float dmin, float radius, std::vector<PeakSite> &sites)
+            : peaks_(peaks),
+              index_(index),
+              mh_(mh),
+              water_(water),
+              dmin_(dmin),
+              radius_(radius),
+              sites_(sites)
         {
-            dz -= 1.0;
         }
-        if (fabs(dx) < fdx && fabs(dy) < fdy && fabs(dz) < fdz)
+
+        void operator()(int begin, int end)
         {
-            /* within parallelopided - worth
-             * further processing
-             */
-            transform(mh->ftoc, &dx, &dy, &dz);
-            dsquared = dx*dx+dy*dy+dz*dz;
-            type = atoms[j].type;
-            if (type == 'C' || type == 'N' || type == 'O')
+            std::vector<int> found;
+            for (int i = begin; i < end; ++i)
             {
-                if (type == 'C' && dsquared < dC)
-                {
-                    return false;
-                }
-                if (type == 'N' && dsquared < dO)
+                float x, y, z;
+                PeakPosition(peaks_[i], mh_, x, y, z);
+                index_.Near(x, y, z, radius_, found);
+                PeakSite &site = sites_[i];
+                site.clear = true;
+                site.nearest = -1;
+                site.distance2 = FLT_MAX;
+                for (size_t k = 0; k < found.size(); ++k)
                 {
-                    return false;
-                }
-                if (type == 'O' && dsquared < dO)
-                {
-                    return false;
+                    const MINATOM &atom = index_.sites[found[k]];
+                    float dx = atom.cx - x;
+                    float dy = atom.cy - y;
+                    float dz = atom.cz - z;
+                    float d2 = dx*dx + dy*dy + dz*dz;
+                    if (d2 < ClearDistance2(atom.type, water_, dmin_))
+                    {
+                        site.clear = false;
+                        break;
+                    }
+                    if (d2 < site.distance2)
+                    {
+                        site.distance2 = d2;
+                        site.nearest = found[k];
+                    }
                 }
             }
-            else
+        }
+
+        // Cartesian position of the peak moved into the unit cell
+        static void PeakPosition(const PEAK &peak, CMapHeaderBase *mh, float &x, float &y, float &z)
+        {
+            x = (float)peak.ix/(float)mh->nx;
+            y = (float)peak.iy/(float)mh->ny;
+            z = (float)peak.iz/(float)mh->nz;
+            x -= (float)floor(x);
+            y -= (float)floor(y);
+            z -= (float)floor(z);
+            mh->FtoC(&x, &y, &z);
+        }
+
+        // Waters keep 3.0A from carbons and other atoms and dmin from
+        // nitrogens and oxygens; fill atoms keep dmin from everything
+        static float ClearDistance2(char type, bool water, float dmin)
+        {
+            if (!water || type == 'N' || type == 'O')
             {
-                if (dsquared < dC)
-                {
-                    return false;
-                }
+                return dmin*dmin;
             }
+            return 3.0f*3.0f;
         }
-    }
-    return true;
+    };
 }
 
 int EMapBase::HydrateMap(int minlevel, int maxadd, int add_water, MIMoleculeBase *model,
@@ -4493,30 +5014,17 @@ int EMapBase::HydrateMap(int minlevel, int maxadd, int add_water, MIMoleculeBase
     /* add-water controls whether we add waters or fill the map with
      * psuedo-carbon atoms */
     int nadd = 0;
-    int ix, iy, iz;
-    float fx, fy, fz;
-    float cx, cy, cz;
+    int i, j;
     Residue *res;
     Residue *residues = model->residuesBegin();
     CMapHeaderBase *mh = mapheader;
-    //MINATOM * atoms=NULL;
-    MINATOM atom, symatom;
+    int nx = mh->nx;
+    int ny = mh->ny;
+    int nz = mh->nz;
+    MINATOM atom;
     vector<MINATOM> atoms;
-    vector<MINATOM> symatoms;
-    PEAK peak;
-    vector<PEAK> peaks;
-    int i, j, kept = 0;
-    int sx, sy, sz, ex, ey, ez;
-    MIAtom *newatom;
-    /*if(!add_water){
-       dmin = 1.45F;
-       dmax = 50.0F;
-       }*/
-    int imin;
-    std::string buf;
-    float dsquared;
 
-    if (!HasDensity())
+    if (!HasDensity() || (size_t)nx*ny*nz != map_points.size())
     {
         Logger::log("There is no map at position %d\n", mapnumber+1);
         return 0;
@@ -4533,239 +5041,223 @@ int EMapBase::HydrateMap(int minlevel, int maxadd, int add_water, MIMoleculeBase
     {
         Logger::log("FillMap: Minlevel = %d\n", minlevel);
     }
-    /* convert the residue list into a list of minatoms including
-     * all the symmetry mates
-     */
-    unsigned int num_atoms = 0;
+
+    /* Atoms within the margin of a point in the unit cell are found in
+     * the index with all their symmetry images. The margin covers the
+     * clash distances and, for waters, normally the maximum distance from
+     * the protein too; beyond it the nearest atom is searched directly. */
+    float clear = add_water ? std::max(3.0f, dmin) : dmin;
+    float margin = std::max(clear, std::min(dmax, 8.0f));
+    SiteIndex protein(mh, margin, std::max(clear, 3.0f));
+    SiteIndex added(mh, margin, std::max(clear, 3.0f));
     for (res = residues; res != NULL; res = res->next())
     {
         for (j = 0; j < res->atomCount(); j++)
         {
             // ignore Hydrogens
-            if (res->atom(j)->name()[0] == 'H')
+            MIAtom *a = res->atom(j);
+            if (a->name()[0] == 'H')
             {
                 continue;
             }
-            num_atoms++;
+            atom.cx = a->x();
+            atom.cy = a->y();
+            atom.cz = a->z();
+            atom.symm = 0;
+            atom.type = a->name()[0];
+            atoms.push_back(atom);
+            protein.AddImages(a->x(), a->y(), a->z(), atom.type);
         }
     }
-    if (num_atoms == 0)
+    if (atoms.empty())
     {
         Logger::log("There must be at least one non-H atom in model\n");
         return 0;
     }
-    Logger::log("Protein has %d non-H atoms\n", num_atoms);
-    unsigned int num_symatoms = (mh->nsym-1) * (num_atoms+maxadd);
-    try
-    {
-        atoms.reserve(num_atoms+maxadd);
-        symatoms.reserve(num_symatoms);
-    }
-    catch (bad_alloc)
+    Logger::log("Protein has %d non-H atoms\n", (int)atoms.size());
+    Logger::log("Protein has %d atoms in the cell and margin\n", (int)protein.sites.size());
+    Logger::footer("Protein has %d atoms in the cell and margin\n", (int)protein.sites.size());
+
+    int sx = ROUND(xmin * nx);
+    int sy = ROUND(ymin * ny);
+    int sz = ROUND(zmin * nz);
+    int ex = ROUND(xmax * nx);
+    int ey = ROUND(ymax * ny);
+    int ez = ROUND(zmax * nz);
+    Logger::log("Search volume x=%0.2f,%0.2f y=%0.2f,%0.2f z=%0.2f,%0.2f\n", xmin, xmax, ymin, ymax, zmin, zmax);
+    Logger::footer("Search volume x=%0.2f,%0.2f y=%0.2f,%0.2f z=%0.2f,%0.2f\n", xmin, xmax, ymin, ymax, zmin, zmax);
+    if (ex <= sx || ey <= sy || ez <= sz)
     {
-        Logger::log("Not enough memory in HydrateMap");
         return 0;
     }
-    Logger::log("Protein has %d symatoms\n", num_symatoms-maxadd);
-    Logger::footer("Protein has %d symatoms\n", num_symatoms-maxadd);
-    i = 0;
-    for (res = residues; res != NULL; res = res->next())
-    {
-        for (j = 0; j < res->atomCount(); j++)
-        {
-            // ignore Hydrogens
-            if (res->atom(j)->name()[0] == 'H')
-            {
-                continue;
-            }
-            atom.fx = res->atom(j)->x();
-            atom.fy = res->atom(j)->y();
-            atom.fz = res->atom(j)->z();
-            atom.cx = res->atom(j)->x();
-            atom.cy = res->atom(j)->y();
-            atom.cz = res->atom(j)->z();
-            atom.symm = 0;
-            atom.type = res->atom(j)->name()[0];
-            transform(mh->ctof, &atom.fx, &atom.fy, &atom.fz);
-            fixcell(&atom);
-            i++;
-            atoms.push_back(atom);
-        }
-    }
-    for (j = 1; j < mh->nsym; j++)
-    {
-        for (i = 0; (unsigned int)i < atoms.size(); i++)
-        {
-            //jj = (j-1)*natoms+i;
-            fx = atoms[i].cx;
-            fy = atoms[i].cy;
-            fz = atoms[i].cz;
-            transform(mh->ctof, &fx, &fy, &fz);
-            symm_mh(fx, fy, fz,
-                    &symatom.fx, &symatom.fy, &symatom.fz,
-                    mh, j);
-            symatom.cx = symatom.fx;
-            symatom.cy = symatom.fy;
-            symatom.cz = symatom.fz;
-            transform(mh->ftoc, &(symatom.cx), &(symatom.cy), &(symatom.cz));
-            fixcell(&symatom);
-            symatom.symm = j;
-            symatom.type = atoms[i].type;
-            symatoms.push_back(symatom);
-        }
-    }
-    sx = ROUND(xmin * mh->nx);
-    sy = ROUND(ymin * mh->ny);
-    sz = ROUND(zmin * mh->nz);
-    ex = ROUND(xmax * mh->nx);
-    ey = ROUND(ymax * mh->ny);
-    ez = ROUND(zmax * mh->nz);
-    Logger::log("Search volume x=%0.2f,%0.2f y=%0.2f,%0.2f z=%0.2f,%0.2f\n", xmin, xmax, ymin, ymax, zmin, zmax);
-    Logger::footer("Search volume x=%0.2f,%0.2f y=%0.2f,%0.2f z=%0.2f,%0.2f\n", xmin, xmax, ymin, ymax, zmin, zmax);
-    for (ix = sx; ix < ex; ix++)
+    std::vector<std::vector<PEAK> > slabs(ex - sx);
+    PeakFinder finder(map_points, nx, ny, nz, sx, sy, sz, ey, ez, (float)minlevel, add_water != 0, slabs);
+    MIParallelFor(sx, ex, finder, 4);
+    vector<PEAK> peaks;
+    for (i = 0; i < (int)slabs.size(); i++)
     {
-        for (iy = sy; iy < ey; iy++)
-        {
-            for (iz = sz; iz < ez; iz++)
-            {
-                fx = (float)ix/(float)mh->nx;
-                fy = (float)iy/(float)mh->ny;
-                fz = (float)iz/(float)mh->nz;
-                if (avgrho(fx, fy, fz) >= (float)minlevel)
-                {
-                    peak.ix = ix;
-                    peak.iy = iy;
-                    peak.iz = iz;
-                    peak.rho = (int)avgrho(fx, fy, fz);
-                    peaks.push_back(peak);
-                }
-            }
-        }
+        peaks.insert(peaks.end(), slabs[i].begin(), slabs[i].end());
     }
     Logger::log("Peaks before filtering = %d\n", (int)peaks.size());
     Logger::footer("Peaks before filtering = %d\n", (int)peaks.size());
     if (add_water)
     {
-        /* sort the peaks by size */
-        qsort(&peaks[0], peaks.size(), sizeof(PEAK), rcompare);
+        std::stable_sort(peaks.begin(), peaks.end(), PeakHigher());
     }
     else
     {
-        /* sort the peaks by size */
-        qsort(&peaks[0], peaks.size(), sizeof(PEAK), dcompare);
+        std::stable_sort(peaks.begin(), peaks.end(), PeakNearerOrigin());
     }
 
-    /* work our way through the peak list */
-    /* and find the unique peaks */
-    dsquared = dmin * dmin;
-    imin = ROUND(dmin/mh->a*(float)mh->nx);
-    int psize;
-    psize = peaks.size();
-    for (i = 0; i < psize; i++)
+    /* keep the peaks that are not within dmin of a peak kept before them,
+     * looking only in the neighboring buckets of a grid of buckets at
+     * least dmin wide */
+    float span[3];
+    FractionalSpan(mh, span);
+    int bucket[3], nbuckets[3];
+    int n[3] = { nx, ny, nz };
+    int extent[3] = { ex - sx, ey - sy, ez - sz };
+    for (int d = 0; d < 3; ++d)
+    {
+        bucket[d] = std::max(1, (int)ceil(dmin*span[d]*n[d]));
+        nbuckets[d] = extent[d]/bucket[d] + 1;
+    }
+    std::vector<std::vector<int> > buckets((size_t)nbuckets[0]*nbuckets[1]*nbuckets[2]);
+    vector<PEAK> unique;
+    float dsquared = dmin*dmin;
+    for (i = 0; i < (int)peaks.size(); i++)
     {
-        if (peaks[i].rho > 0)
+        int b[3] = { (peaks[i].ix - sx)/bucket[0], (peaks[i].iy - sy)/bucket[1], (peaks[i].iz - sz)/bucket[2] };
+        bool near = false;
+        for (int bx = std::max(0, b[0]-1); bx <= std::min(nbuckets[0]-1, b[0]+1) && !near; ++bx)
         {
-            for (j = 0; j < psize; j++)
+            for (int by = std::max(0, b[1]-1); by <= std::min(nbuckets[1]-1, b[1]+1) && !near; ++by)
             {
-                if (j != i && peaks[j].rho > 0)
+                for (int bz = std::max(0, b[2]-1); bz <= std::min(nbuckets[2]-1, b[2]+1) && !near; ++bz)
                 {
-                    ix = abs(peaks[i].ix-peaks[j].ix);
-                    if (ix <= imin)
+                    const std::vector<int> &list = buckets[((size_t)bz*nbuckets[1] + by)*nbuckets[0] + bx];
+                    for (size_t k = 0; k < list.size(); ++k)
                     {
-                        iy = peaks[i].iy-peaks[j].iy;
-                        iz = peaks[i].iz-peaks[j].iz;
-                        fx = (float)ix/(float)mh->nx;
-                        fy = (float)iy/(float)mh->ny;
-                        fz = (float)iz/(float)mh->nz;
-                        transform(mh->ftoc, &fx, &fy, &fz);
+                        const PEAK &kept = unique[list[k]];
+                        float fx = (float)(peaks[i].ix - kept.ix)/(float)nx;
+                        float fy = (float)(peaks[i].iy - kept.iy)/(float)ny;
+                        float fz = (float)(peaks[i].iz - kept.iz)/(float)nz;
+                        mh->FtoC(&fx, &fy, &fz);
                         if (fx*fx+fy*fy+fz*fz <= dsquared)
                         {
-                            peaks[j].rho = -peaks[j].rho;
+                            near = true;
+                            break;
                         }
                     }
                 }
             }
         }
-    }
-    for (i = 0; (unsigned int)i < peaks.size(); i++)
-    {
-        if (peaks[i].rho > 0)
+        if (!near)
         {
-            kept++;
+            buckets[((size_t)b[2]*nbuckets[1] + b[1])*nbuckets[0] + b[0]].push_back((int)unique.size());
+            unique.push_back(peaks[i]);
         }
     }
-    Logger::log("Kept %d peaks after sorting\n", kept);
-    Logger::footer("Kept %d peaks after sorting\n", kept);
+    Logger::log("Kept %d peaks after sorting\n", (int)unique.size());
+    Logger::footer("Kept %d peaks after sorting\n", (int)unique.size());
 
-    /* evaluate peaks for wateryness */
-    Residue *focusres;
+    /* check the peaks against the protein in parallel; the atoms added
+     * are checked as they are placed */
+    std::vector<PeakSite> sites(unique.size());
+    PeakSiteChecker checker(unique, protein, mh, add_water != 0, dmin, margin, sites);
+    MIParallelFor(0, (int)unique.size(), checker, 64);
 
-    for (i = 0; (unsigned int)i < peaks.size(); i++)
+    std::vector<int> found;
+    for (i = 0; i < (int)unique.size(); i++)
     {
-        if (peaks[i].rho > 0)
+        if (!sites[i].clear)
         {
-            fx = (float)peaks[i].ix/(float)mh->nx;
-            fy = (float)peaks[i].iy/(float)mh->ny;
-            fz = (float)peaks[i].iz/(float)mh->nz;
-            if (NearCheck(fx, fy, fz, &atoms[0], atoms.size(), mh, add_water, dmin))
+            continue;
+        }
+        float x, y, z;
+        PeakSiteChecker::PeakPosition(unique[i], mh, x, y, z);
+        const MINATOM *nearest = sites[i].nearest >= 0 ? &protein.sites[sites[i].nearest] : NULL;
+        float distance2 = sites[i].distance2;
+        added.Near(x, y, z, margin, found);
+        bool clearOfAdded = true;
+        for (size_t k = 0; k < found.size(); ++k)
+        {
+            const MINATOM &other = added.sites[found[k]];
+            float dx = other.cx - x;
+            float dy = other.cy - y;
+            float dz = other.cz - z;
+            float d2 = dx*dx + dy*dy + dz*dz;
+            if (d2 < PeakSiteChecker::ClearDistance2(other.type, add_water != 0, dmin))
             {
-                if (NearCheck(fx, fy, fz, &symatoms[0], symatoms.size(), mh, add_water, dmin))
-                {
-                    PutNearProtein(fx, fy, fz, &atoms[0], atoms.size(), &cx, &cy, &cz, mh);
-                    if (FarCheck(cx, cy, cz, &atoms[0], atoms.size(), dmax))
-                    {
-                        focusres = model->AddWater(cx, cy, cz, false);
-                        if (focusres)
-                        {
-                            if (add_water)
-                            {
-                                Logger::log("Add water %s at %f %f %f\n", focusres->name().c_str(), cx, cy, cz);
-                                Logger::footer("Add water %s at %f %f %f\n", focusres->name().c_str(), cx, cy, cz);
-                            }
-                            /* refine the water position */
-                            //if(add_water) TranslationalSearchNotify(0,0);
-                            /* add to the errorpop list */
-                            newatom = focusres->atom(0);
-                            res = focusres;
-                            nadd++;
-                            /* Must also add to atoms list
-                             * to prevent adding two waters
-                             * on top of each other *
-                             */
-                            atom.fx = newatom->x();
-                            atom.fy = newatom->y();
-                            atom.fz = newatom->z();
-                            atom.cx = newatom->x();
-                            atom.cy = newatom->y();
-                            atom.cz = newatom->z();
-                            atom.symm = 0;
-                            atom.type = 'O';
-                            transform(mh->ctof, &atom.fx, &atom.fy, &atom.fz);
-                            fixcell(&atom);
-                            for (j = 1; j < mh->nsym; j++)
-                            {
-                                symm_mh(atom.fx, atom.fy, atom.fz, &symatom.fx, &symatom.fy, &symatom.fz, mh, j);
-                                symatom.cx = symatom.fx;
-                                symatom.cy = symatom.fy;
-                                symatom.cz = symatom.fz;
-                                transform(mh->ftoc, &(symatom.cx), &(symatom.cy), &(symatom.cz));
-                                fixcell(&symatom);
-                                symatom.symm = j;
-                                symatom.type = atom.type;
-                                symatoms.push_back(symatom);
-                            }
-                            atoms.push_back(atom);
-                            if (nadd >= maxadd)
-                            {
-                                goto cleanup;
-                            }
-                        }
-                    }
-                }
+                clearOfAdded = false;
+                break;
+            }
+            if (d2 < distance2)
+            {
+                distance2 = d2;
+                nearest = &other;
             }
         }
+        if (!clearOfAdded)
+        {
+            continue;
+        }
+
+        /* move the peak to the symmetry position next to the nearest
+         * atom of the model */
+        float cx, cy, cz;
+        if (nearest)
+        {
+            if (distance2 >= dmax*dmax)
+            {
+                continue;
+            }
+            float fx = x, fy = y, fz = z;
+            mh->CtoF(&fx, &fy, &fz);
+            mh->unsymm_mh(fx - nearest->tx, fy - nearest->ty, fz - nearest->tz, &cx, &cy, &cz, nearest->symm);
+            mh->FtoC(&cx, &cy, &cz);
+        }
+        else
+        {
+            if (dmax <= margin)
+            {
+                continue;
+            }
+            float fx = x, fy = y, fz = z;
+            mh->CtoF(&fx, &fy, &fz);
+            PutNearProtein(fx, fy, fz, &atoms[0], atoms.size(), &cx, &cy, &cz, mh);
+            if (!FarCheck(cx, cy, cz, &atoms[0], atoms.size(), dmax))
+            {
+                continue;
+            }
+        }
+
+        Residue *focusres = model->AddWater(cx, cy, cz, false);
+        if (!focusres)
+        {
+            continue;
+        }
+        if (add_water)
+        {
+            Logger::log("Add water %s at %f %f %f\n", focusres->name().c_str(), cx, cy, cz);
+            Logger::footer("Add water %s at %f %f %f\n", focusres->name().c_str(), cx, cy, cz);
+        }
+        nadd++;
+        /* Must also add to the atoms to prevent adding two waters
+         * on top of each other */
+        MIAtom *newatom = focusres->atom(0);
+        atom.cx = newatom->x();
+        atom.cy = newatom->y();
+        atom.cz = newatom->z();
+        atom.symm = 0;
+        atom.type = 'O';
+        atoms.push_back(atom);
+        added.AddImages(newatom->x(), newatom->y(), newatom->z(), 'O');
+        if (nadd >= maxadd)
+        {
+            break;
+        }
     }
-cleanup:
     model->Build();
     if (add_water)
     {
@@ -4796,112 +5288,37 @@ bool EMapBase::CalcSolventMask(float percentSolvent, float radius)
 
 bool EMapBase::SigmaMap()
 {
-    int ix, iy, iz;
     int nx = mapheader->nx;
     int ny = mapheader->ny;
     int nz = mapheader->nz;
-    long nmap = map_points.capacity();
-    if (nmap < 9)
+    if (map_points.size() < 9 || map_points.size() < (size_t)nx*ny*nz)
     {
         return false;
     }
-    float rho, rhosq, sigma;
-    std::vector<float> map2;
-    try
-    {
-        map2.resize(nmap);
-    }
-    catch (...)
-    {
-        return false;
-    }
-    for (ix = 0; ix < nx; ix++)
-    {
-        for (iy = 0; iy < ny; iy++)
-        {
-            for (iz = 0; iz < nz; iz++)
-            {
-                rhosq = 0.0;
-                rho =  map_points[mapdex(ix, iy, iz)];
-                rhosq += rho*rho;
-                rho =  map_points[mapdex(ix+1, iy, iz)];
-                rhosq += rho*rho;
-                rho =  map_points[mapdex(ix-1, iy, iz)];
-                rhosq += rho*rho;
-                rho =  map_points[mapdex(ix, iy+1, iz)];
-                rhosq += rho*rho;
-                rho =  map_points[mapdex(ix, iy-1, iz)];
-                rhosq += rho*rho;
-                rho =  map_points[mapdex(ix, iy, iz+1)];
-                rhosq += rho*rho;
-                rho =  map_points[mapdex(ix, iy, iz-1)];
-                rhosq += rho*rho;
-
-                sigma = sqrt((rhosq-rhosq/7.0f)/6.0f);
-
-                map2[mapdex(ix, iy, iz)] = sigma;
-            }
-        }
-    }
-    copy(map2.begin(), map2.end(), map_points.begin());
-    return true;
+    // Local rms density over each point and its six face neighbours
+    MapFilter filter(&map_points[0], nx, ny, nz);
+    return filter.LocalCrossRms();
 }
 
 bool EMapBase::SmoothMap(float radius)
 {
-    int i, ix, iy, iz;
-    float sum = 0.0;
     int nx = mapheader->nx;
     int ny = mapheader->ny;
     int nz = mapheader->nz;
-    long nmap = map_points.capacity();
-    if (nmap < 9)
-    {
-        return false;
-    }
-    std::vector<float> map2;
-    try
-    {
-        map2.resize(nmap);
-    }
-    catch (...)
+    if (map_points.size() < 9 || map_points.size() < (size_t)nx*ny*nz)
     {
         return false;
     }
     int ntimes = ROUND(radius/(mapheader->a/(float)mapheader->nx));
-    for (i = 0; i < ntimes; i++)
+    if (ntimes <= 0)
     {
-        for (ix = 0; ix < nx; ix++)
-        {
-            for (iy = 0; iy < ny; iy++)
-            {
-                for (iz = 0; iz < nz; iz++)
-                {
-                    sum =    2.0F*map_points[mapdex(ix-1, iy, iz)]
-                          +2.0F*map_points[mapdex(ix+1, iy, iz)]
-                          +2.0F*map_points[mapdex(ix, iy-1, iz)]
-                          +2.0F*map_points[mapdex(ix, iy+1, iz)]
-                          +2.0F*map_points[mapdex(ix, iy, iz-1)]
-                          +2.0F*map_points[mapdex(ix, iy, iz+1)]
-                          +map_points[mapdex(ix+1, iy+1, iz)]
-                          +map_points[mapdex(ix-1, iy+1, iz)]
-                          +map_points[mapdex(ix+1, iy-1, iz)]
-                          +map_points[mapdex(ix-1, iy-1, iz)]
-                          +map_points[mapdex(ix+1, iy, iz+1)]
-                          +map_points[mapdex(ix-1, iy, iz+1)]
-                          +map_points[mapdex(ix+1, iy, iz-1)]
-                          +map_points[mapdex(ix-1, iy, iz-1)]
-                          +map_points[mapdex(ix, iy+1, iz+1)]
-                          +map_points[mapdex(ix, iy-1, iz+1)]
-                          +map_points[mapdex(ix, iy+1, iz-1)]
-                          +map_points[mapdex(ix, iy-1, iz-1)]
-                          +6.0F*map_points[mapdex(ix, iy, iz)] ;
-                    map2[mapdex(ix, iy, iz)] = sum/30.0f;
-                }
-            }
-        }
-        copy(map2.begin(), map2.end(), map_points.begin());
+        return true;
     }
+    // The Gaussian has the spread of ntimes passes of the 19 point
+    // stencil used before, whose variance along each axis is 0.4 points
+    float sigma = sqrt(0.4f*ntimes);
+    MapFilter filter(&map_points[0], nx, ny, nz);
+    filter.Gaussian(sigma, sigma, sigma);
     return true;
 }
 
@@ -4911,21 +5328,14 @@ bool EMapBase::ScaleSolventPercent(float percentSolvent)
     {
         return false;
     }
-    unsigned int nmap = map_points.capacity();
-    std::vector<float> map2;
-    try
-    {
-        map2.resize(nmap);
-    }
-    catch (...)
+    size_t nmap = map_points.size();
+    if (nmap == 0)
     {
         return false;
     }
-    copy(map_points.begin(), map_points.end(), map2.begin());
-    sort(map2.begin(), map2.end());
-    float s0 = map2[(unsigned int)((float)nmap*percentSolvent)];
-    float map_max = map2[nmap-1];
-    float map_min = map2[0];
+    float s0 = MapFilter::Percentile(&map_points[0], nmap, percentSolvent);
+    float map_max = *std::max_element(map_points.begin(), map_points.end());
+    float map_min = *std::min_element(map_points.begin(), map_points.end());
     float solv_add = 0 - s0;
     float solv_scale;
     if ((s0-map_min) != 0)
@@ -4947,7 +5357,7 @@ bool EMapBase::ScaleSolventPercent(float percentSolvent)
         prot_scale = 1.0F;
     }
     mapmin = mapmax = map_points[0];
-    for (unsigned int i = 0; i < nmap; i++)
+    for (size_t i = 0; i < nmap; i++)
     {
         if (map_points[i] < s0)
         {
@@ -5058,14 +5468,12 @@ bool EMapBase::IsRefFile(const char *pathname)
 
 void EMapBase::RecalcResolution()
 {
-    sthol(1, 1, 1, mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma, 1);
+    ReciprocalCell cell(mapheader->a, mapheader->b, mapheader->c, mapheader->alpha, mapheader->beta, mapheader->gamma);
     refls_stholmax = -1.0F;
     refls_stholmin = 999999.0F;
     for (unsigned int i = 0; i < refls.size(); i++)
     {
-        refls[i].sthol = sthol(refls[i].ind[0], refls[i].ind[1], refls[i].ind[2],
-                               mapheader->a, mapheader->b, mapheader->c,
-                               mapheader->alpha, mapheader->beta, mapheader->gamma, 0);
+        refls[i].sthol = cell.sthol(refls[i].ind[0], refls[i].ind[1], refls[i].ind[2]);
         if (refls[i].sthol > refls_stholmax)
         {
             refls_stholmax = refls[i].sthol;
@@ -5124,7 +5532,7 @@ float EMapBase::CorrScore(MIAtomList atoms)
     float fofcsum = 0.0;
     float fosum = 0.0, fcsum = 0.0;
     float fofosum = 0.0, fcfcsum = 0.0;
-    //float Bscale;
+    double Bscale;
 
     MIAtom *a;
     int n = 0;
@@ -5132,7 +5540,7 @@ float EMapBase::CorrScore(MIAtomList atoms)
     res.setType("ALA");
     sfinit();
 
-    Bscale = std::max(exp(mh->resmin+.1)/2.0, 0.0) + 2.0;
+    Bscale = ModelBscale(mh);
 
     /* first figure out the size of the map given the cell
      * and the resolution desired
@@ -5152,12 +5560,12 @@ float EMapBase::CorrScore(MIAtomList atoms)
     for (unsigned int i = 0; i < atoms.size(); i++)
     {
         a = atoms[i];
-        addrho(a, rho, nx, ny, nz, mh, &res);
+        addrho(a, rho, nx, ny, nz, mh, &res, Bscale);
     }
 
     //if((rho = buildrho(res, mh, wait))==NULL)
     //  return(0);
-    InvertMap(rho, mh, refls);
+    InvertMap(rho, mh, refls, Bscale);
     free((void*)rho);
     //sc = ComputeScale( refls, mh);
     //ApplyScale(refls, sc, mh);
@@ -5187,6 +5595,264 @@ float EMapBase::CorrScore(MIAtomList atoms)
     return (corr);
 }
 
+namespace
+{
+    // Density coefficients of one search model atom from rhocoefs, which
+    // depend only on the atom and the grid and so are shared by every
+    // rotation.
+    struct SearchAtom
+    {
+        float x, y, z;
+        float ae[6], be[6], boxrad[3];
+        float dmax;
+    };
+
+    // An observed structure factor expanded to one point of the P1 grid.
+    // scale undoes the Bscale blurring of the model density.
+    struct SearchCoef
+    {
+        int index;
+        float re, im;
+        float scale;
+    };
+
+    bool MRSolutionCompare(const MRSolution &s1, const MRSolution &s2)
+    {
+        return s1.score > s2.score;
+    }
+
+    void EulerMatrix(float alpha, float beta, float gamma, float mat[3][3])
+    {
+        double ca = cos(alpha*DEG2RAD), sa = sin(alpha*DEG2RAD);
+        double cb = cos(beta*DEG2RAD), sb = sin(beta*DEG2RAD);
+        double cg = cos(gamma*DEG2RAD), sg = sin(gamma*DEG2RAD);
+        mat[0][0] = (float)(ca*cb*cg - sa*sg);
+        mat[0][1] = (float)(-ca*cb*sg - sa*cg);
+        mat[0][2] = (float)(ca*sb);
+        mat[1][0] = (float)(sa*cb*cg + ca*sg);
+        mat[1][1] = (float)(-sa*cb*sg + ca*cg);
+        mat[1][2] = (float)(sa*sb);
+        mat[2][0] = (float)(-sb*cg);
+        mat[2][1] = (float)(sb*sg);
+        mat[2][2] = (float)cb;
+    }
+
+    // For each rotation: builds the P1 density of the rotated model,
+    // transforms it, multiplies by the observed structure factors and
+    // transforms back to get the translation function, whose highest point
+    // is the placement for that rotation.
+    class TranslationSearcher
+    {
+        const std::vector<SearchAtom> &atoms_;
+        const std::vector<SearchCoef> &coefs_;
+        const CMapHeaderBase &p1_;
+        double obsNorm_;
+        std::vector<MRSolution> &solutions_;
+
+    public:
+        TranslationSearcher(const std::vector<SearchAtom> &atoms, const std::vector<SearchCoef> &coefs,
+                            const CMapHeaderBase &p1, double obsNorm, std::vector<MRSolution> &solutions)
+            : atoms_(atoms),
+              coefs_(coefs),
+              p1_(p1),
+              obsNorm_(obsNorm),
+              solutions_(solutions)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            int nx = p1_.nx;
+            int ny = p1_.ny;
+            int nz = p1_.nz;
+            micomplex zero;
+            zero.r = 0.0f;
+            zero.i = 0.0f;
+            std::vector<micomplex> rho(nx*ny*nz);
+            std::vector<micomplex> tf(nx*ny*nz);
+            for (int r = begin; r < end; ++r)
+            {
+                MRSolution &solution = solutions_[r];
+                const float (*mat)[3] = solution.rotation;
+                std::fill(rho.begin(), rho.end(), zero);
+                for (size_t i = 0; i < atoms_.size(); ++i)
+                {
+                    const SearchAtom &a = atoms_[i];
+                    float x = a.x*mat[0][0] + a.y*mat[0][1] + a.z*mat[0][2];
+                    float y = a.x*mat[1][0] + a.y*mat[1][1] + a.z*mat[1][2];
+                    float z = a.x*mat[2][0] + a.y*mat[2][1] + a.z*mat[2][2];
+                    addrhoat(a.ae, a.be, a.boxrad, a.dmax, x, y, z, &rho[0], nx, ny, nz, &p1_);
+                }
+                TransformGrid(&rho[0], nx, ny, nz);
+
+                // The transform gives the conjugate of the model structure
+                // factors, so the product is the correlation coefficient
+                std::fill(tf.begin(), tf.end(), zero);
+                double calcNorm = 0.0;
+                for (size_t i = 0; i < coefs_.size(); ++i)
+                {
+                    const SearchCoef &c = coefs_[i];
+                    float gr = rho[c.index].r*c.scale;
+                    float gi = rho[c.index].i*c.scale;
+                    tf[c.index].r = c.re*gr - c.im*gi;
+                    tf[c.index].i = c.re*gi + c.im*gr;
+                    calcNorm += (double)gr*gr + (double)gi*gi;
+                }
+                TransformGrid(&tf[0], nx, ny, nz);
+
+                int best = 0;
+                for (int i = 1; i < nx*ny*nz; ++i)
+                {
+                    if (tf[i].r > tf[best].r)
+                    {
+                        best = i;
+                    }
+                }
+                solution.translation[0] = (float)(best%nx)/(float)nx;
+                solution.translation[1] = (float)((best/nx)%ny)/(float)ny;
+                solution.translation[2] = (float)(best/(nx*ny))/(float)nz;
+                solution.score = calcNorm > 0.0 ? (float)(tf[best].r/sqrt(obsNorm_*calcNorm)) : 0.0f;
+            }
+        }
+    };
+}
+
+std::vector<MRSolution> EMapBase::TranslationSearch(const MIAtomList &atoms, float step, int nsolutions)
+{
+    std::vector<MRSolution> solutions;
+    CMapHeaderBase *mh = mapheader;
+    int nx = mh->nx;
+    int ny = mh->ny;
+    int nz = mh->nz;
+    if (atoms.empty() || refls.empty() || nx <= 0 || ny <= 0 || nz <= 0 || step <= 0.0f || nsolutions <= 0)
+    {
+        return solutions;
+    }
+
+    sfinit();
+    double Bscale = ModelBscale(mh);
+
+    // The model density is built in P1; the observed structure factors
+    // are expanded to the whole sphere instead
+    CMapHeaderBase p1(*mh);
+    p1.nsym = 1;
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            p1.symops[i][j][0] = (i == j) ? 1.0f : 0.0f;
+        }
+    }
+
+    Residue res;
+    res.setType("ALA");
+    std::vector<SearchAtom> searchAtoms;
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        if (!atom_has_density(atoms[i]))
+        {
+            continue;
+        }
+        SearchAtom a;
+        a.x = atoms[i]->x();
+        a.y = atoms[i]->y();
+        a.z = atoms[i]->z();
+        rhocoefs(atoms[i], &res, nx, ny, nz, &p1, Bscale, a.ae, a.be, a.boxrad, &a.dmax);
+        searchAtoms.push_back(a);
+    }
+
+    // F(hS) = F(h) exp(-2 pi i h.T) for each symmetry operator x' = Sx + T,
+    // and F(-h) is the conjugate of F(h)
+    std::vector<SearchCoef> coefs;
+    std::vector<char> used(nx*ny*nz, 0);
+    double obsNorm = 0.0;
+    for (size_t i = 0; i < refls.size(); ++i)
+    {
+        const CREFL &refl = refls[i];
+        if (refl.fo <= 0.0f
+            || refl.sthol > 0.5/mh->resmin
+            || refl.sthol < 0.5/mh->resmax)
+        {
+            continue;
+        }
+        float fobs = FOMsValid ? refl.fo*refl.fom : refl.fo;
+        float scale = (float)exp(Bscale*refl.sthol*refl.sthol);
+        for (int is = 0; is < mh->nsym; ++is)
+        {
+            int k[3];
+            double shift = 0.0;
+            for (int c = 0; c < 3; ++c)
+            {
+                k[c] = ROUND(refl.ind[0]*mh->symops[0][c][is]
+                             + refl.ind[1]*mh->symops[1][c][is]
+                             + refl.ind[2]*mh->symops[2][c][is]);
+                shift += refl.ind[c]*mh->symops[c][3][is];
+            }
+            if (2*abs(k[0]) >= nx || 2*abs(k[1]) >= ny || 2*abs(k[2]) >= nz)
+            {
+                continue;
+            }
+            double phase = refl.phi*DEG2RAD - 2.0*PI*shift;
+            for (int friedel = 0; friedel < 2; ++friedel)
+            {
+                int sign = friedel ? -1 : 1;
+                int index = mdex(sign*k[0], sign*k[1], sign*k[2], nx, ny, nz);
+                if (used[index])
+                {
+                    continue;
+                }
+                used[index] = 1;
+                SearchCoef coef;
+                coef.index = index;
+                coef.re = (float)(fobs*cos(phase));
+                coef.im = (float)(sign*fobs*sin(phase));
+                coef.scale = scale;
+                coefs.push_back(coef);
+                obsNorm += (double)fobs*fobs;
+            }
+        }
+    }
+    if (searchAtoms.empty() || coefs.empty())
+    {
+        return solutions;
+    }
+
+    // Sample beta evenly and alpha in proportion to sin(beta) so that the
+    // rotations are spread roughly uniformly
+    std::vector<MRSolution> rotations;
+    int nbeta = (int)ceil(180.0/step);
+    int ngamma = (int)ceil(360.0/step);
+    for (int ib = 0; ib <= nbeta; ++ib)
+    {
+        float beta = 180.0f*(float)ib/(float)nbeta;
+        int nalpha = std::max(1, (int)ceil(360.0*sin(beta*DEG2RAD)/step));
+        for (int ia = 0; ia < nalpha; ++ia)
+        {
+            for (int ig = 0; ig < ngamma; ++ig)
+            {
+                MRSolution r;
+                r.euler[0] = 360.0f*(float)ia/(float)nalpha;
+                r.euler[1] = beta;
+                r.euler[2] = 360.0f*(float)ig/(float)ngamma;
+                EulerMatrix(r.euler[0], r.euler[1], r.euler[2], r.rotation);
+                r.translation[0] = r.translation[1] = r.translation[2] = 0.0f;
+                r.score = 0.0f;
+                rotations.push_back(r);
+            }
+        }
+    }
+    Logger::log("Translation search: %d rotations, %d atoms, %d structure factors on a %d x %d x %d grid",
+                (int)rotations.size(), (int)searchAtoms.size(), (int)coefs.size(), nx, ny, nz);
+
+    TranslationSearcher searcher(searchAtoms, coefs, p1, obsNorm, rotations);
+    MIParallelFor(0, (int)rotations.size(), searcher);
+
+    size_t n = std::min((size_t)nsolutions, rotations.size());
+    std::partial_sort(rotations.begin(), rotations.begin() + n, rotations.end(), MRSolutionCompare);
+    solutions.assign(rotations.begin(), rotations.begin() + n);
+    return solutions;
+}
+
 long EMapBase::Reindex(int index_mat[][3])
 {
     long nindex = 0;
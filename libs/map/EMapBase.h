@@ -10,6 +10,7 @@
 #include "CMapHeaderBase.h"
 #include "MapSettingsBase.h"
 #include "CREFL.h"
+#include "MRSolution.h"
 #include "maptypes.h"
 
 namespace chemlib
@@ -18,6 +19,9 @@ namespace chemlib
     class MIAtom;
 }
 
+class SnapshotWriter;
+class SnapshotSection;
+
 //@{
 // Contouring types for the contour map function.
 //@}
@@ -61,6 +65,12 @@ protected:
     int sfFFT(chemlib::Residue *res, float &scale);
 
     std::vector<float> map_points;
+    //@{
+    // Gaussian coefficients of each scattering type used by
+    // LocalCorrelation, built for the resolution densityKernelResolution.
+    //@}
+    std::vector<float> densityKernels;
+    float densityKernelResolution;
     std::vector<float> section;
     std::vector<MAP_POINT> PList;
     float RList[5][10];
@@ -215,7 +225,7 @@ public:
     //@{
     // returns the index of a map point given the 3-space coordinates
     //@}
-    int mapdex(int ix, int iy, int iz)
+    int mapdex(int ix, int iy, int iz) const
     {
         return (mapheader->nx*(mapheader->ny*((iz+64*mapheader->nz)%mapheader->nz)
                                +(iy+64*mapheader->ny)%mapheader->ny)+(ix+64*mapheader->nx)%mapheader->nx);
@@ -233,6 +243,16 @@ public:
 
     long Reindex(int index_mat[3][3]);
     float CorrScore(std::vector<chemlib::MIAtom*> atoms);
+
+    //@{
+    // Phased molecular replacement search. Rotations of the atoms are
+    // sampled every step degrees and for each one the translation function,
+    // the correlation of the model density with the map at every shift on
+    // the map header's grid, is computed with one FFT. Rotations are
+    // spread across threads. Returns up to nsolutions placements, best
+    // first, from the resolution range of the map header.
+    //@}
+    std::vector<MRSolution> TranslationSearch(const std::vector<chemlib::MIAtom*> &atoms, float step, int nsolutions);
     float RFactor;
     const std::vector<CREFL>&GetRefls()
     {
@@ -323,6 +343,28 @@ public:
     //@}
     float RCorrelation(std::vector<chemlib::MIAtom*> &atoms);
     //@{
+    // Real-space correlation coefficient of the atoms with the map over the
+    // grid points within maskRadius of an atom. The atoms are typed as
+    // atoms of res, as the structure factor calculation types them. The
+    // model density is built only in a box around the atoms from
+    // per-element Gaussian kernels at the map resolution. Nothing is
+    // changed, so it is cheap enough to call for every trial of an
+    // optimizer and may be called from several threads at once.
+    //@}
+    float LocalCorrelation(const std::vector<chemlib::MIAtom*> &atoms, const chemlib::Residue *res,
+                           float maskRadius = 2.0f) const;
+    //@{
+    // Builds the kernels used by LocalCorrelation for the current
+    // resolution. Without them LocalCorrelation builds its own on every
+    // call, so call this after the map is made and before scoring many
+    // fits. Not to be called while LocalCorrelation runs on another thread.
+    //@}
+    void PrepareDensityKernels();
+    //@{
+    // B-factor by which atoms are smeared to the map resolution.
+    //@}
+    float ResolutionB();
+    //@{
     // the center of the map in x, y, z Cartesian coords.
     //@}
     float map_center[3];
@@ -340,6 +382,16 @@ public:
     //@}
     int Read(const char *file);
     //@{
+    // Write the reflections, computed map grid and header to a binary
+    // session snapshot.
+    //@}
+    void WriteSnapshot(SnapshotWriter &out) const;
+    //@{
+    // Restore the state written by WriteSnapshot. This replaces loading
+    // the phase file and FFT'ing it; the map still needs contouring.
+    //@}
+    bool ReadSnapshot(SnapshotSection &in);
+    //@{
     // Read a crystal from a file.
     // @param the name of the file.
     //@}
@@ -569,6 +621,22 @@ public:
     //@}
     int NCRAverage(int ix, int iy, int iz);
     //@{
+    // Average the density over the non-crystallographic copies into
+    // averaged, leaving this map unchanged. The mask is the grid points
+    // within maskRadius of maskAtoms, the reference copy; each point of
+    // the other copies is taken back into the mask by the operator that
+    // places it there and set to the average over all copies. Points in
+    // no copy keep their value. With no atoms every point is averaged.
+    //@}
+    bool NCSAverage(EMapBase *averaged, const std::vector<chemlib::MIAtom*> &maskAtoms, float maskRadius = 2.5f);
+    //@{
+    // Refine the non-crystallographic operators by small rotations and
+    // shifts to maximize the correlation of the density in the mask of
+    // maskAtoms with that at its images. Returns the number of operators
+    // changed.
+    //@}
+    int RefineNCSOperators(const std::vector<chemlib::MIAtom*> &maskAtoms, float maskRadius = 2.5f);
+    //@{
     // calculate a line segment of the chicken-wire map.
     //@}
     int segment(double *x1, double *y1, double *x2, double *y2, int i, int j,
@@ -589,10 +657,25 @@ public:
         return (refls.size() > 0);
     }
 
+    //@{
+    // The map grid of mapheader->nx*ny*nz points, x fastest. NULL if there
+    // is no map; invalidated when the map is recalculated or reloaded, so
+    // copy rather than keep it.
+    //@}
+    float *MapPoints()
+    {
+        return map_points.empty() ? NULL : &map_points[0];
+    }
+
+    size_t MapPointCount() const
+    {
+        return map_points.size();
+    }
+
     //@{
     // return true if the map has density points.
     //@}
-    bool HasDensity()
+    bool HasDensity() const
     {
         return map_points.size() > 8;
     }
@@ -0,0 +1,24 @@
+#ifndef mifit_map_MRSolution_h
+#define mifit_map_MRSolution_h
+
+//@{
+// A placement of a molecular replacement search model found by
+// EMapBase::TranslationSearch. The model coordinates are rotated about the
+// origin by rotation (x' = rotation * x) and then shifted by the
+// fractional translation.
+//@}
+struct MRSolution
+{
+    //@{
+    // Rotation as z-y-z Euler angles alpha, beta, gamma in degrees
+    //@}
+    float euler[3];
+    float rotation[3][3];
+    float translation[3];
+    //@{
+    // Correlation of the placed model density with the map, from -1 to 1
+    //@}
+    float score;
+};
+
+#endif // ifndef mifit_map_MRSolution_h
@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <cmath>
+
+#include <util/parallel.h>
+
+#include "MapFilter.h"
+
+namespace
+{
+    inline int Wrap(int i, int n)
+    {
+        i %= n;
+        return i < 0 ? i + n : i;
+    }
+
+    std::vector<float> GaussianKernel(float sigma)
+    {
+        int radius = (int)ceil(3.0f*sigma);
+        std::vector<float> kernel(2*radius + 1);
+        float sum = 0.0f;
+        for (int k = -radius; k <= radius; ++k)
+        {
+            kernel[k + radius] = exp(-(float)(k*k)/(2.0f*sigma*sigma));
+            sum += kernel[k + radius];
+        }
+        for (size_t k = 0; k < kernel.size(); ++k)
+        {
+            kernel[k] /= sum;
+        }
+        return kernel;
+    }
+
+    // Filters rows along x, planes along y or xz-slabs along z. For y and
+    // z a whole row is accumulated from the shifted source rows so that
+    // the inner loop runs along x through contiguous memory.
+    class AxisConvolver
+    {
+        float *points_;
+        int nx_, ny_, nz_;
+        int axis_;
+        const std::vector<float> &kernel_;
+        int radius_;
+
+        void Rows(int begin, int end)
+        {
+            std::vector<float> line(nx_ + 2*radius_);
+            for (int iz = begin; iz < end; ++iz)
+            {
+                for (int iy = 0; iy < ny_; ++iy)
+                {
+                    float *row = points_ + (size_t)nx_*(ny_*iz + iy);
+                    for (int i = 0; i < (int)line.size(); ++i)
+                    {
+                        line[i] = row[Wrap(i - radius_, nx_)];
+                    }
+                    for (int ix = 0; ix < nx_; ++ix)
+                    {
+                        float sum = 0.0f;
+                        for (int k = 0; k <= 2*radius_; ++k)
+                        {
+                            sum += kernel_[k]*line[ix + k];
+                        }
+                        row[ix] = sum;
+                    }
+                }
+            }
+        }
+
+        // Convolves the n rows of nx_ points starting at first, step
+        // apart, using scratch for a copy of them
+        void Lines(float *first, size_t step, int n, std::vector<float> &scratch)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                std::copy(first + step*i, first + step*i + nx_, scratch.begin() + (size_t)nx_*i);
+            }
+            for (int i = 0; i < n; ++i)
+            {
+                float *out = first + step*i;
+                std::fill(out, out + nx_, 0.0f);
+                for (int k = 0; k <= 2*radius_; ++k)
+                {
+                    const float *in = &scratch[(size_t)nx_*Wrap(i + k - radius_, n)];
+                    float w = kernel_[k];
+                    for (int ix = 0; ix < nx_; ++ix)
+                    {
+                        out[ix] += w*in[ix];
+                    }
+                }
+            }
+        }
+
+    public:
+        AxisConvolver(float *points, int nx, int ny, int nz, int axis, const std::vector<float> &kernel)
+            : points_(points),
+              nx_(nx),
+              ny_(ny),
+              nz_(nz),
+              axis_(axis),
+              kernel_(kernel),
+              radius_((int)kernel.size()/2)
+        {
+        }
+
+        // Range over z for the x and y axes and over y for z
+        void operator()(int begin, int end)
+        {
+            if (axis_ == 0)
+            {
+                Rows(begin, end);
+            }
+            else if (axis_ == 1)
+            {
+                std::vector<float> plane((size_t)nx_*ny_);
+                for (int iz = begin; iz < end; ++iz)
+                {
+                    Lines(points_ + (size_t)nx_*ny_*iz, nx_, ny_, plane);
+                }
+            }
+            else
+            {
+                std::vector<float> slab((size_t)nx_*nz_);
+                for (int iy = begin; iy < end; ++iy)
+                {
+                    Lines(points_ + (size_t)nx_*iy, (size_t)nx_*ny_, nz_, slab);
+                }
+            }
+        }
+    };
+
+    // The rms over the point and its six face neighbours of each point in
+    // a range of z sections, read from a copy of the squared map. The
+    // neighbours along y and z are whole rows, so the inner loop runs
+    // along x through contiguous memory.
+    class CrossRms
+    {
+        float *points_;
+        const float *squares_;
+        int nx_, ny_, nz_;
+
+    public:
+        CrossRms(float *points, const float *squares, int nx, int ny, int nz)
+            : points_(points),
+              squares_(squares),
+              nx_(nx),
+              ny_(ny),
+              nz_(nz)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            for (int iz = begin; iz < end; ++iz)
+            {
+                for (int iy = 0; iy < ny_; ++iy)
+                {
+                    size_t row = (size_t)nx_*(ny_*iz + iy);
+                    const float *c = squares_ + row;
+                    const float *yp = squares_ + (size_t)nx_*(ny_*iz + Wrap(iy + 1, ny_));
+                    const float *ym = squares_ + (size_t)nx_*(ny_*iz + Wrap(iy - 1, ny_));
+                    const float *zp = squares_ + (size_t)nx_*(ny_*Wrap(iz + 1, nz_) + iy);
+                    const float *zm = squares_ + (size_t)nx_*(ny_*Wrap(iz - 1, nz_) + iy);
+                    float *out = points_ + row;
+                    for (int ix = 0; ix < nx_; ++ix)
+                    {
+                        // summed in the order of the original stencil
+                        float rhosq = c[ix];
+                        rhosq += c[ix + 1 < nx_ ? ix + 1 : 0];
+                        rhosq += c[ix > 0 ? ix - 1 : nx_ - 1];
+                        rhosq += yp[ix];
+                        rhosq += ym[ix];
+                        rhosq += zp[ix];
+                        rhosq += zm[ix];
+                        out[ix] = sqrt((rhosq - rhosq/7.0f)/6.0f);
+                    }
+                }
+            }
+        }
+    };
+
+    const int PercentileBins = 4096;
+
+    inline int PercentileBin(float value, float lo, float scale)
+    {
+        return std::min(PercentileBins - 1, (int)((value - lo)*scale));
+    }
+}
+
+MapFilter::MapFilter(float *points, int nx, int ny, int nz)
+    : points_(points),
+      nx_(nx),
+      ny_(ny),
+      nz_(nz)
+{
+}
+
+void MapFilter::Convolve(int axis, const std::vector<float> &kernel)
+{
+    if (kernel.size() < 2 || nx_ < 1 || ny_ < 1 || nz_ < 1)
+    {
+        return;
+    }
+    AxisConvolver convolver(points_, nx_, ny_, nz_, axis, kernel);
+    MIParallelFor(0, axis == 2 ? ny_ : nz_, convolver, 2);
+}
+
+void MapFilter::Gaussian(float sigmaX, float sigmaY, float sigmaZ)
+{
+    float sigma[3] = { sigmaX, sigmaY, sigmaZ };
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (sigma[axis] > 0.0f)
+        {
+            Convolve(axis, GaussianKernel(sigma[axis]));
+        }
+    }
+}
+
+void MapFilter::Box(int halfX, int halfY, int halfZ)
+{
+    int half[3] = { halfX, halfY, halfZ };
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (half[axis] > 0)
+        {
+            std::vector<float> kernel(2*half[axis] + 1, 1.0f/(2*half[axis] + 1));
+            Convolve(axis, kernel);
+        }
+    }
+}
+
+bool MapFilter::LocalDeviation(int halfWidth, bool aboutMean)
+{
+    size_t n = (size_t)nx_*ny_*nz_;
+    std::vector<float> mean;
+    if (aboutMean)
+    {
+        try
+        {
+            mean.assign(points_, points_ + n);
+        }
+        catch (...)
+        {
+            return false;
+        }
+        MapFilter(&mean[0], nx_, ny_, nz_).Box(halfWidth, halfWidth, halfWidth);
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        points_[i] *= points_[i];
+    }
+    Box(halfWidth, halfWidth, halfWidth);
+    for (size_t i = 0; i < n; ++i)
+    {
+        float variance = points_[i];
+        if (aboutMean)
+        {
+            variance -= mean[i]*mean[i];
+        }
+        points_[i] = sqrt(std::max(variance, 0.0f));
+    }
+    return true;
+}
+
+bool MapFilter::LocalCrossRms()
+{
+    size_t n = (size_t)nx_*ny_*nz_;
+    std::vector<float> squares;
+    try
+    {
+        squares.resize(n);
+    }
+    catch (...)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        squares[i] = points_[i]*points_[i];
+    }
+    CrossRms rms(points_, &squares[0], nx_, ny_, nz_);
+    MIParallelFor(0, nz_, rms, 2);
+    return true;
+}
+
+float MapFilter::Percentile(const float *points, size_t n, double fraction)
+{
+    if (n == 0)
+    {
+        return 0.0f;
+    }
+    size_t rank = (size_t)std::max(0.0, fraction*n);
+    rank = std::min(rank, n-1);
+    float lo = points[0], hi = points[0];
+    for (size_t i = 1; i < n; ++i)
+    {
+        lo = std::min(lo, points[i]);
+        hi = std::max(hi, points[i]);
+    }
+    if (lo == hi)
+    {
+        return lo;
+    }
+    float scale = PercentileBins/(hi - lo);
+    std::vector<size_t> counts(PercentileBins, 0);
+    for (size_t i = 0; i < n; ++i)
+    {
+        counts[PercentileBin(points[i], lo, scale)]++;
+    }
+    int bin = 0;
+    size_t below = 0;
+    while (below + counts[bin] <= rank)
+    {
+        below += counts[bin++];
+    }
+    std::vector<float> values;
+    values.reserve(counts[bin]);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (PercentileBin(points[i], lo, scale) == bin)
+        {
+            values.push_back(points[i]);
+        }
+    }
+    std::nth_element(values.begin(), values.begin() + (rank - below), values.end());
+    return values[rank - below];
+}
@@ -0,0 +1,62 @@
+#ifndef mifit_map_MapFilter_h
+#define mifit_map_MapFilter_h
+
+#include <cstddef>
+#include <vector>
+
+//@{
+// Filters applied in place to a periodic map grid stored with x varying
+// fastest, as in EMapBase. Each axis is filtered in turn, a slab at a
+// time in parallel, so at most one scratch slab per thread is needed.
+//@}
+class MapFilter
+{
+public:
+    MapFilter(float *points, int nx, int ny, int nz);
+
+    //@{
+    // Convolves the map along one axis (0, 1 or 2 for x, y or z) with a
+    // kernel of odd length centered on its middle element.
+    //@}
+    void Convolve(int axis, const std::vector<float> &kernel);
+
+    //@{
+    // Gaussian smoothing with the given standard deviations in grid
+    // points along each axis. Axes with a deviation of zero are skipped.
+    //@}
+    void Gaussian(float sigmaX, float sigmaY, float sigmaZ);
+
+    //@{
+    // Replaces each point by the mean of the box reaching the given number
+    // of points either side of it along each axis.
+    //@}
+    void Box(int halfX, int halfY, int halfZ);
+
+    //@{
+    // Replaces each point by the root-mean-square density in the cube of
+    // points within halfWidth of it, or by the standard deviation about
+    // the cube's mean if aboutMean is true. The latter needs a copy of the
+    // map and returns false if it cannot be allocated.
+    //@}
+    bool LocalDeviation(int halfWidth, bool aboutMean);
+
+    //@{
+    // Replaces each point by the root-mean-square density of itself and
+    // its six face neighbours. Needs a copy of the squared map and returns
+    // false if it cannot be allocated.
+    //@}
+    bool LocalCrossRms();
+
+    //@{
+    // The value with the given fraction of the points below it, the same
+    // as indexing the sorted points at fraction times n. Found from a
+    // histogram and a selection within one bin without copying the map.
+    //@}
+    static float Percentile(const float *points, size_t n, double fraction);
+
+private:
+    float *points_;
+    int nx_, ny_, nz_;
+};
+
+#endif // ifndef mifit_map_MapFilter_h
@@ -0,0 +1,549 @@
+#include <algorithm>
+#include <cmath>
+
+#include <chemlib/chemlib.h>
+#include <util/parallel.h>
+
+#include "EMapBase.h"
+
+using namespace chemlib;
+
+namespace
+{
+    // An NCS operator and its inverse acting on fractional coordinates
+    struct FractionalOperator
+    {
+        float m[3][3];
+        float t[3];
+        float inv[3][3];
+        float invt[3];
+    };
+
+    void Multiply(const float a[3][3], const float b[3][3], float c[3][3])
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                c[i][j] = a[i][0]*b[0][j] + a[i][1]*b[1][j] + a[i][2]*b[2][j];
+            }
+        }
+    }
+
+    void MultiplyVector(const float a[3][3], const float v[3], float out[3])
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            out[i] = a[i][0]*v[0] + a[i][1]*v[1] + a[i][2]*v[2];
+        }
+    }
+
+    bool Invert(const float a[3][3], float inv[3][3])
+    {
+        float det = a[0][0]*(a[1][1]*a[2][2]-a[1][2]*a[2][1])
+                    - a[0][1]*(a[1][0]*a[2][2]-a[1][2]*a[2][0])
+                    + a[0][2]*(a[1][0]*a[2][1]-a[1][1]*a[2][0]);
+        if (fabs(det) < 1.0e-6f)
+        {
+            return false;
+        }
+        inv[0][0] = (a[1][1]*a[2][2]-a[1][2]*a[2][1])/det;
+        inv[0][1] = (a[0][2]*a[2][1]-a[0][1]*a[2][2])/det;
+        inv[0][2] = (a[0][1]*a[1][2]-a[0][2]*a[1][1])/det;
+        inv[1][0] = (a[1][2]*a[2][0]-a[1][0]*a[2][2])/det;
+        inv[1][1] = (a[0][0]*a[2][2]-a[0][2]*a[2][0])/det;
+        inv[1][2] = (a[0][2]*a[1][0]-a[0][0]*a[1][2])/det;
+        inv[2][0] = (a[1][0]*a[2][1]-a[1][1]*a[2][0])/det;
+        inv[2][1] = (a[0][1]*a[2][0]-a[0][0]*a[2][1])/det;
+        inv[2][2] = (a[0][0]*a[1][1]-a[0][1]*a[1][0])/det;
+        return true;
+    }
+
+    // Rotation and translation of a Cartesian NCS operator
+    void CartesianOperator(const float op[12], float r[3][3], float t[3])
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                r[i][j] = op[3*i + j];
+            }
+            t[i] = op[9 + i];
+        }
+    }
+
+    bool IsIdentity(const float op[12])
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                if (fabs(op[3*i + j] - (i == j ? 1.0f : 0.0f)) > 1.0e-4f)
+                {
+                    return false;
+                }
+            }
+            if (fabs(op[9 + i]) > 1.0e-3f)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The operators of the header other than the identity, which is
+    // always included in the average
+    void FractionalOperators(CMapHeaderBase *mh, std::vector<FractionalOperator> &ops)
+    {
+        ops.clear();
+        for (int k = 0; k < mh->nNCRSymmops; ++k)
+        {
+            if (IsIdentity(mh->NCRSymmops[k]))
+            {
+                continue;
+            }
+            float r[3][3], t[3], rinv[3][3], tmp[3][3];
+            CartesianOperator(mh->NCRSymmops[k], r, t);
+            if (!Invert(r, rinv))
+            {
+                continue;
+            }
+            FractionalOperator op;
+            Multiply(r, mh->ftoc, tmp);
+            Multiply(mh->ctof, tmp, op.m);
+            MultiplyVector(mh->ctof, t, op.t);
+            Multiply(rinv, mh->ftoc, tmp);
+            Multiply(mh->ctof, tmp, op.inv);
+            float rt[3];
+            MultiplyVector(rinv, t, rt);
+            for (int i = 0; i < 3; ++i)
+            {
+                rt[i] = -rt[i];
+            }
+            MultiplyVector(mh->ctof, rt, op.invt);
+            ops.push_back(op);
+        }
+    }
+
+    inline int Wrap(int i, int n)
+    {
+        i %= n;
+        return i < 0 ? i + n : i;
+    }
+
+    // Averages the map a row at a time. Along a row the images of the
+    // points move by a constant step, so each operator is applied once
+    // per row and then stepped.
+    class NCSAverager
+    {
+        EMapBase *map_;
+        const float *points_;
+        const std::vector<FractionalOperator> &ops_;
+        const std::vector<unsigned char> *mask_;
+        int nx_, ny_, nz_;
+        std::vector<float> &out_;
+
+        bool InMask(const float q[3]) const
+        {
+            int ix = Wrap((int)floor(q[0]*nx_ + 0.5f), nx_);
+            int iy = Wrap((int)floor(q[1]*ny_ + 0.5f), ny_);
+            int iz = Wrap((int)floor(q[2]*nz_ + 0.5f), nz_);
+            return (*mask_)[(size_t)nx_*(ny_*iz + iy) + ix] != 0;
+        }
+
+        // Mean of the density at q and at its images
+        float Average(const float q[3]) const
+        {
+            float sum = map_->avgrho(q[0], q[1], q[2]);
+            for (size_t k = 0; k < ops_.size(); ++k)
+            {
+                const FractionalOperator &op = ops_[k];
+                float p[3];
+                MultiplyVector(op.m, q, p);
+                sum += map_->avgrho(p[0] + op.t[0], p[1] + op.t[1], p[2] + op.t[2]);
+            }
+            return sum/(float)(ops_.size() + 1);
+        }
+
+    public:
+        NCSAverager(EMapBase *map, const float *points, const std::vector<FractionalOperator> &ops,
+                    const std::vector<unsigned char> *mask, int nx, int ny, int nz, std::vector<float> &out)
+            : map_(map),
+              points_(points),
+              ops_(ops),
+              mask_(mask),
+              nx_(nx),
+              ny_(ny),
+              nz_(nz),
+              out_(out)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            size_t nops = ops_.size();
+            // Preimage of the row start under each operator and its step
+            std::vector<float> start(3*nops), step(3*nops);
+            for (size_t k = 0; k < nops; ++k)
+            {
+                for (int i = 0; i < 3; ++i)
+                {
+                    step[3*k + i] = ops_[k].inv[i][0]/(float)nx_;
+                }
+            }
+            for (int iz = begin; iz < end; ++iz)
+            {
+                for (int iy = 0; iy < ny_; ++iy)
+                {
+                    float p0[3] = { 0.0f, (float)iy/ny_, (float)iz/nz_ };
+                    for (size_t k = 0; k < nops; ++k)
+                    {
+                        float q[3];
+                        MultiplyVector(ops_[k].inv, p0, q);
+                        for (int i = 0; i < 3; ++i)
+                        {
+                            start[3*k + i] = q[i] + ops_[k].invt[i];
+                        }
+                    }
+                    size_t row = (size_t)nx_*(ny_*iz + iy);
+                    for (int ix = 0; ix < nx_; ++ix)
+                    {
+                        float p[3] = { (float)ix/nx_, p0[1], p0[2] };
+                        if (mask_ == NULL || (*mask_)[row + ix])
+                        {
+                            out_[row + ix] = Average(p);
+                            continue;
+                        }
+                        out_[row + ix] = points_[row + ix];
+                        for (size_t k = 0; k < nops; ++k)
+                        {
+                            float q[3];
+                            for (int i = 0; i < 3; ++i)
+                            {
+                                q[i] = start[3*k + i] + ix*step[3*k + i];
+                            }
+                            if (InMask(q))
+                            {
+                                out_[row + ix] = Average(q);
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    // Sums for the correlation of the density at the mask points with
+    // that at their images under a trial operator
+    struct CorrelationSums
+    {
+        double x, y, xx, yy, xy;
+    };
+
+    class OperatorScorer
+    {
+        EMapBase *map_;
+        CMapHeaderBase *mh_;
+        const std::vector<float> &sites_;
+        const std::vector<float> &rho_;
+        const float (*r_)[3];
+        const float *t_;
+        std::vector<CorrelationSums> &blocks_;
+
+    public:
+        enum
+        {
+            BlockSize = 1024
+        };
+
+        OperatorScorer(EMapBase *map, const std::vector<float> &sites, const std::vector<float> &rho,
+                       const float r[3][3], const float t[3], std::vector<CorrelationSums> &blocks)
+            : map_(map),
+              mh_(map->mapheader),
+              sites_(sites),
+              rho_(rho),
+              r_(r),
+              t_(t),
+              blocks_(blocks)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            int n = (int)rho_.size();
+            for (int block = begin; block < end; ++block)
+            {
+                CorrelationSums s = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+                int last = std::min(n, (block+1)*BlockSize);
+                for (int i = block*BlockSize; i < last; ++i)
+                {
+                    const float *c = &sites_[3*i];
+                    float x = r_[0][0]*c[0] + r_[0][1]*c[1] + r_[0][2]*c[2] + t_[0];
+                    float y = r_[1][0]*c[0] + r_[1][1]*c[1] + r_[1][2]*c[2] + t_[1];
+                    float z = r_[2][0]*c[0] + r_[2][1]*c[1] + r_[2][2]*c[2] + t_[2];
+                    mh_->CtoF(&x, &y, &z);
+                    double a = rho_[i];
+                    double b = map_->avgrho(x, y, z);
+                    s.x += a;
+                    s.y += b;
+                    s.xx += a*a;
+                    s.yy += b*b;
+                    s.xy += a*b;
+                }
+                blocks_[block] = s;
+            }
+        }
+    };
+
+    float ScoreOperator(EMapBase *map, const std::vector<float> &sites, const std::vector<float> &rho,
+                        const float r[3][3], const float t[3])
+    {
+        int n = (int)rho.size();
+        std::vector<CorrelationSums> blocks((n + OperatorScorer::BlockSize - 1)/OperatorScorer::BlockSize);
+        OperatorScorer scorer(map, sites, rho, r, t, blocks);
+        MIParallelFor(0, (int)blocks.size(), scorer);
+        CorrelationSums s = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            s.x += blocks[i].x;
+            s.y += blocks[i].y;
+            s.xx += blocks[i].xx;
+            s.yy += blocks[i].yy;
+            s.xy += blocks[i].xy;
+        }
+        double vx = n*s.xx - s.x*s.x;
+        double vy = n*s.yy - s.y*s.y;
+        if (vx <= 0.0 || vy <= 0.0)
+        {
+            return 0.0f;
+        }
+        return (float)((n*s.xy - s.x*s.y)/sqrt(vx*vy));
+    }
+
+    // The operator r, t followed by small rotations in degrees about x, y
+    // and z through the image of center and a shift
+    void ShiftOperator(const float r[3][3], const float t[3], const float center[3], const float params[6],
+                       float rout[3][3], float tout[3])
+    {
+        const float degtorad = (float)(acos(-1.0)/180.0);
+        float ca = cos(params[0]*degtorad), sa = sin(params[0]*degtorad);
+        float cb = cos(params[1]*degtorad), sb = sin(params[1]*degtorad);
+        float cc = cos(params[2]*degtorad), sc = sin(params[2]*degtorad);
+        float rx[3][3] = { { 1, 0, 0 }, { 0, ca, -sa }, { 0, sa, ca } };
+        float ry[3][3] = { { cb, 0, sb }, { 0, 1, 0 }, { -sb, 0, cb } };
+        float rz[3][3] = { { cc, -sc, 0 }, { sc, cc, 0 }, { 0, 0, 1 } };
+        float ryz[3][3], rd[3][3];
+        Multiply(ry, rz, ryz);
+        Multiply(rx, ryz, rd);
+        Multiply(rd, r, rout);
+        // The image of center stays put under the rotation: the new
+        // translation is rd*(t - image) + image + shift
+        float image[3], rt[3];
+        MultiplyVector(r, center, image);
+        for (int i = 0; i < 3; ++i)
+        {
+            image[i] += t[i];
+            rt[i] = t[i] - image[i];
+        }
+        MultiplyVector(rd, rt, tout);
+        for (int i = 0; i < 3; ++i)
+        {
+            tout[i] += image[i] + params[3 + i];
+        }
+    }
+
+    // Grid points within radius of the atoms
+    void BuildMask(CMapHeaderBase *mh, const std::vector<MIAtom*> &atoms, float radius,
+                   std::vector<unsigned char> &mask)
+    {
+        int nx = mh->nx, ny = mh->ny, nz = mh->nz;
+        mask.assign((size_t)nx*ny*nz, 0);
+        float r2 = radius*radius;
+        // Fractional half widths of a sphere of the radius along each axis
+        float span[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            span[i] = radius*sqrt(mh->ctof[i][0]*mh->ctof[i][0] + mh->ctof[i][1]*mh->ctof[i][1]
+                                  + mh->ctof[i][2]*mh->ctof[i][2]);
+        }
+        for (size_t n = 0; n < atoms.size(); ++n)
+        {
+            float f[3] = { atoms[n]->x(), atoms[n]->y(), atoms[n]->z() };
+            mh->CtoF(&f[0], &f[1], &f[2]);
+            int lo[3], hi[3];
+            int dims[3] = { nx, ny, nz };
+            for (int i = 0; i < 3; ++i)
+            {
+                lo[i] = (int)floor((f[i] - span[i])*dims[i]);
+                hi[i] = (int)ceil((f[i] + span[i])*dims[i]);
+            }
+            for (int iz = lo[2]; iz <= hi[2]; ++iz)
+            {
+                for (int iy = lo[1]; iy <= hi[1]; ++iy)
+                {
+                    for (int ix = lo[0]; ix <= hi[0]; ++ix)
+                    {
+                        float d[3] = { (float)ix/nx - f[0], (float)iy/ny - f[1], (float)iz/nz - f[2] };
+                        float c[3];
+                        MultiplyVector(mh->ftoc, d, c);
+                        if (c[0]*c[0] + c[1]*c[1] + c[2]*c[2] <= r2)
+                        {
+                            mask[(size_t)nx*(ny*Wrap(iz, nz) + Wrap(iy, ny)) + Wrap(ix, nx)] = 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool EMapBase::NCSAverage(EMapBase *averaged, const std::vector<MIAtom*> &maskAtoms, float maskRadius)
+{
+    int nx = mapheader->nx;
+    int ny = mapheader->ny;
+    int nz = mapheader->nz;
+    if (averaged == NULL || averaged == this || !HasDensity() || map_points.size() < (size_t)nx*ny*nz)
+    {
+        return false;
+    }
+    std::vector<FractionalOperator> ops;
+    FractionalOperators(mapheader, ops);
+    if (ops.empty())
+    {
+        Logger::log("NCS average: no non-crystallographic operators other than the identity");
+        return false;
+    }
+
+    std::vector<unsigned char> mask;
+    if (!maskAtoms.empty())
+    {
+        BuildMask(mapheader, maskAtoms, maskRadius, mask);
+    }
+    std::vector<float> out((size_t)nx*ny*nz);
+    NCSAverager averager(this, &map_points[0], ops, maskAtoms.empty() ? NULL : &mask, nx, ny, nz, out);
+    MIParallelFor(0, nz, averager);
+
+    *averaged->mapheader = *mapheader;
+    *averaged->GetSettings() = *GetSettings();
+    averaged->map_points.swap(out);
+    averaged->scale = scale;
+    averaged->mapmin = *std::min_element(averaged->map_points.begin(), averaged->map_points.end());
+    averaged->mapmax = *std::max_element(averaged->map_points.begin(), averaged->map_points.end());
+    averaged->mapName = mapName + " NCS averaged";
+    Logger::log("NCS average: averaged over %d copies", (int)ops.size() + 1);
+    return true;
+}
+
+int EMapBase::RefineNCSOperators(const std::vector<MIAtom*> &maskAtoms, float maskRadius)
+{
+    int nx = mapheader->nx;
+    int ny = mapheader->ny;
+    int nz = mapheader->nz;
+    if (!HasDensity() || maskAtoms.empty() || map_points.size() < (size_t)nx*ny*nz)
+    {
+        return 0;
+    }
+    std::vector<unsigned char> mask;
+    BuildMask(mapheader, maskAtoms, maskRadius, mask);
+
+    // Cartesian coordinates of up to maxSites mask points, evenly strided,
+    // and the density at each
+    const size_t maxSites = 20000;
+    size_t inMask = std::count(mask.begin(), mask.end(), (unsigned char)1);
+    if (inMask < 10)
+    {
+        return 0;
+    }
+    size_t stride = (inMask + maxSites - 1)/maxSites;
+    std::vector<float> sites;
+    std::vector<float> rho;
+    float center[3] = { 0.0f, 0.0f, 0.0f };
+    size_t seen = 0;
+    for (size_t i = 0; i < mask.size(); ++i)
+    {
+        if (!mask[i] || (seen++ % stride) != 0)
+        {
+            continue;
+        }
+        int ix = (int)(i % nx);
+        int iy = (int)((i/nx) % ny);
+        int iz = (int)(i/((size_t)nx*ny));
+        float x = (float)ix/nx, y = (float)iy/ny, z = (float)iz/nz;
+        mapheader->FtoC(&x, &y, &z);
+        sites.push_back(x);
+        sites.push_back(y);
+        sites.push_back(z);
+        rho.push_back(map_points[i]);
+        center[0] += x;
+        center[1] += y;
+        center[2] += z;
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        center[i] /= (float)rho.size();
+    }
+
+    int changed = 0;
+    for (int k = 0; k < mapheader->nNCRSymmops; ++k)
+    {
+        float *op = mapheader->NCRSymmops[k];
+        if (IsIdentity(op))
+        {
+            continue;
+        }
+        float r[3][3], t[3];
+        CartesianOperator(op, r, t);
+        float start = ScoreOperator(this, sites, rho, r, t);
+        float best = start;
+        float params[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        float rotStep = 1.0f, shiftStep = 0.5f;
+        // Pattern search over the three rotations and three shifts,
+        // halving the steps when no move improves the correlation
+        while (rotStep >= 0.05f || shiftStep >= 0.02f)
+        {
+            bool improved = false;
+            for (int p = 0; p < 6; ++p)
+            {
+                float step = p < 3 ? rotStep : shiftStep;
+                for (int sign = -1; sign <= 1; sign += 2)
+                {
+                    float trial[6];
+                    std::copy(params, params + 6, trial);
+                    trial[p] += sign*step;
+                    float rtrial[3][3], ttrial[3];
+                    ShiftOperator(r, t, center, trial, rtrial, ttrial);
+                    float score = ScoreOperator(this, sites, rho, rtrial, ttrial);
+                    if (score > best + 1.0e-5f)
+                    {
+                        best = score;
+                        std::copy(trial, trial + 6, params);
+                        improved = true;
+                        break;
+                    }
+                }
+            }
+            if (!improved)
+            {
+                rotStep *= 0.5f;
+                shiftStep *= 0.5f;
+            }
+        }
+        if (best > start + 1.0e-5f)
+        {
+            float rnew[3][3], tnew[3];
+            ShiftOperator(r, t, center, params, rnew, tnew);
+            for (int i = 0; i < 3; ++i)
+            {
+                for (int j = 0; j < 3; ++j)
+                {
+                    op[3*i + j] = rnew[i][j];
+                }
+                op[9 + i] = tnew[i];
+            }
+            ++changed;
+        }
+        Logger::log("NCS operator %d: correlation %0.3f refined to %0.3f", k + 1, start, best);
+    }
+    return changed;
+}
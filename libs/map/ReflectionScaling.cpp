@@ -0,0 +1,818 @@
+#include <algorithm>
+#include <cmath>
+
+#include <util/parallel.h>
+
+#include "CMapHeaderBase.h"
+#include "CREFL.h"
+#include "ReflectionScaling.h"
+#include "fft.h"
+
+namespace
+{
+    // Reflections are summed in blocks of this size, each block on one
+    // thread, and the block sums are added in order
+    const int BlockSize = 4096;
+
+    int BlockCount(int nrefl)
+    {
+        return (nrefl + BlockSize - 1)/BlockSize;
+    }
+
+    // Solves the symmetric positive definite system a x = b of order n by
+    // Cholesky decomposition, leaving x in b
+    bool SolveSymmetric(double *a, double *b, int n)
+    {
+        double largest = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            largest = std::max(largest, a[i*n + i]);
+        }
+        if (largest <= 0.0)
+        {
+            return false;
+        }
+        for (int j = 0; j < n; ++j)
+        {
+            double d = a[j*n + j];
+            for (int k = 0; k < j; ++k)
+            {
+                d -= a[j*n + k]*a[j*n + k];
+            }
+            if (d <= 1.0e-12*largest)
+            {
+                return false;
+            }
+            a[j*n + j] = sqrt(d);
+            for (int i = j+1; i < n; ++i)
+            {
+                double s = a[i*n + j];
+                for (int k = 0; k < j; ++k)
+                {
+                    s -= a[i*n + k]*a[j*n + k];
+                }
+                a[i*n + j] = s/a[j*n + j];
+            }
+        }
+        for (int i = 0; i < n; ++i)
+        {
+            double s = b[i];
+            for (int k = 0; k < i; ++k)
+            {
+                s -= a[i*n + k]*b[k];
+            }
+            b[i] = s/a[i*n + i];
+        }
+        for (int i = n-1; i >= 0; --i)
+        {
+            double s = b[i];
+            for (int k = i+1; k < n; ++k)
+            {
+                s -= a[k*n + i]*b[k];
+            }
+            b[i] = s/a[i*n + i];
+        }
+        return true;
+    }
+
+    bool InRange(const CREFL &refl, float lo, float hi)
+    {
+        return refl.sthol >= lo && refl.sthol <= hi;
+    }
+
+    struct BinSums
+    {
+        int count;
+        double weight;
+        double weightedFo2;
+        double weightedFc2;
+        double fo2;
+        double fc2;
+        double fo4;
+        double fc4;
+        double fo2fc2;
+
+        BinSums()
+            : count(0),
+              weight(0.0),
+              weightedFo2(0.0),
+              weightedFc2(0.0),
+              fo2(0.0),
+              fc2(0.0),
+              fo4(0.0),
+              fc4(0.0),
+              fo2fc2(0.0)
+        {
+        }
+
+        void Add(const BinSums &s)
+        {
+            count += s.count;
+            weight += s.weight;
+            weightedFo2 += s.weightedFo2;
+            weightedFc2 += s.weightedFc2;
+            fo2 += s.fo2;
+            fc2 += s.fc2;
+            fo4 += s.fo4;
+            fc4 += s.fc4;
+            fo2fc2 += s.fo2fc2;
+        }
+    };
+
+    // The moments of the normalized intensities are sums of the raw
+    // intensities over epsilon divided by the bin means, so a single pass
+    // collects everything SigmaA needs
+    class BinAccumulator
+    {
+        const CREFL *refl_;
+        int nrefl_;
+        const std::vector<float> &limits_;
+        long *iss_;
+        long *its_;
+        long nsym_;
+        std::vector<float> &epsilon_;
+        std::vector<unsigned char> &centric_;
+        std::vector<int> &binOf_;
+        std::vector<std::vector<BinSums> > &blockSums_;
+        std::vector<int> &blockFoms_;
+
+    public:
+        BinAccumulator(const CREFL *refl, int nrefl, const std::vector<float> &limits, long *iss, long *its, long nsym,
+                       std::vector<float> &epsilon, std::vector<unsigned char> &centric, std::vector<int> &binOf,
+                       std::vector<std::vector<BinSums> > &blockSums, std::vector<int> &blockFoms)
+            : refl_(refl),
+              nrefl_(nrefl),
+              limits_(limits),
+              iss_(iss),
+              its_(its),
+              nsym_(nsym),
+              epsilon_(epsilon),
+              centric_(centric),
+              binOf_(binOf),
+              blockSums_(blockSums),
+              blockFoms_(blockFoms)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            int numbins = (int)limits_.size() + 1;
+            for (int block = begin; block < end; ++block)
+            {
+                std::vector<BinSums> &sums = blockSums_[block];
+                sums.assign(numbins, BinSums());
+                int foms = 0;
+                int last = std::min(nrefl_, (block+1)*BlockSize);
+                for (int i = block*BlockSize; i < last; ++i)
+                {
+                    const CREFL &r = refl_[i];
+                    long ih = r.ind[0], ik = r.ind[1], il = r.ind[2];
+                    long mult, mk, iflg, iflg2, nsym = nsym_;
+                    float eps;
+                    stdrefl_(&ih, &ik, &il, &mult, &eps, &mk, &iflg, &iflg2, iss_, its_, &nsym);
+                    // Absent reflections return before counting the identity
+                    eps = std::max(eps, 1.0f);
+                    epsilon_[i] = eps;
+                    centric_[i] = (unsigned char)(mk-1);
+                    if (r.fc <= 1.0)
+                    {
+                        foms++;
+                    }
+                    int bin = (int)(std::upper_bound(limits_.begin(), limits_.end(), r.sthol) - limits_.begin());
+                    binOf_[i] = bin;
+
+                    double wt = centric_[i] ? 1.0 : 2.0;
+                    double fo2 = (double)r.fo*r.fo/eps;
+                    double fc2 = (double)r.fc*r.fc/eps;
+                    BinSums &s = sums[bin];
+                    s.count++;
+                    s.weight += wt;
+                    s.weightedFo2 += wt*fo2;
+                    s.weightedFc2 += wt*fc2;
+                    s.fo2 += fo2;
+                    s.fc2 += fc2;
+                    s.fo4 += fo2*fo2;
+                    s.fc4 += fc2*fc2;
+                    s.fo2fc2 += fo2*fc2;
+                }
+                blockFoms_[block] = foms;
+            }
+        }
+    };
+
+    class SigmaAApplier
+    {
+        CREFL *refl_;
+        const std::vector<ResolutionBin> &bins_;
+        const std::vector<float> &epsilon_;
+        const std::vector<unsigned char> &centric_;
+        const std::vector<int> &binOf_;
+
+    public:
+        SigmaAApplier(CREFL *refl, const std::vector<ResolutionBin> &bins, const std::vector<float> &epsilon,
+                      const std::vector<unsigned char> &centric, const std::vector<int> &binOf)
+            : refl_(refl),
+              bins_(bins),
+              epsilon_(epsilon),
+              centric_(centric),
+              binOf_(binOf)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                CREFL &r = refl_[i];
+                const ResolutionBin &bin = bins_[binOf_[i]];
+                float sigmaA = bin.sigmaA;
+                float norm = (float)sqrt(bin.meanFo2*epsilon_[i]);
+                if (norm <= 0.0f)
+                {
+                    r.fom = 0.0f;
+                    r.acalc = 0.0f;
+                    r.bcalc = 0.0f;
+                    continue;
+                }
+                float eo = r.fo/norm;
+                float ec = r.fc/norm;
+                float Xarg = sigmaA*2.0F*eo*ec/(1.0F-sigmaA*sigmaA);
+                float m;
+                if (!centric_[i])
+                {
+                    m = sim(Xarg);
+                    r.acalc = (2.0F*m*eo-sigmaA*ec)*norm;
+                    r.bcalc = m*r.fo-r.fc;
+                }
+                else
+                {
+                    m = (float)tanh(Xarg);
+                    r.acalc = m*r.fo;
+                    r.bcalc = r.fo-r.fc;
+                }
+                r.fom = m;
+            }
+        }
+    };
+
+    struct SolventSums
+    {
+        double jtj[3][3];
+        double jtr[3];
+        double squares;
+        double absolute;
+        double fo;
+        int count;
+
+        SolventSums()
+            : squares(0.0),
+              absolute(0.0),
+              fo(0.0),
+              count(0)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                jtr[i] = 0.0;
+                for (int j = 0; j < 3; ++j)
+                {
+                    jtj[i][j] = 0.0;
+                }
+            }
+        }
+
+        void Add(const SolventSums &s)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                jtr[i] += s.jtr[i];
+                for (int j = 0; j < 3; ++j)
+                {
+                    jtj[i][j] += s.jtj[i][j];
+                }
+            }
+            squares += s.squares;
+            absolute += s.absolute;
+            fo += s.fo;
+            count += s.count;
+        }
+    };
+
+    // Residuals of Fo against s Fc (1 - K exp(-B sthol^2)) and their
+    // derivatives by s, K and B
+    class SolventAccumulator
+    {
+        const CREFL *refl_;
+        int nrefl_;
+        float lo_, hi_;
+        double params_[3];
+        std::vector<SolventSums> &blockSums_;
+
+    public:
+        SolventAccumulator(const CREFL *refl, int nrefl, float lo, float hi, const double params[3],
+                           std::vector<SolventSums> &blockSums)
+            : refl_(refl),
+              nrefl_(nrefl),
+              lo_(lo),
+              hi_(hi),
+              blockSums_(blockSums)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                params_[i] = params[i];
+            }
+        }
+
+        void operator()(int begin, int end)
+        {
+            double s = params_[0], K = params_[1], B = params_[2];
+            for (int block = begin; block < end; ++block)
+            {
+                SolventSums sums;
+                int last = std::min(nrefl_, (block+1)*BlockSize);
+                for (int i = block*BlockSize; i < last; ++i)
+                {
+                    const CREFL &r = refl_[i];
+                    if (!InRange(r, lo_, hi_))
+                    {
+                        continue;
+                    }
+                    double s2 = (double)r.sthol*r.sthol;
+                    double e = exp(-B*s2);
+                    double g = 1.0 - K*e;
+                    double model = s*r.fc*g;
+                    double resid = r.fo - model;
+                    double d[3] = { r.fc*g, -s*r.fc*e, s*r.fc*K*s2*e };
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        sums.jtr[a] += d[a]*resid;
+                        for (int b = 0; b <= a; ++b)
+                        {
+                            sums.jtj[a][b] += d[a]*d[b];
+                        }
+                    }
+                    sums.squares += resid*resid;
+                    sums.absolute += fabs(resid);
+                    sums.fo += r.fo;
+                    sums.count++;
+                }
+                blockSums_[block] = sums;
+            }
+        }
+    };
+
+    SolventSums SumSolvent(const CREFL *refl, int nrefl, float lo, float hi, const double params[3])
+    {
+        std::vector<SolventSums> blockSums(BlockCount(nrefl));
+        SolventAccumulator accumulator(refl, nrefl, lo, hi, params, blockSums);
+        MIParallelFor(0, (int)blockSums.size(), accumulator);
+        SolventSums total;
+        for (size_t i = 0; i < blockSums.size(); ++i)
+        {
+            total.Add(blockSums[i]);
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+            for (int b = a+1; b < 3; ++b)
+            {
+                total.jtj[a][b] = total.jtj[b][a];
+            }
+        }
+        return total;
+    }
+
+    // Takes h a*, k b*, l c* to orthogonal axes so that the products of
+    // the direction cosines of a reflection can be formed
+    class ReciprocalFrame
+    {
+        float as_, bs_, cs_;
+        float or11_, or21_, or22_, or31_, or32_, or33_;
+
+    public:
+        explicit ReciprocalFrame(const CMapHeaderBase *mh)
+        {
+            float degtor = (float)(acos(-1.0)/180.0);
+            float cosa = (float)cos(mh->alpha*degtor);
+            float cosb = (float)cos(mh->beta*degtor);
+            float cosg = (float)cos(mh->gamma*degtor);
+            float sina = (float)sin(mh->alpha*degtor);
+            float sinb = (float)sin(mh->beta*degtor);
+            float sing = (float)sin(mh->gamma*degtor);
+            float cosas = (cosb*cosg - cosa)/sinb/sing;
+            float cosbs = (cosa*cosg - cosb)/sina/sing;
+            float V = mh->a*mh->b*mh->c*(float)sqrt(1-cosa*cosa-cosb*cosb-cosg*cosg+2.0*cosa*cosg*cosb);
+            as_ = mh->b*mh->c*sina/V;
+            bs_ = mh->a*mh->c*sinb/V;
+            cs_ = mh->a*mh->b*sing/V;
+            or11_ = sing*(float)sin(acos(cosbs));
+            or21_ = -cosg*(float)sin(acos(cosbs));
+            or22_ = (float)sin(acos(cosas));
+            or31_ = cosbs;
+            or32_ = cosas;
+            or33_ = 1.0f;
+        }
+
+        void Products(const CREFL &refl, float rr[6]) const
+        {
+            float dstar = refl.sthol/0.5F;
+            float zh = refl.ind[0]*as_;
+            float zk = refl.ind[1]*bs_;
+            float zl = refl.ind[2]*cs_;
+            zl = (or31_*zh+or32_*zk+or33_*zl)/dstar;
+            zk = (or21_*zh+or22_*zk)/dstar;
+            zh = or11_*zh/dstar;
+            rr[0] = zh*zh;
+            rr[1] = zk*zk;
+            rr[2] = zl*zl;
+            rr[3] = zh*zk*2;
+            rr[4] = zh*zl*2;
+            rr[5] = zk*zl*2;
+        }
+    };
+
+    struct AnisoSums
+    {
+        double normal[6][6];
+        double rhs[6];
+
+        AnisoSums()
+        {
+            for (int i = 0; i < 6; ++i)
+            {
+                rhs[i] = 0.0;
+                for (int j = 0; j < 6; ++j)
+                {
+                    normal[i][j] = 0.0;
+                }
+            }
+        }
+    };
+
+    class AnisoAccumulator
+    {
+        const CREFL *refl_;
+        int nrefl_;
+        float lo_, hi_;
+        const ReciprocalFrame &frame_;
+        std::vector<AnisoSums> &blockSums_;
+
+    public:
+        AnisoAccumulator(const CREFL *refl, int nrefl, float lo, float hi, const ReciprocalFrame &frame,
+                         std::vector<AnisoSums> &blockSums)
+            : refl_(refl),
+              nrefl_(nrefl),
+              lo_(lo),
+              hi_(hi),
+              frame_(frame),
+              blockSums_(blockSums)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            for (int block = begin; block < end; ++block)
+            {
+                AnisoSums sums;
+                int last = std::min(nrefl_, (block+1)*BlockSize);
+                for (int i = block*BlockSize; i < last; ++i)
+                {
+                    const CREFL &r = refl_[i];
+                    if (!InRange(r, lo_, hi_) || r.fo <= 0.0f || r.sthol <= 0.0f)
+                    {
+                        continue;
+                    }
+                    // Leave out gross outliers
+                    if (fabs(r.fo - r.fc) >= (r.fo + r.fc)/2.0f)
+                    {
+                        continue;
+                    }
+                    float rr[6];
+                    frame_.Products(r, rr);
+                    for (int a = 0; a < 6; ++a)
+                    {
+                        double da = (double)r.fc*rr[a];
+                        sums.rhs[a] += da*r.fo;
+                        for (int b = 0; b <= a; ++b)
+                        {
+                            sums.normal[a][b] += da*r.fc*rr[b];
+                        }
+                    }
+                }
+                blockSums_[block] = sums;
+            }
+        }
+    };
+
+    struct RSums
+    {
+        double fo;
+        double start;
+        double scaled;
+        int count;
+    };
+
+    class AnisoApplier
+    {
+        CREFL *refl_;
+        int nrefl_;
+        float lo_, hi_;
+        const ReciprocalFrame &frame_;
+        const float *tensor_;
+        std::vector<RSums> &blockSums_;
+
+    public:
+        AnisoApplier(CREFL *refl, int nrefl, float lo, float hi, const ReciprocalFrame &frame, const float *tensor,
+                     std::vector<RSums> &blockSums)
+            : refl_(refl),
+              nrefl_(nrefl),
+              lo_(lo),
+              hi_(hi),
+              frame_(frame),
+              tensor_(tensor),
+              blockSums_(blockSums)
+        {
+        }
+
+        void operator()(int begin, int end)
+        {
+            for (int block = begin; block < end; ++block)
+            {
+                RSums sums = { 0.0, 0.0, 0.0, 0 };
+                int last = std::min(nrefl_, (block+1)*BlockSize);
+                for (int i = block*BlockSize; i < last; ++i)
+                {
+                    CREFL &r = refl_[i];
+                    if (!InRange(r, lo_, hi_) || r.fo <= 0.0f || r.sthol <= 0.0f)
+                    {
+                        continue;
+                    }
+                    float rr[6];
+                    frame_.Products(r, rr);
+                    float scale = 0.0f;
+                    for (int a = 0; a < 6; ++a)
+                    {
+                        scale += tensor_[a]*rr[a];
+                    }
+                    sums.fo += r.fo;
+                    sums.start += fabs(r.fo - r.fc);
+                    r.fc *= scale;
+                    r.acalc *= scale;
+                    r.bcalc *= scale;
+                    r.awhole *= scale;
+                    r.bwhole *= scale;
+                    sums.scaled += fabs(r.fo - r.fc);
+                    sums.count++;
+                }
+                blockSums_[block] = sums;
+            }
+        }
+    };
+}
+
+ReflectionScaler::ReflectionScaler(CMapHeaderBase *mh)
+    : mh_(mh),
+      fomCount_(0)
+{
+}
+
+void ReflectionScaler::BinStatistics(const CREFL *refl, int nrefl, int numbins)
+{
+    bins_.clear();
+    fomCount_ = 0;
+    if (nrefl <= 0)
+    {
+        return;
+    }
+    numbins = std::max(1, std::min(numbins, nrefl));
+
+    // Bin boundaries at equal counts of the sorted resolutions
+    std::vector<float> sthol(nrefl);
+    for (int i = 0; i < nrefl; ++i)
+    {
+        sthol[i] = refl[i].sthol;
+    }
+    std::sort(sthol.begin(), sthol.end());
+    std::vector<float> limits(numbins-1);
+    for (int b = 1; b < numbins; ++b)
+    {
+        limits[b-1] = sthol[(size_t)b*nrefl/numbins];
+    }
+
+    // 3 x 3 x 96 rotations and 3 x 96 translations in 24ths for stdrefl
+    long iss[864];
+    long its[288];
+    for (int k = 0; k < mh_->nsym; k++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            its[j+k*3] = (long)floor(mh_->symops[j][3][k]*24.0 + 0.5);
+            for (int i = 0; i < 3; i++)
+            {
+                iss[i+3*(j+3*k)] = (long)mh_->symops[i][j][k];
+            }
+        }
+    }
+
+    epsilon_.resize(nrefl);
+    centric_.resize(nrefl);
+    binOf_.resize(nrefl);
+    int nblocks = BlockCount(nrefl);
+    std::vector<std::vector<BinSums> > blockSums(nblocks);
+    std::vector<int> blockFoms(nblocks, 0);
+    BinAccumulator accumulator(refl, nrefl, limits, iss, its, mh_->nsym, epsilon_, centric_, binOf_,
+                               blockSums, blockFoms);
+    MIParallelFor(0, nblocks, accumulator);
+
+    std::vector<BinSums> sums(numbins);
+    for (int block = 0; block < nblocks; ++block)
+    {
+        fomCount_ += blockFoms[block];
+        for (int b = 0; b < numbins; ++b)
+        {
+            sums[b].Add(blockSums[block][b]);
+        }
+    }
+
+    bins_.resize(numbins);
+    for (int b = 0; b < numbins; ++b)
+    {
+        ResolutionBin &bin = bins_[b];
+        const BinSums &s = sums[b];
+        bin.stholMin = b > 0 ? limits[b-1] : sthol.front();
+        bin.stholMax = b < numbins-1 ? limits[b] : sthol.back();
+        bin.count = s.count;
+        bin.meanFo2 = s.weight > 0.0 ? s.weightedFo2/s.weight : 0.0;
+        bin.meanFc2 = s.weight > 0.0 ? s.weightedFc2/s.weight : 0.0;
+        bin.sumEo2 = bin.sumEc2 = bin.sumEo4 = bin.sumEc4 = bin.sumEo2Ec2 = 0.0;
+        bin.sigmaA = 0.05F;
+        bin.correlation = 0.0F;
+        if (bin.count == 0 || bin.meanFo2 <= 0.0 || bin.meanFc2 <= 0.0)
+        {
+            continue;
+        }
+        bin.sumEo2 = s.fo2/bin.meanFo2;
+        bin.sumEc2 = s.fc2/bin.meanFc2;
+        bin.sumEo4 = s.fo4/(bin.meanFo2*bin.meanFo2);
+        bin.sumEc4 = s.fc4/(bin.meanFc2*bin.meanFc2);
+        bin.sumEo2Ec2 = s.fo2fc2/(bin.meanFo2*bin.meanFc2);
+
+        double n = bin.count;
+        double covariance = n*bin.sumEo2Ec2 - bin.sumEo2*bin.sumEc2;
+        double varianceProduct = (n*bin.sumEo4 - bin.sumEo2*bin.sumEo2)*(n*bin.sumEc4 - bin.sumEc2*bin.sumEc2);
+        if (varianceProduct <= 0.0)
+        {
+            continue;
+        }
+        bin.correlation = (float)(covariance/sqrt(varianceProduct));
+        // SigmaA is the square root of the correlation of the intensities
+        if (covariance > 0.0)
+        {
+            bin.sigmaA = std::min((float)sqrt(bin.correlation), 0.999F);
+        }
+    }
+}
+
+void ReflectionScaler::ApplySigmaA(CREFL *refl, int nrefl) const
+{
+    if (bins_.empty() || (int)binOf_.size() != nrefl)
+    {
+        return;
+    }
+    SigmaAApplier applier(refl, bins_, epsilon_, centric_, binOf_);
+    MIParallelFor(0, nrefl, applier, BlockSize);
+}
+
+float ReflectionScaler::FitBulkSolvent(const CREFL *refl, int nrefl, float &K, float &B, float &startR) const
+{
+    float lo = 0.5F/mh_->resmax;
+    float hi = 0.5F/mh_->resmin;
+    startR = -1.0F;
+
+    // Overall scale without the solvent to start from
+    double params[3] = { 1.0, 0.0, B };
+    SolventSums sums = SumSolvent(refl, nrefl, lo, hi, params);
+    if (sums.count == 0 || sums.fo <= 0.0)
+    {
+        return -1.0F;
+    }
+    params[0] = sums.jtj[0][0] > 0.0 ? 1.0 + sums.jtr[0]/sums.jtj[0][0] : 1.0;
+    sums = SumSolvent(refl, nrefl, lo, hi, params);
+    startR = (float)(sums.absolute/sums.fo);
+
+    // Levenberg-Marquardt on s, K and B with K kept in [0,1] and B
+    // positive
+    params[1] = K;
+    sums = SumSolvent(refl, nrefl, lo, hi, params);
+    double lambda = 1.0e-3;
+    for (int iter = 0; iter < 100 && lambda < 1.0e8; ++iter)
+    {
+        double a[9], step[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            step[i] = sums.jtr[i];
+            for (int j = 0; j < 3; ++j)
+            {
+                a[i*3 + j] = sums.jtj[i][j];
+            }
+            a[i*3 + i] *= 1.0 + lambda;
+        }
+        if (!SolveSymmetric(a, step, 3))
+        {
+            lambda *= 10.0;
+            continue;
+        }
+        double trial[3] = { params[0] + step[0], params[1] + step[1], params[2] + step[2] };
+        trial[1] = std::max(0.0, std::min(trial[1], 1.0));
+        trial[2] = std::max(1.0, trial[2]);
+        SolventSums trialSums = SumSolvent(refl, nrefl, lo, hi, trial);
+        if (trialSums.squares < sums.squares)
+        {
+            double gain = (sums.squares - trialSums.squares)/sums.squares;
+            for (int i = 0; i < 3; ++i)
+            {
+                params[i] = trial[i];
+            }
+            sums = trialSums;
+            lambda = std::max(lambda/10.0, 1.0e-7);
+            if (gain < 1.0e-7)
+            {
+                break;
+            }
+        }
+        else
+        {
+            lambda *= 10.0;
+        }
+    }
+    K = (float)params[1];
+    B = (float)params[2];
+    return (float)(sums.absolute/sums.fo);
+}
+
+bool ReflectionScaler::FitAnisotropic(const CREFL *refl, int nrefl, float tensor[6]) const
+{
+    ReciprocalFrame frame(mh_);
+    float lo = 0.5F/mh_->resmax;
+    float hi = 0.5F/mh_->resmin;
+    std::vector<AnisoSums> blockSums(BlockCount(nrefl));
+    AnisoAccumulator accumulator(refl, nrefl, lo, hi, frame, blockSums);
+    MIParallelFor(0, (int)blockSums.size(), accumulator);
+
+    double normal[36], rhs[6];
+    for (int a = 0; a < 6; ++a)
+    {
+        rhs[a] = 0.0;
+        for (int b = 0; b < 6; ++b)
+        {
+            normal[a*6 + b] = 0.0;
+        }
+    }
+    for (size_t block = 0; block < blockSums.size(); ++block)
+    {
+        for (int a = 0; a < 6; ++a)
+        {
+            rhs[a] += blockSums[block].rhs[a];
+            for (int b = 0; b <= a; ++b)
+            {
+                normal[a*6 + b] += blockSums[block].normal[a][b];
+            }
+        }
+    }
+    for (int a = 0; a < 6; ++a)
+    {
+        for (int b = a+1; b < 6; ++b)
+        {
+            normal[a*6 + b] = normal[b*6 + a];
+        }
+    }
+    if (!SolveSymmetric(normal, rhs, 6))
+    {
+        return false;
+    }
+    for (int a = 0; a < 6; ++a)
+    {
+        tensor[a] = (float)rhs[a];
+    }
+    return true;
+}
+
+int ReflectionScaler::ApplyAnisotropic(CREFL *refl, int nrefl, const float tensor[6], float &startR, float &scaledR) const
+{
+    ReciprocalFrame frame(mh_);
+    float lo = 0.5F/mh_->resmax;
+    float hi = 0.5F/mh_->resmin;
+    std::vector<RSums> blockSums(BlockCount(nrefl));
+    AnisoApplier applier(refl, nrefl, lo, hi, frame, tensor, blockSums);
+    MIParallelFor(0, (int)blockSums.size(), applier);
+
+    RSums total = { 0.0, 0.0, 0.0, 0 };
+    for (size_t block = 0; block < blockSums.size(); ++block)
+    {
+        total.fo += blockSums[block].fo;
+        total.start += blockSums[block].start;
+        total.scaled += blockSums[block].scaled;
+        total.count += blockSums[block].count;
+    }
+    startR = total.fo > 0.0 ? (float)(total.start/total.fo) : 0.0F;
+    scaledR = total.fo > 0.0 ? (float)(total.scaled/total.fo) : 0.0F;
+    return total.count;
+}
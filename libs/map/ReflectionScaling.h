@@ -0,0 +1,106 @@
+#ifndef mifit_map_ReflectionScaling_h
+#define mifit_map_ReflectionScaling_h
+
+#include <vector>
+
+class CMapHeaderBase;
+class CREFL;
+
+//@{
+// Statistics of one resolution bin: the mean intensities of Fo and Fc
+// over epsilon, weighted by 2 for acentric and 1 for centric reflections,
+// and the sums of the normalized intensities Eo^2 and Ec^2 and of their
+// squares and product from which SigmaA is estimated.
+//@}
+struct ResolutionBin
+{
+    float stholMin;
+    float stholMax;
+    int count;
+    double meanFo2;
+    double meanFc2;
+    double sumEo2;
+    double sumEc2;
+    double sumEo4;
+    double sumEc4;
+    double sumEo2Ec2;
+    float sigmaA;
+    float correlation;
+};
+
+//@{
+// Scaling of calculated against observed amplitudes: resolution bin
+// statistics and SigmaA coefficients, a bulk solvent correction and an
+// anisotropic scale. Each pass over the reflections is split into fixed
+// blocks summed in parallel and combined in block order, so the results
+// do not depend on the number of threads.
+//@}
+class ReflectionScaler
+{
+public:
+    explicit ReflectionScaler(CMapHeaderBase *mh);
+
+    //@{
+    // Splits the reflections into numbins bins of equal count by
+    // resolution and gathers their statistics, the epsilon factor and
+    // centric flag of each reflection and the number of Fc's that look
+    // like figures of merit, all in one pass.
+    //@}
+    void BinStatistics(const CREFL *refl, int nrefl, int numbins);
+
+    const std::vector<ResolutionBin> &Bins() const
+    {
+        return bins_;
+    }
+
+    //@{
+    // Number of reflections with Fc no larger than 1 in the last call to
+    // BinStatistics.
+    //@}
+    int FomCount() const
+    {
+        return fomCount_;
+    }
+
+    //@{
+    // Sets the figure of merit, 2mFo-DFc in acalc and mFo-Fc in bcalc
+    // from the bin statistics by the method of Read (1986) Acta Cryst
+    // A42, 140-149. BinStatistics must have been called on the same
+    // reflections.
+    //@}
+    void ApplySigmaA(CREFL *refl, int nrefl) const;
+
+    //@{
+    // Least-squares fit of Fo = s Fc (1 - K exp(-B sthol^2)) over the
+    // resolution range of the map header, starting from K and B. Returns
+    // the R-factor of the fit and in startR that of the overall scale
+    // alone, or -1 if no reflections are in range.
+    //@}
+    float FitBulkSolvent(const CREFL *refl, int nrefl, float &K, float &B, float &startR) const;
+
+    //@{
+    // Linear least-squares fit of the anisotropic scale, a symmetric
+    // tensor in the direction cosines of the reciprocal lattice given as
+    // its 11, 22, 33, 12, 13 and 23 elements, to the reflections in the
+    // resolution range of the map header whose Fo and Fc agree within
+    // their mean. Returns false if the normal matrix is singular.
+    //@}
+    bool FitAnisotropic(const CREFL *refl, int nrefl, float tensor[6]) const;
+
+    //@{
+    // Scales Fc and the calculated parts of the reflections in range by
+    // the tensor. Returns the number scaled and the R-factors before and
+    // after.
+    //@}
+    int ApplyAnisotropic(CREFL *refl, int nrefl, const float tensor[6], float &startR, float &scaledR) const;
+
+private:
+    CMapHeaderBase *mh_;
+    std::vector<ResolutionBin> bins_;
+    std::vector<float> epsilon_;
+    std::vector<unsigned char> centric_;
+    std::vector<int> binOf_;
+    int fomCount_;
+};
+
+#endif // ifndef mifit_map_ReflectionScaling_h
@@ -43,19 +43,14 @@ int stdrefl_(long int *ih, long int *ik, long int *il, long int *mult, float *ep
 int MIMapFactor(int ntest, int prime, int even, int inc);
 int SigmaA();
 float *fft3d(CREFL *refl, int nrefl, CMapHeaderBase *mapheader, int usepsi);
-void get_unit_cell();
 void cycle(int *x, int *y, int *z);
 double psi_(int p, int N, int k);
-void read_sf(float *x, int nx, int ny, int nz, float scale, float temp, CREFL *refl, int nrefl, int usepsi);
-void expansion_error(int nsymop);
-int xpnd(int h1[], int h2[], fcomplex * f1, fcomplex * f2, int n);
 void wplane(float *x, int nx, int ny, float *p, int mx, int my, int x0, int y_0, int level);
-int nextf(int h[3], fcomplex * f, int i, CREFL * refl, int nrefl);
 void cexp(fcomplex *a, float b);
 int str_index(char *str1, char *str2);
 int my_index(char *str, char ch);
 void put_80(char *cptr, FILE *file);
-double B_(double x, int j, int N);
+double B_(double x, int j, int N, int SplineOrder);
 int SigmaA_C(CREFL *refl, int nrefl, CMapHeaderBase *mhin);
 float sim(float x);
 int smi(float *am, long int *nm, long int *n, long int *nfail);
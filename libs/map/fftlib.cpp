@@ -238,14 +238,14 @@ int realft_(real *even, real *odd, integer *n, integer *dim)
     integer i__1, i__2, i__3, i__4, i__5;
 
     /* Local variables */
-    static real twon, a, b, c, d, e, f;
-    static integer i, j, k, l;
-    static real angle;
-    static integer d2, d3, d4, d5, i0, i1, i2;
-    static real twopi;
-    static integer nover2;
-    static real co, si;
-    static integer nt;
+    real twon, a, b, c, d, e, f;
+    integer i, j, k, l;
+    real angle;
+    integer d2, d3, d4, d5, i0, i1, i2;
+    real twopi;
+    integer nover2;
+    real co, si;
+    integer nt;
 
 
     /*     REAL FOURIER TRANSFORM */
@@ -368,14 +368,14 @@ int hermft(real *x, real *y, integer *n, integer *dim)
     integer i__1, i__2, i__3, i__4, i__5;
 
     /* Local variables */
-    static real twon, a, b, c, d, e, f;
-    static integer i, j, k;
-    static real angle;
-    static integer d2, d3, d4, d5, i0, i1, i2, k1;
-    static real twopi;
-    static integer nover2;
-    static real co, si;
-    static integer nt;
+    real twon, a, b, c, d, e, f;
+    integer i, j, k;
+    real angle;
+    integer d2, d3, d4, d5, i0, i1, i2, k1;
+    real twopi;
+    integer nover2;
+    real co, si;
+    integer nt;
 
 
     /*     HERMITIAN SYMMETRIC FOURIER TRANSFORM */
@@ -482,13 +482,13 @@ int sdiad_(real *x, real *y, integer *n, integer *dim)
 
 
     /* Local variables */
-    static logical fold;
-    static real twon, a, c;
-    static integer i, j, k, l, m;
-    static real s, angle;
-    static integer d1, d2, d3, d4, d5, k0, k1, k2;
-    static real twopi;
-    static integer nover2, mn, nn;
+    logical fold;
+    real twon, a, c;
+    integer i, j, k, l, m;
+    real s, angle;
+    integer d1, d2, d3, d4, d5, k0, k1, k2;
+    real twopi;
+    integer nover2, mn, nn;
 
 
 
@@ -729,13 +729,13 @@ int inv21_(real *x, real *y, integer *n, integer *d)
     integer i__1, i__2, i__3, i__4, i__5;
 
     /* Local variables */
-    static real a, b, c;
-    static integer i, j, k, l, m;
-    static real r, s, c1;
-    static integer d1, d2, d3, d4, d5, j1, j2, j3;
-    static real s1;
-    static integer nover2, kk, ll;
-    static real pi;
+    real a, b, c;
+    integer i, j, k, l, m;
+    real r, s, c1;
+    integer d1, d2, d3, d4, d5, j1, j2, j3;
+    real s1;
+    integer nover2, kk, ll;
+    real pi;
 
     /*     INVERTS FOURIER TRANSFORM ALONG A SCREW */
     /*     DIAD. THE RESULT IS SCALED BY N. */
@@ -906,11 +906,11 @@ int cmplft_(real *x, real *y, integer *n, integer *d)
     int s_stop();
 
     /* Local variables */
-    static integer pmax;
-    static integer psym;
-    static logical error;
-    static integer unsym[15];
-    static integer factor[15], twogrp, sym[15];
+    integer pmax;
+    integer psym;
+    logical error;
+    integer unsym[15];
+    integer factor[15], twogrp, sym[15];
 
 
 
@@ -994,18 +994,18 @@ int rsymft_(real *x, integer *n, integer *dim)
 
 
     /* Local variables */
-    static real twon;
-    static integer twod2;
-    static real a, b, c, d;
-    static integer i, j, k, l, m;
-    static real angle;
-    static integer d1, d2, d3, d4, d5, j0, j1, k0, k1, k2, i0;
-    static real twopi;
-    static integer i1, i2, nover2, nover4;
-    static real co;
-    static integer ii, mj, mk, ml, mm;
-    static real si;
-    static integer nn;
+    real twon;
+    integer twod2;
+    real a, b, c, d;
+    integer i, j, k, l, m;
+    real angle;
+    integer d1, d2, d3, d4, d5, j0, j1, k0, k1, k2, i0;
+    real twopi;
+    integer i1, i2, nover2, nover4;
+    real co;
+    integer ii, mj, mk, ml, mm;
+    real si;
+    integer nn;
 
 
     /*     REAL SYMMETRIC MULTIDIMENSIONAL FOURIER TRANSFORM */
@@ -1271,7 +1271,7 @@ int srfp_(integer *pts, integer *pmax, integer *twogrp, integer *factor, integer
 
 
     /* Local variables */
-    static integer nest, ptwo, f, j, n, p, q, r, jj, pp[14], qq[7];
+    integer nest, ptwo, f, j, n, p, q, r, jj, pp[14], qq[7];
 
     /* Fortran I/O blocks */
 
@@ -1434,25 +1434,25 @@ int diprp_(integer *pts, integer *sym, integer *psym, integer *unsym, integer *d
             i__11, i__12, i__13, i__14, i__15, i__16, i__17, i__18, i__19,
             i__20, i__21, i__22, i__23, i__24, i__25, i__26, i__27, i__28,
             i__29, i__30, i__31;
-    static integer equiv_25[14], equiv_26[14];
+    integer equiv_25[14], equiv_26[14];
 
     /* Local variables */
-    static integer mods, nest, size, test, mult, a, b, c, d, e, f, g, h, i, j,
-                   k, l, m, n, p;
+    integer mods, nest, size, test, mult, a, b, c, d, e, f, g, h, i, j,
+            k, l, m, n, p;
 #define s (equiv_25)
-    static real t;
+    real t;
 #define u (equiv_26)
-    static integer delta, p0, p1, p2, p3, p4, p5;
+    integer delta, p0, p1, p2, p3, p4, p5;
 #define al (equiv_26)
 #define bl (equiv_26 + 1)
-    static integer dk;
+    integer dk;
 #define cl (equiv_26 + 2)
 #define dl (equiv_26 + 3)
 #define el (equiv_26 + 4)
 #define fl (equiv_26 + 5)
-    static integer jj;
+    integer jj;
 #define bs (equiv_25 + 1)
-    static integer kk, lk;
+    integer kk, lk;
 #define cs (equiv_25 + 2)
 #define ds (equiv_25 + 3)
 #define es (equiv_25 + 4)
@@ -1463,7 +1463,7 @@ int diprp_(integer *pts, integer *sym, integer *psym, integer *unsym, integer *d
 #define js (equiv_25 + 9)
 #define ks (equiv_25 + 10)
 #define ls (equiv_25 + 11)
-    static integer nt;
+    integer nt;
 #define ms (equiv_25 + 12)
 #define ns (equiv_25 + 13)
 #define gl (equiv_26 + 6)
@@ -1474,8 +1474,8 @@ int diprp_(integer *pts, integer *sym, integer *psym, integer *unsym, integer *d
 #define ll (equiv_26 + 11)
 #define ml (equiv_26 + 12)
 #define nl (equiv_26 + 13)
-    static logical onemod;
-    static integer modulo[14], punsym, sep;
+    logical onemod;
+    integer modulo[14], punsym, sep;
 
     /*     DOUBLE IN PLACE REORDERING PROGRAMME */
 
@@ -1647,6 +1647,7 @@ L500:
     test = (unsym[1] * unsym[2] - 1) * mult * *psym;
     lk = mult;
     dk = mult;
+    mods = 1;
     i__27 = nest;
     for (k = 2; k <= i__27; ++k)
     {
@@ -1794,7 +1795,7 @@ int mdftkd_(integer *n, integer *factor, integer *dim, real *x, real *y)
 {
 
     /* Local variables */
-    static integer f, m, p, r, s;
+    integer f, m, p, r, s;
 
 
     /*     MULTI-DIMENSIONAL COMPLEX FOURIER TRANSFORM KERNEL DRIVER */
@@ -1892,18 +1893,18 @@ int r2cftk_(integer *n, integer *m, real *x0, real *y0, real *x1, real *y1, inte
     integer i__1, i__2, i__3, i__4, i__5, i__6, i__7;
 
     /* Local variables */
-    static logical fold;
-    static integer size;
-    static logical zero;
-    static real c;
-    static integer j, k, l;
-    static real s, angle;
-    static integer k0, k1, k2, l1, m2, mover2, kk;
-    static real is, iu;
-    static integer ns, nt;
-    static real rs, ru, fm2;
-    static integer mm2, sep;
-    static real fjm1;
+    logical fold;
+    integer size;
+    logical zero;
+    real c = 0;
+    integer j, k, l;
+    real s = 0, angle;
+    integer k0, k1, k2, l1, m2, mover2, kk;
+    real is, iu;
+    integer ns, nt;
+    real rs, ru, fm2;
+    integer mm2, sep;
+    real fjm1;
 
     /*     RADIX 2 MULTI-DIMENSIONAL COMPLEX FOURIER TRANSFORM KERNEL */
 
@@ -2010,23 +2011,23 @@ int r3cftk_(integer *n, integer *m, real *x0, real *y0, real *x1, real *y1, real
     integer i__1, i__2, i__3, i__4, i__5, i__6, i__7;
 
     /* Local variables */
-    static logical fold;
-    static integer size;
-    static logical zero;
-    static integer j, k, l;
-    static real t, angle, c1, c2, i0, i1;
-    static integer k0, k1, k2, l1;
-    static real i2;
-    static integer m3;
-    static real r0, s1, s2, r1, r2;
-    static integer mover2;
-    static real ia, ib, ra, rb;
-    static integer kk;
-    static real is;
-    static integer ns, nt;
-    static real rs, fm3;
-    static integer mm3, sep;
-    static real fjm1;
+    logical fold;
+    integer size;
+    logical zero;
+    integer j, k, l;
+    real t, angle, c1 = 0, c2 = 0, i0, i1;
+    integer k0, k1, k2, l1;
+    real i2;
+    integer m3;
+    real r0, s1 = 0, s2 = 0, r1, r2;
+    integer mover2;
+    real ia, ib, ra, rb;
+    integer kk;
+    real is;
+    integer ns, nt;
+    real rs, fm3;
+    integer mm3, sep;
+    real fjm1;
 
     /*     RADIX 3 MULTI-DIMENSIONAL COMPLEX FOURIER TRANSFORM KERNEL */
 
@@ -2152,21 +2153,21 @@ int r4cftk_(integer *n, integer *m, real *x0, real *y0, real *x1, real *y1, real
     integer i__1, i__2, i__3, i__4, i__5, i__6, i__7;
 
     /* Local variables */
-    static logical fold;
-    static integer size;
-    static logical zero;
-    static integer j, k, l;
-    static real t, angle, c1, c2, c3, i1;
-    static integer k0, k1, k2, l1;
-    static real i2, i3;
-    static integer m4;
-    static real r1, s1, s2, s3, r2, r3;
-    static integer mover2, kk, ns, nt;
-    static real fm4, is0, is1;
-    static integer mm4;
-    static real iu0, iu1, rs0, rs1, ru0, ru1;
-    static integer sep;
-    static real fjm1;
+    logical fold;
+    integer size;
+    logical zero;
+    integer j, k, l;
+    real t, angle, c1 = 0, c2 = 0, c3 = 0, i1;
+    integer k0, k1, k2, l1;
+    real i2, i3;
+    integer m4;
+    real r1, s1 = 0, s2 = 0, s3 = 0, r2, r3;
+    integer mover2, kk, ns, nt;
+    real fm4, is0, is1;
+    integer mm4;
+    real iu0, iu1, rs0, rs1, ru0, ru1;
+    integer sep;
+    real fjm1;
 
     /*     RADIX 4 MULTI-DIMENSIONAL COMPLEX FOURIER TRANSFORM KERNEL */
 
@@ -2308,21 +2309,21 @@ int r5cftk_(integer *n, integer *m, real *x0, real *y0, real *x1, real *y1, real
     integer i__1, i__2, i__3, i__4, i__5, i__6, i__7;
 
     /* Local variables */
-    static logical fold;
-    static integer size;
-    static logical zero;
-    static integer j, k, l;
-    static real t, angle, c1, c2, c3, c4, i0;
-    static integer k0, k1, k2, l1;
-    static real i1, i2, i3;
-    static integer m5;
-    static real s1, s2, s3, s4, r0, r1, r2, r3, r4, i4;
-    static integer mover2, kk, ns, nt;
-    static real ia1, ia2, ib1, ib2, ra1, ra2, rb1, rb2, fm5, is1, is2;
-    static integer mm5;
-    static real iu1, iu2, rs1, rs2, ru1, ru2;
-    static integer sep;
-    static real fjm1;
+    logical fold;
+    integer size;
+    logical zero;
+    integer j, k, l;
+    real t, angle, c1 = 0, c2 = 0, c3 = 0, c4 = 0, i0;
+    integer k0, k1, k2, l1;
+    real i1, i2, i3;
+    integer m5;
+    real s1 = 0, s2 = 0, s3 = 0, s4 = 0, r0, r1, r2, r3, r4, i4;
+    integer mover2, kk, ns, nt;
+    real ia1, ia2, ib1, ib2, ra1, ra2, rb1, rb2, fm5, is1, is2;
+    integer mm5;
+    real iu1, iu2, rs1, rs2, ru1, ru2;
+    integer sep;
+    real fjm1;
 
     /*     RADIX 5 MULTI-DIMENSIONAL COMPLEX FOURIER TRANSFORM KERNEL */
 
@@ -2486,23 +2487,23 @@ int r8cftk_(integer *n, integer *m, real *x0, real *y0, real *x1, real *y1, real
     integer i__1, i__2, i__3, i__4, i__5, i__6, i__7;
 
     /* Local variables */
-    static logical fold;
-    static integer size;
-    static logical zero;
-    static integer j, k, l;
-    static real t, angle, c1, c2, c3, c4, c5, c6, c7;
-    static integer k0, k1, k2, l1;
-    static real i1, i2, i3, r1, s1;
-    static integer m8;
-    static real s2, s3, s4, s5, s6, s7, r2, r3, r4, r5, r6, r7, i4, i5, i6,
-                i7;
-    static integer mover2, kk, ns, nt;
-    static real fm8, is0, is1, is2, is3, iu0, iu1;
-    static integer mm8;
-    static real iu2, iu3, rs0, rs1, rs2, rs3, ru0, ru1, ru2, ru3;
-    static integer sep;
-    static real fjm1, iss0, iss1, isu0, isu1, ius0, ius1, iuu0, iuu1, rss0,
-                rss1, rsu0, rsu1, rus0, rus1, ruu0, ruu1;
+    logical fold;
+    integer size;
+    logical zero;
+    integer j, k, l;
+    real t, angle, c1 = 0, c2 = 0, c3 = 0, c4 = 0, c5 = 0, c6 = 0, c7 = 0;
+    integer k0, k1, k2, l1;
+    real i1, i2, i3, r1, s1 = 0;
+    integer m8;
+    real s2 = 0, s3 = 0, s4 = 0, s5 = 0, s6 = 0, s7 = 0, r2, r3, r4, r5, r6, r7, i4, i5, i6,
+         i7;
+    integer mover2, kk, ns, nt;
+    real fm8, is0, is1, is2, is3, iu0, iu1;
+    integer mm8;
+    real iu2, iu3, rs0, rs1, rs2, rs3, ru0, ru1, ru2, ru3;
+    integer sep;
+    real fjm1, iss0, iss1, isu0, isu1, ius0, ius1, iuu0, iuu1, rss0,
+         rss1, rsu0, rsu1, rus0, rus1, ruu0, ruu1;
 
     /*     RADIX 8 MULTI-DIMENSIONAL COMPLEX FOURIER TRANSFORM KERNEL */
 
@@ -2723,28 +2724,28 @@ int rpcftk_(integer *n, integer *m, integer *p, integer *r, real *x, real *y, in
             i__6, i__7, i__8, i__9;
 
     /* Local variables */
-    static logical fold;
-    static integer size;
-    static logical zero;
-    static real a[18], b[18], c[18];
-    static integer j, k, l;
-    static real s[18], t;
-    static integer u;
-    static real angle;
-    static integer v, k0, k1, k2, l1;
-    static real aa[81] /* was [9][9] */, bb[81] /* was [9][9] */;
-    static integer mover2;
-    static real ia[9], ib[9], ra[9];
-    static integer jj;
-    static real rb[9], fp;
-    static integer kk;
-    static real fu, is;
-    static integer mp;
-    static real iu;
-    static integer pm, pp, ns, nt;
-    static real rs, ru, xt, yt, fmp;
-    static integer sep, mmp;
-    static real fjm1;
+    logical fold;
+    integer size;
+    logical zero;
+    real a[18], b[18], c[18];
+    integer j, k, l;
+    real s[18], t;
+    integer u;
+    real angle;
+    integer v, k0, k1, k2, l1;
+    real aa[81] /* was [9][9] */, bb[81] /* was [9][9] */;
+    integer mover2;
+    real ia[9], ib[9], ra[9];
+    integer jj;
+    real rb[9], fp;
+    integer kk;
+    real fu, is;
+    integer mp;
+    real iu;
+    integer pm, pp, ns, nt;
+    real rs, ru, xt, yt, fmp;
+    integer sep, mmp;
+    real fjm1;
 
     /*     RADIX PRIME MULTI-DIMENSIONAL COMPLEX FOURIER TRANSFORM KERNEL */
 
@@ -11,6 +11,7 @@
 #include "maptypes.h"
 #include "fft.h"
 #include "sfcalc.h"
+#include "ReflectionScaling.h"
 
 
 #define c_mul(a, b, c) cmul(a.re, a.im, b.re, b.im, c.re, c.im)
@@ -25,22 +26,40 @@
 }
 
 
-static double raddeg;
-static float g11, g12, g13, g22, g23, g33, dsqmin, dsqmax;
-static float a, b, c, alpha, beta, gama, rmin, rmax, vol;
-/*
-   extern int r[3][4][96];
- */
-static int rsym[3][4][MISymmop::MAXSYMMOPS];
-static int nx, ny, nz, hmax, kmax, lmax;
-static int xmin, ymin, zmin, xmax, ymax, zmax;
-static int hin[4], hout[4];
-static int nsymmops;
-static int ix, iy, iz;
-static int maptype = 0;
-static char buf[2000];
-
-static fcomplex *membuf;
+namespace
+{
+    /* The state of one Fourier transform, formerly kept in file
+     * statics, so that maps can be calculated on several threads at
+     * once.
+     */
+    class FFTCalculation
+    {
+    public:
+        FFTCalculation()
+            : maptype(0)
+        {
+        }
+
+        float *Run(CREFL *refl, int nrefl, CMapHeaderBase *mapheader, int usepsi);
+
+    private:
+        void get_unit_cell();
+        void read_sf(float *x, int nx, int ny, int nz, float scale, float temp, CREFL *refl, int nrefl, int usepsi);
+        void expansion_error(int nsymop);
+        int xpnd(int h1[], int h2[], fcomplex *f1, fcomplex *f2, int n);
+        int nextf(int h[3], fcomplex *f, int i, CREFL *refl, int nrefl);
+
+        double raddeg;
+        float g11, g12, g13, g22, g23, g33, dsqmin, dsqmax;
+        float a, b, c, alpha, beta, gama, rmin, rmax, vol;
+        int rsym[3][4][MISymmop::MAXSYMMOPS];
+        int nx, ny, nz, hmax, kmax, lmax;
+        int hin[4], hout[4];
+        int nsymmops;
+        int maptype;
+        char buf[2000];
+    };
+}
 /*
    extern nextf (), symops(), xpnd (), expansion_error ();
    extern void read_sf ();
@@ -53,8 +72,17 @@ static fcomplex *membuf;
 
 float*
 fft3d(CREFL *refl, int nrefl, CMapHeaderBase *mapheader, int usepsi)
+{
+    FFTCalculation calculation;
+    return calculation.Run(refl, nrefl, mapheader, usepsi);
+}
+
+float *FFTCalculation::Run(CREFL *refl, int nrefl, CMapHeaderBase *mapheader, int usepsi)
 {
     float scale, temp;
+    int ymin, zmin, ymax, zmax;
+    int iy, iz;
+    fcomplex *membuf;
     int i, j, nyblk, nzblk, k, kl = 0, ku = 0;
     long int d[6];
     int offset, zl, zu, z1, z2, yl, yu, y_1, y_2;
@@ -104,8 +132,7 @@ fft3d(CREFL *refl, int nrefl, CMapHeaderBase *mapheader, int usepsi)
     nx = mapheader->nx;
     ny = mapheader->ny;
     nz = mapheader->nz;
-    xmin = ymin = zmin = 0;
-    xmax = nx -1;
+    ymin = zmin = 0;
     ymax = ny -1;
     zmax = nz -1;
     if ((nx <= 0) || (ny <= 0) || (nz <= 0))
@@ -186,9 +213,9 @@ fft3d(CREFL *refl, int nrefl, CMapHeaderBase *mapheader, int usepsi)
     Logger::log(buf);
     sprintf(buf, " Sampling          %5d%5d%5d\n", nx, ny, nz);
     Logger::log(buf);
-    sprintf(buf, " Minimum boundary  %5d%5d%5d\n", xmin, ymin, zmin);
+    sprintf(buf, " Minimum boundary  %5d%5d%5d\n", 0, ymin, zmin);
     Logger::log(buf);
-    sprintf(buf, " Maximum boundary  %5d%5d%5d\n", xmax, ymax, zmax);
+    sprintf(buf, " Maximum boundary  %5d%5d%5d\n", nx - 1, ymax, zmax);
     Logger::log(buf);
 #endif
 
@@ -356,7 +383,7 @@ fft3d(CREFL *refl, int nrefl, CMapHeaderBase *mapheader, int usepsi)
     return ((float*)membuf);
 }
 
-void get_unit_cell()
+void FFTCalculation::get_unit_cell()
 {
     double s, ca, cb, sa, sb, cg, sg, vf, astar, bstar, cstar;
 
@@ -454,11 +481,12 @@ double psi_(int p, int N, int k)
     return psi;
 }
 
-void read_sf(float *x, int nx, int ny, int nz, float scale, float temp, CREFL *refl, int nrefl, int usepsi)
+void FFTCalculation::read_sf(float *x, int nx, int ny, int nz, float scale, float temp, CREFL *refl, int nrefl, int usepsi)
 {
     int count, p, q, r, used;
     float dsq, fh, fk, fl, s, t;
     fcomplex f, /*ww,*/ fsym;
+    fsym.re = fsym.im = 0.0f;
     int nsymop = 0;
     char buf[100];
 
@@ -600,7 +628,7 @@ void read_sf(float *x, int nx, int ny, int nz, float scale, float temp, CREFL *r
     Logger::log(buf);
 }
 
-void expansion_error(int nsymop)
+void FFTCalculation::expansion_error(int nsymop)
 {
     sprintf(buf, "Symmetry expansion error generated index out of bounds\n");
     Logger::log(buf);
@@ -613,7 +641,7 @@ void expansion_error(int nsymop)
     Logger::log(buf);
 }
 
-int xpnd(int h1[], int h2[], fcomplex *f1, fcomplex *f2, int n)
+int FFTCalculation::xpnd(int h1[], int h2[], fcomplex *f1, fcomplex *f2, int n)
 {
 
     /*      Symmetry operators are stored in a common block.  They include
@@ -719,7 +747,8 @@ int xpnd(int h1[], int h2[], fcomplex *f1, fcomplex *f2, int n)
 
 void wplane(float *x, int nx, int ny, float *p, int mx, int my, int x0, int y_0, int level)
 {
-    int i, j;
+    int i, j, ix, iy;
+    float rmin, rmax;
     double r, rsq = 0.0;
 
     /*rmax = x[ny*x0+y_0];*/
@@ -759,9 +788,9 @@ void wplane(float *x, int nx, int ny, float *p, int mx, int my, int x0, int y_0,
     printf(" Level %d: Min = %10.8e Max = %10.8e rms = %10.8e\n", level, rmin, rmax, r);
 }
 
-int nextf(int h[3], fcomplex *f, int i, CREFL *refl, int nrefl)
+int FFTCalculation::nextf(int h[3], fcomplex *f, int i, CREFL *refl, int nrefl)
 {
-    static float phi, fobs;
+    float phi, fobs;
     if (i >= nrefl)
     {
         return (false);
@@ -877,18 +906,16 @@ void put_80(char *cptr, FILE *file)
     values of rho are returned by intrplnt_() in the array S[].
  */
 
-static int SplineOrder;
-static double HalfSplineOrder;
-
 /* t_(j,k,n) computes the knot tj=[j-(k/2)]/n */
 
 #define t_(j, N) (((double)j - HalfSplineOrder)/((double)N))
 
-/* B_(x, j, k, N) computes the b-spline bj(x), at knot j, of orders k=4, and 3,    on the uniform knot sequence tj = [j - (k/2)]/N
+/* B_(x, j, N, k) computes the b-spline bj(x), at knot j, of orders k=4, and 3,    on the uniform knot sequence tj = [j - (k/2)]/N
  */
 
-double B_(double x, int j, int N)
+double B_(double x, int j, int N, int SplineOrder)
 {
+    double HalfSplineOrder = SplineOrder / 2.0;
     double tj0, tj1, tj2, tj3, tj4;
     register double y;
     if (SplineOrder == QUADRATIC)
@@ -981,8 +1008,8 @@ float fx, fy, fz;
     int x0, y0, z0, nx, ny, nz, nxny;
     float *A, *az, *azy;
 
-    SplineOrder = SplineMap[map] + 2;
-    HalfSplineOrder = SplineOrder / 2.0;
+    int SplineOrder = SplineMap[map] + 2;
+    double HalfSplineOrder = SplineOrder / 2.0;
     nx = MapHeader[map].nx;
     ny = MapHeader[map].ny;
     nz = MapHeader[map].nz;
@@ -1027,10 +1054,10 @@ float fx, fy, fz;
     for (i = 0; i < SplineOrder; i++)
     {
         jx = jx0 + i;
-        bx[i] = B_(x, jx, nx);
+        bx[i] = B_(x, jx, nx, SplineOrder);
         px[i] = (jx + nx) % nx;
         jy = jy0 + i;
-        by[i] = B_(y, jy, ny);
+        by[i] = B_(y, jy, ny, SplineOrder);
         py[i] = ((jy + ny) % ny) * nx;
     }
     r = 0;
@@ -1048,7 +1075,7 @@ float fx, fy, fz;
             }
             rxy += rx * by[iy];
         }
-        r += rxy * B_(z, jz, nz);
+        r += rxy * B_(z, jz, nz, SplineOrder);
     }
     r *= MapHeader[map].scale;
     return (float)r;
@@ -1101,7 +1128,7 @@ float fx, fy, fz;
         for (i = 0; i < SplineOrder; i++)
         {
             jz = jz0 + i;
-            bz[i] = B_(z, jz, nz);
+            bz[i] = B_(z, jz, nz, SplineOrder);
             pz[i] = ((jz + nz) % nz) * nxny;
         }
     }
@@ -1122,7 +1149,7 @@ float fx, fy, fz;
         for (i = 0; i < SplineOrder; i++)
         {
             jy = jy0 + i;
-            by[i] = B_(y, jy, ny);
+            by[i] = B_(y, jy, ny, SplineOrder);
             py[i] = ((jy + ny) % ny) * nx;
         }
     }
@@ -1143,7 +1170,7 @@ float fx, fy, fz;
         for (i = 0; i < SplineOrder; i++)
         {
             jx = jx0 + i;
-            bx[i] = B_(x, jx, nx);
+            bx[i] = B_(x, jx, nx, SplineOrder);
             px[i] = (jx + nx) % nx;
         }
     }
@@ -1181,64 +1208,10 @@ float fx, fy, fz;
  * and mFo-Fc is stored in bcalc field
  */
 #define MAXBINS 50
-int scompare(const void *in, const void *jn)
-{
-    CREFL *i = (CREFL*)in;
-    CREFL *j = (CREFL*)jn;
-    /* use with qsort to sort reflections according to sthol */
-    int k = 1;
-    if (i->sthol == j->sthol)
-    {
-        return (0);
-    }
-    if (i->sthol < j->sthol)
-    {
-        return (-1);
-    }
-    return (k);
-}
 
 int SigmaA_C(CREFL *refl, int nrefl, CMapHeaderBase *mhin)
 {
-    float *epsilon;
-    //extern int scompare();
-    //char buf[200];
-    unsigned char *centric;
-    int i, j, k, ibin, nbin[MAXBINS];
-    long int ih, ik, il;
-    /* increased to 3 x 3 x 96 - dem 7/31/97 */
-    long int iss[864];
-    /* increased to 3 x 96 - dem 7/31/97 */
-    long int its[288];
-    float eps, wt;
-    long int mult, mk, iflg, iflg2, nsym;
-    float sigman[MAXBINS], sigmap[MAXBINS];
-    float sum22[MAXBINS], sum20[MAXBINS], sum02[MAXBINS], sum40[MAXBINS], sum04[MAXBINS];
-    float sum22T = 0, sum20T = 0, sum02T = 0, sum40T = 0, sum04T = 0;
-    float sumwt[MAXBINS];
-    float sigmaA[MAXBINS], signum, sigden;
-    float eo, ec, m, Xarg;
-    float corr, mtot = 0.0;
-    int ntot = 0, numbins = 10, nfom = 0;
-#ifdef XVIEW
-    float ratio = (float)atof((char*)xv_get(fftpop->sigmaratio, PANEL_VALUE));
-#else
-    float ratio = 1.0F;
-#endif
-
-    /* try to catch nonsense values */
-    if (ratio <= 0.0)
-    {
-        ratio = 1.0;
-    }
-    if (ratio > 3.0)
-    {
-        ratio = 1.0;
-    }
-#ifdef DEBUG
-    sprintf(buf, "Ratio of reference to working set is %f\n", ratio);
-    Logger::log(buf);
-#endif
+    int i, numbins;
 
     if (nrefl < 100)
     {
@@ -1248,50 +1221,16 @@ int SigmaA_C(CREFL *refl, int nrefl, CMapHeaderBase *mhin)
 
     /* determine number of bins such that each bin has at least
      * 500 reflections */
-    numbins = std::min(MAXBINS, ROUND((float)nrefl/500.0));
+    numbins = std::max(1, std::min(MAXBINS, ROUND((float)nrefl/500.0)));
 
-    /* sort the reflections by sthol */
-    qsort(refl, nrefl, sizeof(CREFL), scompare);
+    /* one pass gets the centric flags, epsilons and bin statistics */
+    ReflectionScaler scaler(mhin);
+    scaler.BinStatistics(refl, nrefl, numbins);
 
-    epsilon = (float*)malloc(sizeof(float)*nrefl);
-    centric = (unsigned char*)malloc(sizeof(unsigned char)*nrefl);
-    if (!epsilon || !centric)
-    {
-        Logger::log("Out of memory in SigmaA: sorry");
-        return 0;
-    }
-    /* first get the centric flag and the epsilon */
-    /* set up the symmetry information */
-    for (k = 0; k < mhin->nsym; k++)
-    {
-        for (j = 0; j < 3; j++)
-        {
-            its[j+k*3] =  ROUND(mhin->symops[j][3][k]*24.0);
-            for (i = 0; i < 3; i++)
-            {
-                iss[i+3*(j+3*k)] = (int)mhin->symops[i][j][k];
-            }
-        }
-    }
-    for (i = 0; i < nrefl; i++)
-    {
-        ih = refl[i].ind[0];
-        ik = refl[i].ind[1];
-        il = refl[i].ind[2];
-        nsym = mhin->nsym;
-        stdrefl_(&ih, &ik, &il, &mult, &eps, &mk, &iflg,
-                 &iflg2, iss, its, &nsym);
-        epsilon[i] = eps;
-        centric[i] = (unsigned char)(mk-1);
-        /* check to make sure that Fc column
-         * does not contain figure-of-merits
-         */
-        if (refl[i].fc <= 1.0)
-        {
-            nfom++;
-        }
-    }
-    if ((float)nfom/(float)nrefl > 0.80)
+    /* check to make sure that Fc column
+     * does not contain figure-of-merits
+     */
+    if ((float)scaler.FomCount()/(float)nrefl > 0.80)
     {
         Logger::log("SigmaA: Fc's are figure-of-merits.");
         printf("SigmaA: Fc's are figure-of-merits.\n");
@@ -1302,139 +1241,19 @@ int SigmaA_C(CREFL *refl, int nrefl, CMapHeaderBase *mhin)
         return 0;
     }
 
-    /* zero the sums */
-    for (i = 0; i < numbins; i++)
-    {
-        sum22[i] = 0;
-        sum20[i] = 0;
-        sum02[i] = 0;
-        sum40[i] = 0;
-        sum04[i] = 0;
-        sumwt[i] = 0;
-        sigman[i] = 0;
-        sigmap[i] = 0;
-        nbin[i] = 0;
-    }
-
-    /* now accumalate sums */
-    for (i = 0; i < nrefl; i++)
-    {
-        ibin = (i*numbins)/(nrefl);
-        wt = 2.0;
-        if (centric[i])
-        {
-            wt = 1.0;
-        }
-        sumwt[ibin] += wt;
-        nbin[ibin]++;
-        sigman[ibin] += refl[i].fo*refl[i].fo*wt/epsilon[i];
-        sigmap[ibin] += refl[i].fc*refl[i].fc*wt/epsilon[i];
-    }
-
-    for (ibin = 0; ibin < numbins; ibin++)
-    {
-        if (sumwt[ibin])
-        {
-            sigman[ibin] /= sumwt[ibin];
-            sigmap[ibin] /= sumwt[ibin];
-        }
-    }
-
-    for (i = 0; i < nrefl; i++)
-    {
-        ibin = (i*numbins)/(nrefl);
-        eo = refl[i].fo/(float)sqrt(sigman[ibin]*epsilon[i]);
-        ec = refl[i].fc/(float)sqrt(sigmap[ibin]*epsilon[i]);
-        eo *= eo;
-        ec *= ec;
-        sum22[ibin] += eo*ec;
-        sum20[ibin] += eo;
-        sum02[ibin] += ec;
-        sum40[ibin] += eo*eo;
-        sum04[ibin] += ec*ec;
-    }
-
 #ifdef DEBUG
-    sprintf(buf, "SigmaA by resolution\n  Bin     Resolution   Number     SigmaA   Correlation\n");
-    Logger::log(buf);
-#endif
-    for (ibin = 0; ibin < numbins; ibin++)
+    const std::vector<ResolutionBin> &bins = scaler.Bins();
+    Logger::log("SigmaA by resolution\n  Bin     Resolution   Number     SigmaA   Correlation\n");
+    for (i = 0; i < (int)bins.size(); i++)
     {
-        if (nbin[ibin] > 0)
-        {
-            ntot += nbin[ibin];
-            sum22T += sum22[ibin];
-            sum20T += sum20[ibin];
-            sum02T += sum02[ibin];
-            sum40T += sum40[ibin];
-            sum04T += sum04[ibin];
-            signum = nbin[ibin]*sum22[ibin] - sum20[ibin]*sum02[ibin];
-            if (signum > 0.0)
-            {
-                sigden = (float)sqrt((nbin[ibin]*sum40[ibin]-sum20[ibin]*sum20[ibin])
-                                     *(nbin[ibin]*sum04[ibin]-sum02[ibin]-sum02[ibin]));
-                sigmaA[ibin] = (float)sqrt(signum/sigden)*ratio;
-            }
-            else
-            {
-#ifdef DEBUG
-                sprintf(buf, "Warning: correlation between E**2's is non-positive for bin %d - sigmaA set to 0.05\n", ibin);
-                Logger::log(buf);
-#endif
-                sigmaA[ibin] = 0.05F;
-            }
-            corr = (nbin[ibin]*sum22[ibin] - sum20[ibin]*sum02[ibin])
-                   /(float)sqrt((nbin[ibin]*sum40[ibin]-sum20[ibin]*sum20[ibin])*(nbin[ibin]*sum04[ibin]-sum02[ibin]*sum02[ibin]));
-#ifdef DEBUG
-            sprintf(buf, "%5d  %6.2f-%6.2f   %6d    %6.5f   %6.5f\n", ibin+1,
-                    (float)(0.5/refl[ibin*nrefl/numbins].sthol),
-                    (float)(0.5/refl[std::min((ibin+1)*nrefl/numbins-1, nrefl-1)].sthol),
-                    nbin[ibin], sigmaA[ibin], corr);
-            Logger::log(buf);
-#endif
-        }
+        Logger::log("%5d  %6.2f-%6.2f   %6d    %6.5f   %6.5f\n", i+1,
+                    (float)(0.5/bins[i].stholMin), (float)(0.5/bins[i].stholMax),
+                    bins[i].count, bins[i].sigmaA, bins[i].correlation);
     }
-
-    corr = (ntot*sum22T - sum20T*sum02T)
-           /(float)sqrt((ntot*sum40T-sum20T*sum20T)*(ntot*sum04T-sum02T*sum02T));
-#ifdef DEBUG
-    sprintf(buf, "SigmaA: Overall correlation is %f for %d refl\n", corr, ntot);
-    Logger::log(buf);
-    Logger::log(buf);
 #endif
 
     /* modify Fo and Fc according to sigmaA */
-    for (i = 0; i < nrefl; i++)
-    {
-        ibin = i*numbins/nrefl;
-        eo = refl[i].fo/(float)sqrt(sigman[ibin]*epsilon[i]);
-        ec = refl[i].fc/(float)sqrt(sigman[ibin]*epsilon[i]);
-        Xarg = sigmaA[ibin]*2.0F*eo*ec/(1.0F-sigmaA[ibin]*sigmaA[ibin]);
-        if (!centric[i])
-        {
-            m = sim(Xarg);
-            refl[i].acalc = (2.0F*m*eo-sigmaA[ibin]*ec)*(float)sqrt(sigman[ibin]*epsilon[i]);
-            refl[i].bcalc = m*refl[i].fo-refl[i].fc;
-        }
-        else
-        {
-            m = (float)tanh(Xarg);
-            refl[i].acalc = m*refl[i].fo;
-            refl[i].bcalc = refl[i].fo-refl[i].fc;
-        }
-        refl[i].fom = m;
-        mtot += m;
-        /*
-           if(i%100==0)printf("%3d %3d %3d %5.2f %5.2f %d %f\n",refl[i].ind[0],refl[i].ind[1],refl[i].ind[2],refl[i].fo, refl[i].fc, (int)centric[i], epsilon[i]);
-         */
-    }
-#ifdef DEBUG
-    sprintf(buf, "SigmaA: Average figure of merit is %0.3f\n", mtot/(float)ntot);
-    Logger::log(buf);
-#endif
-
-    free(epsilon);
-    free(centric);
+    scaler.ApplySigmaA(refl, nrefl);
     return nrefl;
 }
 
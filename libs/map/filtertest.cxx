@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/time.h>
+
+#include <math/mathlib.h>
+
+#include "EMapBase.h"
+#include "MapFilter.h"
+#include "maptypes.h"
+#include "testlogger.cxx"
+
+// The solvent mask filters on a real map against the stencils they
+// replaced, which are kept below. The local rms must be the same to the
+// bit; for the Gaussian smoothing the differences from ntimes passes of
+// the 19 point stencil are printed, down to the solvent mask they give.
+// named cxx to avoid being put into compilation of library
+//
+// usage: filtertest [data.mtz [radius [solvent fraction]]]
+// The data must have the FP, SIGFP, FC, PHIC, FOM and FREE columns refmac
+// writes.
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// The previous SigmaMap: rms over the 7 point cross, z innermost
+static void OldSigmaMap(EMapBase &emap, std::vector<float> &points)
+{
+    CMapHeaderBase *mh = emap.GetMapHeader();
+    std::vector<float> map2(points.size());
+    for (int ix = 0; ix < mh->nx; ix++)
+    {
+        for (int iy = 0; iy < mh->ny; iy++)
+        {
+            for (int iz = 0; iz < mh->nz; iz++)
+            {
+                float rho, rhosq = 0.0;
+                rho =  points[emap.mapdex(ix, iy, iz)];
+                rhosq += rho*rho;
+                rho =  points[emap.mapdex(ix+1, iy, iz)];
+                rhosq += rho*rho;
+                rho =  points[emap.mapdex(ix-1, iy, iz)];
+                rhosq += rho*rho;
+                rho =  points[emap.mapdex(ix, iy+1, iz)];
+                rhosq += rho*rho;
+                rho =  points[emap.mapdex(ix, iy-1, iz)];
+                rhosq += rho*rho;
+                rho =  points[emap.mapdex(ix, iy, iz+1)];
+                rhosq += rho*rho;
+                rho =  points[emap.mapdex(ix, iy, iz-1)];
+                rhosq += rho*rho;
+                map2[emap.mapdex(ix, iy, iz)] = sqrt((rhosq-rhosq/7.0f)/6.0f);
+            }
+        }
+    }
+    points = map2;
+}
+
+// The previous SmoothMap: ntimes passes of the 19 point stencil
+static void OldSmoothMap(EMapBase &emap, std::vector<float> &points, int ntimes)
+{
+    CMapHeaderBase *mh = emap.GetMapHeader();
+    std::vector<float> map2(points.size());
+    for (int i = 0; i < ntimes; i++)
+    {
+        for (int ix = 0; ix < mh->nx; ix++)
+        {
+            for (int iy = 0; iy < mh->ny; iy++)
+            {
+                for (int iz = 0; iz < mh->nz; iz++)
+                {
+                    float sum = 2.0F*points[emap.mapdex(ix-1, iy, iz)]
+                                +2.0F*points[emap.mapdex(ix+1, iy, iz)]
+                                +2.0F*points[emap.mapdex(ix, iy-1, iz)]
+                                +2.0F*points[emap.mapdex(ix, iy+1, iz)]
+                                +2.0F*points[emap.mapdex(ix, iy, iz-1)]
+                                +2.0F*points[emap.mapdex(ix, iy, iz+1)]
+                                +points[emap.mapdex(ix+1, iy+1, iz)]
+                                +points[emap.mapdex(ix-1, iy+1, iz)]
+                                +points[emap.mapdex(ix+1, iy-1, iz)]
+                                +points[emap.mapdex(ix-1, iy-1, iz)]
+                                +points[emap.mapdex(ix+1, iy, iz+1)]
+                                +points[emap.mapdex(ix-1, iy, iz+1)]
+                                +points[emap.mapdex(ix+1, iy, iz-1)]
+                                +points[emap.mapdex(ix-1, iy, iz-1)]
+                                +points[emap.mapdex(ix, iy+1, iz+1)]
+                                +points[emap.mapdex(ix, iy-1, iz+1)]
+                                +points[emap.mapdex(ix, iy+1, iz-1)]
+                                +points[emap.mapdex(ix, iy-1, iz-1)]
+                                +6.0F*points[emap.mapdex(ix, iy, iz)];
+                    map2[emap.mapdex(ix, iy, iz)] = sum/30.0f;
+                }
+            }
+        }
+        points = map2;
+    }
+}
+
+static float Rms(const std::vector<float> &points)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        sum += points[i]*points[i];
+    }
+    return (float)sqrt(sum/points.size());
+}
+
+int main(int argc, char **argv)
+{
+    const char *data = argc > 1 ? argv[1] : "../../examples/ligand_example.mtz";
+    float radius = argc > 2 ? (float)atof(argv[2]) : 3.0f;
+    float solvent = argc > 3 ? (float)atof(argv[3]) : 0.5f;
+
+    EMapBase emap;
+    emap.UseColumnLabels("FP", "FC", "FOM", "PHIC", "SIGFP", "FREE");
+    if (!emap.LoadMapPhaseFile(data) || !emap.FFTMap(MIMapType::TwoFoFc, 1) || emap.MapPoints() == NULL)
+    {
+        printf("Cannot calculate a map from %s\n", data);
+        return 1;
+    }
+    CMapHeaderBase *mh = emap.GetMapHeader();
+    std::vector<float> map(emap.MapPoints(), emap.MapPoints() + emap.MapPointCount());
+    printf("2Fo-Fc map of %s: %d x %d x %d points, %.2f A apart\n", data, mh->nx, mh->ny, mh->nz,
+           mh->a/mh->nx);
+
+    // local rms
+    std::vector<float> oldSigma(map);
+    double start = Now();
+    OldSigmaMap(emap, oldSigma);
+    double oldTime = Now() - start;
+    start = Now();
+    emap.SigmaMap();
+    double newTime = Now() - start;
+    std::vector<float> sigma(emap.MapPoints(), emap.MapPoints() + emap.MapPointCount());
+    float sigmaDiff = 0.0f;
+    for (size_t i = 0; i < sigma.size(); ++i)
+    {
+        sigmaDiff = std::max(sigmaDiff, (float)fabs(sigma[i] - oldSigma[i]));
+    }
+    printf("SigmaMap:  old %.3f s, new %.3f s, max difference %g\n", oldTime, newTime, sigmaDiff);
+
+    // smoothing, from the same local rms map
+    int ntimes = ROUND(radius/(mh->a/(float)mh->nx));
+    std::vector<float> oldSmooth(sigma);
+    start = Now();
+    OldSmoothMap(emap, oldSmooth, ntimes);
+    oldTime = Now() - start;
+    start = Now();
+    emap.SmoothMap(radius);
+    newTime = Now() - start;
+    std::vector<float> smooth(emap.MapPoints(), emap.MapPoints() + emap.MapPointCount());
+    double maxDiff = 0.0, sumDiff2 = 0.0, sumXY = 0.0, sumX = 0.0, sumY = 0.0, sumX2 = 0.0, sumY2 = 0.0;
+    for (size_t i = 0; i < smooth.size(); ++i)
+    {
+        double x = oldSmooth[i], y = smooth[i];
+        maxDiff = std::max(maxDiff, fabs(x - y));
+        sumDiff2 += (x - y)*(x - y);
+        sumX += x;
+        sumY += y;
+        sumXY += x*y;
+        sumX2 += x*x;
+        sumY2 += y*y;
+    }
+    double n = (double)smooth.size();
+    double cc = (sumXY - sumX*sumY/n)/sqrt((sumX2 - sumX*sumX/n)*(sumY2 - sumY*sumY/n));
+    float oldRms = Rms(oldSmooth);
+    printf("SmoothMap: %d passes against sigma %.2f, old %.3f s, new %.3f s\n", ntimes, sqrt(0.4f*ntimes),
+           oldTime, newTime);
+    printf("           max difference %.4g (%.2f%% of the old rms), rms difference %.4g (%.2f%%), correlation %.6f\n",
+           maxDiff, 100.0*maxDiff/oldRms, sqrt(sumDiff2/n), 100.0*sqrt(sumDiff2/n)/oldRms, cc);
+
+    // the solvent masks the two give
+    float oldCut = MapFilter::Percentile(&oldSmooth[0], oldSmooth.size(), solvent);
+    float cut = MapFilter::Percentile(&smooth[0], smooth.size(), solvent);
+    size_t same = 0;
+    for (size_t i = 0; i < smooth.size(); ++i)
+    {
+        if ((oldSmooth[i] < oldCut) == (smooth[i] < cut))
+        {
+            same++;
+        }
+    }
+    printf("Solvent mask at %.0f%%: %.3f%% of points agree\n", 100.0*solvent, 100.0*same/n);
+
+    if (sigmaDiff != 0.0f)
+    {
+        printf("FAILED: SigmaMap differs from the 7 point cross\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
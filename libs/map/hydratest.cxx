@@ -0,0 +1,616 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <vector>
+#include <sys/time.h>
+
+#include <chemlib/chemlib.h>
+#include <chemlib/MIMolDictionary.h>
+#include <chemlib/MIMoleculeBase.h>
+#include <chemlib/PDB.h>
+#include <chemlib/Residue.h>
+#include <math/mathlib.h>
+
+#include "EMapBase.h"
+#include "MINATOM.h"
+#include "PEAK.h"
+#include "testlogger.cxx"
+
+// Water picking on maps of isolated peaks against the search it replaced,
+// which is kept below: every grid point above the level checked against
+// all atoms and symmetry atoms, then moved next to the nearest atom. On
+// such maps every peak is a local maximum, so in orthogonal cells both
+// must add the same waters at the same places. In every cell, oblique
+// ones too, each water is checked by brute force for its distances to
+// the model and the other waters.
+// named cxx to avoid being put into compilation of library
+//
+// usage: hydratest [model.pdb [peaks]]
+
+using namespace chemlib;
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// A map whose points are set directly
+class PeakMap : public EMapBase
+{
+public:
+    void SetPoints(const std::vector<float> &points)
+    {
+        map_points = points;
+    }
+};
+
+// The previous search, without its logging
+
+static int rcompare(const void *i, const void *j)
+{
+    return ((PEAK*)j)->rho - ((PEAK*)i)->rho;
+}
+
+static void fixcell(MINATOM *a)
+{
+    a->tx = a->ty = a->tz = 0.0;
+    while (a->fx < 0.0)
+    {
+        a->fx += 1.0;
+        a->tx += 1.0;
+    }
+    while (a->fx >= 1.0)
+    {
+        a->fx -= 1.0;
+        a->tx -= 1.0;
+    }
+    while (a->fy < 0.0)
+    {
+        a->fy += 1.0;
+        a->ty += 1.0;
+    }
+    while (a->fy >= 1.0)
+    {
+        a->fy -= 1.0;
+        a->ty -= 1.0;
+    }
+    while (a->fz < 0.0)
+    {
+        a->fz += 1.0;
+        a->tz += 1.0;
+    }
+    while (a->fz >= 1.0)
+    {
+        a->fz -= 1.0;
+        a->tz -= 1.0;
+    }
+}
+
+// Brings d into [-0.5, 0.5], moving s by the same whole cells
+static void Wrap(float &d, float &s)
+{
+    while (d < -0.5)
+    {
+        s += 1.0;
+        d += 1.0;
+    }
+    while (d > 0.5)
+    {
+        s -= 1.0;
+        d -= 1.0;
+    }
+}
+
+static void PutNearProtein(float fx, float fy, float fz, MINATOM *atoms, int natoms, float *bx, float *by, float *bz, CMapHeaderBase *mh)
+{
+    float dbest = FLT_MAX;
+    for (int isymm = 0; isymm < mh->nsym; isymm++)
+    {
+        float sx, sy, sz;
+        mh->symm_mh(fx, fy, fz, &sx, &sy, &sz, isymm);
+        for (int j = 0; j < natoms; j++)
+        {
+            float cx = atoms[j].cx;
+            float cy = atoms[j].cy;
+            float cz = atoms[j].cz;
+            transform(mh->ctof, &cx, &cy, &cz);
+            float dx = sx-cx;
+            float dy = sy-cy;
+            float dz = sz-cz;
+            Wrap(dx, sx);
+            Wrap(dy, sy);
+            Wrap(dz, sz);
+            transform(mh->ftoc, &dx, &dy, &dz);
+            float dsquared = dx*dx+dy*dy+dz*dz;
+            if (dsquared < dbest)
+            {
+                float tx = sx, ty = sy, tz = sz;
+                transform(mh->ftoc, &tx, &ty, &tz);
+                *bx = tx;
+                *by = ty;
+                *bz = tz;
+                dbest = dsquared;
+            }
+        }
+    }
+}
+
+static int FarCheck(float cx, float cy, float cz, MINATOM *atoms, int natoms, float dmax)
+{
+    float dmin = dmax*dmax;
+    for (int i = 0; i < natoms; i++)
+    {
+        float dx = cx - atoms[i].cx;
+        float dy = cy - atoms[i].cy;
+        float dz = cz - atoms[i].cz;
+        if (dx*dx+dy*dy+dz*dz < dmin)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int NearCheck(float fx, float fy, float fz, MINATOM *atoms, int natoms, CMapHeaderBase *mh, int add_water, float dmin)
+{
+    float dC = 3.0*3.0;
+    float dO = dmin*dmin;
+    if (add_water == 0)
+    {
+        dC = dO;
+    }
+    fx -= floor(fx);
+    fy -= floor(fy);
+    fz -= floor(fz);
+
+    /* 3.3 Angstroms in fractional units */
+    float fdx = 3.3f/mh->a;
+    float fdy = 3.3f/mh->b;
+    float fdz = 3.3f/mh->c;
+    for (int j = 0; j < natoms; j++)
+    {
+        float dx = fx-atoms[j].fx;
+        float dy = fy-atoms[j].fy;
+        float dz = fz-atoms[j].fz;
+        float unused;
+        Wrap(dx, unused);
+        Wrap(dy, unused);
+        Wrap(dz, unused);
+        if (fabs(dx) < fdx && fabs(dy) < fdy && fabs(dz) < fdz)
+        {
+            transform(mh->ftoc, &dx, &dy, &dz);
+            float dsquared = dx*dx+dy*dy+dz*dz;
+            char type = atoms[j].type;
+            if (dsquared < ((type == 'N' || type == 'O') ? dO : dC))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static MINATOM MakeAtom(float x, float y, float z, char type, CMapHeaderBase *mh)
+{
+    MINATOM atom;
+    atom.fx = atom.cx = x;
+    atom.fy = atom.cy = y;
+    atom.fz = atom.cz = z;
+    atom.symm = 0;
+    atom.type = type;
+    transform(mh->ctof, &atom.fx, &atom.fy, &atom.fz);
+    fixcell(&atom);
+    return atom;
+}
+
+static void AddSymmAtoms(const MINATOM &atom, CMapHeaderBase *mh, std::vector<MINATOM> &symatoms)
+{
+    for (int j = 1; j < mh->nsym; j++)
+    {
+        float fx = atom.cx, fy = atom.cy, fz = atom.cz;
+        transform(mh->ctof, &fx, &fy, &fz);
+        MINATOM symatom;
+        mh->symm_mh(fx, fy, fz, &symatom.fx, &symatom.fy, &symatom.fz, j);
+        symatom.cx = symatom.fx;
+        symatom.cy = symatom.fy;
+        symatom.cz = symatom.fz;
+        transform(mh->ftoc, &symatom.cx, &symatom.cy, &symatom.cz);
+        fixcell(&symatom);
+        symatom.symm = j;
+        symatom.type = atom.type;
+        symatoms.push_back(symatom);
+    }
+}
+
+// The previous HydrateMap for waters over the whole cell
+static int OldHydrateMap(EMapBase &emap, int minlevel, int maxadd, MIMoleculeBase *model, float dmin, float dmax)
+{
+    CMapHeaderBase *mh = emap.GetMapHeader();
+    std::vector<MINATOM> atoms;
+    std::vector<MINATOM> symatoms;
+    for (Residue *res = model->residuesBegin(); res != NULL; res = res->next())
+    {
+        for (int j = 0; j < res->atomCount(); j++)
+        {
+            MIAtom *a = res->atom(j);
+            if (a->name()[0] != 'H')
+            {
+                atoms.push_back(MakeAtom(a->x(), a->y(), a->z(), a->name()[0], mh));
+            }
+        }
+    }
+    for (size_t i = 0; i < atoms.size(); i++)
+    {
+        AddSymmAtoms(atoms[i], mh, symatoms);
+    }
+
+    std::vector<PEAK> peaks;
+    for (int ix = 0; ix < mh->nx; ix++)
+    {
+        for (int iy = 0; iy < mh->ny; iy++)
+        {
+            for (int iz = 0; iz < mh->nz; iz++)
+            {
+                float fx = (float)ix/(float)mh->nx;
+                float fy = (float)iy/(float)mh->ny;
+                float fz = (float)iz/(float)mh->nz;
+                if (emap.avgrho(fx, fy, fz) >= (float)minlevel)
+                {
+                    PEAK peak;
+                    peak.ix = ix;
+                    peak.iy = iy;
+                    peak.iz = iz;
+                    peak.rho = (int)emap.avgrho(fx, fy, fz);
+                    peaks.push_back(peak);
+                }
+            }
+        }
+    }
+    qsort(&peaks[0], peaks.size(), sizeof(PEAK), rcompare);
+
+    float dsquared = dmin * dmin;
+    int imin = ROUND(dmin/mh->a*(float)mh->nx);
+    int psize = peaks.size();
+    for (int i = 0; i < psize; i++)
+    {
+        if (peaks[i].rho <= 0)
+        {
+            continue;
+        }
+        for (int j = 0; j < psize; j++)
+        {
+            if (j != i && peaks[j].rho > 0 && abs(peaks[i].ix-peaks[j].ix) <= imin)
+            {
+                float fx = (float)abs(peaks[i].ix-peaks[j].ix)/(float)mh->nx;
+                float fy = (float)(peaks[i].iy-peaks[j].iy)/(float)mh->ny;
+                float fz = (float)(peaks[i].iz-peaks[j].iz)/(float)mh->nz;
+                transform(mh->ftoc, &fx, &fy, &fz);
+                if (fx*fx+fy*fy+fz*fz <= dsquared)
+                {
+                    peaks[j].rho = -peaks[j].rho;
+                }
+            }
+        }
+    }
+
+    int nadd = 0;
+    for (int i = 0; i < psize && nadd < maxadd; i++)
+    {
+        if (peaks[i].rho <= 0)
+        {
+            continue;
+        }
+        float fx = (float)peaks[i].ix/(float)mh->nx;
+        float fy = (float)peaks[i].iy/(float)mh->ny;
+        float fz = (float)peaks[i].iz/(float)mh->nz;
+        if (!NearCheck(fx, fy, fz, &atoms[0], atoms.size(), mh, 1, dmin)
+            || (!symatoms.empty() && !NearCheck(fx, fy, fz, &symatoms[0], symatoms.size(), mh, 1, dmin)))
+        {
+            continue;
+        }
+        float cx, cy, cz;
+        PutNearProtein(fx, fy, fz, &atoms[0], atoms.size(), &cx, &cy, &cz, mh);
+        if (!FarCheck(cx, cy, cz, &atoms[0], atoms.size(), dmax))
+        {
+            continue;
+        }
+        Residue *water = model->AddWater(cx, cy, cz, false);
+        if (water)
+        {
+            nadd++;
+            MINATOM atom = MakeAtom(water->atom(0)->x(), water->atom(0)->y(), water->atom(0)->z(), 'O', mh);
+            AddSymmAtoms(atom, mh, symatoms);
+            atoms.push_back(atom);
+        }
+    }
+    model->Build();
+    return nadd;
+}
+
+struct CellCase
+{
+    const char *name;
+    int spgpno;
+    float a, b, c, alpha, beta, gamma;
+    bool compare;
+};
+
+// Random grid points, none next to another; those closer than dmin are
+// left to the deduplication
+static std::vector<float> PeakPoints(int nx, int ny, int nz, int npeaks)
+{
+    std::vector<float> points((size_t)nx*ny*nz, 0.0f);
+    std::vector<int> levels;
+    for (int i = 0; i < npeaks; ++i)
+    {
+        levels.push_back(60 + i);
+    }
+    std::random_shuffle(levels.begin(), levels.end());
+    std::set<int> taken;
+    for (int i = 0; i < npeaks; ++i)
+    {
+        int ix, iy, iz;
+        bool clash;
+        do
+        {
+            ix = rand() % nx;
+            iy = rand() % ny;
+            iz = rand() % nz;
+            clash = false;
+            for (int dx = -1; dx <= 1 && !clash; ++dx)
+            {
+                for (int dy = -1; dy <= 1 && !clash; ++dy)
+                {
+                    for (int dz = -1; dz <= 1 && !clash; ++dz)
+                    {
+                        int jx = (ix + dx + nx) % nx, jy = (iy + dy + ny) % ny, jz = (iz + dz + nz) % nz;
+                        clash = taken.count((jz*ny + jy)*nx + jx) != 0;
+                    }
+                }
+            }
+        } while (clash);
+        taken.insert((iz*ny + iy)*nx + ix);
+        points[(iz*ny + iy)*nx + ix] = (float)levels[i];
+    }
+    return points;
+}
+
+// PDB::Read keeps only the first residue
+static MIMoleculeBase *ReadModel(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    std::vector<Bond> connects;
+    Residue *residues = fp != NULL ? LoadPDB(fp, &connects) : NULL;
+    if (residues == NULL)
+    {
+        return NULL;
+    }
+    fclose(fp);
+    return new MIMoleculeBase(residues, "model", connects.empty() ? NULL : &connects[0], (int)connects.size());
+}
+
+// Heavy atom positions and types of the model, the waters added last
+static void Atoms(MIMoleculeBase *model, std::vector<float> &positions, std::vector<char> &types)
+{
+    for (Residue *res = model->residuesBegin(); res != NULL; res = res->next())
+    {
+        for (int j = 0; j < res->atomCount(); ++j)
+        {
+            MIAtom *a = res->atom(j);
+            if (a->name()[0] != 'H')
+            {
+                positions.push_back(a->x());
+                positions.push_back(a->y());
+                positions.push_back(a->z());
+                types.push_back(a->name()[0]);
+            }
+        }
+    }
+}
+
+// Cartesian length of the shortest lattice translate of the fractional
+// vector d; in oblique cells that need not be the one in [-0.5, 0.5]
+static float ShortestImage(float d[3], CMapHeaderBase *mh, bool oblique)
+{
+    float best = FLT_MAX;
+    int range = oblique ? 1 : 0;
+    for (int q = 0; q < 3; ++q)
+    {
+        d[q] -= (float)floor(d[q] + 0.5f);
+    }
+    for (int kx = -range; kx <= range; ++kx)
+    {
+        for (int ky = -range; ky <= range; ++ky)
+        {
+            for (int kz = -range; kz <= range; ++kz)
+            {
+                float x = d[0] + kx, y = d[1] + ky, z = d[2] + kz;
+                transform(mh->ftoc, &x, &y, &z);
+                best = std::min(best, (float)sqrt(x*x + y*y + z*z));
+            }
+        }
+    }
+    return best;
+}
+
+// Checks each added water by brute force against every symmetry image of
+// the other atoms: it must keep dmin from N, O and the other waters, 3A
+// from everything else, and lie within dmax of some atom
+static int BadWaters(const std::vector<float> &positions, const std::vector<char> &types, size_t first,
+                     CMapHeaderBase *mh, float dmin, float dmax)
+{
+    bool oblique = mh->alpha != 90.0f || mh->beta != 90.0f || mh->gamma != 90.0f;
+    int bad = 0;
+    for (size_t i = first; i < types.size(); ++i)
+    {
+        float w[3] = { positions[3*i], positions[3*i+1], positions[3*i+2] };
+        transform(mh->ctof, &w[0], &w[1], &w[2]);
+        bool clear = true;
+        float nearest = FLT_MAX;
+        for (size_t j = 0; j < types.size() && clear; ++j)
+        {
+            if (j == i)
+            {
+                continue;
+            }
+            float a[3] = { positions[3*j], positions[3*j+1], positions[3*j+2] };
+            transform(mh->ctof, &a[0], &a[1], &a[2]);
+            float clearance = (types[j] == 'N' || types[j] == 'O') ? dmin : 3.0f;
+            for (int isymm = 0; isymm < mh->nsym; ++isymm)
+            {
+                float s[3];
+                mh->symm_mh(a[0], a[1], a[2], &s[0], &s[1], &s[2], isymm);
+                float d[3] = { w[0] - s[0], w[1] - s[1], w[2] - s[2] };
+                float distance = ShortestImage(d, mh, oblique);
+                // dmin less a little for the rounding of the two positions
+                if (distance < clearance - 1.0e-3f)
+                {
+                    clear = false;
+                    break;
+                }
+                nearest = std::min(nearest, distance);
+            }
+        }
+        if (!clear || nearest >= dmax)
+        {
+            bad++;
+        }
+    }
+    return bad;
+}
+
+// Whether the position b is one of the symmetry images of a
+static bool Equivalent(const float a[3], const float b[3], CMapHeaderBase *mh)
+{
+    float fa[3] = { a[0], a[1], a[2] };
+    float fb[3] = { b[0], b[1], b[2] };
+    transform(mh->ctof, &fa[0], &fa[1], &fa[2]);
+    transform(mh->ctof, &fb[0], &fb[1], &fb[2]);
+    for (int isymm = 0; isymm < mh->nsym; ++isymm)
+    {
+        float s[3];
+        mh->symm_mh(fa[0], fa[1], fa[2], &s[0], &s[1], &s[2], isymm);
+        float d[3] = { fb[0] - s[0], fb[1] - s[1], fb[2] - s[2] };
+        if (ShortestImage(d, mh, false) < 1.0e-3f)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "../../examples/ligand_example.pdb";
+    int npeaks = argc > 2 ? atoi(argv[2]) : 5000;
+    const float dmin = 2.3f, dmax = 7.0f;
+    const int minlevel = 50, maxadd = 100000;
+
+    // The previous search wrapped fractional differences into [-0.5, 0.5]
+    // to find the nearest image, which in an oblique cell can miss it and
+    // reject a water that is in fact near the model, so it is compared
+    // only in the orthogonal cells
+    static const CellCase cases[] =
+    {
+        { "P4(3)2(1)2", 96, 91.154f, 91.154f, 128.585f, 90.0f, 90.0f, 90.0f, true },
+        { "P2(1)2(1)2(1)", 19, 91.154f, 95.0f, 128.585f, 90.0f, 90.0f, 90.0f, true },
+        { "P2(1)", 4, 91.154f, 95.0f, 128.585f, 90.0f, 90.0f, 90.0f, true },
+        { "P2(1) oblique", 4, 91.154f, 95.0f, 128.585f, 90.0f, 100.0f, 90.0f, false }
+    };
+
+    // The models are built with bonds by distance
+    MIMolDictionary dictionary;
+    MISetDictionary(&dictionary);
+
+    bool ok = true;
+    srand(1);
+    for (size_t k = 0; k < sizeof(cases)/sizeof(cases[0]); ++k)
+    {
+        const CellCase &cell = cases[k];
+        PeakMap emap;
+        CMapHeaderBase *mh = emap.GetMapHeader();
+        mh->a = cell.a;
+        mh->b = cell.b;
+        mh->c = cell.c;
+        mh->alpha = cell.alpha;
+        mh->beta = cell.beta;
+        mh->gamma = cell.gamma;
+        mh->spgpno = cell.spgpno;
+        mh->SetSymmOps();
+        mh->nx = 2*ROUND(cell.a/2.0f);
+        mh->ny = 2*ROUND(cell.b/2.0f);
+        mh->nz = 2*ROUND(cell.c/2.0f);
+        emap.SetPoints(PeakPoints(mh->nx, mh->ny, mh->nz, npeaks));
+
+        MIMoleculeBase *oldModel = ReadModel(path);
+        MIMoleculeBase *newModel = ReadModel(path);
+        if (oldModel == NULL || newModel == NULL)
+        {
+            printf("Cannot read %s\n", path);
+            return 1;
+        }
+        std::vector<float> positions;
+        std::vector<char> types;
+        Atoms(newModel, positions, types);
+        size_t modelAtoms = types.size();
+
+        double start = Now();
+        int oldAdded = OldHydrateMap(emap, minlevel, maxadd, oldModel, dmin, dmax);
+        double oldTime = Now() - start;
+        start = Now();
+        int newAdded = emap.HydrateMap(minlevel, maxadd, 1, newModel, dmin, dmax, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f);
+        double newTime = Now() - start;
+        printf("%-14s %d symops, %d x %d x %d grid, %d peaks: old %d waters in %.2f s, new %d in %.2f s\n",
+               cell.name, mh->nsym, mh->nx, mh->ny, mh->nz, npeaks, oldAdded, oldTime, newAdded, newTime);
+
+        std::vector<float> oldPositions;
+        std::vector<char> oldTypes;
+        Atoms(oldModel, oldPositions, oldTypes);
+        positions.clear();
+        types.clear();
+        Atoms(newModel, positions, types);
+
+        // The same peaks taken in the same order; a peak equally near two
+        // images of the model, such as one on a symmetry axis, may be
+        // moved next to either
+        if (cell.compare)
+        {
+            int same = 0, moved = 0;
+            for (size_t i = modelAtoms; i < types.size() && i < oldTypes.size(); ++i)
+            {
+                const float *a = &oldPositions[3*i];
+                const float *b = &positions[3*i];
+                if (fabs(a[0] - b[0]) < 1.0e-3f && fabs(a[1] - b[1]) < 1.0e-3f && fabs(a[2] - b[2]) < 1.0e-3f)
+                {
+                    same++;
+                }
+                else if (Equivalent(a, b, mh))
+                {
+                    moved++;
+                }
+            }
+            printf("               %d at the same place, %d at a symmetry image of it\n", same, moved);
+            if (oldAdded != newAdded || same + moved != newAdded)
+            {
+                printf("FAILED: %s waters differ from the previous search\n", cell.name);
+                ok = false;
+            }
+        }
+
+        int bad = BadWaters(positions, types, modelAtoms, mh, dmin, dmax);
+        if (bad != 0)
+        {
+            printf("FAILED: %s has %d waters too near an atom or too far from the model\n", cell.name, bad);
+            ok = false;
+        }
+        delete oldModel;
+        delete newModel;
+    }
+    printf(ok ? "OK\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
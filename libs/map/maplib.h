@@ -17,8 +17,11 @@ unsigned int MIMapFreeScatteringFactorTables();
 #include "MAP_POINT.h"
 #include "MapSettingsBase.h"
 #include "InterpBox.h"
+#include "MapFilter.h"
+#include "ReflectionScaling.h"
 #include "maptypes.h"
 #include "CREFL.h"
+#include "MRSolution.h"
 
 // private #include "fssubs.h"
 // private #include "fft.h"
@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/time.h>
+
+#include <chemlib/chemlib.h>
+#include <chemlib/MIMolDictionary.h>
+#include <chemlib/PDB.h>
+#include <chemlib/Residue.h>
+
+#include "EMapBase.h"
+#include "maplib.h"
+#include "maptypes.h"
+#include "rescalc.h"
+#include "testlogger.cxx"
+
+// The FFT translation search on structure factors of a fragment placed
+// with a known rotation and shift in an oblique P1 cell. The structure
+// factors are summed directly here from the atoms, so they do not share
+// the library's density or transforms. The best solution must put the
+// search model back where the fragment is, to within a grid step, with
+// a rotation on the search's grid and one off it.
+// named cxx to avoid being put into compilation of library
+//
+// usage: mrtest [model.pdb [residues]]
+
+using namespace chemlib;
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static const float resolution = 3.0f;
+static const float searchStep = 30.0f;
+
+struct Placement
+{
+    const char *name;
+    float euler[3];
+    float shift[3];     // fractional position of the centroid
+};
+
+// z-y-z rotation by alpha, beta and gamma degrees
+static void Rotation(const float euler[3], double mat[3][3])
+{
+    double d = acos(-1.0)/180.0;
+    double ca = cos(euler[0]*d), sa = sin(euler[0]*d);
+    double cb = cos(euler[1]*d), sb = sin(euler[1]*d);
+    double cg = cos(euler[2]*d), sg = sin(euler[2]*d);
+    mat[0][0] = ca*cb*cg - sa*sg;
+    mat[0][1] = -ca*cb*sg - sa*cg;
+    mat[0][2] = ca*sb;
+    mat[1][0] = sa*cb*cg + ca*sg;
+    mat[1][1] = -sa*cb*sg + ca*cg;
+    mat[1][2] = sa*sb;
+    mat[2][0] = -sb*cg;
+    mat[2][1] = sb*sg;
+    mat[2][2] = cb;
+}
+
+// F(h) = sum of Z exp(-B s^2) exp(2 pi i h.x) over the atoms, for all
+// reflections of the upper half of reciprocal space to the resolution
+static void MakeReflections(CMapHeaderBase *mh, const std::vector<MIAtom*> &atoms, const std::vector<float> &xyz,
+                            std::vector<CREFL> &refls)
+{
+    std::vector<float> fractional(xyz);
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        mh->CtoF(&fractional[3*i], &fractional[3*i+1], &fractional[3*i+2]);
+    }
+    ReciprocalCell cell(mh->a, mh->b, mh->c, mh->alpha, mh->beta, mh->gamma);
+    float limit = 0.5f/resolution;
+    int hmax = (int)(mh->a/resolution) + 1;
+    int kmax = (int)(mh->b/resolution) + 1;
+    int lmax = (int)(mh->c/resolution) + 1;
+    double twopi = 2.0*acos(-1.0);
+    for (int h = -hmax; h <= hmax; h++)
+    {
+        for (int k = -kmax; k <= kmax; k++)
+        {
+            for (int l = 0; l <= lmax; l++)
+            {
+                if (l == 0 && (k < 0 || (k == 0 && h <= 0)))
+                {
+                    continue;
+                }
+                float sthol = cell.sthol(h, k, l);
+                if (sthol > limit)
+                {
+                    continue;
+                }
+                double a = 0.0, b = 0.0;
+                for (size_t i = 0; i < atoms.size(); ++i)
+                {
+                    int z = atoms[i]->atomicnumber() > 0 ? atoms[i]->atomicnumber() : 6;
+                    double f = z*exp(-atoms[i]->BValue()*sthol*sthol);
+                    double angle = twopi*(h*fractional[3*i] + k*fractional[3*i+1] + l*fractional[3*i+2]);
+                    a += f*cos(angle);
+                    b += f*sin(angle);
+                }
+                CREFL r;
+                memset(&r, 0, sizeof(r));
+                r.ind[0] = h;
+                r.ind[1] = k;
+                r.ind[2] = l;
+                r.sthol = sthol;
+                r.fo = (float)sqrt(a*a + b*b);
+                r.phi = (float)(atan2(b, a)*180.0/acos(-1.0));
+                r.sigma = 1.0f;
+                r.fom = 1.0f;
+                refls.push_back(r);
+            }
+        }
+    }
+}
+
+// The grid and resolution limits MIMolOpt::MolecularReplace sets up
+static void SetupSearch(CMapHeaderBase *mh)
+{
+    mh->resmin = resolution;
+    mh->resmax = 20.0f;
+    mh->maptype = MIMapType::Fo;
+    float grid = 2.5f;
+    mh->nx = MIMapFactor((int)(grid*mh->a/mh->resmin), FFT_PRIME, EVEN, 2);
+    mh->ny = MIMapFactor((int)(grid*mh->b/mh->resmin), FFT_PRIME, EVEN, 2);
+    mh->nz = MIMapFactor((int)(grid*mh->c/mh->resmin), FFT_PRIME, EVEN, 2);
+    mh->hmax = (int)(mh->a/mh->resmin);
+    mh->kmax = (int)(mh->b/mh->resmin);
+    mh->lmax = (int)(mh->c/mh->resmin);
+    while (mh->nx <= 2*mh->hmax)
+    {
+        mh->nx = MIMapFactor(mh->nx+1, FFT_PRIME, EVEN, 2);
+    }
+    while (mh->ny <= 2*mh->kmax)
+    {
+        mh->ny = MIMapFactor(mh->ny+1, FFT_PRIME, EVEN, 2);
+    }
+    while (mh->nz <= 2*mh->lmax)
+    {
+        mh->nz = MIMapFactor(mh->nz+1, FFT_PRIME, EVEN, 2);
+    }
+}
+
+// Rms distance of the solution's placement of the centred atoms from the
+// true positions, taking the lattice translation that brings the
+// centroids closest
+static float PlacementError(CMapHeaderBase *mh, const std::vector<float> &centred, const std::vector<float> &truth,
+                            const MRSolution &solution)
+{
+    size_t n = centred.size()/3;
+    float t[3] = { solution.translation[0], solution.translation[1], solution.translation[2] };
+    mh->FtoC(&t[0], &t[1], &t[2]);
+    std::vector<float> placed(centred.size());
+    float offset[3] = { 0.0f, 0.0f, 0.0f };
+    for (size_t i = 0; i < n; ++i)
+    {
+        const float *x = &centred[3*i];
+        for (int j = 0; j < 3; ++j)
+        {
+            const float *row = solution.rotation[j];
+            placed[3*i+j] = x[0]*row[0] + x[1]*row[1] + x[2]*row[2] + t[j];
+            offset[j] += (truth[3*i+j] - placed[3*i+j])/(float)n;
+        }
+    }
+    mh->CtoF(&offset[0], &offset[1], &offset[2]);
+    for (int j = 0; j < 3; ++j)
+    {
+        offset[j] = (float)floor(offset[j] + 0.5f);
+    }
+    mh->FtoC(&offset[0], &offset[1], &offset[2]);
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            double d = placed[3*i+j] + offset[j] - truth[3*i+j];
+            sum += d*d;
+        }
+    }
+    return (float)sqrt(sum/n);
+}
+
+int main(int argc, char **argv)
+{
+    const char *model = argc > 1 ? argv[1] : "../../examples/ligand_example.pdb";
+    int nresidues = argc > 2 ? atoi(argv[2]) : 12;
+
+    MIMolDictionary dictionary;
+    MISetDictionary(&dictionary);
+    MIMapInitializeScatteringFactorTables("", "");
+
+    // PDB::Read keeps only the first residue
+    FILE *fp = fopen(model, "r");
+    std::vector<Bond> connects;
+    Residue *residues = fp != NULL ? LoadPDB(fp, &connects) : NULL;
+    if (residues == NULL)
+    {
+        printf("Cannot read %s\n", model);
+        return 1;
+    }
+    fclose(fp);
+
+    // the heavy atoms of the first residues, centred
+    std::vector<MIAtom*> atoms;
+    int n = 0;
+    for (Residue *res = residues; res != NULL && n < nresidues; res = res->next(), ++n)
+    {
+        for (int i = 0; i < res->atomCount(); ++i)
+        {
+            if (res->atom(i)->name()[0] != 'H')
+            {
+                atoms.push_back(res->atom(i));
+            }
+        }
+    }
+    float centroid[3] = { 0.0f, 0.0f, 0.0f };
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        centroid[0] += atoms[i]->x()/(float)atoms.size();
+        centroid[1] += atoms[i]->y()/(float)atoms.size();
+        centroid[2] += atoms[i]->z()/(float)atoms.size();
+    }
+    std::vector<float> centred;
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        centred.push_back(atoms[i]->x() - centroid[0]);
+        centred.push_back(atoms[i]->y() - centroid[1]);
+        centred.push_back(atoms[i]->z() - centroid[2]);
+    }
+
+    Placement placements[] =
+    {
+        { "on the grid ", { 60.0f, 90.0f, 120.0f }, { 0.31f, 0.62f, 0.27f } },
+        { "off the grid", { 7.0f, 4.0f, 351.0f }, { 0.83f, 0.14f, 0.55f } }
+    };
+    int failures = 0;
+    for (size_t p = 0; p < sizeof(placements)/sizeof(placements[0]); ++p)
+    {
+        const Placement &placement = placements[p];
+        EMapBase emap;
+        CMapHeaderBase *mh = emap.GetMapHeader();
+        mh->a = 42.0f;
+        mh->b = 46.0f;
+        mh->c = 50.0f;
+        mh->alpha = 90.0f;
+        mh->beta = 98.0f;
+        mh->gamma = 90.0f;
+        mh->spgpno = 1;
+        mh->SetSymmOps();
+        SetupSearch(mh);
+
+        double mat[3][3];
+        Rotation(placement.euler, mat);
+        float t[3] = { placement.shift[0], placement.shift[1], placement.shift[2] };
+        mh->FtoC(&t[0], &t[1], &t[2]);
+        std::vector<float> truth(centred.size());
+        for (size_t i = 0; i < atoms.size(); ++i)
+        {
+            const float *x = &centred[3*i];
+            for (int j = 0; j < 3; ++j)
+            {
+                truth[3*i+j] = (float)(mat[j][0]*x[0] + mat[j][1]*x[1] + mat[j][2]*x[2]) + t[j];
+            }
+        }
+        MakeReflections(mh, atoms, truth, emap.refls);
+
+        // the search model sits at the origin, as MolecularReplace puts it
+        for (size_t i = 0; i < atoms.size(); ++i)
+        {
+            atoms[i]->setPosition(centred[3*i], centred[3*i+1], centred[3*i+2]);
+        }
+        double start = Now();
+        std::vector<MRSolution> solutions = emap.TranslationSearch(atoms, searchStep, 5);
+        double seconds = Now() - start;
+        if (solutions.empty())
+        {
+            printf("FAILED: %s: no solutions\n", placement.name);
+            ++failures;
+            continue;
+        }
+        const MRSolution &best = solutions[0];
+        float error = PlacementError(mh, centred, truth, best);
+        float spacing = std::max(mh->a/mh->nx, std::max(mh->b/mh->ny, mh->c/mh->nz));
+        printf("%s %d atoms, %d reflections, %d x %d x %d grid: score %.3f Euler %.0f %.0f %.0f, "
+               "placed %.2f A from the truth in %.2f s\n",
+               placement.name, (int)atoms.size(), (int)emap.refls.size(), mh->nx, mh->ny, mh->nz, best.score,
+               best.euler[0], best.euler[1], best.euler[2], error, seconds);
+        float tolerance = p == 0 ? spacing : 2.0f*spacing;
+        if (error > tolerance)
+        {
+            printf("FAILED: %s: the best solution is %.2f A from the truth, more than %.2f A\n",
+                   placement.name, error, tolerance);
+            ++failures;
+        }
+        if (solutions.size() > 1 && best.score < solutions[1].score)
+        {
+            printf("FAILED: %s: solutions are not sorted by score\n", placement.name);
+            ++failures;
+        }
+    }
+
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures != 0;
+}
@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/time.h>
+
+#include <chemlib/chemlib.h>
+#include <chemlib/PDB.h>
+#include <chemlib/Residue.h>
+#include <math/mathlib.h>
+#include <util/parallel.h>
+
+#include "EMapBase.h"
+#include "testlogger.cxx"
+
+// NCS averaging on a map of two copies of a model, drawn as Gaussian atoms
+// with noise added in an oblique P1 cell, the second copy placed by a
+// known rotation and shift. The averaged map is checked point by point
+// against an average worked out here in Cartesian coordinates, the noise
+// in both copies must fall, every point outside them must be left alone
+// and the result must be the same to the bit on one thread and on
+// several. Without a mask it must agree with NCRAverage. Then the
+// operator is knocked off by a small rotation and shift, and
+// RefineNCSOperators must bring it back.
+// named cxx to avoid being put into compilation of library
+//
+// usage: ncstest [model.pdb [threads]]
+
+using namespace chemlib;
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+class PointMap : public EMapBase
+{
+public:
+    void SetPoints(const std::vector<float> &points)
+    {
+        map_points = points;
+    }
+};
+
+static const float gridSpacing = 0.75f;
+static const float atomSigma = 1.0f;
+static const float maskRadius = 2.5f;
+
+static float Gaussian()
+{
+    float u = (rand() + 0.5f) / ((float)RAND_MAX + 1.0f);
+    float v = (rand() + 0.5f) / ((float)RAND_MAX + 1.0f);
+    return (float)(sqrt(-2.0*log(u))*cos(2.0*acos(-1.0)*v));
+}
+
+// Rotation by angle degrees about axis
+static void Rotation(const float axis[3], float angle, float r[3][3])
+{
+    float length = (float)sqrt(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+    float u[3] = { axis[0]/length, axis[1]/length, axis[2]/length };
+    float c = (float)cos(angle*acos(-1.0)/180.0);
+    float s = (float)sin(angle*acos(-1.0)/180.0);
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            r[i][j] = (1.0f - c)*u[i]*u[j] + (i == j ? c : 0.0f);
+        }
+    }
+    r[0][1] -= s*u[2];
+    r[0][2] += s*u[1];
+    r[1][0] += s*u[2];
+    r[1][2] -= s*u[0];
+    r[2][0] -= s*u[1];
+    r[2][1] += s*u[0];
+}
+
+static void Apply(const float op[12], const float x[3], float out[3])
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        out[i] = op[3*i]*x[0] + op[3*i + 1]*x[1] + op[3*i + 2]*x[2] + op[9 + i];
+    }
+}
+
+// The preimage of x: the transpose of the rotation applied to x - t
+static void ApplyInverse(const float op[12], const float x[3], float out[3])
+{
+    float d[3] = { x[0] - op[9], x[1] - op[10], x[2] - op[11] };
+    for (int i = 0; i < 3; ++i)
+    {
+        out[i] = op[i]*d[0] + op[3 + i]*d[1] + op[6 + i]*d[2];
+    }
+}
+
+static void SetOperator(const float r[3][3], const float t[3], float op[12])
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            op[3*i + j] = r[i][j];
+        }
+        op[9 + i] = t[i];
+    }
+}
+
+static int Wrap(int i, int n)
+{
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+// Calls add(index, squared distance) for the grid points within radius of
+// the Cartesian point x
+template <typename Add>
+static void ForPointsNear(CMapHeaderBase *mh, const float x[3], float radius, Add &add)
+{
+    float f[3] = { x[0], x[1], x[2] };
+    mh->CtoF(&f[0], &f[1], &f[2]);
+    int n[3] = { mh->nx, mh->ny, mh->nz };
+    // with some margin for the oblique cell
+    int reach = (int)ceil(radius/gridSpacing*1.2f) + 1;
+    int center[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        center[i] = (int)floor(f[i]*n[i]);
+    }
+    for (int iz = center[2] - reach; iz <= center[2] + reach; ++iz)
+    {
+        for (int iy = center[1] - reach; iy <= center[1] + reach; ++iy)
+        {
+            for (int ix = center[0] - reach; ix <= center[0] + reach; ++ix)
+            {
+                float p[3] = { (float)ix/n[0], (float)iy/n[1], (float)iz/n[2] };
+                mh->FtoC(&p[0], &p[1], &p[2]);
+                float d2 = (p[0]-x[0])*(p[0]-x[0]) + (p[1]-x[1])*(p[1]-x[1]) + (p[2]-x[2])*(p[2]-x[2]);
+                if (d2 <= radius*radius)
+                {
+                    add((size_t)n[0]*(n[1]*Wrap(iz, n[2]) + Wrap(iy, n[1])) + Wrap(ix, n[0]), d2);
+                }
+            }
+        }
+    }
+}
+
+struct AddDensity
+{
+    std::vector<float> &points;
+
+    AddDensity(std::vector<float> &p)
+        : points(p)
+    {
+    }
+
+    void operator()(size_t i, float d2)
+    {
+        points[i] += 100.0f*(float)exp(-d2/(2.0f*atomSigma*atomSigma));
+    }
+};
+
+struct AddMask
+{
+    std::vector<unsigned char> &mask;
+
+    AddMask(std::vector<unsigned char> &m)
+        : mask(m)
+    {
+    }
+
+    void operator()(size_t i, float)
+    {
+        mask[i] = 1;
+    }
+};
+
+static size_t Index(CMapHeaderBase *mh, const float c[3])
+{
+    float f[3] = { c[0], c[1], c[2] };
+    mh->CtoF(&f[0], &f[1], &f[2]);
+    int ix = Wrap((int)floor(f[0]*mh->nx + 0.5f), mh->nx);
+    int iy = Wrap((int)floor(f[1]*mh->ny + 0.5f), mh->ny);
+    int iz = Wrap((int)floor(f[2]*mh->nz + 0.5f), mh->nz);
+    return (size_t)mh->nx*(mh->ny*iz + iy) + ix;
+}
+
+static float Rho(EMapBase &emap, const float c[3])
+{
+    float f[3] = { c[0], c[1], c[2] };
+    emap.GetMapHeader()->CtoF(&f[0], &f[1], &f[2]);
+    return emap.avgrho(f[0], f[1], f[2]);
+}
+
+// Rms distance between the images of the atoms under two operators
+static float Deviation(const std::vector<float> &atoms, const float a[12], const float b[12])
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < atoms.size(); i += 3)
+    {
+        float pa[3], pb[3];
+        Apply(a, &atoms[i], pa);
+        Apply(b, &atoms[i], pb);
+        sum += (pa[0]-pb[0])*(pa[0]-pb[0]) + (pa[1]-pb[1])*(pa[1]-pb[1]) + (pa[2]-pb[2])*(pa[2]-pb[2]);
+    }
+    return (float)sqrt(3.0*sum/atoms.size());
+}
+
+int main(int argc, char **argv)
+{
+    const char *model = argc > 1 ? argv[1] : "../../examples/ligand_example.pdb";
+    int threads = argc > 2 ? atoi(argv[2]) : 8;
+
+    // PDB::Read keeps only the first residue
+    FILE *fp = fopen(model, "r");
+    std::vector<Bond> connects;
+    Residue *residues = fp != NULL ? LoadPDB(fp, &connects) : NULL;
+    if (residues == NULL)
+    {
+        printf("Cannot read %s\n", model);
+        return 1;
+    }
+    fclose(fp);
+
+    // the heavy atoms, centred
+    std::vector<MIAtom*> atoms;
+    float centroid[3] = { 0.0f, 0.0f, 0.0f };
+    for (Residue *res = residues; res != NULL; res = res->next())
+    {
+        for (int i = 0; i < res->atomCount(); ++i)
+        {
+            MIAtom *a = res->atom(i);
+            if (a->name()[0] != 'H')
+            {
+                atoms.push_back(a);
+                centroid[0] += a->x();
+                centroid[1] += a->y();
+                centroid[2] += a->z();
+            }
+        }
+    }
+    float extent = 0.0f;
+    for (int i = 0; i < 3; ++i)
+    {
+        centroid[i] /= (float)atoms.size();
+    }
+    for (size_t n = 0; n < atoms.size(); ++n)
+    {
+        float d[3] = { atoms[n]->x() - centroid[0], atoms[n]->y() - centroid[1], atoms[n]->z() - centroid[2] };
+        extent = std::max(extent, (float)sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]));
+    }
+
+    // Two copies side by side along a with room for the masks between
+    PointMap emap;
+    CMapHeaderBase *mh = emap.GetMapHeader();
+    float width = 2.0f*extent + 4.0f*maskRadius;
+    mh->a = 2.0f*width;
+    mh->b = width;
+    mh->c = width;
+    mh->alpha = 90.0f;
+    mh->beta = 100.0f;
+    mh->gamma = 90.0f;
+    mh->spgpno = 1;
+    mh->SetSymmOps();
+    mh->nx = 2*(int)(mh->a/gridSpacing/2.0f);
+    mh->ny = 2*(int)(mh->b/gridSpacing/2.0f);
+    mh->nz = 2*(int)(mh->c/gridSpacing/2.0f);
+    size_t npoints = (size_t)mh->nx*mh->ny*mh->nz;
+
+    float centerA[3] = { 0.25f, 0.5f, 0.5f };
+    float centerB[3] = { 0.75f, 0.5f, 0.5f };
+    mh->FtoC(&centerA[0], &centerA[1], &centerA[2]);
+    mh->FtoC(&centerB[0], &centerB[1], &centerB[2]);
+    std::vector<float> copyA;
+    for (size_t n = 0; n < atoms.size(); ++n)
+    {
+        atoms[n]->setPosition(atoms[n]->x() - centroid[0] + centerA[0], atoms[n]->y() - centroid[1] + centerA[1],
+                              atoms[n]->z() - centroid[2] + centerA[2]);
+        copyA.push_back(atoms[n]->x());
+        copyA.push_back(atoms[n]->y());
+        copyA.push_back(atoms[n]->z());
+    }
+
+    // B = R A + t, with the centre of A going to the centre of B
+    float axis[3] = { 1.0f, 2.0f, 3.0f };
+    float r[3][3], t[3];
+    Rotation(axis, 150.0f, r);
+    for (int i = 0; i < 3; ++i)
+    {
+        t[i] = centerB[i] - (r[i][0]*centerA[0] + r[i][1]*centerA[1] + r[i][2]*centerA[2]);
+    }
+    float truth[12], identity[12];
+    float unit[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    float zero[3] = { 0.0f, 0.0f, 0.0f };
+    SetOperator(r, t, truth);
+    SetOperator(unit, zero, identity);
+    // The identity comes second, so NCRAverage applying the operators one
+    // after another, as it once did, would show
+    memcpy(mh->NCRSymmops[0], truth, sizeof(truth));
+    memcpy(mh->NCRSymmops[1], identity, sizeof(identity));
+    mh->nNCRSymmops = 2;
+
+    // the density of both copies, and with noise
+    std::vector<float> clean(npoints, 0.0f);
+    std::vector<unsigned char> maskA(npoints, 0);
+    AddDensity addDensity(clean);
+    AddMask addMask(maskA);
+    for (size_t i = 0; i < copyA.size(); i += 3)
+    {
+        float b[3];
+        Apply(truth, &copyA[i], b);
+        ForPointsNear(mh, &copyA[i], 3.0f*atomSigma, addDensity);
+        ForPointsNear(mh, b, 3.0f*atomSigma, addDensity);
+        ForPointsNear(mh, &copyA[i], maskRadius, addMask);
+    }
+    double sum2 = 0.0;
+    size_t inA = 0;
+    for (size_t i = 0; i < npoints; ++i)
+    {
+        if (maskA[i])
+        {
+            sum2 += clean[i]*clean[i];
+            inA++;
+        }
+    }
+    float noiseLevel = 0.3f*(float)sqrt(sum2/inA);
+    std::vector<float> noisy(clean);
+    srand(1);
+    for (size_t i = 0; i < npoints; ++i)
+    {
+        noisy[i] += noiseLevel*Gaussian();
+    }
+    emap.SetPoints(noisy);
+    printf("%d atoms in two copies, P1 %.1f %.1f %.1f %.0f %.0f %.0f, %d x %d x %d points, %d in the mask\n",
+           (int)atoms.size(), mh->a, mh->b, mh->c, mh->alpha, mh->beta, mh->gamma, mh->nx, mh->ny, mh->nz,
+           (int)inA);
+
+    bool ok = true;
+
+    // with no mask every point is averaged, as NCRAverage does
+    EMapBase unmasked;
+    MISetParallelThreadCount(threads);
+    if (!emap.NCSAverage(&unmasked, std::vector<MIAtom*>()))
+    {
+        printf("FAILED: NCSAverage without a mask\n");
+        return 1;
+    }
+    int ncrDiffer = 0;
+    for (int iz = 0; iz < mh->nz; iz += 3)
+    {
+        for (int iy = 0; iy < mh->ny; iy += 3)
+        {
+            for (int ix = 0; ix < mh->nx; ix += 3)
+            {
+                float averaged = unmasked.MapPoints()[(size_t)mh->nx*(mh->ny*iz + iy) + ix];
+                if (abs(emap.NCRAverage(ix, iy, iz) - ROUND(averaged)) > 1)
+                {
+                    ncrDiffer++;
+                }
+            }
+        }
+    }
+    printf("Without a mask: %d points of a ninth of the grid differ from NCRAverage\n", ncrDiffer);
+    if (ncrDiffer != 0)
+    {
+        printf("FAILED: NCSAverage without a mask differs from NCRAverage\n");
+        ok = false;
+    }
+
+    // with the mask, on one thread and on several
+    EMapBase serial, parallel;
+    MISetParallelThreadCount(1);
+    double start = Now();
+    bool averagedSerial = emap.NCSAverage(&serial, atoms, maskRadius);
+    double serialTime = Now() - start;
+    MISetParallelThreadCount(threads);
+    start = Now();
+    bool averagedParallel = emap.NCSAverage(&parallel, atoms, maskRadius);
+    double parallelTime = Now() - start;
+    if (!averagedSerial || !averagedParallel || serial.MapPointCount() != npoints
+        || parallel.MapPointCount() != npoints)
+    {
+        printf("FAILED: NCSAverage with a mask\n");
+        return 1;
+    }
+    printf("Masked average: 1 thread %.3f s, %d threads %.3f s\n", serialTime, threads, parallelTime);
+    if (memcmp(serial.MapPoints(), parallel.MapPoints(), npoints*sizeof(float)) != 0)
+    {
+        printf("FAILED: the average on %d threads differs from one\n", threads);
+        ok = false;
+    }
+
+    // The interpolation is linear in the density, so the average of the
+    // noisy map less that of the clean one is the averaged noise
+    PointMap cleanMap;
+    EMapBase cleanAveraged;
+    *cleanMap.GetMapHeader() = *mh;
+    cleanMap.SetPoints(clean);
+    cleanMap.NCSAverage(&cleanAveraged, atoms, maskRadius);
+
+    // against the average worked out here
+    const float *averaged = serial.MapPoints();
+    const float *cleanAverage = cleanAveraged.MapPoints();
+    int differ = 0, changedOutside = 0;
+    size_t inCopies = 0;
+    double noiseBefore = 0.0, noiseAfter = 0.0;
+    float maxDiff = 0.0f;
+    for (int iz = 0; iz < mh->nz; ++iz)
+    {
+        for (int iy = 0; iy < mh->ny; ++iy)
+        {
+            for (int ix = 0; ix < mh->nx; ++ix)
+            {
+                size_t i = (size_t)mh->nx*(mh->ny*iz + iy) + ix;
+                float p[3] = { (float)ix/mh->nx, (float)iy/mh->ny, (float)iz/mh->nz };
+                mh->FtoC(&p[0], &p[1], &p[2]);
+                float q[3], image[3];
+                bool inCopy = maskA[i] != 0;
+                if (inCopy)
+                {
+                    std::copy(p, p + 3, q);
+                }
+                else
+                {
+                    ApplyInverse(truth, p, q);
+                    inCopy = maskA[Index(mh, q)] != 0;
+                }
+                if (!inCopy)
+                {
+                    if (averaged[i] != noisy[i])
+                    {
+                        changedOutside++;
+                    }
+                    continue;
+                }
+                Apply(truth, q, image);
+                float expected = (Rho(emap, q) + Rho(emap, image))/2.0f;
+                float diff = (float)fabs(averaged[i] - expected);
+                maxDiff = std::max(maxDiff, diff);
+                if (diff > 0.01f)
+                {
+                    differ++;
+                }
+                inCopies++;
+                noiseBefore += (noisy[i] - clean[i])*(noisy[i] - clean[i]);
+                float noise = averaged[i] - cleanAverage[i];
+                noiseAfter += noise*noise;
+            }
+        }
+    }
+    float before = (float)sqrt(noiseBefore/inCopies);
+    float after = (float)sqrt(noiseAfter/inCopies);
+    printf("%d points in the copies, %d differ from the Cartesian average (largest difference %.3g)\n",
+           (int)inCopies, differ, maxDiff);
+    printf("Rms noise in the copies %.2f before averaging, %.2f after; %d points outside changed\n", before, after,
+           changedOutside);
+    // Points on the edge of the mask may round to the other side of it
+    if (differ > (int)(inCopies/1000))
+    {
+        printf("FAILED: the average differs from the Cartesian one\n");
+        ok = false;
+    }
+    if (changedOutside != 0)
+    {
+        printf("FAILED: points outside the copies changed\n");
+        ok = false;
+    }
+    if (after > 0.8f*before)
+    {
+        printf("FAILED: averaging did not reduce the noise\n");
+        ok = false;
+    }
+
+    // operator refinement from a rotation of 2 degrees about the centre of
+    // B and a shift of 0.45 A, on one thread and on several
+    float tilt[3] = { 0.3f, -1.0f, 0.5f };
+    float dr[3][3], rOff[3][3], tOff[3];
+    float shift[3] = { 0.3f, -0.2f, 0.25f };
+    Rotation(tilt, 2.0f, dr);
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            rOff[i][j] = dr[i][0]*r[0][j] + dr[i][1]*r[1][j] + dr[i][2]*r[2][j];
+        }
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        float d[3] = { t[0] - centerB[0], t[1] - centerB[1], t[2] - centerB[2] };
+        tOff[i] = dr[i][0]*d[0] + dr[i][1]*d[1] + dr[i][2]*d[2] + centerB[i] + shift[i];
+    }
+    float off[12], refined[12];
+    SetOperator(rOff, tOff, off);
+    for (int run = 0; run < 2; ++run)
+    {
+        memcpy(mh->NCRSymmops[0], off, sizeof(off));
+        MISetParallelThreadCount(run == 0 ? 1 : threads);
+        start = Now();
+        int changed = emap.RefineNCSOperators(atoms, maskRadius);
+        double time = Now() - start;
+        if (run == 0)
+        {
+            memcpy(refined, mh->NCRSymmops[0], sizeof(refined));
+            printf("Refinement: %d operator changed in %.3f s, atoms off by %.3f A before, %.3f A after\n",
+                   changed, time, Deviation(copyA, off, truth), Deviation(copyA, refined, truth));
+            if (changed != 1 || Deviation(copyA, refined, truth) > 0.1f)
+            {
+                printf("FAILED: the operator was not refined back\n");
+                ok = false;
+            }
+            if (memcmp(mh->NCRSymmops[1], identity, sizeof(identity)) != 0)
+            {
+                printf("FAILED: the identity was changed\n");
+                ok = false;
+            }
+        }
+        else if (memcmp(mh->NCRSymmops[0], refined, sizeof(refined)) != 0)
+        {
+            printf("FAILED: the operator refined on %d threads differs from one\n", threads);
+            ok = false;
+        }
+    }
+    MISetParallelThreadCount(0);
+    FreeResidueList(residues);
+    printf(ok ? "OK\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
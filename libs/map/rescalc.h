@@ -1,6 +1,28 @@
 #ifndef RESCALC_H_
 #define RESCALC_H_
 
+/* Reciprocal cell of a unit cell, from which sin(theta)/lambda of any
+   reflection follows. Holds no shared state so that several cells can be
+   in use at once on different threads.
+ */
+class ReciprocalCell
+{
+public:
+    ReciprocalCell(float A, float B, float C, float ALPHA, float BETA, float GAMMA);
+
+    /* false if a cell edge or angle is zero */
+    bool valid() const
+    {
+        return valid_;
+    }
+
+    float sthol(int ih, int ik, int il) const;
+
+private:
+    bool valid_;
+    double as, bs, cs, cosas, cosbs, cosgs;
+};
+
 float sthol(int ih, int ik, int il, float A, float B, float C, float ALPHA, float BETA, float GAMMA, int init);
 float rescalc(int ih, int ik, int il, float A, float B, float C, float ALPHA, float BETA, float GAMMA, int init);
 float Volume(float, float, float, float, float, float);
@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/time.h>
+
+#include <util/parallel.h>
+
+#include "CMapHeaderBase.h"
+#include "CREFL.h"
+#include "ReflectionScaling.h"
+#include "rescalc.h"
+#include "testlogger.cxx"
+
+// The reflection scaler on synthetic data in a monoclinic cell. Fo is made
+// from Fc with a known bulk solvent K and B, with a known anisotropic
+// tensor and with errors that grow with resolution, and the fits must find
+// K, B and the tensor again; the tensor's frame is worked out here from
+// the header's orthogonalization. Every step is then run on several
+// threads, and each bin, parameter and reflection must be the same to the
+// bit as on one.
+// named cxx to avoid being put into compilation of library
+//
+// usage: scaletest [threads]
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static const float bulkScale = 1.4f;
+static const float bulkK = 0.75f;
+static const float bulkB = 55.0f;
+static const float anisoTensor[6] = { 1.12f, 0.93f, 1.03f, 0.04f, -0.06f, 0.03f };
+
+static float Random()
+{
+    return (rand() + 0.5f) / ((float)RAND_MAX + 1.0f);
+}
+
+// All reflections of the upper half of reciprocal space to the header's
+// resolution but the systematic absences of P2(1), with Fc drawn from a
+// Wilson distribution and a random phase
+static void MakeReflections(CMapHeaderBase *mh, std::vector<CREFL> &refls)
+{
+    ReciprocalCell cell(mh->a, mh->b, mh->c, mh->alpha, mh->beta, mh->gamma);
+    float limit = 0.5f/mh->resmin;
+    int hmax = (int)(mh->a/mh->resmin) + 1;
+    int kmax = (int)(mh->b/mh->resmin) + 1;
+    int lmax = (int)(mh->c/mh->resmin) + 1;
+    srand(1);
+    for (int h = -hmax; h <= hmax; h++)
+    {
+        for (int k = 0; k <= kmax; k++)
+        {
+            for (int l = 0; l <= lmax; l++)
+            {
+                if ((h == 0 && k == 0 && l == 0) || (h == 0 && l == 0 && k % 2 == 1))
+                {
+                    continue;
+                }
+                float sthol = cell.sthol(h, k, l);
+                if (sthol > limit)
+                {
+                    continue;
+                }
+                CREFL r;
+                memset(&r, 0, sizeof(r));
+                r.ind[0] = h;
+                r.ind[1] = k;
+                r.ind[2] = l;
+                r.sthol = sthol;
+                r.fc = 100.0f*(float)(sqrt(-log(Random()))*exp(-15.0*sthol*sthol));
+                r.phi = 360.0f*Random();
+                float radians = r.phi*(float)(acos(-1.0)/180.0);
+                r.acalc = r.awhole = r.fc*(float)cos(radians);
+                r.bcalc = r.bwhole = r.fc*(float)sin(radians);
+                r.sigma = 1.0f;
+                refls.push_back(r);
+            }
+        }
+    }
+}
+
+// Products of the direction cosines of the reflection in the orthogonal
+// frame of the header: the reciprocal vector is h times ctof
+static void DirectionProducts(const CREFL &r, CMapHeaderBase *mh, float rr[6])
+{
+    double s[3];
+    for (int j = 0; j < 3; j++)
+    {
+        s[j] = r.ind[0]*mh->ctof[0][j] + r.ind[1]*mh->ctof[1][j] + r.ind[2]*mh->ctof[2][j];
+    }
+    double length = sqrt(s[0]*s[0] + s[1]*s[1] + s[2]*s[2]);
+    for (int j = 0; j < 3; j++)
+    {
+        s[j] /= length;
+    }
+    rr[0] = (float)(s[0]*s[0]);
+    rr[1] = (float)(s[1]*s[1]);
+    rr[2] = (float)(s[2]*s[2]);
+    rr[3] = (float)(2.0*s[0]*s[1]);
+    rr[4] = (float)(2.0*s[0]*s[2]);
+    rr[5] = (float)(2.0*s[1]*s[2]);
+}
+
+// Fo for the three cases
+static void MakeBulkSolvent(std::vector<CREFL> &refls)
+{
+    for (size_t i = 0; i < refls.size(); ++i)
+    {
+        CREFL &r = refls[i];
+        r.fo = bulkScale*r.fc*(1.0f - bulkK*(float)exp(-bulkB*r.sthol*r.sthol));
+    }
+}
+
+static void MakeAnisotropic(std::vector<CREFL> &refls, CMapHeaderBase *mh)
+{
+    for (size_t i = 0; i < refls.size(); ++i)
+    {
+        CREFL &r = refls[i];
+        float rr[6];
+        DirectionProducts(r, mh, rr);
+        float scale = 0.0f;
+        for (int a = 0; a < 6; a++)
+        {
+            scale += anisoTensor[a]*rr[a];
+        }
+        r.fo = r.fc*scale;
+    }
+}
+
+// Fo is |Fc + e| with a complex error e whose rms grows from 20% of the
+// rms Fc at low resolution to 220% at the limit, so SigmaA must fall
+static void MakeErrors(std::vector<CREFL> &refls, CMapHeaderBase *mh)
+{
+    srand(2);
+    float limit = 0.5f/mh->resmin;
+    for (size_t i = 0; i < refls.size(); ++i)
+    {
+        CREFL &r = refls[i];
+        float rms = 100.0f*(float)exp(-15.0*r.sthol*r.sthol)*(0.2f + 2.0f*(r.sthol/limit)*(r.sthol/limit));
+        float size = rms*(float)sqrt(-log(Random()));
+        float phase = 2.0f*(float)acos(-1.0)*Random();
+        float a = r.acalc + size*(float)cos(phase);
+        float b = r.bcalc + size*(float)sin(phase);
+        r.fo = (float)sqrt(a*a + b*b);
+    }
+}
+
+static void Add(std::vector<double> &values, const std::vector<CREFL> &refls)
+{
+    for (size_t i = 0; i < refls.size(); ++i)
+    {
+        const CREFL &r = refls[i];
+        values.push_back(r.fc);
+        values.push_back(r.fom);
+        values.push_back(r.acalc);
+        values.push_back(r.bcalc);
+        values.push_back(r.awhole);
+        values.push_back(r.bwhole);
+    }
+}
+
+// Every result of the three cases, in order, for comparing runs; prints
+// and checks them when report is set
+static bool Scale(CMapHeaderBase *mh, const std::vector<CREFL> &source, std::vector<double> &values, bool report)
+{
+    int nrefl = (int)source.size();
+    bool ok = true;
+    ReflectionScaler scaler(mh);
+
+    // bulk solvent from the start CalcBulkSolvent uses
+    std::vector<CREFL> refls(source);
+    MakeBulkSolvent(refls);
+    float K = 0.9f, B = 150.0f, startR;
+    float r = scaler.FitBulkSolvent(&refls[0], nrefl, K, B, startR);
+    values.push_back(K);
+    values.push_back(B);
+    values.push_back(r);
+    values.push_back(startR);
+    if (report)
+    {
+        printf("Bulk solvent: K %.4f B %.2f (made with %.2f %.1f), R %.5f from %.4f\n", K, B, bulkK, bulkB, r,
+               startR);
+        if (fabs(K - bulkK) > 0.005f || fabs(B - bulkB) > 0.5f || r > 0.001f || r < 0.0f || startR < 0.01f)
+        {
+            printf("FAILED: the bulk solvent was not recovered\n");
+            ok = false;
+        }
+    }
+
+    // anisotropic tensor
+    refls = source;
+    MakeAnisotropic(refls, mh);
+    float tensor[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    bool fitted = scaler.FitAnisotropic(&refls[0], nrefl, tensor);
+    float scaledR = 0.0f;
+    int count = scaler.ApplyAnisotropic(&refls[0], nrefl, tensor, startR, scaledR);
+    values.push_back(fitted);
+    values.insert(values.end(), tensor, tensor + 6);
+    values.push_back(count);
+    values.push_back(startR);
+    values.push_back(scaledR);
+    Add(values, refls);
+    if (report)
+    {
+        float worst = 0.0f;
+        printf("Anisotropic:");
+        for (int a = 0; a < 6; a++)
+        {
+            printf(" %.4f", tensor[a]);
+            worst = std::max(worst, (float)fabs(tensor[a] - anisoTensor[a]));
+        }
+        printf(" (largest error %.2g)\n             %d reflections, R %.4f scaled to %.5f\n", worst, count,
+               startR, scaledR);
+        if (!fitted || worst > 0.001f || count < nrefl/2 || scaledR > 0.001f || startR < 0.01f)
+        {
+            printf("FAILED: the anisotropic tensor was not recovered\n");
+            ok = false;
+        }
+    }
+
+    // SigmaA
+    refls = source;
+    MakeErrors(refls, mh);
+    scaler.BinStatistics(&refls[0], nrefl, 10);
+    scaler.ApplySigmaA(&refls[0], nrefl);
+    const std::vector<ResolutionBin> &bins = scaler.Bins();
+    values.push_back(scaler.FomCount());
+    int binned = 0;
+    for (size_t i = 0; i < bins.size(); ++i)
+    {
+        const ResolutionBin &bin = bins[i];
+        values.push_back(bin.stholMin);
+        values.push_back(bin.stholMax);
+        values.push_back(bin.count);
+        values.push_back(bin.meanFo2);
+        values.push_back(bin.meanFc2);
+        values.push_back(bin.sumEo2);
+        values.push_back(bin.sumEc2);
+        values.push_back(bin.sumEo4);
+        values.push_back(bin.sumEc4);
+        values.push_back(bin.sumEo2Ec2);
+        values.push_back(bin.sigmaA);
+        values.push_back(bin.correlation);
+        binned += bin.count;
+    }
+    Add(values, refls);
+    if (report)
+    {
+        printf("SigmaA by bin:");
+        bool falling = bins.size() == 10;
+        for (size_t i = 0; i < bins.size(); ++i)
+        {
+            printf(" %.3f", bins[i].sigmaA);
+            falling = falling && bins[i].sigmaA > 0.05f && bins[i].sigmaA < 1.0f
+                      && (i == 0 || bins[i].sigmaA < bins[i-1].sigmaA + 0.02f);
+        }
+        printf("\n");
+        bool fomsOk = true;
+        for (int i = 0; i < nrefl; ++i)
+        {
+            fomsOk = fomsOk && refls[i].fom >= 0.0f && refls[i].fom <= 1.0f;
+        }
+        falling = falling && bins.front().sigmaA > bins.back().sigmaA + 0.3f;
+        if (!falling || binned != nrefl || !fomsOk)
+        {
+            printf("FAILED: SigmaA should fall with resolution and give figures of merit from 0 to 1\n");
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : 8;
+
+    CMapHeaderBase mh;
+    mh.a = 52.0f;
+    mh.b = 61.0f;
+    mh.c = 73.0f;
+    mh.alpha = 90.0f;
+    mh.beta = 103.0f;
+    mh.gamma = 90.0f;
+    mh.spgpno = 4;
+    mh.SetSymmOps();
+    mh.resmin = 2.0f;
+    mh.resmax = 30.0f;
+
+    std::vector<CREFL> refls;
+    MakeReflections(&mh, refls);
+    printf("P2(1) %.0f %.0f %.0f %.0f %.0f %.0f to %.1f A: %d reflections\n", mh.a, mh.b, mh.c, mh.alpha, mh.beta,
+           mh.gamma, mh.resmin, (int)refls.size());
+
+    MISetParallelThreadCount(1);
+    std::vector<double> serial;
+    double start = Now();
+    bool ok = Scale(&mh, refls, serial, true);
+    printf("1 thread: %.3f s\n", Now() - start);
+
+    for (int threads = 2; threads <= maxThreads; threads *= 2)
+    {
+        MISetParallelThreadCount(threads);
+        std::vector<double> values;
+        start = Now();
+        Scale(&mh, refls, values, false);
+        printf("%d threads: %.3f s\n", threads, Now() - start);
+        if (values.size() != serial.size() || memcmp(&values[0], &serial[0], values.size()*sizeof(double)) != 0)
+        {
+            printf("FAILED: %d threads differ from one\n", threads);
+            ok = false;
+        }
+    }
+    MISetParallelThreadCount(0);
+    printf(ok ? "OK\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
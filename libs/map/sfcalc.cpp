@@ -6,12 +6,14 @@
 #include <math/mathlib.h>
 #include <chemlib/chemlib.h>
 #include <chemlib/Monomer.h>
+#include <QtCore/QMutex>
 
 //all these headers are verified as required
 #include "sfcalc.h"
 #include "sfcalc_data.h"
 #include "maplib.h"
 #include "fft.h"
+#include "ReflectionScaling.h"
 
 
 using namespace chemlib;
@@ -20,14 +22,21 @@ using namespace chemlib;
 #define Y 1
 #define Z 2
 
+static QMutex sfinitMutex;
+static bool sfinitDone = false;
+
+/* builds the reciprocal space form factor table once; safe to call
+ * from several threads. The lock is taken on every call, so a thread
+ * that finds the table built also sees its contents
+ */
 void
 sfinit()
 {
     int i, j;
-    static int init = 0;
     double fj, sol, sol2;
 
-    if (init != 0)
+    QMutexLocker lock(&sfinitMutex);
+    if (sfinitDone)
     {
         return;
     }
@@ -48,25 +57,51 @@ sfinit()
                            +a4[i]*exp(-b4[i]*sol2);
         }
     }
-    init = 1;
-    srand(1);
+    sfinitDone = true;
 }
 
-int sfatom(const MIAtom &atom, CREFL refl[], int nrefl, CMapHeaderBase *mh)
+SFSymmetryTable::SFSymmetryTable(const CREFL refl[], int nrefl, const CMapHeaderBase *mh)
+    : nsym(mh->nsym),
+      xpart((size_t)nrefl*mh->nsym),
+      ypart((size_t)nrefl*mh->nsym),
+      zpart((size_t)nrefl*mh->nsym),
+      trans((size_t)nrefl*mh->nsym)
 {
-    static int ir, in, it;
-    static double scftmp, sf,  ah, ak, al, phase;
-    static double cp, sp;
+    double ah, ak, al;
+    for (int ir = 0; ir < nrefl; ir++)
+    {
+        ah = refl[ir].ind[0];
+        ak = refl[ir].ind[1];
+        al = refl[ir].ind[2];
+        for (int in = 0; in < nsym; in++)
+        {
+            trans[nsym*ir+in] = ah * mh->symops[X][3][in]
+                                +ak * mh->symops[Y][3][in]
+                                +al * mh->symops[Z][3][in];
+            xpart[nsym*ir+in] = ah * mh->symops[X][X][in]
+                                +ak * mh->symops[Y][X][in]
+                                +al * mh->symops[Z][X][in];
+            ypart[nsym*ir+in] = ah * mh->symops[X][Y][in]
+                                +ak * mh->symops[Y][Y][in]
+                                +al * mh->symops[Z][Y][in];
+            zpart[nsym*ir+in] = ah * mh->symops[X][Z][in]
+                                +ak * mh->symops[Y][Z][in]
+                                +al * mh->symops[Z][Z][in];
+        }
+    }
+}
+
+int sfatom(const MIAtom &atom, CREFL refl[], int nrefl, CMapHeaderBase *mh, const SFSymmetryTable &sym)
+{
+    int ir, in, it;
+    double scftmp, sf, phase;
+    double cp, sp;
     int type = 0;
     int nr = 0;
-    static double *xpart = NULL, *ypart = NULL, *zpart = NULL, *trans = NULL;
-    static double x, y, z, sthol;
-    static int init = 0, index;
-    static double twopi;
-    static double degtor;
-    static int nsym;
-    static CREFL *oldrefl = NULL;
-    static int oldnrefl = 0;
+    double x, y, z, sthol;
+    int index;
+    const double twopi = 2.0 * acos(-1.0);
+    int nsym = sym.nsym;
 
     if (atom.occ() < 0.00001)
     {
@@ -76,67 +111,7 @@ int sfatom(const MIAtom &atom, CREFL refl[], int nrefl, CMapHeaderBase *mh)
     {
         return 0;
     }
-
-    nsym = mh->nsym;
-    if (init == 0)
-    {
-        sfinit();
-        twopi = 2.0 * acos(-1.0);
-        degtor = acos(-1.0)/180.0;
-        init = 1;
-    }
-    if (oldrefl != &refl[0] || oldnrefl != nrefl)
-    {
-        Logger::log("Allocating and initializing reflection data");
-        if (xpart != NULL)
-        {
-            free(xpart);
-        }
-        if (ypart != NULL)
-        {
-            free(ypart);
-        }
-        if (zpart != NULL)
-        {
-            free(zpart);
-        }
-        if (trans != NULL)
-        {
-            free(trans);
-        }
-        xpart = (double*)malloc(nrefl*nsym*sizeof(double));
-        ypart = (double*)malloc(nrefl*nsym*sizeof(double));
-        zpart = (double*)malloc(nrefl*nsym*sizeof(double));
-        trans = (double*)malloc(nrefl*nsym*sizeof(double));
-        if (trans == NULL)
-        {
-            Logger::log("SFCalc: cannot allocate memory!");
-            return (0);
-        }
-        for (ir = 0; ir < nrefl; ir++)
-        {
-            ah = refl[ir].ind[0];
-            ak = refl[ir].ind[1];
-            al = refl[ir].ind[2];
-            for (in = 0; in < nsym; in++)
-            {
-                trans[nsym*ir+in] = ah * mh->symops[X][3][in]
-                                    +ak * mh->symops[Y][3][in]
-                                    +al * mh->symops[Z][3][in];
-                xpart[nsym*ir+in] = ah * mh->symops[X][X][in]
-                                    +ak * mh->symops[Y][X][in]
-                                    +al * mh->symops[Z][X][in];
-                ypart[nsym*ir+in] = ah * mh->symops[X][Y][in]
-                                    +ak * mh->symops[Y][Y][in]
-                                    +al * mh->symops[Z][Y][in];
-                zpart[nsym*ir+in] = ah * mh->symops[X][Z][in]
-                                    +ak * mh->symops[Y][Z][in]
-                                    +al * mh->symops[Z][Z][in];
-            }
-        }
-        oldrefl = &refl[0];
-        oldnrefl = nrefl;
-    }
+    sfinit();
 
     type = ScattIndex(&atom.name()[0], "*");
 
@@ -163,30 +138,10 @@ int sfatom(const MIAtom &atom, CREFL refl[], int nrefl, CMapHeaderBase *mh)
         sf = ftable[type][it];
         scftmp = sf * exp(-sthol*sthol*atom.BValue());
         scftmp *= atom.occ();
-        ah = refl[ir].ind[0];
-        ak = refl[ir].ind[1];
-        al = refl[ir].ind[2];
         for (in = 0; in < nsym; in++)
         {
-            /*
-               trans = ah * mh->symops[X][3][in] +
-               ak * mh->symops[Y][3][in] +
-               al * mh->symops[Z][3][in];
-
-               xpart = ah * mh->symops[X][X][in] +
-               ak * mh->symops[Y][X][in] +
-               al * mh->symops[Z][X][in];
-
-               ypart = ah * mh->symops[X][Y][in] +
-               ak * mh->symops[Y][Y][in] +
-               al * mh->symops[Z][Y][in];
-
-               zpart = ah * mh->symops[X][Z][in] +
-               ak * mh->symops[Y][Z][in] +
-               al * mh->symops[Z][Z][in];
-             */
             index = nsym*ir +in;
-            phase = twopi*(xpart[index]*x + ypart[index]*y + zpart[index]*z + trans[index]);
+            phase = twopi*(sym.xpart[index]*x + sym.ypart[index]*y + sym.zpart[index]*z + sym.trans[index]);
             cp = cos(phase)*scftmp;
             sp = sin(phase)*scftmp;
             refl[ir].acalc += (float)cp;
@@ -227,6 +182,7 @@ int sfcalc(Residue *res, CREFL refl[], int nrefl, CMapHeaderBase *mh, int init)
         res = res->next();
     }
     res = start;
+    SFSymmetryTable sym(refl, nrefl, mh);
     while (res != NULL)
     {
         if (!(strcmp(res->type().c_str(), "BND") == 0 && res->name().size() > 0 && res->name()[0] == '#') )
@@ -236,7 +192,7 @@ int sfcalc(Residue *res, CREFL refl[], int nrefl, CMapHeaderBase *mh, int init)
         }
         for (i = 0; i < res->atomCount(); i++)
         {
-            nr = sfatom(*res->atom(i), refl, nrefl, mh);
+            nr = sfatom(*res->atom(i), refl, nrefl, mh, sym);
             if (nr)
             {
                 n++;
@@ -265,9 +221,10 @@ int sfcalcatom(MIAtom *atoms[], int natoms, CREFL refl[], int nrefl, CMapHeaderB
             refl[i].bcalc = 0.0;
         }
     }
+    SFSymmetryTable sym(refl, nrefl, mh);
     for (i = 0; i < natoms; i++)
     {
-        nr = sfatom(*atoms[i], refl, nrefl, mh);
+        nr = sfatom(*atoms[i], refl, nrefl, mh, sym);
         if (nr)
         {
             n++;
@@ -400,116 +357,31 @@ ApplyScale2(CREFL refl[], int nrefl, float scale, CMapHeaderBase *mh)
 
 int CalcBulkSolvent(CREFL refl[], int nrefl, CMapHeaderBase *mh)
 {
-    float bestR, r;
-    float *B, *K;
-    float sumfo = 0.0, sumdif = 0.0;
-    int i = 0;
-    B = &(mh->Bsolvent);
-    K = &(mh->Ksolvent);
-    if (*B <= 0.0)
-    {
-        *B = 150.0F;
-    }
-    if (*K <= 0.0)
-    {
-        *K = 0.90F;
-    }
-    for (i = 0; i < nrefl; i++)
+    float r, startR;
+    float B = mh->Bsolvent;
+    float K = mh->Ksolvent;
+    if (B <= 0.0 || K <= 0.0 || K > 1.0)
     {
-        if (refl[i].sthol > 0.5F/mh->resmin
-            || refl[i].sthol < 0.5F/mh->resmax)
-        {
-            continue;
-        }
-        sumfo += refl[i].fo;
-        sumdif += (float)fabs(refl[i].fo-refl[i].fc);
-    }
-    if (sumfo > 0.0)
-    {
-        printf("---Calculate Bulk Solvent Correction---\nStart:   R=%0.3f\n", sumdif/sumfo);
+        B = 150.0F;
+        K = 0.90F;
     }
-    bestR = sumdif/sumfo;
-    for (i = 0; i < 10; i++)
+    ReflectionScaler scaler(mh);
+    r = scaler.FitBulkSolvent(refl, nrefl, K, B, startR);
+    if (r < 0.0)
     {
-        r = EstimateBulkSolvent(refl, nrefl, B, K, i, mh);
-        printf("Cycle %d: R=%0.3f Bsolv=%0.1f Ksolv=%0.3f\n", i+1, r, *B, *K);
-        if (r < bestR-0.003)
-        {
-            bestR = r;
-        }
-        else
-        {
-            goto end;
-        }
+        return 0;
     }
-end:
-    if (i == 0)
+    printf("---Calculate Bulk Solvent Correction---\nStart:   R=%0.3f\n", startR);
+    printf("Fit:     R=%0.3f Bsolv=%0.1f Ksolv=%0.3f\n", r, B, K);
+    if (r >= startR-0.003)
     {
         printf("R got worse or no better - no correction will be applied\n");
         mh->Ksolvent = 0.0;
         return 0;
     }
-    else
-    {
-        return 1;
-    }
-
-}
-
-float EstimateBulkSolvent(CREFL refl[], int nrefl, float *B, float *K, int ntimes, CMapHeaderBase *mh)
-{
-    int i, iB, iK;
-    float trialB, trialK, bestB, bestK, bestR;
-    float scale;
-    float fcsum = 0.0, fosum = 0.0;
-    float s2;
-    bestR = 100.0;
-    bestB = *B;
-    bestK = *K;
-    for (iB = -4; iB <= 5; iB++)
-    {
-        trialB = *B + (float)iB*(*B/(5.0F+(float)ntimes));
-        for (iK = -3; iK <= 3; iK++)
-        {
-            trialK = *K + (float)iK*(*K/(9.0F+(float)ntimes));
-            fosum = 0.0;
-            fcsum = 0.0;
-            for (i = 0; i < nrefl; i++)
-            {
-                if (refl[i].sthol > 0.5F/mh->resmin
-                    || refl[i].sthol < 0.5F/mh->resmax)
-                {
-                    continue;
-                }
-                s2 = refl[i].sthol * refl[i].sthol;
-                fcsum += refl[i].fc * (float)(1.0-(trialK*exp(-trialB*s2)));
-                fosum += refl[i].fo;
-            }
-            scale = fosum / fcsum;
-            fcsum = 0.0;
-            fosum = 0.0;
-            for (i = 0; i < nrefl; i++)
-            {
-                if (refl[i].sthol > 0.5F/mh->resmin
-                    || refl[i].sthol < 0.5F/mh->resmax)
-                {
-                    continue;
-                }
-                s2 = refl[i].sthol * refl[i].sthol;
-                fcsum += (float)fabs(refl[i].fo/scale - (refl[i].fc * (float)(1.0-(trialK*exp(-trialB*s2)))));
-                fosum += refl[i].fo/scale;
-            }
-            if (fcsum/fosum < bestR)
-            {
-                bestK = trialK;
-                bestB = trialB;
-                bestR = fcsum/fosum;
-            }
-        }
-    }
-    *B = bestB;
-    *K = bestK;
-    return bestR;
+    mh->Bsolvent = B;
+    mh->Ksolvent = K;
+    return 1;
 }
 
 int SubtractPartial(CREFL refl[], int nrefl, CMapHeaderBase *mh)
@@ -618,6 +490,7 @@ int randomize(Residue *res, float maxdev)
     float d = (float)RAND_MAX;
     char buf[100];
 
+    srand(1);
     while (res != NULL)
     {
         for (i = 0; i < res->atomCount(); i++)
@@ -1287,266 +1160,36 @@ float x;
 
 int scaleaniso(CREFL refl[], int nrefl, CMapHeaderBase *mh)
 {
-    float resbin[MAXBINS], rfactbin[MAXBINS];
-    float deltabin[MAXBINS];
-    int number = 0;
-    float diff, scale;
-    float sthol, width;
-    float fp, fm, delta, wtdel;
-    int i, j;
-    float ssqmax, ssqmin;
-    char buff[200];
-    float ah, ak, al;
-    float as, bs, cs, cosgs, cosbs, cosas, V;
-    float cosa, cosb, cosg, sina, sinb, sing;
-    float alpha, beta, gamma;
-    float rr[7], sc[7];
-    float am[22], v[7], dv[7], diag[7];
-    float scbin[7][MAXBINS];
-    float dstar, zh, zk, zl;
-    long int nv = 6, nm, ising;
-    float sumwr;
-    float sumn1, sumn2, sumd1;
-    int no;
-    int loop;
-    float or11, or21, or22, or31, or32, or33;
-    int fail, ii, iid;
-    int numberbins = 1;
-    float degtor;
-    //int sigma = 0;
-    int ih, ik, il;
-    degtor = (float)(acos(-1.0)/180.0);
+    float sc[6];
+    float startR, scaledR;
+    int i, no;
 
     if (mh->maptype == (int)MIMapType::Fofom || mh->fc_is_fom != 0)
     {
         Logger::log("Cannot apply anisotropic scaling to Fo*f.o.m phase type");
         return 0;
     }
-
-    for (i = 0; i < numberbins; i++)
-    {
-        rfactbin[i] = 0.0;
-        deltabin[i] = 0.0;
-    }
-    nm = nv * ( nv + 1)/2;
-    alpha = mh->alpha * degtor;
-    beta = mh->beta * degtor;
-    gamma = mh->gamma * degtor;
-    cosa = (float)cos(alpha);
-    cosb = (float)cos(beta);
-    cosg = (float)cos(gamma);
-    sina = (float)sin(alpha);
-    sinb = (float)sin(beta);
-    sing = (float)sin(gamma);
-    cosas = (cosb*cosg - cosa)/sinb/sing ;
-    cosbs = (cosa*cosg - cosb)/sina/sing ;
-    cosgs = (cosa*cosb - cosg)/sina/sinb ;
-    V = mh->a*mh->b*mh->c * (float)sqrt(1-cosa*cosa-cosb*cosb-cosg*cosg+2.0*cosa*cosg*cosb);
-    as = mh->b*mh->c*sina/V;
-    bs = mh->a*mh->c*sinb/V;
-    cs = mh->a*mh->b*sing/V;
-    or11 = sing* (float)sin(acos(cosbs));
-    or21 = -cosg*(float)sin(acos(cosbs));
-    or22 = (float)sin(acos(cosas));
-    or31 = cosbs;
-    or32 = cosas;
-    or33 = 1.0;
-
-    ssqmax = 0.5F/mh->resmin;
-    ssqmax = ssqmax*ssqmax;
-    ssqmin = 0.5F/mh->resmax;
-    ssqmin = ssqmin*ssqmin;
-    width = (ssqmax - ssqmin) / (float)numberbins;
-    if (width <= 0.0)
-    {
-        sprintf(buff, "Bin width too small %f\n", width);
-        Logger::log(buff);
+    if (mh->resmin >= mh->resmax)
+    {
+        Logger::log("Bin width too small\n");
         return (-1);
     }
     printf("---Anisotropic Scaling---------------\n");
 
-    for (i = 0; i < numberbins; i++)
-    {
-        /* initialize matrices */
-        sc[1] = 1.0;
-        sc[2] = 1.0;
-        sc[3] = 1.0;
-        sc[4] = 0.0;
-        sc[5] = 0.0;
-        sc[6] = 0.0;
-        sumn1 = 0.0;
-        sumn2 = 0.0;
-        sumd1 = 0.0;
-        sumwr = 0.0;
-        for (loop = 1; loop <= nm; loop++)
-        {
-            am[loop] = 0.0;
-        }
-        for (loop = 1; loop <= nv; loop++)
-        {
-            v[loop] = 0.0;
-        }
-        /* first pass to find scale factor */
-        number = 0;
-        no = 0;
-        for (j = 0; j < nrefl; j++)
-        {
-            ah = (float)refl[j].ind[0];
-            ak = (float)refl[j].ind[1];
-            al = (float)refl[j].ind[2];
-            sthol = refl[j].sthol;
-            dstar = sthol/ 0.5F;
-            if (sthol*sthol > (ssqmin+i*width)
-                && sthol*sthol < (ssqmin+(i+1)*width) )
-            {
-                if (refl[i].fo > 0.0)
-                {
-                    fp = refl[j].fo;
-                    fm = refl[j].fc;
-                    delta = (float)fabs(fp -fm);
-                    if (delta < (fp+fm)/2.0)
-                    {
-                        zh = ah * as;
-                        zk = ak * bs;
-                        zl = al * cs;
-                        zl = (or31*zh+or32*zk+or33*zl)/dstar;
-                        zk = (or21*zh+or22*zk)/dstar;
-                        zh = or11*zh/dstar;
-                        /*            zh,zk,zl now directional cosines of reciprocal lattice */
-                        rr[1] = zh*zh;
-                        rr[2] = zk*zk;
-                        rr[3] = zl*zl;
-                        rr[4] = zh*zk*2;
-                        rr[5] = zh*zl*2;
-                        rr[6] = zk*zl*2;
-                        scale = 0.0;
-                        for (loop = 1; loop <= 6; loop++)
-                        {
-                            scale = scale + sc[loop]*rr[loop];
-                        }
-                        delta = fp - scale*fm;
-                        wtdel = delta;
-                        for (loop = 1; loop <= 6; loop++)
-                        {
-                            dv[loop] = fm*rr[loop];
-                        }
-                        matset(&am[1], &dv[1], &nm, &nv);
-                        for (loop = 1; loop <= nv; loop++)
-                        {
-                            v[loop] = v[loop]+wtdel*dv[loop];
-                        }
-                    }
-                }
-            }
-        }
-
-        ising = 0;
-        fail = 0;
-        ii = nm;
-        iid = nv;
-        for (loop = 1; loop <= nv; loop++)
-        {
-            diag[loop] = am[loop];
-            if (diag[loop] == 0.0)
-            {
-                sprintf(buff, "ANISOSCALE: Diagonal element zero for variable %d\n", loop);
-                Logger::log(buff);
-                ising = 1;
-            }
-            ii = ii - iid;
-            iid = iid -1;
-        }
-        if (ising == 1)
-        {
-            sprintf(buff, "ANISOSCALE: Matrix is singular!! Try decreasing number of bins\n");
-            Logger::log(buff);
-            return -1;
-        }
-        smi(am+1, &nm, &nv, &ising);
-        if (ising != 0)
-        {
-            sprintf(buff, "ANISOSCALE: Matrix is singular?! Try decreasing number of bins\n");
-            Logger::log(buff);
-            return -1;
-        }
-        solv(&am[1], &v[1], &dv[1], &diag[1], &nm, &nv, &sumwr);
-        for (loop = 1; loop <= 6; loop++)
-        {
-            sc[loop] = sc[loop]+ dv[loop];
-        }
-        printf("Shell %d: Scale Factors:", i+1);
-        for (loop = 1; loop <= 6; loop++)
-        {
-            scbin[loop][i] = sc[loop];
-            printf(" %0.3f", sc[loop]);
-        }
-
-        printf("\n    Resltn %0.3f-%0.3f", (float)(0.5/(sqrt(ssqmin+(i+1)*width))), (float)(0.5/(sqrt(ssqmin+i*width))));
-
-        /*  second pass to apply scale factor */
-        for (j = 0; j < nrefl; j++)
-        {
-            ah = (float)refl[j].ind[0];
-            ak = (float)refl[j].ind[1];
-            al = (float)refl[j].ind[2];
-            sthol = refl[j].sthol;
-            dstar = sthol/ 0.5F;
-            if (sthol*sthol > (ssqmin+i*width)
-                && sthol*sthol < (ssqmin+(i+1)*width) )
-            {
-                if (refl[j].fo > 0.0)
-                {
-                    ih = (int)ah;
-                    ik = (int)ak;
-                    il = (int)al;
-                    fp = refl[j].fo;
-                    fm = refl[j].fc;
-                    delta = (float)fabs(fp -fm);
-                    sumd1 += fp;
-                    sumn1 += delta;
-                    zh = ah * as;
-                    zk = ak * bs;
-                    zl = al * cs;
-                    zl = (or31*zh+or32*zk+or33*zl)/dstar;
-                    zk = (or21*zh+or22*zk)/dstar;
-                    zh = or11*zh/dstar;
-                    /*           zh,zk,zl now directional cosines of reciprocal lattice */
-                    rr[1] = zh*zh;
-                    rr[2] = zk*zk;
-                    rr[3] = zl*zl;
-                    rr[4] = zh*zk*2;
-                    rr[5] = zh*zl*2;
-                    rr[6] = zk*zl*2;
-                    scale = 0.0;
-                    for (loop = 1; loop <= 6; loop++)
-                    {
-                        scale = scale + sc[loop]*rr[loop];
-                    }
-                    refl[j].fc *= scale;
-                    refl[j].acalc *= scale;
-                    refl[j].bcalc *= scale;
-                    refl[j].awhole *= scale;
-                    refl[j].bwhole *= scale;
-                    diff = (float)fabs(fp - refl[j].fc);
-                    no++;
-                    sumn2 = sumn2 + diff;
-                }
-            }
-        }
-        if (sumd1 > 0.0)
-        {
-            rfactbin[i] = sumn2/sumd1;
-            deltabin[i] = sumn2/(float)no;
-            printf("  Rstart=%0.3f Rscaled=%0.3f  n=%d rfls\n", sumn1/sumd1, rfactbin[i], no);
-        }
-        else
-        {
-            rfactbin[i] = 0.0;
-            deltabin[i] = 0.0;
-        }
-        resbin[i] = 0.5F/(float)(sqrt(ssqmin + i*width));
-        resbin[i+1] = 0.5F/(float)(sqrt(ssqmin + (i+1)*width));
+    ReflectionScaler scaler(mh);
+    if (!scaler.FitAnisotropic(refl, nrefl, sc))
+    {
+        Logger::log("ANISOSCALE: Matrix is singular!!\n");
+        return -1;
+    }
+    printf("Scale Factors:");
+    for (i = 0; i < 6; i++)
+    {
+        printf(" %0.3f", sc[i]);
     }
+    printf("\n    Resltn %0.3f-%0.3f", mh->resmin, mh->resmax);
+    no = scaler.ApplyAnisotropic(refl, nrefl, sc, startR, scaledR);
+    printf("  Rstart=%0.3f Rscaled=%0.3f  n=%d rfls\n", startR, scaledR, no);
     return (1);
 }
 
@@ -20,6 +20,25 @@ namespace chemlib
 #endif
 
 //private
+
+//@{
+// The symmetry-expanded indices of a reflection list used by sfatom,
+// built once per list. Each calculation has its own, so structure
+// factors for different maps can be summed on different threads.
+//@}
+class SFSymmetryTable
+{
+public:
+    SFSymmetryTable(const CREFL refl[], int nrefl, const CMapHeaderBase *mh);
+
+    int nsym;
+    std::vector<double> xpart;
+    std::vector<double> ypart;
+    std::vector<double> zpart;
+    std::vector<double> trans;
+};
+
+int sfatom(const chemlib::MIAtom &atom, CREFL refl[], int nrefl, CMapHeaderBase *mh, const SFSymmetryTable &sym);
 float ComputeScale(std::vector<CREFL> &refl, CMapHeaderBase *mh);
 int ApplyScale(std::vector<CREFL> &refl, float scale, CMapHeaderBase *mh);
 float ComputeScale2(CREFL refl[], int nrefl, CMapHeaderBase *mh);
@@ -28,7 +47,6 @@ int sfcalc(chemlib::Residue *  res, CREFL refl[], int nrefl, CMapHeaderBase *mh,
 int AtomDeriv();
 int ScattIndex(const char *aname, const char *restype);
 int CalcBulkSolvent(CREFL refl[], int nrefl, CMapHeaderBase *mh);
-float EstimateBulkSolvent(CREFL refl[], int nrefl, float *B, float *K, int ntimes, CMapHeaderBase *mh);
 int sfcalcatom(chemlib::MIAtom *atoms[], int natoms, CREFL refl[], int nrefl, CMapHeaderBase *mh, int init);
 void sfinit();
 
@@ -57,7 +57,6 @@ double dfrano[] = {0.001, .017, .029, .047, 0.319, -1.179, -5.233, -5.096, -4.99
 double dfiano[] = {0.001, .009, .018, .032, 0.557,  3.204, 6.295, 7.297, 7.686, 1.283, 4.653, 11.276, 6.835, 3.934, 6.221, 12.320, 13.409, 6.566, 11.946, 1.139, 8.505, 3.937, 0.0, 0.0};
 
 int MAXFTABLE;
-double Bscale = 20.0;
 double **ftable;
 int default_atom_type = 0;
 char **rtypes;
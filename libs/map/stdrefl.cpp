@@ -5,8 +5,8 @@
     long int i__1;
 
     /* Local variables */
-    static long int kind, indm, indp, imax, jmax, i, j, k, icent, ispec, jh[3],
-                    ip, mk2, ind[3], ikl, isg;
+    long int kind, indm, indp, imax, jmax, i, j, k, icent, ispec, jh[3],
+             ip, mk2, ind[3], ikl, isg;
 
     /*     SUBROUTINE STDREF(IH,IK,IL,MULT,EPS,MK,IFLG,IFLG2) */
     /*     COMMON /SYMTRY/ NSYM,ISS(3,3,24),ITS(3,24) */
@@ -76,6 +76,7 @@
     ispec = 0;
     *iflg2 = 0;
     imax = -1;
+    jmax = 1;
     *mult = 0;
     *eps = (float)0.;
     *mk = 1;
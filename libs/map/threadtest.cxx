@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <QtCore/QThread>
+
+#include <chemlib/chemlib.h>
+#include <chemlib/MIMolDictionary.h>
+#include <chemlib/MIMoleculeBase.h>
+#include <chemlib/Residue.h>
+#include <chemlib/PDB.h>
+#include <molopt/MIMolOpt.h>
+#include <molopt/RamaTable.h>
+
+#include "EMapBase.h"
+#include "maplib.h"
+#include "maptypes.h"
+#include "sfcalc.h"
+#include "testlogger.cxx"
+
+// Structure factors and maps calculated on several threads at once, each
+// with its own EMapBase, against the same calculations run one after
+// another. Every map point and structure factor must match bit for bit.
+// Real-space refinements of stretches of the model then run the same way,
+// each on its own copy of the model with its own MIMolOpt, whose dictionary
+// a MIDictionaryScope makes the thread's, and every refined coordinate
+// must match the serial run's.
+// named cxx to avoid being put into compilation of library
+//
+// usage: threadtest [model.pdb data.mtz [threads [rounds]]]
+// The data must have the FP, SIGFP, FC, PHIC, FOM and FREE columns refmac
+// writes. The dictionary and Ramachandran tables are read from ../../data.
+
+using namespace chemlib;
+
+// Each case has its own resolution, so its model density is smeared by its
+// own B-value and sampled on its own grid
+struct MapCase
+{
+    unsigned int maptype;
+    float resmin;
+};
+
+static const MapCase mapCases[] =
+{
+    { MIMapType::TwoFoFc, 2.0f },
+    { MIMapType::FoFc, 2.5f },
+    { MIMapType::Fc, 3.0f },
+    { MIMapType::ThreeFoTwoFc, 3.5f }
+};
+static const int numMapCases = sizeof(mapCases) / sizeof(mapCases[0]);
+
+// Reflections summed atom by atom, which is slow, so only the first of them
+static const unsigned int DIRECT_REFLS = 2000;
+
+struct MapResult
+{
+    std::vector<float> map;
+    std::vector<float> fc;     // acalc, bcalc of the FFT structure factors
+    std::vector<float> direct; // acalc, bcalc summed atom by atom
+};
+
+// Structure factors from the model by FFT, a map of the case's type and a
+// direct summation over the first reflections, all at the case's
+// resolution. The model is shared by all jobs and only read.
+class MapJob : public QThread
+{
+public:
+    MapJob(Residue *model, const char *data, const MapCase &mapCase)
+        : ok(false),
+          _model(model),
+          _data(data),
+          _case(mapCase)
+    {
+    }
+
+    bool Calculate()
+    {
+        EMapBase emap;
+        emap.UseColumnLabels("FP", "FC", "FOM", "PHIC", "SIGFP", "FREE");
+        if (!emap.LoadMapPhaseFile(_data))
+        {
+            return false;
+        }
+        CMapHeaderBase *mh = emap.GetMapHeader();
+        mh->resmin = std::max(mh->resmin, _case.resmin);
+        if (!emap.SFCalc(_model) || !emap.FFTMap(_case.maptype, 1, mh->resmin, mh->resmax)
+            || emap.MapPoints() == NULL)
+        {
+            return false;
+        }
+        result.map.assign(emap.MapPoints(), emap.MapPoints() + emap.MapPointCount());
+
+        const std::vector<CREFL> &refls = emap.GetRefls();
+        for (unsigned int i = 0; i < refls.size(); ++i)
+        {
+            result.fc.push_back(refls[i].acalc);
+            result.fc.push_back(refls[i].bcalc);
+        }
+
+        std::vector<CREFL> subset(refls.begin(), refls.begin() + std::min((unsigned int)refls.size(), DIRECT_REFLS));
+        std::vector<MIAtom*> atoms;
+        for (Residue *res = _model; res != NULL; res = res->next())
+        {
+            for (int i = 0; i < res->atomCount(); ++i)
+            {
+                atoms.push_back(res->atom(i));
+            }
+        }
+        sfcalcatom(&atoms[0], atoms.size(), &subset[0], subset.size(), mh, 0);
+        for (unsigned int i = 0; i < subset.size(); ++i)
+        {
+            result.direct.push_back(subset[i].acalc);
+            result.direct.push_back(subset[i].bcalc);
+        }
+        return true;
+    }
+
+    bool ok;
+    MapResult result;
+
+protected:
+    void run()
+    {
+        ok = Calculate();
+    }
+
+private:
+    Residue *_model;
+    const char *_data;
+    MapCase _case;
+};
+
+// Stretches of the model refined against a 2Fo-Fc map at 2.5 A
+struct RefineCase
+{
+    int first;    // index of the first residue
+    int count;
+};
+
+static const RefineCase refineCases[] =
+{
+    { 2, 4 },
+    { 9, 3 },
+    { 20, 5 },
+    { 33, 2 }
+};
+static const int numRefineCases = sizeof(refineCases) / sizeof(refineCases[0]);
+
+static const char *dataDir = "../../data";
+
+// Reads its own copy of the model and refines one stretch of it with an
+// MIMolOpt of its own; the Ramachandran table is shared by all jobs and
+// only read.
+class RefineJob : public QThread
+{
+public:
+    RefineJob(const char *model, const char *data, const RamaTable *rama, const RefineCase &refineCase)
+        : ok(false),
+          _model(model),
+          _data(data),
+          _rama(rama),
+          _case(refineCase)
+    {
+    }
+
+    bool Calculate()
+    {
+        MIMolOpt refiner;
+        std::string dictionary(dataDir);
+        dictionary += "/dict.noh.pdb";
+        if (!refiner.dict.LoadDefaultDictionary(dictionary, "../.."))
+        {
+            return false;
+        }
+        MIDictionaryScope scope(&refiner.dict);
+        refiner.SetRamaTable(_rama);
+
+        FILE *fp = fopen(_model, "r");
+        std::vector<Bond> connects;
+        Residue *residues = fp != NULL ? LoadPDB(fp, &connects) : NULL;
+        if (fp != NULL)
+        {
+            fclose(fp);
+        }
+        if (residues == NULL)
+        {
+            return false;
+        }
+        MIMoleculeBase model(residues, "model", connects.empty() ? NULL : &connects[0], (int)connects.size());
+
+        EMapBase emap;
+        emap.UseColumnLabels("FP", "FC", "FOM", "PHIC", "SIGFP", "FREE");
+        if (!emap.LoadMapPhaseFile(_data))
+        {
+            return false;
+        }
+        CMapHeaderBase *mh = emap.GetMapHeader();
+        mh->resmin = std::max(mh->resmin, 2.5f);
+        if (!emap.SFCalc(residues) || !emap.FFTMap(MIMapType::TwoFoFc, 1, mh->resmin, mh->resmax))
+        {
+            return false;
+        }
+
+        Residue *first = residues;
+        for (int i = 0; i < _case.first && first != NULL; ++i)
+        {
+            first = first->next();
+        }
+        Residue *last = first;
+        for (int i = 1; i < _case.count && last != NULL; ++i)
+        {
+            last = last->next();
+        }
+        if (last == NULL || refiner.SetRefiRes(first, last, &model, &emap) != _case.count)
+        {
+            return false;
+        }
+        refiner.Refine();
+        refiner.Accept();
+
+        for (Residue *res = residues; res != NULL; res = res->next())
+        {
+            for (int i = 0; i < res->atomCount(); ++i)
+            {
+                const MIAtom *atom = res->atom(i);
+                result.push_back(atom->x());
+                result.push_back(atom->y());
+                result.push_back(atom->z());
+            }
+        }
+        return true;
+    }
+
+    bool ok;
+    std::vector<float> result;
+
+protected:
+    void run()
+    {
+        ok = Calculate();
+    }
+
+private:
+    const char *_model;
+    const char *_data;
+    const RamaTable *_rama;
+    RefineCase _case;
+};
+
+static bool Same(const std::vector<float> &a, const std::vector<float> &b)
+{
+    return a.size() == b.size() && (a.empty() || memcmp(&a[0], &b[0], a.size() * sizeof(float)) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *model = argc > 2 ? argv[1] : "../../examples/ligand_example.pdb";
+    const char *data = argc > 2 ? argv[2] : "../../examples/ligand_example.mtz";
+    int threads = argc > 3 ? atoi(argv[3]) : 8;
+    int rounds = argc > 4 ? atoi(argv[4]) : 5;
+
+    // PDB::Read keeps only the first residue
+    FILE *fp = fopen(model, "r");
+    std::vector<Bond> connects;
+    Residue *residues = fp != NULL ? LoadPDB(fp, &connects) : NULL;
+    if (residues == NULL)
+    {
+        printf("Cannot read %s\n", model);
+        return 1;
+    }
+    fclose(fp);
+
+    // the built-in scattering factors
+    MIMapInitializeScatteringFactorTables("", "");
+
+    std::vector<MapResult> serial(numMapCases);
+    for (int i = 0; i < numMapCases; ++i)
+    {
+        MapJob job(residues, data, mapCases[i]);
+        if (!job.Calculate())
+        {
+            printf("Cannot calculate a %s map from %s\n", StringForMapType(mapCases[i].maptype), data);
+            return 1;
+        }
+        serial[i] = job.result;
+        printf("%s at %.1f A: %d map points, %d reflections\n", StringForMapType(mapCases[i].maptype),
+               mapCases[i].resmin, (int)serial[i].map.size(), (int)serial[i].fc.size() / 2);
+    }
+
+    bool ok = true;
+    for (int round = 0; round < rounds; ++round)
+    {
+        std::vector<MapJob*> jobs;
+        for (int i = 0; i < threads; ++i)
+        {
+            jobs.push_back(new MapJob(residues, data, mapCases[(i + round) % numMapCases]));
+        }
+        for (int i = 0; i < threads; ++i)
+        {
+            jobs[i]->start();
+        }
+        for (int i = 0; i < threads; ++i)
+        {
+            jobs[i]->wait();
+        }
+        for (int i = 0; i < threads; ++i)
+        {
+            const MapResult &expected = serial[(i + round) % numMapCases];
+            const MapResult &result = jobs[i]->result;
+            if (!jobs[i]->ok || !Same(result.map, expected.map) || !Same(result.fc, expected.fc)
+                || !Same(result.direct, expected.direct))
+            {
+                printf("FAILED: round %d thread %d differs from the serial %s map\n", round, i,
+                       StringForMapType(mapCases[(i + round) % numMapCases].maptype));
+                ok = false;
+            }
+            delete jobs[i];
+        }
+    }
+    FreeResidueList(residues);
+
+    RamaTable rama;
+    if (!rama.Load(dataDir))
+    {
+        printf("Cannot read the Ramachandran tables from %s\n", dataDir);
+        return 1;
+    }
+    std::vector<std::vector<float> > refined(numRefineCases);
+    for (int i = 0; i < numRefineCases; ++i)
+    {
+        RefineJob job(model, data, &rama, refineCases[i]);
+        if (!job.Calculate())
+        {
+            printf("Cannot refine %d residues from residue %d of %s\n", refineCases[i].count,
+                   refineCases[i].first, model);
+            return 1;
+        }
+        refined[i] = job.result;
+        printf("Refined %d residues from residue %d\n", refineCases[i].count, refineCases[i].first);
+    }
+    for (int round = 0; round < rounds; ++round)
+    {
+        std::vector<RefineJob*> jobs;
+        for (int i = 0; i < threads; ++i)
+        {
+            jobs.push_back(new RefineJob(model, data, &rama, refineCases[(i + round) % numRefineCases]));
+        }
+        for (int i = 0; i < threads; ++i)
+        {
+            jobs[i]->start();
+        }
+        for (int i = 0; i < threads; ++i)
+        {
+            jobs[i]->wait();
+        }
+        for (int i = 0; i < threads; ++i)
+        {
+            if (!jobs[i]->ok || !Same(jobs[i]->result, refined[(i + round) % numRefineCases]))
+            {
+                printf("FAILED: round %d thread %d differs from the serial refinement\n", round, i);
+                ok = false;
+            }
+            delete jobs[i];
+        }
+    }
+    MIMapFreeScatteringFactorTables();
+    printf("%d rounds of %d threads\n", rounds, threads);
+    printf(ok ? "OK\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
@@ -695,9 +695,11 @@ int EMapBase::NCRAverage(int ix, int iy, int iz)
     fz = (float)iz/(float)mapheader->nz;
     for (is = 0; is < mapheader->nNCRSymmops; is++)
     {
-        mapheader->NCRTransform(&fx, &fy, &fz, is);
+        /* each operator acts on the original point */
+        float tx = fx, ty = fy, tz = fz;
+        mapheader->NCRTransform(&tx, &ty, &tz, is);
         /* get rho at this point by interpolation */
-        rh += avgrho(fx, fy, fz);
+        rh += avgrho(tx, ty, tz);
         n++;
     }
     if (n > 0)
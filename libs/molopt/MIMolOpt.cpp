@@ -10,6 +10,7 @@
 #include <map/maplib.h>
 
 #include "MIMolOpt.h"
+#include "RamaTable.h"
 
 
 //#include "mifit_algorithm.h"
@@ -45,7 +46,8 @@ using namespace std;
 //////////////////////////////////////////////////////////////////////
 
 MIMolOpt::MIMolOpt()
-    : refineTargetLocked(false)
+    : refineTargetLocked(false),
+      ramaTable(NULL)
 {
 
     RefiRes = NULL;
@@ -796,7 +798,24 @@ int MIMolOpt::minimize_phipsi()
         bestii = 1;
         bestjj = 1;
         sumi = sumj = sume = 0.0;
-        if (strcmp("GLY", dict.RefiPhiPsis[i].res->type().c_str()))
+        bool move = false;
+        dphi = dpsi = 0.0f;
+        if (ramaTable)
+        {
+            /* step down the gradient of the potential for the residue class */
+            const Residue *res = dict.RefiPhiPsis[i].res;
+            const Residue *next = res->next();
+            RamaTable::ResidueClass residueClass = RamaTable::Classify(res->type(), next ? next->type() : std::string());
+            phi = (float)CalcAtomTorsion(dict.RefiPhiPsis[i].getAtom1(), dict.RefiPhiPsis[i].getAtom2(), dict.RefiPhiPsis[i].atom3, dict.RefiPhiPsis[i].atom4);
+            psi = (float)CalcAtomTorsion(dict.RefiPhiPsis[i+1].getAtom1(), dict.RefiPhiPsis[i+1].getAtom2(), dict.RefiPhiPsis[i+1].atom3, dict.RefiPhiPsis[i+1].atom4);
+            float dEdphi, dEdpsi;
+            ramaTable->Energy(residueClass, phi, psi, &dEdphi, &dEdpsi);
+            /* degrees squared per unit of energy, about the curvature of the wells */
+            dphi = -100.0f*dEdphi;
+            dpsi = -100.0f*dEdpsi;
+            move = true;
+        }
+        else if (strcmp("GLY", dict.RefiPhiPsis[i].res->type().c_str()))
         {
             phi = (float)CalcAtomTorsion(dict.RefiPhiPsis[i].getAtom1(), dict.RefiPhiPsis[i].getAtom2(), dict.RefiPhiPsis[i].atom3, dict.RefiPhiPsis[i].atom4);
             psi = (float)CalcAtomTorsion(dict.RefiPhiPsis[i+1].getAtom1(), dict.RefiPhiPsis[i+1].getAtom2(), dict.RefiPhiPsis[i+1].atom3, dict.RefiPhiPsis[i+1].atom4);
@@ -825,70 +844,74 @@ int MIMolOpt::minimize_phipsi()
                 dele = beste-e[1][1];
                 /* 90 = 9 points * 30.0 between points */
                 dphi = (sumi-1.0f)*270.0f;
-                if (dphi > 5.0f)
-                {
-                    dphi = 5.0f;
-                }
-                if (dphi < -5.0f)
-                {
-                    dphi = -5.0f;
-                }
                 dpsi = (sumj-1.0f)*270.0f;
-                if (dpsi > 5.0f)
-                {
-                    dpsi = 5.0f;
-                }
-                if (dpsi < -5.0f)
-                {
-                    dpsi = -5.0f;
-                }
-                /*
-                   printf("bestii = %d, bestjj = %d sumi=%f sumj=%f\n",bestii, bestjj, sumi, sumj);
-                   printf("for %s phi-psi=%f %f, dphi-psi=%f %f\n", dict.RefiPhiPsis[i].res->name(),phi,psi,dphi,dpsi);
-                 */
-                /* figure out change to atoms */
-                w = dphi*dphi/(dict.sigmatorsion*dict.sigmatorsion);
-                if (w > 0.10F)
-                {
-                    my_dTorsion(dict.RefiPhiPsis[i].getAtom2(), dict.RefiPhiPsis[i].atom3, dict.RefiPhiPsis[i].atom4, dphi, &dx, &dy, &dz);
-                    dx *= w;
-                    dy *= w;
-                    dz *= w;
-                    dict.RefiPhiPsis[i].atom4->addDelta(dx, dy, dz);
-                    dict.RefiPhiPsis[i].atom4->addWeight(w);
-                }
-                /*
-                   my_dTorsion(dict.RefiPhiPsis[i].getAtom2(), dict.RefiPhiPsis[i].atom3, dict.RefiPhiPsis[i].getAtom1(), -dphi/2.0, &dx, &dy, &dz);
-                   dx *= w;
-                   dy *= w;
-                   dz *= w;
-                   dict.RefiPhiPsis[i].getAtom1()->dx += dx;
-                   dict.RefiPhiPsis[i].getAtom1()->dy += dy;
-                   dict.RefiPhiPsis[i].getAtom1()->dz += dz;
-                   dict.RefiPhiPsis[i].getAtom1()->weight += w;
-                 */
-                w = dpsi*dpsi/(dict.sigmatorsion*dict.sigmatorsion);
-                if (w > 0.10F)
-                {
-                    my_dTorsion(dict.RefiPhiPsis[i+1].getAtom2(), dict.RefiPhiPsis[i+1].atom3, dict.RefiPhiPsis[i+1].atom4, dpsi, &dx, &dy, &dz);
-                    dx *= w;
-                    dy *= w;
-                    dz *= w;
-                    dict.RefiPhiPsis[i+1].atom4->addDelta(dx, dy, dz);
-                    dict.RefiPhiPsis[i+1].atom4->addWeight(w);
-                }
-                /*
-                   my_dTorsion(dict.RefiPhiPsis[i+1].getAtom2(), dict.RefiPhiPsis[i+1].atom3, dict.RefiPhiPsis[i+1].getAtom1(), -dpsi/2.0, &dx, &dy, &dz);
-                   dx *= w;
-                   dy *= w;
-                   dz *= w;
-                   dict.RefiPhiPsis[i+1].getAtom1()->dx += dx;
-                   dict.RefiPhiPsis[i+1].getAtom1()->dy += dy;
-                   dict.RefiPhiPsis[i+1].getAtom1()->dz += dz;
-                   dict.RefiPhiPsis[i+1].getAtom1()->weight += w;
-                 */
+                move = true;
             }
         }
+        if (move)
+        {
+            if (dphi > 5.0f)
+            {
+                dphi = 5.0f;
+            }
+            if (dphi < -5.0f)
+            {
+                dphi = -5.0f;
+            }
+            if (dpsi > 5.0f)
+            {
+                dpsi = 5.0f;
+            }
+            if (dpsi < -5.0f)
+            {
+                dpsi = -5.0f;
+            }
+            /*
+               printf("bestii = %d, bestjj = %d sumi=%f sumj=%f\n",bestii, bestjj, sumi, sumj);
+               printf("for %s phi-psi=%f %f, dphi-psi=%f %f\n", dict.RefiPhiPsis[i].res->name(),phi,psi,dphi,dpsi);
+             */
+            /* figure out change to atoms */
+            w = dphi*dphi/(dict.sigmatorsion*dict.sigmatorsion);
+            if (w > 0.10F)
+            {
+                my_dTorsion(dict.RefiPhiPsis[i].getAtom2(), dict.RefiPhiPsis[i].atom3, dict.RefiPhiPsis[i].atom4, dphi, &dx, &dy, &dz);
+                dx *= w;
+                dy *= w;
+                dz *= w;
+                dict.RefiPhiPsis[i].atom4->addDelta(dx, dy, dz);
+                dict.RefiPhiPsis[i].atom4->addWeight(w);
+            }
+            /*
+               my_dTorsion(dict.RefiPhiPsis[i].getAtom2(), dict.RefiPhiPsis[i].atom3, dict.RefiPhiPsis[i].getAtom1(), -dphi/2.0, &dx, &dy, &dz);
+               dx *= w;
+               dy *= w;
+               dz *= w;
+               dict.RefiPhiPsis[i].getAtom1()->dx += dx;
+               dict.RefiPhiPsis[i].getAtom1()->dy += dy;
+               dict.RefiPhiPsis[i].getAtom1()->dz += dz;
+               dict.RefiPhiPsis[i].getAtom1()->weight += w;
+             */
+            w = dpsi*dpsi/(dict.sigmatorsion*dict.sigmatorsion);
+            if (w > 0.10F)
+            {
+                my_dTorsion(dict.RefiPhiPsis[i+1].getAtom2(), dict.RefiPhiPsis[i+1].atom3, dict.RefiPhiPsis[i+1].atom4, dpsi, &dx, &dy, &dz);
+                dx *= w;
+                dy *= w;
+                dz *= w;
+                dict.RefiPhiPsis[i+1].atom4->addDelta(dx, dy, dz);
+                dict.RefiPhiPsis[i+1].atom4->addWeight(w);
+            }
+            /*
+               my_dTorsion(dict.RefiPhiPsis[i+1].getAtom2(), dict.RefiPhiPsis[i+1].atom3, dict.RefiPhiPsis[i+1].getAtom1(), -dpsi/2.0, &dx, &dy, &dz);
+               dx *= w;
+               dy *= w;
+               dz *= w;
+               dict.RefiPhiPsis[i+1].getAtom1()->dx += dx;
+               dict.RefiPhiPsis[i+1].getAtom1()->dy += dy;
+               dict.RefiPhiPsis[i+1].getAtom1()->dz += dz;
+               dict.RefiPhiPsis[i+1].getAtom1()->weight += w;
+             */
+        }
         /* put omega at 180.0 and omega' at 0.0*/
         for (ii = 2; ii <= 3; ii++)
         {
@@ -2136,6 +2159,7 @@ void MIMolOpt::Do()
 {
     ConnectTo(CurrentModel); //Connect up signals
     SaveToken = geomsaver.Save(RefiRes, nRefiRes, CurrentModel);
+    journal.Track(RefiRes, nRefiRes);
 
     Residue *res = RefiRes;
     int i = 0, j;
@@ -2152,26 +2176,35 @@ void MIMolOpt::Do()
 
 bool MIMolOpt::Undo()
 {
-    if (SaveToken != 0)
+    if (!journal.Undo())
     {
-        if (geomsaver.Restore(SaveToken))
-            SaveToken--;
-        Logger::log("SaveToken is now %d", (int)SaveToken);
-        return true;
+        return false;
     }
-    return false;
+    MIMoleculeBase *model = journal.Model(journal.Position());
+    if (MIMoleculeBase::isValid(model))
+    {
+        model->SetCoordsChanged(true);
+        model->SetModified(true);
+    }
+    Logger::log("Undo: %s", journal.Title(journal.Position()).c_str());
+    return true;
 }
 
 bool MIMolOpt::Redo()
 {
-    if (SaveToken && (int)(SaveToken+1) < geomsaver.NumberSets())
+    if (!journal.Redo())
     {
-        if (geomsaver.Restore(SaveToken) && MIMoleculeBase::isValid(geomsaver.Model(SaveToken)) && geomsaver.Model(SaveToken)->Build())
-            SaveToken++;
-        Logger::log("SaveToken is now %d", (int)SaveToken);
-        return true;
+        return false;
     }
-    return false;
+    MIMoleculeBase *model = journal.Model(journal.Position() - 1);
+    if (MIMoleculeBase::isValid(model))
+    {
+        model->Build();
+        model->SetCoordsChanged(true);
+        model->SetModified(true);
+    }
+    Logger::log("Redo: %s", journal.Title(journal.Position() - 1).c_str());
+    return true;
 }
 
 void MIMolOpt::Accept()
@@ -2182,9 +2215,28 @@ void MIMolOpt::Accept()
     }
 
     ConnectTo(CurrentModel); //Connect up signals
-    unsigned long newSaveToken = geomsaver.Save(RefiRes, nRefiRes, CurrentModel);
     geomsaver.RestoreColor(SaveToken, AtomType::REFIATOM);
-    SaveToken = newSaveToken;
+    if (RefiRes)
+    {
+        Residue *last = RefiRes;
+        for (int i = 1; i < nRefiRes && last->next() != NULL; ++i)
+        {
+            last = last->next();
+        }
+        char title[1024];
+        sprintf(title, "Refine %s_%s to %s_%s", RefiRes->type().c_str(), RefiRes->name().c_str(),
+                last->type().c_str(), last->name().c_str());
+        journal.Commit(CurrentModel, title);
+    }
+    else
+    {
+        journal.Discard();
+    }
+
+    // The journal now holds the step, the snapshots were only needed while
+    // refining
+    geomsaver.Clear();
+    SaveToken = 0;
     if (CurrentModel)
     {
         CurrentModel->SetCoordsChanged(true);
@@ -2200,8 +2252,10 @@ void MIMolOpt::Cancel()
         return;
     }
     geomsaver.RestoreColor(SaveToken, AtomType::REFIATOM);
-    if (geomsaver.Restore(SaveToken))
-        SaveToken--;
+    geomsaver.Restore(SaveToken);
+    journal.Discard();
+    geomsaver.Clear();
+    SaveToken = 0;
     clearRefineTarget();
 }
 
@@ -2241,6 +2295,7 @@ void MIMolOpt::Purge(MIMoleculeBase *node)
         clearRefineTarget();
     }
     geomsaver.Purge(node);
+    journal.Purge(node);
 }
 
 void MIMolOpt::Purge(Residue *res)
@@ -2255,6 +2310,7 @@ void MIMolOpt::Purge(Residue *res)
     for (int i = 0; i < res->atomCount(); i++)
     {
         geomsaver.Purge(res->atom(i));
+        journal.Purge(res->atom(i));
     }
 }
 
@@ -2274,6 +2330,7 @@ void MIMolOpt::Purge(MIAtom *atom)
     // and this isn't too expensive either; if the residue is purged first,
     // there's nothing for this to do
     geomsaver.Purge(atom);
+    journal.Purge(atom);
 }
 
 
@@ -2413,7 +2470,14 @@ void MIMolOpt::RigidOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol, E
     float rdens_start = CurrentMap->RDensity(CurrentAtoms);
 
     ConnectTo(fitmol); //Connect up signals
-    SaveToken = geomsaver.Save(CurrentAtoms, fitmol);
+    // The fit is one Undo step, unless an open refinement records it
+    bool record = !journal.IsTracking();
+    if (record)
+    {
+        journal.Track(CurrentAtoms);
+    }
+    GeomSaver start;
+    unsigned int startToken = start.Save(CurrentAtoms, fitmol);
 
     // find the center of mass of the atoms
     GetCenter(CurrentAtoms, cx, cy, cz);
@@ -2452,7 +2516,7 @@ void MIMolOpt::RigidOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol, E
     for (p = population.begin(); p != population.end(); p++)
     {
         score(*p, CurrentAtoms, cx, cy, cz, emap);
-        geomsaver.Restore(SaveToken);
+        start.Restore(startToken);
     }
     sort(population.begin(), population.end(), trial_compare);
     best_r = population[0].score;
@@ -2496,7 +2560,7 @@ void MIMolOpt::RigidOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol, E
                 }
             }
             score(t, CurrentAtoms, cx, cy, cz, emap);
-            geomsaver.Restore(SaveToken);
+            start.Restore(startToken);
             t2 = &population2[i];
             if (t.score >= ti->score)
             {
@@ -2529,6 +2593,10 @@ void MIMolOpt::RigidOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol, E
 
     Logger::log("Start Rdens=%0.2f Final=%0.2f\nRot: %0.2f %0.2f %0.2f Trans: %0.2f %0.2f %0.2f", rdens_start, best_r,
                 population[0].p[0], population[0].p[1], population[0].p[2], population[0].p[3], population[0].p[4], population[0].p[5]);
+    if (record)
+    {
+        journal.Commit(fitmol, "Rigid-body fit");
+    }
 
     for (i = 0; i < population.size(); i++)
     {
@@ -2761,7 +2829,14 @@ void MIMolOpt::TorsionOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol,
     }
 
     ConnectTo(fitmol); //Connect up signals
-    SaveToken = geomsaver.Save(CurrentAtoms, fitmol);
+    // The fit is one Undo step, unless an open refinement records it
+    bool record = !journal.IsTracking();
+    if (record)
+    {
+        journal.Track(CurrentAtoms);
+    }
+    GeomSaver start;
+    unsigned int startToken = start.Save(CurrentAtoms, fitmol);
 
     for (i = 0; i < npop; i++)
     {
@@ -2795,7 +2870,7 @@ void MIMolOpt::TorsionOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol,
     for (p = population.begin(); p != population.end(); p++)
     {
         score_torsion(*p, CurrentAtoms, fitmol, emap, torsions, td, tatomflags, Neighbours);
-        geomsaver.Restore(SaveToken);
+        start.Restore(startToken);
     }
     rdens_start = population[0].score;
 
@@ -2841,7 +2916,7 @@ void MIMolOpt::TorsionOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol,
                 }
             }
             score_torsion(t, CurrentAtoms, fitmol, emap, torsions, td, tatomflags, Neighbours);
-            geomsaver.Restore(SaveToken);
+            start.Restore(startToken);
             t2 = &population2[i];
             if (t.score >= ti->score)
             {
@@ -2880,7 +2955,10 @@ void MIMolOpt::TorsionOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol,
     }
     delete[] tatomflags;
     fitmol->ClearTorsion();
-
+    if (record)
+    {
+        journal.Commit(fitmol, "Torsion fit");
+    }
 }
 
 static void score_full(trial &t, MIAtomList &atoms, float cx, float cy, float cz, /* center of atoms */
@@ -3400,7 +3478,7 @@ void MIMolOpt::FullOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol, EM
 }
 
 void MIMolOpt::LigandOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol, EMapBase *emap, const float *center,
-                              InterpBox &box, unsigned int refine_level, GeomSaver &confs,
+                              InterpBox &box, unsigned int refine_level, ConfEnsemble &confs,
                               MIMolOptCheckPoint *checkpoint)
 {
 
@@ -3508,10 +3586,9 @@ void MIMolOpt::LigandOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol,
         }
      */
     dict.GetFlexibleTorsions(torsions, res);
-    if (confs.NumberSets() <= 2 && !torsions.empty())
+    if (confs.NumberSets() <= 1 && !torsions.empty())
     {
         conflib::GenerateEnsemble(res,
-                                  fitmol,
                                   dict.RefiBonds,
                                   torsions,
                                   confs);
@@ -3604,7 +3681,7 @@ void MIMolOpt::LigandOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol,
     {
 
         // Choose a random conformation from the set in "confs"
-        c = chemlib::irand_approx(confs.NumberSets() - 1) + 1;
+        c = chemlib::irand_approx(confs.NumberSets());
         confs.Restore(c);
 
 
@@ -3864,6 +3941,11 @@ void MIMolOpt::LigandOptimize(MIAtomList &CurrentAtoms, MIMoleculeBase *fitmol,
     if (IsRefining())
     {
         geomsaver.RestoreColor(this->SaveToken, AtomType::REFIATOM);
+        // The caller keeps its own history of fits, so this refinement is
+        // not an Undo step of its own
+        journal.Discard();
+        geomsaver.Clear();
+        this->SaveToken = 0;
         internalSetRefiRes(NULL, 0);
     }
 
@@ -4249,36 +4331,13 @@ float MIMolOpt::StdevTorsions()
     return (float)sqrt(sumd/(double)dict.RefiTorsions.size());
 }
 
-static void molrep_score(trial &t, MIAtomList &atoms, EMapBase *emap)
-{
-    RotateAtomVec(t.p[0], t.p[1], t.p[2], 0.0f, 0.0f, 0.0f, &atoms);
-    float fx, fy, fz;
-    fx = (float)t.p[3];
-    fy = (float)t.p[4];
-    fz = (float)t.p[5];
-    emap->mapheader->FtoC(&fx, &fy, &fz);
-    TranslateAtomVec(fx, fy, fz, &atoms);
-    //emap->SFCalc(model->residuesBegin());
-    t.score = emap->CorrScore(atoms);
-}
-
 void MIMolOpt::MolecularReplace(MIMoleculeBase *model, EMapBase *emap)
 {
     MIAtomList CurrentAtoms;
-    unsigned int SaveToken, StartToken;
     CurrentMap = emap;
-    float maxt = 0.5F;
-    float maxr = 180.0F;
     float cx = 0, cy = 0, cz = 0;
-    unsigned int i, j, k;
-    trial t;
-    unsigned int p1, p2, p3;
-    trial *ti, *ta, *tb, *tc, *t2;
-    float F = 0.8F;
-    float CR = 0.9F;
-    int D = 6;
-    unsigned int npop = 20*D;
-    float rms;
+    float step = 10.0F;
+    int nsolutions = 10;
 
     if (!model || !emap)
     {
@@ -4333,140 +4392,53 @@ void MIMolOpt::MolecularReplace(MIMoleculeBase *model, EMapBase *emap)
     }
 
     ConnectTo(model); //Connect up signals
-    StartToken = geomsaver.Save(CurrentAtoms, model);
+    bool record = !journal.IsTracking();
+    if (record)
+    {
+        journal.Track(CurrentAtoms);
+    }
 
     // find the center of mass of the atoms
     GetCenter(CurrentAtoms, cx, cy, cz);
 
     // translate to origin
     model->Translate(-cx, -cy, -cz, &CurrentAtoms);
-    GetCenter(CurrentAtoms, cx, cy, cz);
-
-    SaveToken = geomsaver.Save(CurrentAtoms, model);
-
-    vector<float> var_start;
-    var_start.reserve(D);
-    for (j = 0; j < 3; j++)
-    {
-        var_start.push_back(maxr);
-    }
-    for (j = 3; j < 6; j++)
-    {
-        var_start.push_back(maxt);
-    }
-
-    vector<trial> population;
-    vector<trial> population2;
-    vector<trial>::iterator p;
-    std::string s;
-    double best_r, worst_r;
-    int igen;
 
-    for (i = 0; i < npop; i++)
+    std::vector<MRSolution> solutions = emap->TranslationSearch(CurrentAtoms, step, nsolutions);
+    if (solutions.empty())
     {
-        t.p = new double[D];
-        for (j = 0; j < (unsigned int)D; j++)
+        model->Translate(cx, cy, cz, &CurrentAtoms);
+        if (record)
         {
-            t.p[j] = frand2(var_start[j]);
+            journal.Discard();
         }
-        population.push_back(t);
-        t.p = new double[D];
-        population2.push_back(t);
+        Logger::log("No molecular replacement solutions found - model not moved");
+        return;
     }
-
-    float score_sum = 0;
-
-    for (p = population.begin(); p != population.end(); p++)
+    for (unsigned int i = 0; i < solutions.size(); i++)
     {
-        molrep_score(*p, CurrentAtoms, emap);
-        score_sum += (float) (p->score*p->score);
-        geomsaver.Restore(SaveToken);
+        Logger::log("Solution %d: score=%0.3f Euler: %0.1f %0.1f %0.1f Trans: %0.3f %0.3f %0.3f", i+1,
+                    solutions[i].score, solutions[i].euler[0], solutions[i].euler[1], solutions[i].euler[2],
+                    solutions[i].translation[0], solutions[i].translation[1], solutions[i].translation[2]);
     }
-    sort(population.begin(), population.end(), trial_compare);
-    best_r = population[0].score;
-    worst_r = population[population.size()-1].score;
-    rms = (float)sqrt(score_sum/(double)population.size());
 
-    for (igen = 0; igen < 500; igen++)
+    // place the model at the best solution
+    const MRSolution &best = solutions[0];
+    float tx = best.translation[0];
+    float ty = best.translation[1];
+    float tz = best.translation[2];
+    emap->mapheader->FtoC(&tx, &ty, &tz);
+    for (unsigned int i = 0; i < CurrentAtoms.size(); i++)
     {
-        for (i = 0; i < npop; i++)
-        {
-            ti = &population[i];
-            do
-            {
-                p1 = irand(npop);
-            } while (p1 == i);
-            ta = &population[p1];
-            do
-            {
-                p2 = irand(npop);
-            } while (p2 == i || p2 == p1);
-            tb = &population[p2];
-            do
-            {
-                p3 = irand(npop);
-            } while (p3 == i || p3 == p1 || p3 == p2);
-            tc = &population[p3];
-            j = irand(D);
-            for (k = 1; k <= (unsigned int)D; k++)
-            {
-                if (frand() < CR || k == (unsigned int)D)
-                {
-                    t.p[j] = tc->p[j] + F*(ta->p[j]-tb->p[j]);
-                }
-                else
-                {
-                    t.p[j] = ti->p[j];
-                }
-                j = j+1;
-                if (j >= (unsigned int)D)
-                {
-                    j = j-(unsigned int)D;
-                }
-            }
-            molrep_score(t, CurrentAtoms, emap);
-            geomsaver.Restore(SaveToken);
-            t2 = &population2[i];
-            if (t.score >= ti->score)
-            {
-                copy_trial(t2, &t, D);
-            }
-            else
-            {
-                copy_trial(t2, ti, D);
-            }
-        }
-        for (i = 0; i < npop; i++)
-        {
-            copy_trial(&population[i], &population2[i], D);
-        }
-        sort(population.begin(), population.end(), trial_compare);
-        best_r = population[0].score;
-        worst_r = population[population.size()-1].score;
-        Logger::footer("Generation %d: best=%0.2f worst=%0.2f rms=%0.2f", igen, best_r, worst_r, rms);
-        if (best_r > 5.0 * rms)
-        {
-            Logger::log("Ended after generation %d with score 5*rms", igen);
-            break;
-        }
+        MIAtom *a = CurrentAtoms[i];
+        float x = a->x(), y = a->y(), z = a->z();
+        a->setPosition(x*best.rotation[0][0] + y*best.rotation[0][1] + z*best.rotation[0][2] + tx,
+                       x*best.rotation[1][0] + y*best.rotation[1][1] + z*best.rotation[1][2] + ty,
+                       x*best.rotation[2][0] + y*best.rotation[2][1] + z*best.rotation[2][2] + tz);
     }
-
-    if (best_r > 0.0)
+    if (record)
     {
-        RotateAtomVec(population[0].p[0], population[0].p[1], population[0].p[2], cx, cy, cz, &CurrentAtoms);
-        TranslateAtomVec(population[0].p[3], population[0].p[4], population[0].p[5], &CurrentAtoms);
-    }
-    else
-    {
-        Logger::log("Final model no better or worse than start - model not moved");
-    }
-
-    Logger::log("RFinal=%0.2f\nRot: %0.2f %0.2f %0.2f Trans: %0.2f %0.2f %0.2f", best_r,
-                population[0].p[0], population[0].p[1], population[0].p[2], population[0].p[3], population[0].p[4], population[0].p[5]);
-    for (i = 0; i < population.size(); i++)
-    {
-        delete[] population[i].p;
-        delete[] population2[i].p;
+        journal.Commit(model, "Molecular replacement");
     }
 }
 
@@ -14,6 +14,7 @@
 class EMapBase;
 class Molecule;
 class InterpBox;
+class RamaTable;
 
 // called during ligand optimization and full optimization
 class MIMolOptCheckPoint
@@ -42,7 +43,7 @@ public:
                       const float *center, InterpBox &box, unsigned int refine_level,
                       MIMolOptCheckPoint *checkpoint = 0);
     void LigandOptimize(std::vector<chemlib::MIAtom*> &CurrentAtoms, chemlib::MIMoleculeBase *fitmol, EMapBase *emap,
-                        const float *center, InterpBox &box, unsigned int refine_level, chemlib::GeomSaver &conformations,
+                        const float *center, InterpBox &box, unsigned int refine_level, chemlib::ConfEnsemble &conformations,
                         MIMolOptCheckPoint *checkpoint = 0);
     void MolecularReplace(chemlib::MIMoleculeBase *fitmol, EMapBase *emap);
     void RefiAllTorsions(chemlib::Residue *reslist);
@@ -55,7 +56,7 @@ public:
     void Do();
     bool CanUndo()
     {
-        return SaveToken!=0 && geomsaver.NumberSets() > 1;
+        return journal.CanUndo();
     }
 
     bool Undo();
@@ -63,7 +64,20 @@ public:
     bool Redo();
     bool CanRedo()
     {
-        return (int)SaveToken < geomsaver.NumberSets()-1;
+        return journal.CanRedo();
+    }
+
+    // Bytes of refinement history to keep for Undo
+    void SetUndoMemoryBudget(size_t bytes)
+    {
+        journal.SetMemoryBudget(bytes);
+    }
+
+    // Ramachandran potential used to restrain phi and psi; without one the
+    // older general table is used and glycines are not restrained
+    void SetRamaTable(const RamaTable *table)
+    {
+        ramaTable = table;
     }
 
     void Reset();
@@ -204,9 +218,11 @@ protected:
     bool RefiVerbose;
     bool fit_while_refine;
     chemlib::GeomSaver geomsaver;
+    chemlib::UndoJournal journal;
     chemlib::Residue *RefiRes;
     chemlib::Residue *ResActiveModel;
     bool refineTargetLocked;
+    const RamaTable *ramaTable;
 
     float BondWeight, AngleWeight, PlaneWeight, MapWeight, TorsionWeight, BumpWeight;
     int AutoFit;
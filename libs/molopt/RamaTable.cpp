@@ -0,0 +1,413 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <sys/stat.h>
+
+#include <util/SnapshotFile.h>
+
+#include "RamaTable.h"
+
+namespace
+{
+    const char *const RamaFiles[RamaTable::ResidueClassCount] =
+    {
+        "rama500-general.data",
+        "rama500-gly-sym-nosec.data",
+        "rama500-pro.data",
+        "rama500-prepro.data"
+    };
+
+    int WrapBin(int i, int n)
+    {
+        i %= n;
+        return i < 0 ? i + n : i;
+    }
+
+    // Value of the contour enclosing the given fraction of the data
+    float ContourLevel(std::vector<float> values, double fraction)
+    {
+        std::sort(values.begin(), values.end(), std::greater<float>());
+        double total = 0.0;
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            total += values[i];
+        }
+        double sum = 0.0;
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            sum += values[i];
+            if (sum >= fraction*total)
+            {
+                return values[i];
+            }
+        }
+        return 0.0f;
+    }
+
+    // The energy is -ln of the table plus a little of a blurred copy of
+    // it, which gives a slope back towards the populated regions where the
+    // table itself is empty
+    const int SmoothRadius = 30;
+    const float SmoothSigma = 10.0f;
+    const float SmoothWeight = 1.0e-3f;
+    const float EnergyFloor = 1.0e-6f;
+
+    // Gaussian blur along both axes of an n by n grid that wraps
+    void PeriodicBlur(std::vector<float> &grid, int n, float sigma, int radius)
+    {
+        std::vector<float> kernel(2*radius + 1);
+        float sum = 0.0f;
+        for (int k = -radius; k <= radius; ++k)
+        {
+            kernel[k + radius] = (float)exp(-0.5*k*k/(sigma*sigma));
+            sum += kernel[k + radius];
+        }
+        for (size_t k = 0; k < kernel.size(); ++k)
+        {
+            kernel[k] /= sum;
+        }
+        std::vector<float> rows(n*n);
+        for (int i = 0; i < n; ++i)
+        {
+            for (int j = 0; j < n; ++j)
+            {
+                float value = 0.0f;
+                for (int k = -radius; k <= radius; ++k)
+                {
+                    value += kernel[k + radius]*grid[WrapBin(i + k, n)*n + j];
+                }
+                rows[i*n + j] = value;
+            }
+        }
+        for (int i = 0; i < n; ++i)
+        {
+            for (int j = 0; j < n; ++j)
+            {
+                float value = 0.0f;
+                for (int k = -radius; k <= radius; ++k)
+                {
+                    value += kernel[k + radius]*rows[i*n + WrapBin(j + k, n)];
+                }
+                grid[i*n + j] = value;
+            }
+        }
+    }
+
+    // Cubic Hermite basis on [0, 1]: value at 0, slope at 0, value at 1
+    // and slope at 1, and their derivatives
+    void Hermite(float t, float h[4], float dh[4])
+    {
+        float t2 = t*t;
+        float t3 = t2*t;
+        h[0] = 2.0f*t3 - 3.0f*t2 + 1.0f;
+        h[1] = t3 - 2.0f*t2 + t;
+        h[2] = -2.0f*t3 + 3.0f*t2;
+        h[3] = t3 - t2;
+        dh[0] = 6.0f*t2 - 6.0f*t;
+        dh[1] = 3.0f*t2 - 4.0f*t + 1.0f;
+        dh[2] = -6.0f*t2 + 6.0f*t;
+        dh[3] = 3.0f*t2 - 2.0f*t;
+    }
+
+    // The cache is a snapshot file with a section of the grid size and
+    // the stamps of the files it was made from, then one per class
+    const quint32 CacheVersion = 1;
+    const quint32 CacheStampTag = MISnapshotTag('R', 'A', 'M', 'S');
+    const quint32 CacheClassTag = MISnapshotTag('R', 'A', 'M', 'A');
+}
+
+RamaTable::RamaTable()
+    : loaded(false)
+{
+    for (int c = 0; c < ResidueClassCount; ++c)
+    {
+        favoredLevel[c] = 0.0f;
+        allowedLevel[c] = 0.0f;
+    }
+}
+
+bool RamaTable::Load(const std::string &dataDir, const std::string &cacheFile)
+{
+    loaded = false;
+    std::string paths[ResidueClassCount];
+    FileStamp stamps[ResidueClassCount];
+    for (int c = 0; c < ResidueClassCount; ++c)
+    {
+        paths[c] = dataDir;
+#ifndef _WIN32
+        paths[c] += "/";
+#else
+        paths[c] += "\\";
+#endif
+        paths[c] += RamaFiles[c];
+        struct stat info;
+        if (stat(paths[c].c_str(), &info) != 0)
+        {
+            return false;
+        }
+        stamps[c].size = info.st_size;
+        stamps[c].modified = info.st_mtime;
+    }
+    if (!cacheFile.empty() && ReadCache(cacheFile, stamps))
+    {
+        loaded = true;
+        return true;
+    }
+
+    for (int c = 0; c < ResidueClassCount; ++c)
+    {
+        FILE *fp = fopen(paths[c].c_str(), "r");
+        if (!fp)
+        {
+            return false;
+        }
+        std::vector<float> &table = tables[c];
+        table.assign(Bins*Bins, 0.0f);
+        int count = 0;
+        char line[256];
+        while (fgets(line, sizeof(line), fp))
+        {
+            float phi, psi, value;
+            if (line[0] == '#' || sscanf(line, "%f %f %f", &phi, &psi, &value) != 3)
+            {
+                continue;
+            }
+            int i = WrapBin((int)floor((phi+180.0f)/2.0f), Bins);
+            int j = WrapBin((int)floor((psi+180.0f)/2.0f), Bins);
+            table[i*Bins + j] = value;
+            ++count;
+        }
+        fclose(fp);
+        if (count != Bins*Bins)
+        {
+            return false;
+        }
+        favoredLevel[c] = ContourLevel(table, 0.98);
+        allowedLevel[c] = ContourLevel(table, c == General ? 0.9995 : 0.998);
+        BuildSpline(c);
+    }
+    loaded = true;
+    if (!cacheFile.empty())
+    {
+        WriteCache(cacheFile, stamps);
+    }
+    return true;
+}
+
+void RamaTable::BuildSpline(int residueClass)
+{
+    const std::vector<float> &table = tables[residueClass];
+    float peak = *std::max_element(table.begin(), table.end());
+    std::vector<float> smooth(table);
+    PeriodicBlur(smooth, Bins, SmoothSigma, SmoothRadius);
+    float smoothPeak = *std::max_element(smooth.begin(), smooth.end());
+    if (peak <= 0.0f || smoothPeak <= 0.0f)
+    {
+        peak = smoothPeak = 1.0f;
+    }
+
+    std::vector<float> energy(Bins*Bins);
+    for (int k = 0; k < Bins*Bins; ++k)
+    {
+        energy[k] = -(float)log(table[k]/peak + SmoothWeight*smooth[k]/smoothPeak + EnergyFloor);
+    }
+    float lowest = *std::min_element(energy.begin(), energy.end());
+
+    // Slopes by central differences, which makes the spline a
+    // Catmull-Rom surface through the grid points
+    std::vector<float> &spline = splines[residueClass];
+    spline.resize(4*Bins*Bins);
+    for (int i = 0; i < Bins; ++i)
+    {
+        int im = WrapBin(i-1, Bins);
+        int ip = WrapBin(i+1, Bins);
+        for (int j = 0; j < Bins; ++j)
+        {
+            int jm = WrapBin(j-1, Bins);
+            int jp = WrapBin(j+1, Bins);
+            float *node = &spline[4*(i*Bins + j)];
+            node[0] = energy[i*Bins + j] - lowest;
+            node[1] = 0.5f*(energy[ip*Bins + j] - energy[im*Bins + j]);
+            node[2] = 0.5f*(energy[i*Bins + jp] - energy[i*Bins + jm]);
+            node[3] = 0.25f*(energy[ip*Bins + jp] - energy[ip*Bins + jm]
+                             - energy[im*Bins + jp] + energy[im*Bins + jm]);
+        }
+    }
+}
+
+bool RamaTable::ReadCache(const std::string &cacheFile, const FileStamp *stamps)
+{
+    SnapshotReader cache;
+    if (!cache.open(cacheFile.c_str(), CacheVersion))
+    {
+        return false;
+    }
+    SnapshotSection header;
+    qint32 bins = 0;
+    qint32 classes = 0;
+    bool ok = cache.section(CacheStampTag, 0, header)
+              && header.read(bins) && bins == Bins
+              && header.read(classes) && classes == ResidueClassCount;
+    for (int c = 0; ok && c < ResidueClassCount; ++c)
+    {
+        qint64 size = 0;
+        qint64 modified = 0;
+        ok = header.read(size) && header.read(modified)
+             && size == stamps[c].size && modified == stamps[c].modified;
+    }
+    for (int c = 0; ok && c < ResidueClassCount; ++c)
+    {
+        SnapshotSection section;
+        ok = cache.section(CacheClassTag, c, section)
+             && section.read(favoredLevel[c])
+             && section.read(allowedLevel[c])
+             && section.readArray(tables[c]) && tables[c].size() == (size_t)(Bins*Bins)
+             && section.readArray(splines[c]) && splines[c].size() == (size_t)(4*Bins*Bins);
+    }
+    return ok;
+}
+
+void RamaTable::WriteCache(const std::string &cacheFile, const FileStamp *stamps) const
+{
+    SnapshotWriter cache;
+    if (!cache.open(cacheFile.c_str(), CacheVersion))
+    {
+        return;
+    }
+    cache.beginSection(CacheStampTag);
+    cache.write((qint32)Bins);
+    cache.write((qint32)ResidueClassCount);
+    for (int c = 0; c < ResidueClassCount; ++c)
+    {
+        cache.write((qint64)stamps[c].size);
+        cache.write((qint64)stamps[c].modified);
+    }
+    cache.endSection();
+    for (int c = 0; c < ResidueClassCount; ++c)
+    {
+        cache.beginSection(CacheClassTag, c);
+        cache.write(favoredLevel[c]);
+        cache.write(allowedLevel[c]);
+        cache.writeArray(tables[c]);
+        cache.writeArray(splines[c]);
+        cache.endSection();
+    }
+    cache.close();
+}
+
+RamaTable::ResidueClass RamaTable::Classify(const std::string &type, const std::string &nextType)
+{
+    if (type == "GLY")
+    {
+        return Glycine;
+    }
+    if (type == "PRO")
+    {
+        return Proline;
+    }
+    if (nextType == "PRO")
+    {
+        return PreProline;
+    }
+    return General;
+}
+
+float RamaTable::Value(ResidueClass residueClass, float phi, float psi) const
+{
+    if (!loaded || phi != phi || psi != psi)
+    {
+        return 0.0f;
+    }
+    // Bin k is centered on -179 + 2k degrees
+    float u = (phi+179.0f)/2.0f;
+    float v = (psi+179.0f)/2.0f;
+    int i0 = (int)floor(u);
+    int j0 = (int)floor(v);
+    float du = u - (float)i0;
+    float dv = v - (float)j0;
+    int i1 = WrapBin(i0+1, Bins);
+    int j1 = WrapBin(j0+1, Bins);
+    i0 = WrapBin(i0, Bins);
+    j0 = WrapBin(j0, Bins);
+    const std::vector<float> &table = tables[residueClass];
+    return (1.0f-du)*((1.0f-dv)*table[i0*Bins + j0] + dv*table[i0*Bins + j1])
+           + du*((1.0f-dv)*table[i1*Bins + j0] + dv*table[i1*Bins + j1]);
+}
+
+RamaTable::Region RamaTable::GetRegion(ResidueClass residueClass, float phi, float psi) const
+{
+    float value = Value(residueClass, phi, psi);
+    if (value >= favoredLevel[residueClass])
+    {
+        return Favored;
+    }
+    return value >= allowedLevel[residueClass] ? Allowed : Outlier;
+}
+
+float RamaTable::Energy(ResidueClass residueClass, float phi, float psi,
+                        float *dPhi, float *dPsi) const
+{
+    if (dPhi)
+    {
+        *dPhi = 0.0f;
+    }
+    if (dPsi)
+    {
+        *dPsi = 0.0f;
+    }
+    if (!loaded || phi != phi || psi != psi)
+    {
+        return 0.0f;
+    }
+    float u = (phi+179.0f)/2.0f;
+    float v = (psi+179.0f)/2.0f;
+    int i0 = (int)floor(u);
+    int j0 = (int)floor(v);
+    float hu[4], dhu[4], hv[4], dhv[4];
+    Hermite(u - (float)i0, hu, dhu);
+    Hermite(v - (float)j0, hv, dhv);
+    int i[2] = { WrapBin(i0, Bins), WrapBin(i0+1, Bins) };
+    int j[2] = { WrapBin(j0, Bins), WrapBin(j0+1, Bins) };
+
+    const std::vector<float> &spline = splines[residueClass];
+    float e = 0.0f;
+    float eu = 0.0f;
+    float ev = 0.0f;
+    for (int a = 0; a < 2; ++a)
+    {
+        for (int b = 0; b < 2; ++b)
+        {
+            const float *node = &spline[4*(i[a]*Bins + j[b])];
+            e += node[0]*hu[2*a]*hv[2*b] + node[1]*hu[2*a+1]*hv[2*b]
+                 + node[2]*hu[2*a]*hv[2*b+1] + node[3]*hu[2*a+1]*hv[2*b+1];
+            eu += node[0]*dhu[2*a]*hv[2*b] + node[1]*dhu[2*a+1]*hv[2*b]
+                  + node[2]*dhu[2*a]*hv[2*b+1] + node[3]*dhu[2*a+1]*hv[2*b+1];
+            ev += node[0]*hu[2*a]*dhv[2*b] + node[1]*hu[2*a+1]*dhv[2*b]
+                  + node[2]*hu[2*a]*dhv[2*b+1] + node[3]*hu[2*a+1]*dhv[2*b+1];
+        }
+    }
+    // u and v are in 2 degree bins
+    if (dPhi)
+    {
+        *dPhi = eu/2.0f;
+    }
+    if (dPsi)
+    {
+        *dPsi = ev/2.0f;
+    }
+    return e;
+}
+
+const char *RamaTable::RegionName(Region region)
+{
+    switch (region)
+    {
+    case Favored:
+        return "favored";
+    case Allowed:
+        return "allowed";
+    default:
+        return "outlier";
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef mifit_molopt_RamaTable_h
+#define mifit_molopt_RamaTable_h
+
+#include <string>
+#include <vector>
+
+//@{
+// Ramachandran probability tables of the Top500 data set, one for each
+// residue class, read from the rama500-*.data files. The tables are on
+// a 2 degree grid of phi and psi and wrap at +/-180 degrees.
+//
+// Each class also has a smooth pseudo-energy for refinement: a bicubic
+// spline through -ln of the smoothed table, kept as the value and
+// derivatives at each grid point so that evaluating it and its gradient
+// costs one cell lookup.
+//@}
+class RamaTable
+{
+public:
+    enum ResidueClass
+    {
+        General = 0,
+        Glycine,
+        Proline,
+        PreProline,
+        ResidueClassCount
+    };
+
+    enum Region
+    {
+        Outlier = 0,
+        Allowed,
+        Favored
+    };
+
+    RamaTable();
+
+    //@{
+    // Reads the four tables from the given directory.
+    // Returns false if any of them is missing or incomplete.
+    // If cacheFile is given the tables and splines are read from it when
+    // it was made from the same files, and it is rewritten otherwise.
+    //@}
+    bool Load(const std::string &dataDir, const std::string &cacheFile = std::string());
+
+    bool IsLoaded() const
+    {
+        return loaded;
+    }
+
+    //@{
+    // Class of a residue given its type and that of the residue after it.
+    //@}
+    static ResidueClass Classify(const std::string &type, const std::string &nextType);
+
+    //@{
+    // Probability density at phi, psi in degrees, interpolated between
+    // the centers of the table bins.
+    //@}
+    float Value(ResidueClass residueClass, float phi, float psi) const;
+
+    //@{
+    // Favored inside the contour enclosing 98% of the data of the class;
+    // allowed inside the one enclosing 99.95% for the general case and
+    // 99.8% for the other classes, as in MolProbity.
+    //@}
+    Region GetRegion(ResidueClass residueClass, float phi, float psi) const;
+
+    //@{
+    // Pseudo-energy at phi, psi in degrees, 0 at the most likely
+    // conformation of the class. If dPhi and dPsi are given they are set to
+    // its derivatives per degree.
+    //@}
+    float Energy(ResidueClass residueClass, float phi, float psi,
+                 float *dPhi = 0, float *dPsi = 0) const;
+
+    static const char *RegionName(Region region);
+
+private:
+    enum
+    {
+        Bins = 180
+    };
+
+    struct FileStamp
+    {
+        long long size;
+        long long modified;
+    };
+
+    void BuildSpline(int residueClass);
+    bool ReadCache(const std::string &cacheFile, const FileStamp *stamps);
+    void WriteCache(const std::string &cacheFile, const FileStamp *stamps) const;
+
+    bool loaded;
+    std::vector<float> tables[ResidueClassCount];
+    // Energy, d/du, d/dv and d2/dudv in bin units at each grid point
+    std::vector<float> splines[ResidueClassCount];
+    float favoredLevel[ResidueClassCount];
+    float allowedLevel[ResidueClassCount];
+};
+
+#endif // ifndef mifit_molopt_RamaTable_h
@@ -2,5 +2,6 @@
 #define MI_MOLOPT_LIB_H
 
 #include "MIMolOpt.h"
+#include "RamaTable.h"
 
 #endif
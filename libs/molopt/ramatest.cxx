@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "RamaTable.h"
+
+// The Ramachandran pseudo-energy of each residue class against central
+// differences of itself on a grid of phi and psi that does not line up
+// with the table bins, including points across the +/-180 wrap. The
+// tables are then loaded twice through a cache file, once writing it and
+// once reading it back without rewriting it, and every value, energy and derivative must be
+// the same to the bit as without the cache.
+// named cxx to avoid being put into compilation of library
+//
+// usage: ramatest [datadir]
+
+static const char *const classNames[RamaTable::ResidueClassCount] =
+{
+    "general", "glycine", "proline", "pre-proline"
+};
+
+// central difference step in degrees
+static const float step = 0.01f;
+
+static bool CheckGradient(const RamaTable &table, RamaTable::ResidueClass residueClass)
+{
+    int points = 0, bad = 0;
+    double worst = 0.0;
+    for (float phi = -179.3f; phi < 180.0f; phi += 7.3f)
+    {
+        for (float psi = -179.7f; psi < 180.0f; psi += 6.1f)
+        {
+            float dPhi, dPsi;
+            table.Energy(residueClass, phi, psi, &dPhi, &dPsi);
+            double numPhi = ((double)table.Energy(residueClass, phi + step, psi)
+                             - table.Energy(residueClass, phi - step, psi))/(2.0*step);
+            double numPsi = ((double)table.Energy(residueClass, phi, psi + step)
+                             - table.Energy(residueClass, phi, psi - step))/(2.0*step);
+            // relative to the size of the slope, with a floor for the
+            // flat regions where float rounding of the energy dominates
+            double scale = std::max(0.05, std::max(fabs(numPhi), fabs(numPsi)));
+            double error = std::max(fabs(dPhi - numPhi), fabs(dPsi - numPsi))/scale;
+            worst = std::max(worst, error);
+            if (error > 0.02)
+            {
+                if (bad < 5)
+                {
+                    printf("FAILED: %s at %.1f %.1f: gradient %g %g, differences %g %g\n", classNames[residueClass],
+                           phi, psi, dPhi, dPsi, numPhi, numPsi);
+                }
+                ++bad;
+            }
+            ++points;
+        }
+    }
+    printf("%-12s %d points, largest relative gradient error %.2g\n", classNames[residueClass], points, worst);
+    return bad == 0;
+}
+
+static bool SameTables(const RamaTable &a, const RamaTable &b, const char *what)
+{
+    for (int c = 0; c < RamaTable::ResidueClassCount; ++c)
+    {
+        RamaTable::ResidueClass residueClass = (RamaTable::ResidueClass)c;
+        for (float phi = -180.0f; phi < 180.0f; phi += 3.7f)
+        {
+            for (float psi = -180.0f; psi < 180.0f; psi += 4.1f)
+            {
+                float aPhi, aPsi, bPhi, bPsi;
+                float aEnergy = a.Energy(residueClass, phi, psi, &aPhi, &aPsi);
+                float bEnergy = b.Energy(residueClass, phi, psi, &bPhi, &bPsi);
+                if (a.Value(residueClass, phi, psi) != b.Value(residueClass, phi, psi)
+                    || a.GetRegion(residueClass, phi, psi) != b.GetRegion(residueClass, phi, psi)
+                    || aEnergy != bEnergy || aPhi != bPhi || aPsi != bPsi)
+                {
+                    printf("FAILED: %s: %s differs at %.1f %.1f\n", what, classNames[c], phi, psi);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::string dataDir = argc > 1 ? argv[1] : "../../data";
+
+    RamaTable table;
+    if (!table.Load(dataDir))
+    {
+        printf("Cannot read the Ramachandran tables from %s\n", dataDir.c_str());
+        return 1;
+    }
+    bool ok = true;
+    for (int c = 0; c < RamaTable::ResidueClassCount; ++c)
+    {
+        ok = CheckGradient(table, (RamaTable::ResidueClass)c) && ok;
+    }
+
+    char cacheFile[64];
+    sprintf(cacheFile, "/tmp/ramatest%d.cache", (int)getpid());
+    unlink(cacheFile);
+    RamaTable written;
+    RamaTable read;
+    if (!written.Load(dataDir, cacheFile) || access(cacheFile, R_OK) != 0)
+    {
+        printf("FAILED: the cache %s was not written\n", cacheFile);
+        ok = false;
+    }
+    else
+    {
+        struct stat before, after;
+        stat(cacheFile, &before);
+        if (!read.Load(dataDir, cacheFile) || stat(cacheFile, &after) != 0
+            || after.st_mtim.tv_sec != before.st_mtim.tv_sec || after.st_mtim.tv_nsec != before.st_mtim.tv_nsec)
+        {
+            printf("FAILED: the cache %s was not read\n", cacheFile);
+            ok = false;
+        }
+    }
+    if (ok)
+    {
+        ok = SameTables(table, written, "writing the cache") && ok;
+        ok = SameTables(table, read, "reading the cache") && ok;
+    }
+    unlink(cacheFile);
+
+    printf(ok ? "OK\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
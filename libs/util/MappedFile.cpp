@@ -0,0 +1,79 @@
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    : map_(0),
+      mapLength_(0),
+      begin_(0),
+      end_(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+bool MappedFile::map(FILE *fp)
+{
+    unmap();
+    long offset = ftell(fp);
+
+#ifndef _WIN32
+    struct stat st;
+    int fd = fileno(fp);
+    if (offset >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+        && st.st_size > offset)
+    {
+        void *p = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            map_ = p;
+            mapLength_ = (size_t)st.st_size;
+            begin_ = static_cast<const char*>(p) + offset;
+            end_ = static_cast<const char*>(p) + mapLength_;
+            fseek(fp, 0, SEEK_END);
+            return true;
+        }
+    }
+#endif
+
+    // Not a regular file (or no mmap); read whatever is left in one go
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    {
+        buffer_.insert(buffer_.end(), chunk, chunk + n);
+    }
+    if (ferror(fp))
+    {
+        buffer_.clear();
+        return false;
+    }
+    if (!buffer_.empty())
+    {
+        begin_ = &buffer_[0];
+        end_ = begin_ + buffer_.size();
+    }
+    return true;
+}
+
+void MappedFile::unmap()
+{
+#ifndef _WIN32
+    if (map_ != 0)
+    {
+        munmap(map_, mapLength_);
+    }
+#endif
+    map_ = 0;
+    mapLength_ = 0;
+    buffer_.clear();
+    begin_ = 0;
+    end_ = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef util_MappedFile_h
+#define util_MappedFile_h
+
+#include <cstdio>
+#include <vector>
+
+/**
+ * Read-only view of the contents of a file. Regular files are
+ * memory-mapped where the platform allows it; anything else (pipes,
+ * platforms without mmap) is read into memory in one piece.
+ */
+class MappedFile
+{
+    void *map_;
+    size_t mapLength_;
+    std::vector<char> buffer_;
+    const char *begin_;
+    const char *end_;
+
+    MappedFile(const MappedFile&);
+    MappedFile &operator=(const MappedFile&);
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    /**
+     * Maps the file from its current position to the end. The stream
+     * position is left at the end of the file.
+     * @return false if the file could not be read
+     */
+    bool map(FILE *fp);
+    void unmap();
+
+    const char *begin() const
+    {
+        return begin_;
+    }
+
+    const char *end() const
+    {
+        return end_;
+    }
+
+    size_t size() const
+    {
+        return end_ - begin_;
+    }
+};
+
+#endif // ifndef util_MappedFile_h
@@ -0,0 +1,277 @@
+#include "SnapshotFile.h"
+
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+    const char SNAPSHOT_MAGIC[8] = { 'M', 'I', 'S', 'N', 'A', 'P', '\r', '\n' };
+    const quint32 SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+    struct SnapshotHeader
+    {
+        char magic[8];
+        quint32 version;
+        quint32 byteOrder;
+        quint32 sectionCount;
+        quint32 reserved;
+        quint64 tableOffset;
+    };
+}
+
+SnapshotWriter::SnapshotWriter()
+    : fp_(0),
+      offset_(0),
+      inSection_(false),
+      failed_(false)
+{
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    if (fp_)
+    {
+        fclose(fp_);
+    }
+}
+
+void SnapshotWriter::put(const void *data, size_t size)
+{
+    if (failed_ || size == 0)
+    {
+        return;
+    }
+    if (fwrite(data, 1, size, fp_) != size)
+    {
+        failed_ = true;
+    }
+    offset_ += size;
+}
+
+void SnapshotWriter::pad()
+{
+    static const char zeros[8] = { 0 };
+    put(zeros, (size_t)((8 - offset_%8)%8));
+}
+
+bool SnapshotWriter::open(const char *path, quint32 version)
+{
+    fp_ = fopen(path, "wb");
+    if (!fp_)
+    {
+        return false;
+    }
+    path_ = path;
+    offset_ = 0;
+    failed_ = false;
+    sections_.clear();
+
+    // The section count and table offset are filled in by close()
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = version;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    put(&header, sizeof(header));
+    return !failed_;
+}
+
+void SnapshotWriter::beginSection(quint32 tag, quint32 index)
+{
+    if (inSection_)
+    {
+        endSection();
+    }
+    pad();
+    SnapshotSectionEntry entry;
+    entry.tag = tag;
+    entry.index = index;
+    entry.offset = offset_;
+    entry.size = 0;
+    sections_.push_back(entry);
+    inSection_ = true;
+}
+
+void SnapshotWriter::endSection()
+{
+    if (inSection_)
+    {
+        sections_.back().size = offset_ - sections_.back().offset;
+        inSection_ = false;
+    }
+}
+
+void SnapshotWriter::write(const void *data, size_t size)
+{
+    put(data, size);
+}
+
+void SnapshotWriter::writeString(const std::string &value)
+{
+    write((quint32)value.size());
+    put(value.data(), value.size());
+}
+
+bool SnapshotWriter::close()
+{
+    if (!fp_)
+    {
+        return false;
+    }
+    endSection();
+    pad();
+    quint64 tableOffset = offset_;
+    if (!sections_.empty())
+    {
+        put(&sections_[0], sections_.size()*sizeof(SnapshotSectionEntry));
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.sectionCount = (quint32)sections_.size();
+    header.tableOffset = tableOffset;
+    if (!failed_ && fseek(fp_, (long)offsetof(SnapshotHeader, sectionCount), SEEK_SET) == 0)
+    {
+        put(&header.sectionCount, sizeof(header.sectionCount) + sizeof(header.reserved) + sizeof(header.tableOffset));
+    }
+    else
+    {
+        failed_ = true;
+    }
+    if (fclose(fp_) != 0)
+    {
+        failed_ = true;
+    }
+    fp_ = 0;
+    if (failed_)
+    {
+        remove(path_.c_str());
+    }
+    return !failed_;
+}
+
+
+SnapshotSection::SnapshotSection()
+    : begin_(0),
+      cur_(0),
+      end_(0),
+      ok_(false)
+{
+}
+
+SnapshotSection::SnapshotSection(const char *begin, const char *end)
+    : begin_(begin),
+      cur_(begin),
+      end_(end),
+      ok_(true)
+{
+}
+
+const char *SnapshotSection::take(size_t size)
+{
+    if (!ok_ || size > (size_t)(end_ - cur_))
+    {
+        ok_ = false;
+        return 0;
+    }
+    const char *p = cur_;
+    cur_ += size;
+    return p;
+}
+
+bool SnapshotSection::read(void *data, size_t size)
+{
+    const char *p = take(size);
+    if (p)
+    {
+        memcpy(data, p, size);
+    }
+    return ok_;
+}
+
+bool SnapshotSection::readString(std::string &value)
+{
+    quint32 length = 0;
+    if (read(length))
+    {
+        const char *p = take(length);
+        if (p)
+        {
+            value.assign(p, length);
+        }
+    }
+    return ok_;
+}
+
+
+SnapshotReader::SnapshotReader()
+{
+}
+
+bool SnapshotReader::open(const char *path, quint32 version)
+{
+    close();
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        return false;
+    }
+    bool mapped = file_.map(fp);
+    fclose(fp);
+    if (!mapped || file_.size() < sizeof(SnapshotHeader))
+    {
+        file_.unmap();
+        return false;
+    }
+
+    SnapshotHeader header;
+    memcpy(&header, file_.begin(), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+        || header.byteOrder != SNAPSHOT_BYTE_ORDER
+        || header.version != version
+        || header.tableOffset > file_.size()
+        || header.sectionCount > (file_.size() - header.tableOffset)/sizeof(SnapshotSectionEntry))
+    {
+        file_.unmap();
+        return false;
+    }
+
+    sections_.resize(header.sectionCount);
+    if (header.sectionCount)
+    {
+        memcpy(&sections_[0], file_.begin() + header.tableOffset,
+               header.sectionCount*sizeof(SnapshotSectionEntry));
+    }
+    for (size_t i = 0; i < sections_.size(); ++i)
+    {
+        if (sections_[i].offset > header.tableOffset
+            || sections_[i].size > header.tableOffset - sections_[i].offset)
+        {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void SnapshotReader::close()
+{
+    sections_.clear();
+    file_.unmap();
+}
+
+bool SnapshotReader::section(quint32 tag, quint32 index, SnapshotSection &section) const
+{
+    for (size_t i = 0; i < sections_.size(); ++i)
+    {
+        if (sections_[i].tag == tag && sections_[i].index == index)
+        {
+            const char *begin = file_.begin() + sections_[i].offset;
+            section = SnapshotSection(begin, begin + sections_[i].size);
+            return true;
+        }
+    }
+    return false;
+}
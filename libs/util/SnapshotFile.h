@@ -0,0 +1,202 @@
+#ifndef util_SnapshotFile_h
+#define util_SnapshotFile_h
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <QtCore/QtGlobal>
+
+#include "MappedFile.h"
+
+/**
+ * Builds the four character tag identifying a snapshot section.
+ */
+inline quint32 MISnapshotTag(char a, char b, char c, char d)
+{
+    return (quint32)(unsigned char)a | ((quint32)(unsigned char)b << 8)
+           | ((quint32)(unsigned char)c << 16) | ((quint32)(unsigned char)d << 24);
+}
+
+/**
+ * Entry in the section table of a snapshot file.
+ */
+struct SnapshotSectionEntry
+{
+    quint32 tag;
+    quint32 index;
+    quint64 offset;
+    quint64 size;
+};
+
+/**
+ * Writes a binary snapshot file: a versioned header followed by tagged
+ * sections and a table locating them. Every section and every array
+ * written with writeArray() starts on an 8 byte boundary, so a reader
+ * that maps the file can use the arrays in place.
+ *
+ * Values are written in native byte order; the header records the byte
+ * order and the reader rejects files written on a different platform.
+ */
+class SnapshotWriter
+{
+    FILE *fp_;
+    std::string path_;
+    quint64 offset_;
+    bool inSection_;
+    bool failed_;
+    std::vector<SnapshotSectionEntry> sections_;
+
+    void put(const void *data, size_t size);
+    void pad();
+
+    SnapshotWriter(const SnapshotWriter&);
+    SnapshotWriter &operator=(const SnapshotWriter&);
+
+public:
+    SnapshotWriter();
+    ~SnapshotWriter();
+
+    /**
+     * Creates the file and writes the header for the given format version.
+     */
+    bool open(const char *path, quint32 version);
+
+    /**
+     * Finishes the file by writing the section table.
+     * @return false if any write failed; the file is then removed
+     */
+    bool close();
+
+    void beginSection(quint32 tag, quint32 index = 0);
+    void endSection();
+
+    void write(const void *data, size_t size);
+
+    template <typename T>
+    void write(const T &value)
+    {
+        write(&value, sizeof(T));
+    }
+
+    void writeString(const std::string &value);
+
+    /**
+     * Writes a count followed by the records, aligned for use in place.
+     * T must be a plain struct with no pointers.
+     */
+    template <typename T>
+    void writeArray(const T *data, size_t count)
+    {
+        write((quint64)count);
+        pad();
+        if (count)
+        {
+            write(data, count*sizeof(T));
+        }
+    }
+
+    template <typename T>
+    void writeArray(const std::vector<T> &data)
+    {
+        writeArray(data.empty() ? (const T*)0 : &data[0], data.size());
+    }
+};
+
+/**
+ * Read cursor over one section of a snapshot. Reads past the end of the
+ * section fail and leave the cursor in the failed state.
+ */
+class SnapshotSection
+{
+    const char *begin_;
+    const char *cur_;
+    const char *end_;
+    bool ok_;
+
+    const char *take(size_t size);
+
+public:
+    SnapshotSection();
+    SnapshotSection(const char *begin, const char *end);
+
+    bool ok() const
+    {
+        return ok_;
+    }
+
+    bool read(void *data, size_t size);
+
+    template <typename T>
+    bool read(T &value)
+    {
+        return read(&value, sizeof(T));
+    }
+
+    bool readString(std::string &value);
+
+    /**
+     * Returns the records of an array written by SnapshotWriter::writeArray
+     * as a pointer into the mapped file, valid while the reader is open.
+     */
+    template <typename T>
+    const T *readArray(size_t &count)
+    {
+        quint64 n = 0;
+        count = 0;
+        if (!read(n))
+        {
+            return 0;
+        }
+        size_t used = cur_ - begin_;
+        take((8 - used%8)%8);
+        if (!ok_ || n > (quint64)(end_ - cur_)/sizeof(T))
+        {
+            ok_ = false;
+            return 0;
+        }
+        count = (size_t)n;
+        return reinterpret_cast<const T*>(take(count*sizeof(T)));
+    }
+
+    template <typename T>
+    bool readArray(std::vector<T> &data)
+    {
+        size_t count;
+        const T *p = readArray<T>(count);
+        data.assign(p, p + count);
+        return ok_;
+    }
+};
+
+/**
+ * Maps a snapshot file written by SnapshotWriter and locates its sections.
+ */
+class SnapshotReader
+{
+    MappedFile file_;
+    std::vector<SnapshotSectionEntry> sections_;
+
+    SnapshotReader(const SnapshotReader&);
+    SnapshotReader &operator=(const SnapshotReader&);
+
+public:
+    SnapshotReader();
+
+    /**
+     * Opens and validates the file.
+     * @return false if the file is missing, truncated, written on a
+     * platform with a different byte order or of a different version
+     */
+    bool open(const char *path, quint32 version);
+    void close();
+
+    bool isOpen() const
+    {
+        return !sections_.empty();
+    }
+
+    bool section(quint32 tag, quint32 index, SnapshotSection &section) const;
+};
+
+#endif // ifndef util_SnapshotFile_h
@@ -0,0 +1,20 @@
+#include "parallel.h"
+
+#include <QtCore/QThread>
+
+static int threadCountOverride = 0;
+
+int MIParallelThreadCount()
+{
+    if (threadCountOverride > 0)
+    {
+        return threadCountOverride;
+    }
+    int count = QThread::idealThreadCount();
+    return count > 0 ? count : 1;
+}
+
+void MISetParallelThreadCount(int count)
+{
+    threadCountOverride = count > 0 ? count : 0;
+}
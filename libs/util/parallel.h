@@ -0,0 +1,76 @@
+#ifndef util_parallel_h
+#define util_parallel_h
+
+#include <QtCore/QList>
+#include <QtCore/QFuture>
+#include <QtCore/QtConcurrentRun>
+
+/**
+ * Number of threads used by MIParallelFor. Defaults to the number of
+ * processor cores.
+ */
+int MIParallelThreadCount();
+
+/**
+ * Overrides the number of threads used by MIParallelFor; 0 restores the
+ * default. A count of 1 runs everything on the calling thread.
+ */
+void MISetParallelThreadCount(int count);
+
+namespace mi_parallel_detail
+{
+    template <typename Body>
+    void runRange(Body *body, int begin, int end)
+    {
+        (*body)(begin, end);
+    }
+}
+
+/**
+ * Splits [begin, end) into at most MIParallelThreadCount() contiguous
+ * ranges of at least minRange items and calls body(rangeBegin, rangeEnd)
+ * for each concurrently, the first range on the calling thread. Returns
+ * when all ranges are done. The ranges are a function of the thread count
+ * only, so results that are combined per range are reproducible.
+ *
+ * body must be safe to call from several threads at once and must not
+ * itself call MIParallelFor.
+ */
+template <typename Body>
+void MIParallelFor(int begin, int end, Body &body, int minRange = 1)
+{
+    int count = end - begin;
+    if (count <= 0)
+    {
+        return;
+    }
+    if (minRange < 1)
+    {
+        minRange = 1;
+    }
+    int nRanges = MIParallelThreadCount();
+    if (nRanges > count / minRange)
+    {
+        nRanges = count / minRange;
+    }
+    if (nRanges <= 1)
+    {
+        body(begin, end);
+        return;
+    }
+
+    QList<QFuture<void> > futures;
+    for (int i = 1; i < nRanges; ++i)
+    {
+        int rangeBegin = begin + (int)((double)count * i / nRanges);
+        int rangeEnd = begin + (int)((double)count * (i + 1) / nRanges);
+        futures.append(QtConcurrent::run(&mi_parallel_detail::runRange<Body>, &body, rangeBegin, rangeEnd));
+    }
+    body(begin, begin + (int)((double)count / nRanges));
+    for (int i = 0; i < futures.size(); ++i)
+    {
+        futures[i].waitForFinished();
+    }
+}
+
+#endif // ifndef util_parallel_h
@@ -1,6 +1,7 @@
 #include "system.h"
 #include <cstdio>
 #include <cctype>
+#include <cmath>
 
 std::string MIBeforeFirst(const std::string &s, char sep)
 {
@@ -158,6 +159,132 @@ bool MIStringToNumber(const std::string &s, float &f)
     return (sscanf(s.c_str(), "%f", &f) == 1);
 }
 
+// Up to 15 significant digits are kept, so the result is exact for
+// all values that appear in coordinate and dictionary files.
+bool MIParseDouble(const char *p, const char *end, double &value)
+{
+    static const double pow10[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    static const int MAX_DIGITS = 15;
+
+    while (p < end && isspace((unsigned char)*p))
+    {
+        ++p;
+    }
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-'))
+    {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    double mantissa = 0.0;
+    int digits = 0;
+    int exponent = 0;
+    bool anyDigits = false;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+    {
+        anyDigits = true;
+        if (digits < MAX_DIGITS)
+        {
+            mantissa = mantissa * 10.0 + (*p - '0');
+            if (mantissa > 0.0)
+            {
+                ++digits;
+            }
+        }
+        else
+        {
+            ++exponent;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p)
+        {
+            anyDigits = true;
+            if (digits < MAX_DIGITS)
+            {
+                mantissa = mantissa * 10.0 + (*p - '0');
+                if (mantissa > 0.0)
+                {
+                    ++digits;
+                }
+                --exponent;
+            }
+        }
+    }
+    if (!anyDigits)
+    {
+        return false;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        bool negativeExponent = false;
+        if (q < end && (*q == '+' || *q == '-'))
+        {
+            negativeExponent = (*q == '-');
+            ++q;
+        }
+        if (q < end && *q >= '0' && *q <= '9')
+        {
+            int e = 0;
+            for (; q < end && *q >= '0' && *q <= '9'; ++q)
+            {
+                if (e < 10000)
+                {
+                    e = e * 10 + (*q - '0');
+                }
+            }
+            exponent += negativeExponent ? -e : e;
+        }
+    }
+
+    if (exponent < 0)
+    {
+        value = exponent >= -22 ? mantissa / pow10[-exponent] : mantissa * pow(10.0, exponent);
+    }
+    else
+    {
+        value = exponent <= 22 ? mantissa * pow10[exponent] : mantissa * pow(10.0, exponent);
+    }
+    if (negative)
+    {
+        value = -value;
+    }
+    return true;
+}
+
+bool MIParseInt(const char *p, const char *end, int &value)
+{
+    while (p < end && isspace((unsigned char)*p))
+    {
+        ++p;
+    }
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-'))
+    {
+        negative = (*p == '-');
+        ++p;
+    }
+    if (p == end || *p < '0' || *p > '9')
+    {
+        return false;
+    }
+    int i = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+    {
+        i = i * 10 + (*p - '0');
+    }
+    value = negative ? -i : i;
+    return true;
+}
+
 void MIStringTrim(std::string &str, bool fromRight)
 {
     if (fromRight)
@@ -19,6 +19,13 @@ bool MIStringToNumber(const std::string &s, long &l);
 bool MIStringToNumber(const std::string &s, int &i);
 bool MIStringToNumber(const std::string &s, float &f);
 
+// Convert a number in place, without copying it into a terminated string.
+// Leading blanks are skipped and conversion stops at the first character
+// that is not part of the number (e.g. the uncertainty in "1.234(5)").
+// Returns false if no digits were found.
+bool MIParseDouble(const char *begin, const char *end, double &d);
+bool MIParseInt(const char *begin, const char *end, int &i);
+
 // If 'from' matches 'to' or 'from' is empty,
 // does not parse 's', returns std::string::npos
 // Otherwise returns number of replacements done
@@ -23,10 +23,49 @@ if 'SHELX_DIR' in os.environ.keys():
     shelxDir = os.environ['SHELX_DIR']
 
 
-def exec_script(script):
-    """Executes the given script in the associated MIFit session"""
+# Frame types, as in LocalSocketScript
+_SCRIPT_REQUEST = 0
+_STATUS_REQUEST = 1
+_CANCEL_REQUEST = 2
+_RESULT_REPLY = 0
+_EXCEPTION_REPLY = 1
+_CANCELLED_REPLY = 2
+_STATUS_REPLY = 3
+_ACCEPTED_REPLY = 4
+
+def _write_frame(data, type, script):
+    out = QtCore.QDataStream(data, QtCore.QIODevice.WriteOnly)
+    out.setVersion(QtCore.QDataStream.Qt_4_5)
+    out.device().seek(data.size())
+    start = data.size()
+    out.writeUInt32(0)
+    out.writeUInt32(type)
+    out << QtCore.QString(script)
+    out.device().seek(start)
+    out.writeUInt32(data.size() - start - 4)
+
+def _read_frame(sock, stream):
+    """Returns the type and text of the next reply, or None if the
+connection closed first."""
+    dataSize = None
+    while True:
+        if dataSize is None:
+            if sock.bytesAvailable() >= 4:
+                dataSize = stream.readUInt32()
+                continue
+        elif sock.bytesAvailable() >= dataSize:
+            type = stream.readUInt32()
+            text = QtCore.QString()
+            stream >> text
+            return (type, text)
+        QtGui.qApp.processEvents()
+        if sock.state() != QtNetwork.QLocalSocket.ConnectedState and sock.bytesAvailable() == 0:
+            return None
+        sock.waitForReadyRead(100)
+
+def _exchange(frames):
     global socketId
-    result = QtCore.QString()
+    replies = []
     sock = QtNetwork.QLocalSocket()
     sock.connectToServer(socketId)
     if sock.waitForConnected():
@@ -35,33 +74,58 @@ def exec_script(script):
         stream.setVersion(QtCore.QDataStream.Qt_4_5)
 
         data = QtCore.QByteArray()
-        out = QtCore.QDataStream(data, QtCore.QIODevice.WriteOnly)
-        out.setVersion(QtCore.QDataStream.Qt_4_5)
-        out.writeUInt32(0)
-        out << QtCore.QString(script)
-        out.device().seek(0)
-        out.writeUInt32(data.size() - 8)
+        for type, script in frames:
+            _write_frame(data, type, script)
         sock.write(data)
         sock.flush()
+        sock.waitForBytesWritten()
 
-        moreInput = True
-        dataSize = 0
-        while moreInput:
-            QtGui.qApp.processEvents()
-            if dataSize == 0:
-                if sock.bytesAvailable() < 8:
-                    continue
-                dataSize = stream.readUInt32()
-            if sock.bytesAvailable() < dataSize:
-                continue
-            stream >> result
-            moreInput = False
+        # Each script is also accepted with its id, ahead of the replies
+        expected = len([f for f in frames if f[0] != _CANCEL_REQUEST])
+        while len(replies) < expected:
+            reply = _read_frame(sock, stream)
+            if reply is None:
+                break
+            if reply[0] != _ACCEPTED_REPLY:
+                replies.append(reply)
 
         sock.close()
     else:
         print 'error connecting to local socket', socketId
     sock = None
-    return result
+    return replies
+
+def exec_scripts(scripts):
+    """Executes the given scripts in the associated MIFit session in one round trip.
+Returns the list of results, in order, with None for a script that was cancelled."""
+    results = []
+    for type, text in _exchange([(_SCRIPT_REQUEST, script) for script in scripts]):
+        if type == _CANCELLED_REPLY:
+            results.append(None)
+        else:
+            results.append(text)
+    return results
+
+def exec_script(script):
+    """Executes the given script in the associated MIFit session"""
+    results = exec_scripts([script])
+    if results and results[0] is not None:
+        return results[0]
+    return QtCore.QString()
+
+def status():
+    """Returns the state of the associated MIFit session's script queue,
+"running <percent> queued <count> ids <id>..." or "idle queued <count> ids <id>...",
+where the ids are those of the running script and then the queued ones."""
+    replies = _exchange([(_STATUS_REQUEST, '')])
+    if replies:
+        return str(replies[0][1])
+    return ''
+
+def cancel(target='all'):
+    """Cancels a script in the associated MIFit session, by the id status()
+gives, or all of its scripts for 'all'"""
+    _exchange([(_CANCEL_REQUEST, str(target))])
 
 def version():
     """Returns the version of MIFit"""
@@ -110,3 +174,19 @@ def addJob(menuName, jobName, executable, arguments, workingDirectory):
     args = "[ '" + "', '".join(arguments) + "' ]"
     script = "mifit.addJob('%s', '%s', '%s', %s, '%s')" % (menuName, jobName, executable, args, workingDirectory)
     exec_script(script)
+
+def submitJob(jobName, executable, arguments, workingDirectory, threads=1, priority=0, after=[]):
+    """Queues a job in MIFit and returns its id. The job starts when threads
+workers are free, before queued jobs of lower priority, and only once the
+jobs whose ids are in after have succeeded; it is cancelled if one fails."""
+    args = "[ '" + "', '".join(arguments) + "' ]"
+    ids = "[ '" + "', '".join(after) + "' ]" if after else "[]"
+    script = "mifit.submitJob('%s', '%s', %s, '%s', %d, %d, %s)" % (jobName, executable, args, workingDirectory, threads, priority, ids)
+    result = exec_script(script)
+    if result and not result.startsWith('Exception'):
+        return str(result)
+    return None
+
+def setJobPriority(jobId, priority):
+    """Sets the priority of a queued MIFit job"""
+    return str(exec_script("mifit.setJobPriority('%s', %d)" % (jobId, priority))) == 'true'